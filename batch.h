@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu.h"
+
+// One independent program run: memory outside the segments starts zeroed.
+struct BatchJob
+{
+    std::vector<MemorySegment> image;
+    Registers registers;
+    uint32_t cycles;
+    bool capture_memory = false; // copy the final 64 KB into the result, otherwise only its digest
+};
+
+struct BatchResult
+{
+    Registers registers;
+    uint64_t memory_digest;
+    std::vector<Byte> memory;
+};
+
+// Runs batches of jobs on a persistent pool of workers. Each worker owns one
+// CPU + Memory pair that is reused for every job it runs (the reset between
+// jobs only clears the pages the previous job wrote), and a deque of job
+// chunks; a worker that drains its own deque steals chunks from the others.
+class BatchRunner
+{
+public:
+    explicit BatchRunner(unsigned threads = std::thread::hardware_concurrency())
+    {
+        threads = std::max(1u, threads);
+        for (unsigned i = 0; i < threads; i++)
+        {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (unsigned i = 0; i < threads; i++)
+        {
+            workers[i]->thread = std::thread(&BatchRunner::worker_loop, this, i);
+        }
+    }
+
+    ~BatchRunner()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutting_down = true;
+        }
+        wake_workers.notify_all();
+        for (auto &worker : workers)
+        {
+            worker->thread.join();
+        }
+    }
+
+    BatchRunner(const BatchRunner &) = delete;
+    BatchRunner &operator=(const BatchRunner &) = delete;
+
+    unsigned thread_count() const
+    {
+        return workers.size();
+    }
+
+    std::vector<BatchResult> run(const std::vector<BatchJob> &jobs)
+    {
+        std::vector<BatchResult> results(jobs.size());
+        if (jobs.empty())
+        {
+            return results;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        current_jobs = &jobs;
+        current_results = &results;
+
+        // deal the chunks round-robin so every worker starts with local work
+        size_t chunk_count = (jobs.size() + chunk_size - 1) / chunk_size;
+        for (size_t chunk = 0; chunk < chunk_count; chunk++)
+        {
+            Worker &worker = *workers[chunk % workers.size()];
+            std::lock_guard<std::mutex> worker_lock(worker.mutex);
+            worker.chunks.push_back(chunk * chunk_size);
+        }
+        remaining_chunks = chunk_count;
+        generation++;
+        wake_workers.notify_all();
+        batch_done.wait(lock, [this] { return remaining_chunks == 0 && busy_workers == 0; });
+        current_jobs = nullptr;
+        current_results = nullptr;
+        return results;
+    }
+
+private:
+    static constexpr size_t chunk_size = 16;
+
+    struct Worker
+    {
+        std::thread thread;
+        std::mutex mutex;
+        std::deque<size_t> chunks; // first job index of each chunk
+        std::unique_ptr<Memory> memory = std::make_unique<Memory>();
+        CPU cpu;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake_workers;
+    std::condition_variable batch_done;
+    uint64_t generation = 0;
+    bool shutting_down = false;
+    unsigned busy_workers = 0;
+    const std::vector<BatchJob> *current_jobs = nullptr;
+    std::vector<BatchResult> *current_results = nullptr;
+    std::atomic<size_t> remaining_chunks{0};
+
+    // own chunks are taken from the back, stolen ones from the front
+    bool take_chunk(unsigned self, size_t &first_job)
+    {
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            Worker &victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.chunks.empty())
+            {
+                continue;
+            }
+            if (i == 0)
+            {
+                first_job = victim.chunks.back();
+                victim.chunks.pop_back();
+            }
+            else
+            {
+                first_job = victim.chunks.front();
+                victim.chunks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static void run_job(Worker &worker, const BatchJob &job, BatchResult &result)
+    {
+        Memory &memory = *worker.memory;
+        CPU &cpu = worker.cpu;
+        // the last job wrote only through load and the CPU; the registers are set below
+        memory.restore();
+        for (const MemorySegment &segment : job.image)
+        {
+            memory.load(segment.address, segment.bytes.data(), segment.bytes.size());
+        }
+        cpu.set_registers(job.registers);
+        cpu.execute(job.cycles, memory);
+
+        result.registers = cpu.registers();
+        result.memory_digest = memory.digest();
+        if (job.capture_memory)
+        {
+            result.memory.assign(memory.data, memory.data + MAX_MEMORY);
+        }
+    }
+
+    void worker_loop(unsigned self)
+    {
+        uint64_t seen_generation = 0;
+        Worker &worker = *workers[self];
+        while (true)
+        {
+            const std::vector<BatchJob> *jobs;
+            std::vector<BatchResult> *results;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake_workers.wait(lock, [&] { return shutting_down || generation != seen_generation; });
+                if (shutting_down)
+                {
+                    return;
+                }
+                seen_generation = generation;
+                if (current_jobs == nullptr)
+                {
+                    // late wake-up for a batch that has already finished
+                    continue;
+                }
+                jobs = current_jobs;
+                results = current_results;
+                busy_workers++;
+            }
+
+            size_t first_job;
+            while (take_chunk(self, first_job))
+            {
+                size_t last_job = std::min(first_job + chunk_size, jobs->size());
+                for (size_t i = first_job; i < last_job; i++)
+                {
+                    run_job(worker, (*jobs)[i], (*results)[i]);
+                }
+                remaining_chunks--;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            busy_workers--;
+            if (remaining_chunks == 0 && busy_workers == 0)
+            {
+                batch_done.notify_all();
+            }
+        }
+    }
+};
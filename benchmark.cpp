@@ -0,0 +1,1229 @@
+// Headless throughput benchmark for the 6502 interpreter.
+//
+//   g++ -O2 -DNDEBUG -pthread benchmark.cpp -o ./build/benchmark
+//   ./build/benchmark [--cycles N] [--opcode-cycles N] [--repeat N]
+//                     [--batch-jobs N] [--functional-rom FILE] [--json FILE] [--label TEXT]
+//
+// Every workload runs for a fixed number of emulated cycles. Timing runs use
+// execute<TraceLevel::off>; instruction counts and the opcode mix come from a
+// separate execute<TraceLevel::opcode> pass so they never perturb the timings.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "busmap.h"
+#include "demo_firmware_recompiled.h"
+#include "demo_firmware.h"
+#include "interval_map.h"
+#include "lockstep.h"
+#include "cpu.h"
+#include "loader.h"
+#include "pool.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "timetravel.h"
+
+// Minimal builder for the hand-assembled workloads.
+struct Program
+{
+    Word origin;
+    std::vector<Byte> bytes;
+
+    explicit Program(Word origin) : origin(origin) {}
+
+    Word here() const
+    {
+        return origin + bytes.size();
+    }
+
+    Program &op(Byte opcode)
+    {
+        bytes.push_back(opcode);
+        return *this;
+    }
+
+    Program &op(Byte opcode, Byte operand)
+    {
+        bytes.push_back(opcode);
+        bytes.push_back(operand);
+        return *this;
+    }
+
+    Program &op_word(Byte opcode, Word operand)
+    {
+        bytes.push_back(opcode);
+        bytes.push_back(operand & 0xFF);
+        bytes.push_back(operand >> 8);
+        return *this;
+    }
+
+    Program &branch(Byte opcode, Word target)
+    {
+        int offset = int(target) - int(here() + 2);
+        assert(offset >= -128 && offset <= 127);
+        return op(opcode, Byte(offset));
+    }
+
+    void load(Memory &memory) const
+    {
+        memory.load(origin, bytes.data(), bytes.size());
+    }
+};
+
+struct Workload
+{
+    std::string name;
+    std::function<void(CPU &, Memory &)> load;
+};
+
+struct RunResult
+{
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    double seconds = 0;
+    uint64_t opcode_counts[256] = {};
+};
+
+// runs in slices so the opcode pass can drain the trace buffer between them
+template <TraceLevel Level>
+void run_cycles(CPU &cpu, Memory &memory, uint64_t cycles, uint32_t slice, TraceBuffer *buffer, RunResult &result)
+{
+    while (cycles > 0)
+    {
+        uint64_t budget = std::min<uint64_t>(cycles, slice);
+        uint64_t used = cpu.execute<Level>(budget, memory);
+        cycles -= std::min(used, cycles);
+        if (used < budget)
+        {
+            cycles = 0; // stopped on an unofficial opcode
+        }
+        if constexpr (Level == TraceLevel::opcode)
+        {
+            result.instructions += buffer->size();
+            buffer->for_each([&result](const TraceRecord &r) { result.opcode_counts[r.value]++; });
+            buffer->clear();
+        }
+    }
+}
+
+RunResult measure(const Workload &workload, uint64_t cycles, int repeat)
+{
+    auto memory = std::make_unique<Memory>();
+    CPU cpu;
+    RunResult result;
+    result.cycles = cycles;
+
+    // counting pass: 2^16 cycle slices never produce more records than the buffer holds
+    TraceBuffer buffer(16);
+    cpu.reset(*memory);
+    workload.load(cpu, *memory);
+    cpu.trace = &buffer;
+    run_cycles<TraceLevel::opcode>(cpu, *memory, cycles, 1 << 16, &buffer, result);
+
+    double best = 0;
+    for (int i = 0; i < repeat; i++)
+    {
+        cpu.reset(*memory);
+        workload.load(cpu, *memory);
+        auto start = std::chrono::steady_clock::now();
+        run_cycles<TraceLevel::off>(cpu, *memory, cycles, 1u << 30, nullptr, result);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+    result.seconds = best;
+    return result;
+}
+
+std::vector<Workload> standard_workloads(const std::string &functional_rom)
+{
+    std::vector<Workload> workloads;
+
+    if (!functional_rom.empty())
+    {
+        Image image;
+        if (!load_image_file(functional_rom, image, 0x0000))
+        {
+            std::cerr << "cannot use functional test ROM " << functional_rom << std::endl;
+        }
+        else
+        {
+            // Klaus Dormann's 6502_functional_test.bin: a full 64 KB image entered at $0400
+            workloads.push_back({"functional_test", [image](CPU &cpu, Memory &memory) {
+                                     load_image(memory, image);
+                                     cpu.PC = 0x0400;
+                                 }});
+        }
+    }
+
+    workloads.push_back({"arith_loop", [](CPU &cpu, Memory &memory) {
+                             Program p(0x0200);
+                             Word start = p.here();
+                             p.op(CPU::INS_LDX_IM, 0x00);
+                             Word loop = p.here();
+                             p.op(CPU::INS_CLC)
+                                 .op(CPU::INS_ADC_IM, 0x07)
+                                 .op(CPU::INS_EOR_IM, 0x5A)
+                                 .op(CPU::INS_ROL_ACC)
+                                 .op(CPU::INS_STA_ZERO_PAGE, 0x10)
+                                 .op(CPU::INS_ADC_ZP, 0x10)
+                                 .op(CPU::INS_INX)
+                                 .branch(CPU::INS_BNE, loop)
+                                 .op(CPU::INS_INY)
+                                 .op_word(CPU::INS_JMP_ABS, start);
+                             p.load(memory);
+                             cpu.PC = start;
+                         }});
+
+    workloads.push_back({"bcd_loop", [](CPU &cpu, Memory &memory) {
+                             // a 4 digit BCD counter and a decimal subtraction, as in score and clock displays
+                             Program p(0x0200);
+                             Word start = p.here();
+                             p.op(CPU::INS_SED);
+                             Word loop = p.here();
+                             p.op(CPU::INS_CLC)
+                                 .op(CPU::INS_LDA_ZP, 0x10)
+                                 .op(CPU::INS_ADC_IM, 0x01)
+                                 .op(CPU::INS_STA_ZERO_PAGE, 0x10)
+                                 .op(CPU::INS_LDA_ZP, 0x11)
+                                 .op(CPU::INS_ADC_IM, 0x00)
+                                 .op(CPU::INS_STA_ZERO_PAGE, 0x11)
+                                 .op(CPU::INS_SEC)
+                                 .op(CPU::INS_SBC_ZP, 0x10)
+                                 .op(CPU::INS_INX)
+                                 .branch(CPU::INS_BNE, loop)
+                                 .op_word(CPU::INS_JMP_ABS, start);
+                             p.load(memory);
+                             cpu.PC = start;
+                         }});
+
+    workloads.push_back({"memcpy", [](CPU &cpu, Memory &memory) {
+                             // copies 16 pages from $2000 to $6000 through ($F0),Y / ($F2),Y
+                             std::vector<Byte> source(0x1000);
+                             for (uint32_t i = 0; i < source.size(); i++)
+                             {
+                                 source[i] = Byte(i * 7);
+                             }
+                             memory.load(0x2000, source.data(), source.size());
+                             Program p(0x0200);
+                             Word start = p.here();
+                             p.op(CPU::INS_LDA_IM, 0x00)
+                                 .op(CPU::INS_STA_ZERO_PAGE, 0xF0)
+                                 .op(CPU::INS_STA_ZERO_PAGE, 0xF2)
+                                 .op(CPU::INS_LDA_IM, 0x20)
+                                 .op(CPU::INS_STA_ZERO_PAGE, 0xF1)
+                                 .op(CPU::INS_LDA_IM, 0x60)
+                                 .op(CPU::INS_STA_ZERO_PAGE, 0xF3)
+                                 .op(CPU::INS_LDX_IM, 0x10)
+                                 .op(CPU::INS_LDY_IM, 0x00);
+                             Word copy = p.here();
+                             p.op(CPU::INS_LDA_INDY, 0xF0)
+                                 .op(CPU::INS_STA_INDY, 0xF2)
+                                 .op(CPU::INS_INY)
+                                 .branch(CPU::INS_BNE, copy)
+                                 .op(CPU::INS_INC_ZP, 0xF1)
+                                 .op(CPU::INS_INC_ZP, 0xF3)
+                                 .op(CPU::INS_DEX)
+                                 .branch(CPU::INS_BNE, copy)
+                                 .op_word(CPU::INS_JMP_ABS, start);
+                             p.load(memory);
+                             cpu.PC = start;
+                         }});
+
+    workloads.push_back({"recursion", [](CPU &cpu, Memory &memory) {
+                             // rec: DEX, BEQ done, TXA, PHA, JSR rec, PLA, TAX, done: RTS
+                             const Word rec = 0x0300;
+                             Program p(0x0200);
+                             Word start = p.here();
+                             p.op(CPU::INS_LDX_IM, 0x20)
+                                 .op_word(CPU::INS_JSR, rec)
+                                 .op_word(CPU::INS_JMP_ABS, start);
+                             p.load(memory);
+
+                             Program r(rec);
+                             Word done = rec + 10;
+                             r.op(CPU::INS_DEX)
+                                 .branch(CPU::INS_BEQ, done)
+                                 .op(CPU::INS_TXA)
+                                 .op(CPU::INS_STACK_PHA)
+                                 .op_word(CPU::INS_JSR, rec)
+                                 .op(CPU::INS_STACK_PLA)
+                                 .op(CPU::INS_TAX);
+                             assert(r.here() == done);
+                             r.op(CPU::INS_RTS);
+                             r.load(memory);
+                             cpu.PC = start;
+                         }});
+
+    return workloads;
+}
+
+// Single-opcode kernel: 64 copies of the instruction followed by a JMP back,
+// or a self-loop for the control-flow opcodes that cannot run straight-line.
+Workload opcode_kernel(Byte opcode)
+{
+    return {"opcode", [opcode](CPU &cpu, Memory &memory) {
+                const Word kernel = 0x1000;
+                OpcodeInfo info = CPU::decode(opcode);
+                // every zero page byte doubles as the pointer $0404 for the indirect modes
+                const std::vector<Byte> pointers(0x100, 0x04);
+                memory.load(0x0000, pointers.data(), pointers.size());
+
+                if (info.operation == Operation::RTS || info.operation == Operation::RTI)
+                {
+                    // a stack page full of $24 pulls P = $24 and PC = $2424 (+1 for RTS)
+                    const std::vector<Byte> stack(0x100, 0x24);
+                    memory.load(0x0100, stack.data(), stack.size());
+                    Word address = info.operation == Operation::RTS ? 0x2425 : 0x2424;
+                    memory.store(address, opcode);
+                    cpu.PC = address;
+                    return;
+                }
+
+                Program p(kernel);
+                switch (info.operation)
+                {
+                case Operation::JMP:
+                    memory.store(0x0600, kernel & 0xFF);
+                    memory.store(0x0601, kernel >> 8);
+                    p.op_word(opcode, info.mode == AddressingMode::absolute ? kernel : 0x0600);
+                    break;
+                case Operation::BRK:
+                    memory.store(0xFFFE, kernel & 0xFF);
+                    memory.store(0xFFFF, kernel >> 8);
+                    p.op(opcode);
+                    break;
+                default:
+                    for (int i = 0; i < 64; i++)
+                    {
+                        switch (info.mode)
+                        {
+                        case AddressingMode::implied:
+                        case AddressingMode::accumulator:
+                            p.op(opcode);
+                            break;
+                        case AddressingMode::immediate:
+                            p.op(opcode, 0x01);
+                            break;
+                        case AddressingMode::relative:
+                            p.op(opcode, 0x00);
+                            break;
+                        case AddressingMode::absolute:
+                            p.op_word(opcode, info.operation == Operation::JSR ? Word(p.here() + 3) : Word(0x0400));
+                            break;
+                        case AddressingMode::absolute_x:
+                        case AddressingMode::absolute_y:
+                            p.op_word(opcode, 0x0400);
+                            break;
+                        default:
+                            p.op(opcode, 0x80);
+                            break;
+                        }
+                    }
+                    p.op_word(CPU::INS_JMP_ABS, kernel);
+                    break;
+                }
+                p.load(memory);
+                cpu.PC = kernel;
+            }};
+}
+
+struct OpcodeCost
+{
+    Byte opcode;
+    double ns;
+};
+
+// Host time per instruction of each official opcode, with the closing JMPs of
+// the straight-line kernels subtracted out.
+std::vector<OpcodeCost> measure_opcodes(uint64_t cycles, int repeat)
+{
+    std::vector<OpcodeCost> costs;
+    RunResult jmp = measure(opcode_kernel(CPU::INS_JMP_ABS), cycles, repeat);
+    double jmp_ns = jmp.seconds * 1e9 / jmp.instructions;
+
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        if (CPU::decode(opcode).operation == Operation::ILL)
+        {
+            continue;
+        }
+        if (opcode == CPU::INS_JMP_ABS)
+        {
+            costs.push_back({Byte(opcode), jmp_ns});
+            continue;
+        }
+        RunResult r = measure(opcode_kernel(opcode), cycles, repeat);
+        uint64_t count = r.opcode_counts[opcode];
+        uint64_t others = r.instructions - count;
+        double ns = (r.seconds * 1e9 - others * jmp_ns) / count;
+        costs.push_back({Byte(opcode), ns});
+    }
+    return costs;
+}
+
+struct BatchScaling
+{
+    unsigned threads;
+    double jobs_per_second;
+};
+
+// short independent jobs: the same loop over a different byte each
+std::vector<BatchJob> make_batch_jobs(size_t job_count)
+{
+    Program p(0x0200);
+    Word loop = p.here();
+    p.op(CPU::INS_CLC)
+        .op(CPU::INS_ADC_ZP, 0x10)
+        .op(CPU::INS_STA_ZERO_PAGE, 0x10)
+        .op(CPU::INS_INX)
+        .branch(CPU::INS_BNE, loop)
+        .op(CPU::INS_INY)
+        .op_word(CPU::INS_JMP_ABS, loop);
+
+    std::vector<BatchJob> jobs(job_count);
+    for (size_t i = 0; i < job_count; i++)
+    {
+        jobs[i].image = {{p.origin, p.bytes}, {0x0010, {Byte(i)}}};
+        jobs[i].registers = {p.origin, 0xFF, 0, 0, 0, 0};
+        jobs[i].cycles = 20000;
+    }
+    return jobs;
+}
+
+// Throughput of BatchRunner on short independent jobs at 1, 2, 4 ... threads.
+std::vector<BatchScaling> measure_batch(size_t job_count, int repeat)
+{
+    std::vector<BatchJob> jobs = make_batch_jobs(job_count);
+    std::vector<BatchScaling> scaling;
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1;; threads = std::min(threads * 2, max_threads))
+    {
+        BatchRunner runner(threads);
+        double best = 0;
+        for (int i = 0; i < repeat; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            runner.run(jobs);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (i == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        scaling.push_back({threads, job_count / best});
+        if (threads == max_threads)
+        {
+            break;
+        }
+    }
+    return scaling;
+}
+
+struct LockstepThroughput
+{
+    uint32_t lanes; // 1: CPU::execute, one job after the other
+    double jobs_per_second;
+    double lockstep_share; // of the instructions, executed once for all lanes
+};
+
+// Runs every job of `jobs` through lockstep batches of Lanes machines on this thread.
+template <uint32_t Lanes>
+LockstepThroughput run_lockstep(const std::vector<BatchJob> &jobs, int repeat)
+{
+    auto batch = std::make_unique<LockstepBatch<Lanes>>();
+    double best = 0;
+    uint64_t lockstep = 0, total = 0;
+    for (int r = 0; r < repeat; r++)
+    {
+        lockstep = total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t first = 0; first + Lanes <= jobs.size(); first += Lanes)
+        {
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                const BatchJob &job = jobs[first + lane];
+                batch->cpu(lane).reset(batch->memory(lane));
+                for (const MemorySegment &segment : job.image)
+                {
+                    batch->memory(lane).load(segment.address, segment.bytes.data(), segment.bytes.size());
+                }
+                batch->cpu(lane).set_registers(job.registers);
+            }
+            batch->run(jobs[first].cycles);
+            lockstep += batch->lockstep_instructions * Lanes;
+            total += batch->lockstep_instructions * Lanes + batch->scalar_steps * Lanes;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (r == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+    return {Lanes, jobs.size() / Lanes * Lanes / best, total ? double(lockstep) / total : 0};
+}
+
+// Jobs/s of the measure_batch jobs on one thread: CPU::execute per job against
+// LockstepBatch with 8, 16 and 32 lanes. The jobs differ only in data, so the
+// lanes never diverge.
+std::vector<LockstepThroughput> measure_lockstep(size_t job_count, int repeat)
+{
+    std::vector<BatchJob> jobs = make_batch_jobs(job_count);
+    auto memory = std::make_unique<Memory>();
+    CPU cpu;
+    double best = 0;
+    for (int r = 0; r < repeat; r++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (const BatchJob &job : jobs)
+        {
+            cpu.reset(*memory);
+            for (const MemorySegment &segment : job.image)
+            {
+                memory->load(segment.address, segment.bytes.data(), segment.bytes.size());
+            }
+            cpu.set_registers(job.registers);
+            cpu.execute(job.cycles, *memory);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (r == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+    return {{1, jobs.size() / best, 0}, run_lockstep<8>(jobs, repeat), run_lockstep<16>(jobs, repeat),
+            run_lockstep<32>(jobs, repeat)};
+}
+
+struct ResetCost
+{
+    uint32_t pages;
+    double ns;
+};
+
+// Cost of Memory::restore() after writes to `pages` distinct pages; it only
+// clears dirty pages, so this should grow linearly from almost nothing.
+std::vector<ResetCost> measure_reset(int repeat)
+{
+    std::vector<ResetCost> costs;
+    auto memory = std::make_unique<Memory>();
+    memory->init();
+    const int iterations = 20000;
+    for (uint32_t pages = 0; pages <= MEMORY_PAGE_COUNT; pages = pages ? pages * 2 : 1)
+    {
+        double best = 0;
+        for (int r = 0; r < repeat; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; i++)
+            {
+                for (uint32_t page = 0; page < pages; page++)
+                {
+                    memory->store(page * (MEMORY_PAGE_COUNT / pages) * MEMORY_PAGE_SIZE, Byte(i));
+                }
+                memory->restore();
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (r == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        costs.push_back({pages, best * 1e9 / iterations});
+    }
+    return costs;
+}
+
+struct SnapshotCost
+{
+    std::string operation;
+    double ns;
+};
+
+// Cost of the MemorySnapshot operations on a 64 KB image with 4 changed pages,
+// using the kernel chosen for this host.
+std::vector<SnapshotCost> measure_snapshot(int repeat)
+{
+    auto memory = std::make_unique<Memory>();
+    memory->init();
+    MemorySnapshot snapshot(*memory);
+    const int iterations = 20000;
+    auto change = [&memory](int i) {
+        for (uint32_t page = 0; page < 4; page++)
+        {
+            memory->store(page * 0x4000 + 0x10, Byte(i | 1));
+        }
+    };
+    std::vector<std::pair<std::string, std::function<void(int)>>> operations = {
+        {"capture", [&](int) { snapshot.capture(*memory); }},
+        {"diff", [&](int i) { change(i); snapshot.diff(*memory); memory->restore(); }},
+        {"diff_dirty", [&](int i) { change(i); snapshot.diff_dirty(*memory); memory->restore(); }},
+        {"restore", [&](int i) { change(i); snapshot.restore(*memory); memory->clear_dirty(); }},
+    };
+    std::vector<SnapshotCost> costs;
+    for (const auto &operation : operations)
+    {
+        double best = 0;
+        for (int r = 0; r < repeat; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; i++)
+            {
+                operation.second(i);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (r == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        costs.push_back({operation.first, best * 1e9 / iterations});
+    }
+    return costs;
+}
+
+struct RecompiledSpeed
+{
+    double interpreted_mhz;
+    double compiled_mhz;
+};
+
+// Emulated MHz of the demo firmware (demo_firmware.h) through CPU::execute and
+// through demo_firmware_recompiled::execute, in runs of 100000 cycles.
+RecompiledSpeed measure_recompiled(uint64_t cycles, int repeat)
+{
+    auto memory = std::make_unique<Memory>();
+    CPU cpu;
+    auto run = [&](uint64_t (*execute)(CPU &, uint64_t, Memory &)) {
+        double best = 0;
+        for (int r = 0; r < repeat; r++)
+        {
+            cpu.reset(*memory);
+            load_image(*memory, demo_firmware_image());
+            cpu.PC = 0xC000;
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t done = 0; done < cycles;)
+            {
+                done += execute(cpu, 100000, *memory);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (r == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        return cycles / best / 1e6;
+    };
+    double interpreted = run([](CPU &cpu, uint64_t budget, Memory &memory) { return cpu.execute(budget, memory); });
+    double compiled = run(demo_firmware_recompiled::execute);
+    return {interpreted, compiled};
+}
+
+struct IdleSpeed
+{
+    double running_mhz;  // every idle round executed
+    double skipping_mhz; // idle loops fast-forwarded
+    double idle_share;   // of the cycles, skipped over
+};
+
+// Emulated MHz of a machine that spends most of its time waiting: an NMI every
+// 20000 cycles copies a page and sets a flag that the main loop polls.
+IdleSpeed measure_idle(uint64_t cycles, int repeat)
+{
+    auto memory = std::make_unique<Memory>();
+    CPU cpu;
+    auto run = [&](bool skip_idle_loops) {
+        double best = 0;
+        for (int r = 0; r < repeat; r++)
+        {
+            cpu.reset(*memory);
+            const Byte main_loop[] = {CPU::INS_LDA_ZP, 0x10, CPU::INS_BEQ, 0xFC, CPU::INS_LDA_IM, 0x00,
+                                      CPU::INS_STA_ZERO_PAGE, 0x10, CPU::INS_JMP_ABS, 0x00, 0x02};
+            const Byte nmi_handler[] = {CPU::INS_LDX_IM, 0x00, CPU::INS_LDA_ABSX, 0x00, 0x04, CPU::INS_STA_ABSX,
+                                        0x00, 0x05, CPU::INS_INX, CPU::INS_BNE, 0xF7, CPU::INS_INC_ZP, 0x10,
+                                        CPU::INS_RTI};
+            const Byte vectors[] = {0x00, 0x03};
+            memory->load(0x0200, main_loop, sizeof(main_loop));
+            memory->load(0x0300, nmi_handler, sizeof(nmi_handler));
+            memory->load(0xFFFA, vectors, sizeof(vectors));
+            cpu.PC = 0x0200;
+            cpu.skip_idle_loops = skip_idle_loops;
+            cpu.idle_cycles_skipped = 0;
+            Scheduler scheduler;
+            std::function<void()> frame = [&] {
+                cpu.raise_nmi();
+                scheduler.schedule_in(20000, frame);
+            };
+            scheduler.schedule_at(20000, frame);
+            auto start = std::chrono::steady_clock::now();
+            scheduler.run_until(cycles, cpu, *memory);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (r == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        return cycles / best / 1e6;
+    };
+    double running = run(false);
+    double skipping = run(true);
+    return {running, skipping, double(cpu.idle_cycles_skipped) / cycles};
+}
+
+struct PoolDensity
+{
+    size_t machines;
+    double private_kb;         // resident KB per machine with its own Memory
+    double pooled_kb;         // resident KB per machine from a MachinePool
+    double acquire_release_ns; // a used machine back to the image and out again
+};
+
+// resident set of the process in KB, from /proc/self/statm
+double resident_kb()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024.0);
+}
+
+// Resident memory of `machines` concurrent machines that booted the demo
+// firmware next to 32 KB of table ROM and ran 100000 cycles each: every one
+// with its own Memory, and out of a MachinePool that shares $4000-$FFFF.
+PoolDensity measure_pool(size_t machines, int repeat)
+{
+    Image image = demo_firmware_image();
+    std::mt19937 random(22);
+    MemorySegment table{0x4000, std::vector<Byte>(0x8000)};
+    for (Byte &value : table.bytes)
+    {
+        value = random();
+    }
+    image.segments.push_back(table);
+    auto boot = [](CPU &cpu, Memory &memory) {
+        cpu.PC = 0xC000;
+        cpu.execute(100000, memory);
+    };
+
+    PoolDensity density{machines, 0, 0, 0};
+    {
+        double before = resident_kb();
+        MachinePool pool(machines);
+        load_image(pool.image(), image);
+        pool.share(0x40, 0xC0);
+        std::vector<PooledMachine *> out;
+        for (size_t i = 0; i < machines; i++)
+        {
+            out.push_back(pool.acquire());
+            boot(out.back()->cpu, out.back()->memory);
+        }
+        density.pooled_kb = (resident_kb() - before) / machines;
+
+        // each round trip restores the pages the previous boot wrote
+        const int iterations = 2000;
+        double best = 0;
+        for (int r = 0; r < repeat; r++)
+        {
+            std::chrono::duration<double> elapsed{0};
+            for (int i = 0; i < iterations; i++)
+            {
+                PooledMachine *machine = out[i % machines];
+                auto start = std::chrono::steady_clock::now();
+                pool.release(machine);
+                machine = pool.acquire();
+                elapsed += std::chrono::steady_clock::now() - start;
+                boot(machine->cpu, machine->memory);
+                out[i % machines] = machine;
+            }
+            if (r == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        density.acquire_release_ns = best * 1e9 / iterations;
+    }
+    {
+        double before = resident_kb();
+        std::vector<std::unique_ptr<Memory>> memories;
+        std::vector<CPU> cpus(machines);
+        for (size_t i = 0; i < machines; i++)
+        {
+            memories.push_back(std::make_unique<Memory>());
+            cpus[i].reset(*memories[i]);
+            load_image(*memories[i], image);
+            boot(cpus[i], *memories[i]);
+        }
+        density.private_kb = (resident_kb() - before) / machines;
+    }
+    return density;
+}
+
+struct SaveStateCost
+{
+    size_t bytes;     // of the record
+    uint32_t pages;   // nonzero RAM pages in it
+    double save_us;
+    double load_us;
+};
+
+// Save and load of the demo firmware machine after 100000 cycles, with 32 KB
+// of mostly repetitive data next to it
+SaveStateCost measure_save_state(int repeat)
+{
+    auto memory = std::make_unique<Memory>();
+    CPU cpu;
+    cpu.reset(*memory);
+    load_image(*memory, demo_firmware_image());
+    for (uint32_t i = 0; i < 0x8000; i++)
+    {
+        memory->store(0x4000 + i, Byte(i / 64 * 7));
+    }
+    cpu.PC = 0xC000;
+    cpu.execute(100000, *memory);
+
+    SaveStateCost cost{0, 0, 0, 0};
+    for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+    {
+        cost.pages += !is_zero_page(memory->data + page * MEMORY_PAGE_SIZE);
+    }
+    std::vector<Byte> record;
+    auto target = std::make_unique<Memory>();
+    CPU loaded;
+    uint64_t clock;
+    const int iterations = 2000;
+    for (int r = 0; r < repeat; r++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            record.clear();
+            save_state(record, cpu, *memory, i);
+        }
+        std::chrono::duration<double> saving = std::chrono::steady_clock::now() - start;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            load_state(record.data(), record.size(), loaded, *target, clock);
+        }
+        std::chrono::duration<double> loading = std::chrono::steady_clock::now() - start;
+        if (r == 0 || saving.count() * 1e6 / iterations < cost.save_us)
+        {
+            cost.save_us = saving.count() * 1e6 / iterations;
+        }
+        if (r == 0 || loading.count() * 1e6 / iterations < cost.load_us)
+        {
+            cost.load_us = loading.count() * 1e6 / iterations;
+        }
+    }
+    cost.bytes = record.size();
+    return cost;
+}
+
+struct TimeTravelCost
+{
+    double plain_mhz;       // Debugger::run
+    double recording_mhz;   // TimeTravel::run, with the default history
+    double reverse_step_us; // one instruction back
+    size_t snapshots;       // kept after the run
+};
+
+// The demo firmware through a Debugger with nothing armed, with and without a
+// TimeTravel history of the default size, then stepped back from the end
+TimeTravelCost measure_time_travel(uint64_t cycles, int repeat)
+{
+    TimeTravelCost cost{0, 0, 0, 0};
+    for (int r = 0; r < repeat; r++)
+    {
+        for (bool recording : {false, true})
+        {
+            auto memory = std::make_unique<Memory>();
+            CPU cpu;
+            cpu.reset(*memory);
+            load_image(*memory, demo_firmware_image());
+            cpu.PC = 0xC000;
+            Debugger debugger(cpu, *memory);
+            TimeTravel history(cpu, *memory, debugger);
+            auto start = std::chrono::steady_clock::now();
+            uint64_t used = recording ? history.run(cycles).cycles : debugger.run(cycles).cycles;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            double mhz = used / elapsed.count() / 1e6;
+            double &best = recording ? cost.recording_mhz : cost.plain_mhz;
+            best = std::max(best, mhz);
+            if (!recording)
+            {
+                continue;
+            }
+            const int steps = 200;
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < steps; i++)
+            {
+                history.reverse_step();
+            }
+            elapsed = std::chrono::steady_clock::now() - start;
+            if (r == 0 || elapsed.count() * 1e6 / steps < cost.reverse_step_us)
+            {
+                cost.reverse_step_us = elapsed.count() * 1e6 / steps;
+            }
+            cost.snapshots = history.snapshot_count();
+        }
+    }
+    return cost;
+}
+
+struct IntervalMapCost
+{
+    double assign_ns;       // interval_map::assign
+    double brute_assign_ns; // filling the same interval of a per-key array
+    double lookup_ns;       // interval_map::operator[]
+    double apply_ns;        // BusMap::apply of a board with RAM, ROM and I/O
+    uint64_t lookup_sum;    // of the looked-up values, the same as from the per-key array
+};
+
+// Random intervals of up to 4096 of 1M keys, then a board map rebuilt into a Memory
+IntervalMapCost measure_interval_map(int repeat)
+{
+    struct NullDevice : BusDevice
+    {
+        Byte read(Word) override
+        {
+            return 0;
+        }
+        void write(Word, Byte) override {}
+    };
+    const uint32_t keys = 1 << 20;
+    const int operations = 100000;
+    std::mt19937 random(25);
+    std::vector<uint32_t> begins(operations), values(operations);
+    for (int i = 0; i < operations; i++)
+    {
+        begins[i] = random() % (keys - 4096);
+        values[i] = random() % 4;
+    }
+    auto ns_per = [](std::chrono::steady_clock::time_point start, int count) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() * 1e9 / count;
+    };
+
+    IntervalMapCost cost{0, 0, 0, 0, 0};
+    std::vector<Byte> rom(0x2000);
+    NullDevice devices[2];
+    auto memory = std::make_unique<Memory>();
+    for (int r = 0; r < repeat; r++)
+    {
+        interval_map<uint32_t, uint32_t> map(0);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < operations; i++)
+        {
+            map.assign(begins[i], begins[i] + 1 + begins[i] % 4096, values[i]);
+        }
+        double assign_ns = ns_per(start, operations);
+
+        std::vector<uint32_t> brute(keys, 0);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < operations; i++)
+        {
+            std::fill(brute.begin() + begins[i], brute.begin() + begins[i] + 1 + begins[i] % 4096, values[i]);
+        }
+        double brute_ns = ns_per(start, operations);
+
+        uint64_t sum = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < operations; i++)
+        {
+            sum += map[begins[i]];
+        }
+        double lookup_ns = ns_per(start, operations);
+        uint64_t brute_sum = 0;
+        for (int i = 0; i < operations; i++)
+        {
+            brute_sum += brute[begins[i]];
+        }
+        if (sum != brute_sum)
+        {
+            std::cerr << "interval map lookups sum to " << sum << ", the per-key array to " << brute_sum << std::endl;
+        }
+        cost.lookup_sum = sum;
+
+        BusMap board;
+        board.map_ram(0x0000, 0x8000);
+        board.map_device(0x8000, 0xC000, nullptr);
+        board.map_device(0xD000, 0xD100, &devices[0]);
+        board.map_device(0xD100, 0xD200, &devices[1]);
+        board.map_rom(0xE000, 0x10000, rom.data());
+        const int applies = 10000;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < applies; i++)
+        {
+            board.apply(*memory);
+        }
+        double apply_ns = ns_per(start, applies);
+
+        if (r == 0 || assign_ns < cost.assign_ns)
+        {
+            cost.assign_ns = assign_ns;
+        }
+        if (r == 0 || brute_ns < cost.brute_assign_ns)
+        {
+            cost.brute_assign_ns = brute_ns;
+        }
+        if (r == 0 || lookup_ns < cost.lookup_ns)
+        {
+            cost.lookup_ns = lookup_ns;
+        }
+        if (r == 0 || apply_ns < cost.apply_ns)
+        {
+            cost.apply_ns = apply_ns;
+        }
+    }
+    return cost;
+}
+
+std::string hex_byte(Byte value)
+{
+    std::stringstream stream;
+    stream << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << int(value);
+    return stream.str();
+}
+
+void write_json(std::ostream &out, const std::string &label, uint64_t cycles,
+                const std::vector<std::pair<std::string, RunResult>> &workloads, const std::vector<OpcodeCost> &opcodes,
+                const std::vector<BatchScaling> &batch, const std::vector<LockstepThroughput> &lockstep,
+                const std::vector<ResetCost> &reset,
+                const std::vector<SnapshotCost> &snapshot, const RecompiledSpeed &recompiled, const IdleSpeed &idle,
+                const PoolDensity &pool, const SaveStateCost &save, const TimeTravelCost &travel,
+                const IntervalMapCost &intervals)
+{
+    out << "{\n";
+    out << "  \"label\": \"" << label << "\",\n";
+    out << "  \"threaded_dispatch\": " << (CPU_THREADED_DISPATCH ? "true" : "false") << ",\n";
+    out << "  \"cycles_per_workload\": " << cycles << ",\n";
+    out << "  \"workloads\": [";
+    for (size_t i = 0; i < workloads.size(); i++)
+    {
+        const RunResult &r = workloads[i].second;
+        out << (i ? "," : "") << "\n    {\"name\": \"" << workloads[i].first << "\""
+            << ", \"cycles\": " << r.cycles
+            << ", \"instructions\": " << r.instructions
+            << ", \"seconds\": " << r.seconds
+            << ", \"emulated_mhz\": " << r.cycles / r.seconds / 1e6
+            << ", \"ns_per_instruction\": " << r.seconds * 1e9 / r.instructions
+            << ", \"opcode_mix\": {";
+        bool first = true;
+        for (int opcode = 0; opcode < 256; opcode++)
+        {
+            if (r.opcode_counts[opcode])
+            {
+                out << (first ? "" : ", ") << "\"" << hex_byte(opcode) << "\": " << r.opcode_counts[opcode];
+                first = false;
+            }
+        }
+        out << "}}";
+    }
+    out << "\n  ],\n";
+    out << "  \"opcodes\": [";
+    for (size_t i = 0; i < opcodes.size(); i++)
+    {
+        OpcodeInfo info = CPU::decode(opcodes[i].opcode);
+        out << (i ? "," : "") << "\n    {\"opcode\": \"" << hex_byte(opcodes[i].opcode) << "\""
+            << ", \"mnemonic\": \"" << operation_name(info.operation) << "\""
+            << ", \"mode\": \"" << addressing_mode_name(info.mode) << "\""
+            << ", \"ns\": " << opcodes[i].ns << "}";
+    }
+    out << "\n  ],\n";
+    out << "  \"batch\": [";
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        out << (i ? ", " : "") << "{\"threads\": " << batch[i].threads << ", \"jobs_per_second\": " << batch[i].jobs_per_second << "}";
+    }
+    out << "],\n";
+    out << "  \"lockstep\": [";
+    for (size_t i = 0; i < lockstep.size(); i++)
+    {
+        out << (i ? ", " : "") << "{\"lanes\": " << lockstep[i].lanes << ", \"jobs_per_second\": " << lockstep[i].jobs_per_second
+            << ", \"lockstep_share\": " << lockstep[i].lockstep_share << "}";
+    }
+    out << "],\n";
+    out << "  \"reset\": [";
+    for (size_t i = 0; i < reset.size(); i++)
+    {
+        out << (i ? ", " : "") << "{\"pages\": " << reset[i].pages << ", \"ns\": " << reset[i].ns << "}";
+    }
+    out << "],\n";
+    out << "  \"snapshot_kernel\": \"" << page_diff_kernel_name() << "\",\n";
+    out << "  \"snapshot\": [";
+    for (size_t i = 0; i < snapshot.size(); i++)
+    {
+        out << (i ? ", " : "") << "{\"operation\": \"" << snapshot[i].operation << "\", \"ns\": " << snapshot[i].ns << "}";
+    }
+    out << "],\n";
+    out << "  \"recompiled\": {\"interpreted_mhz\": " << recompiled.interpreted_mhz
+        << ", \"compiled_mhz\": " << recompiled.compiled_mhz << "},\n";
+    out << "  \"idle\": {\"running_mhz\": " << idle.running_mhz << ", \"skipping_mhz\": " << idle.skipping_mhz
+        << ", \"idle_share\": " << idle.idle_share << "},\n";
+    out << "  \"pool\": {\"machines\": " << pool.machines << ", \"private_kb\": " << pool.private_kb
+        << ", \"pooled_kb\": " << pool.pooled_kb << ", \"acquire_release_ns\": " << pool.acquire_release_ns << "},\n";
+    out << "  \"save_state\": {\"bytes\": " << save.bytes << ", \"pages\": " << save.pages << ", \"save_us\": " << save.save_us
+        << ", \"load_us\": " << save.load_us << "},\n";
+    out << "  \"time_travel\": {\"plain_mhz\": " << travel.plain_mhz << ", \"recording_mhz\": " << travel.recording_mhz
+        << ", \"reverse_step_us\": " << travel.reverse_step_us << ", \"snapshots\": " << travel.snapshots << "},\n";
+    out << "  \"interval_map\": {\"assign_ns\": " << intervals.assign_ns << ", \"brute_assign_ns\": " << intervals.brute_assign_ns
+        << ", \"lookup_ns\": " << intervals.lookup_ns << ", \"bus_map_apply_ns\": " << intervals.apply_ns << "}\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t cycles = 50000000;
+    uint64_t opcode_cycles = 1000000;
+    int repeat = 3;
+    size_t batch_jobs = 4000;
+    std::string functional_rom, json_path, label;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--cycles" && has_value)
+            cycles = std::stoull(argv[++i]);
+        else if (arg == "--opcode-cycles" && has_value)
+            opcode_cycles = std::stoull(argv[++i]);
+        else if (arg == "--repeat" && has_value)
+            repeat = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--batch-jobs" && has_value)
+            batch_jobs = std::stoull(argv[++i]);
+        else if (arg == "--functional-rom" && has_value)
+            functional_rom = argv[++i];
+        else if (arg == "--json" && has_value)
+            json_path = argv[++i];
+        else if (arg == "--label" && has_value)
+            label = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--cycles N] [--opcode-cycles N] [--repeat N]"
+                      << " [--batch-jobs N] [--functional-rom FILE] [--json FILE] [--label TEXT]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::pair<std::string, RunResult>> results;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const Workload &workload : standard_workloads(functional_rom))
+    {
+        RunResult r = measure(workload, cycles, repeat);
+        results.push_back({workload.name, r});
+        std::cout << std::left << std::setw(16) << workload.name << std::right
+                  << std::setw(10) << r.cycles / r.seconds / 1e6 << " MHz"
+                  << std::setw(10) << r.seconds * 1e9 / r.instructions << " ns/instruction"
+                  << std::setw(14) << r.instructions << " instructions" << std::endl;
+    }
+
+    std::vector<OpcodeCost> opcodes;
+    if (opcode_cycles > 0)
+    {
+        opcodes = measure_opcodes(opcode_cycles, repeat);
+        std::cout << "\nper-opcode cost (ns/instruction)" << std::endl;
+        for (size_t i = 0; i < opcodes.size(); i++)
+        {
+            OpcodeInfo info = CPU::decode(opcodes[i].opcode);
+            std::cout << "  " << hex_byte(opcodes[i].opcode) << " " << operation_name(info.operation)
+                      << " " << std::left << std::setw(17) << addressing_mode_name(info.mode) << std::right
+                      << std::setw(8) << opcodes[i].ns << ((i % 3 == 2) ? "\n" : "");
+        }
+        std::cout << std::endl;
+    }
+
+    std::vector<BatchScaling> batch;
+    if (batch_jobs > 0)
+    {
+        batch = measure_batch(batch_jobs, repeat);
+        std::cout << "batch of " << batch_jobs << " jobs" << std::endl;
+        for (const BatchScaling &b : batch)
+        {
+            std::cout << "  " << std::setw(3) << b.threads << " threads " << std::setw(12) << b.jobs_per_second
+                      << " jobs/s " << std::setw(6) << b.jobs_per_second / batch[0].jobs_per_second << "x" << std::endl;
+        }
+    }
+
+    std::vector<LockstepThroughput> lockstep;
+    if (batch_jobs > 0)
+    {
+        lockstep = measure_lockstep(batch_jobs, repeat);
+        std::cout << "lockstep batch, one thread" << std::endl;
+        for (const LockstepThroughput &l : lockstep)
+        {
+            std::cout << "  " << std::setw(3) << l.lanes << " lanes   " << std::setw(12) << l.jobs_per_second << " jobs/s "
+                      << std::setw(6) << l.jobs_per_second / lockstep[0].jobs_per_second << "x " << std::setw(8)
+                      << 100 * l.lockstep_share << "% in lockstep" << std::endl;
+        }
+    }
+
+    std::vector<ResetCost> reset = measure_reset(repeat);
+    std::cout << "memory reset cost" << std::endl;
+    for (const ResetCost &r : reset)
+    {
+        std::cout << "  " << std::setw(3) << r.pages << " dirty pages " << std::setw(10) << r.ns << " ns" << std::endl;
+    }
+
+    std::vector<SnapshotCost> snapshot = measure_snapshot(repeat);
+    std::cout << "memory snapshot (" << page_diff_kernel_name() << ", 4 changed pages)" << std::endl;
+    for (const SnapshotCost &c : snapshot)
+    {
+        std::cout << "  " << std::left << std::setw(12) << c.operation << std::right << std::setw(10) << c.ns << " ns" << std::endl;
+    }
+
+    RecompiledSpeed recompiled = measure_recompiled(cycles, repeat);
+    std::cout << "demo firmware" << std::endl
+              << "  interpreted " << std::setw(10) << recompiled.interpreted_mhz << " MHz" << std::endl
+              << "  recompiled  " << std::setw(10) << recompiled.compiled_mhz << " MHz " << std::setw(6)
+              << recompiled.compiled_mhz / recompiled.interpreted_mhz << "x" << std::endl;
+
+    IdleSpeed idle = measure_idle(cycles, repeat);
+    std::cout << "mostly idle machine, " << 100 * idle.idle_share << "% of the cycles in idle loops" << std::endl
+              << "  every round " << std::setw(10) << idle.running_mhz << " MHz" << std::endl
+              << "  skipped     " << std::setw(10) << idle.skipping_mhz << " MHz " << std::setw(6)
+              << idle.skipping_mhz / idle.running_mhz << "x" << std::endl;
+
+    PoolDensity pool = measure_pool(2000, repeat);
+    std::cout << pool.machines << " machines, resident KB each" << std::endl
+              << "  own Memory   " << std::setw(10) << pool.private_kb << std::endl
+              << "  MachinePool  " << std::setw(10) << pool.pooled_kb << std::endl
+              << "  acquire/release " << std::setw(7) << pool.acquire_release_ns << " ns" << std::endl;
+
+    SaveStateCost save = measure_save_state(repeat);
+    std::cout << "save state of " << save.pages << " RAM pages: " << save.bytes << " bytes" << std::endl
+              << "  save " << std::setw(10) << save.save_us << " us" << std::endl
+              << "  load " << std::setw(10) << save.load_us << " us" << std::endl;
+
+    TimeTravelCost travel = measure_time_travel(cycles, repeat);
+    std::cout << "time travel, demo firmware, " << travel.snapshots << " snapshots kept" << std::endl
+              << "  forward     " << std::setw(10) << travel.plain_mhz << " MHz" << std::endl
+              << "  recording   " << std::setw(10) << travel.recording_mhz << " MHz " << std::setw(6)
+              << travel.recording_mhz / travel.plain_mhz << "x" << std::endl
+              << "  reverse step " << std::setw(9) << travel.reverse_step_us << " us" << std::endl;
+
+    IntervalMapCost intervals = measure_interval_map(repeat);
+    std::cout << "interval map, 1M keys, intervals of up to 4096" << std::endl
+              << "  assign      " << std::setw(10) << intervals.assign_ns << " ns" << std::endl
+              << "  brute force " << std::setw(10) << intervals.brute_assign_ns << " ns" << std::endl
+              << "  lookup      " << std::setw(10) << intervals.lookup_ns << " ns (sum " << intervals.lookup_sum << ")"
+              << std::endl
+              << "  bus map apply " << std::setw(8) << intervals.apply_ns << " ns" << std::endl;
+
+    if (!json_path.empty())
+    {
+        std::ofstream out(json_path);
+        write_json(out, label, cycles, results, opcodes, batch, lockstep, reset, snapshot, recompiled, idle, pool, save, travel, intervals);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstring>
+
+#include "common.h"
+
+enum class StopReason : uint8_t
+{
+    none,
+    breakpoint,  // PC reached an execution breakpoint; the instruction has not run
+    read_watch,  // the last instruction read a watched address
+    write_watch, // the last instruction wrote a watched address
+    illegal      // stopped on an unofficial opcode
+};
+
+// Execution breakpoints and read/write watchpoints for
+// CPU::execute<TraceLevel::debug>, one bit per address each. Every other trace
+// level compiles the checks out, so they only cost anything once armed.
+struct Breakpoints
+{
+    uint64_t execute[MAX_MEMORY / 64];
+    uint64_t read[MAX_MEMORY / 64];
+    uint64_t write[MAX_MEMORY / 64];
+    uint32_t count = 0; // bits set across the three maps
+
+    // why the last execute<TraceLevel::debug> stopped early, and where: the PC
+    // for breakpoints, the accessed address for watchpoints
+    StopReason reason = StopReason::none;
+    Word address = 0;
+
+    Breakpoints()
+    {
+        clear();
+    }
+
+    bool armed() const
+    {
+        return count > 0;
+    }
+
+    void clear()
+    {
+        std::memset(execute, 0, sizeof(execute));
+        std::memset(read, 0, sizeof(read));
+        std::memset(write, 0, sizeof(write));
+        count = 0;
+    }
+
+    void set_breakpoint(Word address, bool enabled = true)
+    {
+        set(execute, address, enabled);
+    }
+
+    void set_watchpoint(Word address, bool on_read, bool on_write, bool enabled = true)
+    {
+        if (on_read)
+        {
+            set(read, address, enabled);
+        }
+        if (on_write)
+        {
+            set(write, address, enabled);
+        }
+    }
+
+    static bool test(const uint64_t *map, Word address)
+    {
+        return (map[address >> 6] >> (address & 63)) & 1;
+    }
+
+    // the first watch hit of an instruction is the one reported
+    void hit(StopReason why, Word where)
+    {
+        if (reason == StopReason::none)
+        {
+            reason = why;
+            address = where;
+        }
+    }
+
+private:
+    void set(uint64_t *map, Word address, bool enabled)
+    {
+        uint64_t bit = 1ull << (address & 63);
+        if (bool(map[address >> 6] & bit) != enabled)
+        {
+            map[address >> 6] ^= bit;
+            count += enabled ? 1 : -1;
+        }
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "interval_map.h"
+#include "memory.h"
+
+// What a range of the bus is: `data` RAM, ROM in `storage` or a device
+struct BusRegion
+{
+    enum Kind : Byte
+    {
+        ram,
+        rom,
+        device
+    };
+
+    Kind kind = ram;
+    // ROM: address `base` reads storage[0], so a region keeps its offsets
+    // wherever it is cut
+    const Byte *storage = nullptr;
+    uint32_t base = 0;
+    BusDevice *bus_device = nullptr;
+
+    bool operator==(const BusRegion &other) const
+    {
+        return kind == other.kind && storage == other.storage && base == other.base && bus_device == other.bus_device;
+    }
+};
+
+// The address map of a board: RAM, ROM and I/O windows by address range, in
+// an interval_map, so a change touches only the ranges it covers and the map
+// always holds as many regions as there are changes of what is mapped. Ranges
+// are given in addresses and must be whole pages, which is as fine as the
+// page table of Memory goes; later ranges overlay earlier ones.
+class BusMap
+{
+public:
+    BusMap() : regions(BusRegion()) {}
+
+    void map_ram(uint32_t begin, uint32_t end)
+    {
+        assign(begin, end, BusRegion());
+    }
+
+    // `storage` holds end - begin bytes; it is not copied
+    void map_rom(uint32_t begin, uint32_t end, const Byte *storage)
+    {
+        assign(begin, end, {BusRegion::rom, storage, begin, nullptr});
+    }
+
+    void map_device(uint32_t begin, uint32_t end, BusDevice *device)
+    {
+        assign(begin, end, {BusRegion::device, nullptr, 0, device});
+    }
+
+    const BusRegion &operator[](Word address) const
+    {
+        return regions[address];
+    }
+
+    // number of ranges with one region each, from 1 for all RAM
+    size_t region_count() const
+    {
+        size_t count = 1;
+        for (const auto &boundary : regions.boundaries())
+        {
+            count += boundary.first < MAX_MEMORY;
+        }
+        return count;
+    }
+
+    // Sets the page table of `memory` to this map, one map_* call per range.
+    // Pages that were RAM already and stay RAM are not remapped, so their
+    // predecoded instructions survive.
+    void apply(Memory &memory) const
+    {
+        uint32_t begin = 0;
+        const BusRegion *region = &regions.first_value();
+        for (const auto &boundary : regions.boundaries())
+        {
+            if (boundary.first >= MAX_MEMORY)
+            {
+                break;
+            }
+            apply(memory, begin, boundary.first, *region);
+            begin = boundary.first;
+            region = &boundary.second;
+        }
+        apply(memory, begin, MAX_MEMORY, *region);
+    }
+
+private:
+    // keys go up to MAX_MEMORY, the end of the last range
+    interval_map<uint32_t, BusRegion> regions;
+
+    void assign(uint32_t begin, uint32_t end, const BusRegion &region)
+    {
+        assert(begin % MEMORY_PAGE_SIZE == 0 && end % MEMORY_PAGE_SIZE == 0 && end <= MAX_MEMORY);
+        regions.assign(begin, end, region);
+    }
+
+    static void apply(Memory &memory, uint32_t begin, uint32_t end, const BusRegion &region)
+    {
+        Byte first_page = begin / MEMORY_PAGE_SIZE;
+        uint32_t count = (end - begin) / MEMORY_PAGE_SIZE;
+        switch (region.kind)
+        {
+        case BusRegion::ram:
+            for (uint32_t page = first_page; page < first_page + count; page++)
+            {
+                Byte *own = memory.data + page * MEMORY_PAGE_SIZE;
+                if (memory.read_pages[page] != own || memory.write_pages[page] != own || memory.devices[page])
+                {
+                    memory.map_ram(page, 1);
+                }
+            }
+            break;
+        case BusRegion::rom:
+            memory.map_rom(first_page, count, region.storage + (begin - region.base));
+            break;
+        case BusRegion::device:
+            memory.map_device(first_page, count, region.bus_device);
+            break;
+        }
+    }
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <bitset>
+
+#define MAX_MEMORY 64 * 1024 // 64 Kb
+
+// for the bus fast paths, which GCC otherwise stops inlining into the (huge) interpreter loop
+#if defined(__GNUC__)
+#define FORCE_INLINE inline __attribute__((always_inline))
+#define NO_INLINE __attribute__((noinline, cold))
+#else
+#define FORCE_INLINE inline
+#define NO_INLINE
+#endif
+
+using Byte = uint8_t;
+using Word = uint16_t;
+
+// An instruction always runs to completion, so the one that exhausts the budget
+// of CPU::execute may overrun it; the remaining budget then goes negative.
+FORCE_INLINE void decrement_cycles(int64_t &cycles, uint32_t dec_value)
+{
+    cycles -= dec_value;
+}
+
+inline std::string to_binary(unsigned short a)
+{
+    std::stringstream stream;
+    stream << "0b" << std::bitset<16>(a);
+    return stream.str();
+}
+
+inline std::string to_hex(unsigned short a)
+{
+    std::stringstream stream;
+    stream << "0x" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << a;
+    return stream.str();
+}
@@ -0,0 +1,109 @@
+// Single-step conformance runner (see conformance.h).
+//
+//   g++ -O2 -DNDEBUG -pthread conformance.cpp -o ./build/conformance
+//   ./build/conformance [--threads N] [--bus] [--verbose] PATH...
+//
+// PATH is a suite file or a directory, whose *.json files are all run, e.g. a
+// checkout of SingleStepTests/65x02 `6502/v1`. Prints the opcodes with
+// failures and the first failing case of each; exits with 1 if any case failed.
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "conformance.h"
+
+int main(int argc, char **argv)
+{
+    unsigned threads = std::thread::hardware_concurrency();
+    bool check_bus = false, verbose = false;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--threads" && has_value)
+            threads = std::stoul(argv[++i]);
+        else if (arg == "--bus")
+            check_bus = true;
+        else if (arg == "--verbose")
+            verbose = true;
+        else if (arg.rfind("--", 0) != 0)
+            paths.push_back(arg);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--threads N] [--bus] [--verbose] PATH..." << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::string> files;
+    for (const std::string &path : paths)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_directory(path, error))
+        {
+            files.push_back(path);
+            continue;
+        }
+        std::vector<std::string> directory;
+        for (const auto &entry : std::filesystem::directory_iterator(path, error))
+        {
+            if (entry.path().extension() == ".json")
+            {
+                directory.push_back(entry.path().string());
+            }
+        }
+        std::sort(directory.begin(), directory.end());
+        files.insert(files.end(), directory.begin(), directory.end());
+    }
+    if (files.empty())
+    {
+        std::cerr << "no test files" << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ConformanceReport report = run_conformance(files, threads, check_bus);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t skipped = 0;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        const OpcodeReport &r = report.opcodes[opcode];
+        skipped += r.skipped;
+        if (r.cases == 0 || (r.failed() == 0 && !verbose))
+        {
+            continue;
+        }
+        OpcodeInfo info = CPU::decode(opcode);
+        std::cout << "0x" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << opcode << std::dec << std::setfill(' ')
+                  << ' ' << operation_name(info.operation) << ' ' << std::left << std::setw(17) << addressing_mode_name(info.mode)
+                  << std::right << std::setw(8) << r.passed << '/' << r.cases - r.skipped << " passed";
+        if (r.failed() > 0)
+        {
+            std::cout << "  registers " << r.register_failures << "  memory " << r.memory_failures << "  cycles "
+                      << r.cycle_failures;
+            if (check_bus)
+            {
+                std::cout << "  bus " << r.bus_failures;
+            }
+            std::cout << "\n    " << r.first_failure;
+        }
+        std::cout << '\n';
+    }
+    for (const std::string &error : report.errors)
+    {
+        std::cout << error << '\n';
+    }
+
+    uint64_t cases = report.cases(), failed = report.failed();
+    std::cout << cases - skipped - failed << '/' << cases - skipped << " cases passed, " << skipped
+              << " skipped (unofficial opcodes), " << files.size() << " files in " << std::fixed << std::setprecision(2)
+              << seconds << " s (" << cases / seconds / 1e6 << "M cases/s)" << std::endl;
+    return failed == 0 && report.errors.empty() ? 0 : 1;
+}
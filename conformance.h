@@ -0,0 +1,535 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "cpu.h"
+#include "loader.h"
+
+// Runner for single-step conformance suites in the format of
+// SingleStepTests/65x02: one JSON file per opcode, each an array of cases
+//
+//   {"name": "a9 6b 7f",
+//    "initial": {"pc": 59082, "s": 39, "a": 57, "x": 33, "y": 174, "p": 96, "ram": [[59082, 169], ...]},
+//    "final":   {...same keys...},
+//    "cycles":  [[59082, 169, "read"], ...]}
+//
+// A case runs exactly one instruction. Registers, the listed RAM bytes and the
+// cycle count (the length of the bus log) must match exactly; with check_bus
+// the bus log itself is compared to a TraceLevel::bus trace as well. Dummy
+// reads (the byte after an implied opcode, the stack before a pull, the page
+// before an index carries) are in that trace with the byte mapped there but
+// never reach a device; the dummy writes of read-modify-write instructions
+// are real.
+//
+// Files are mmapped and parsed case by case into a reused SingleStepCase, so
+// a suite never has to fit in memory, and whole files are handed out to the
+// worker threads.
+
+struct BusCycle
+{
+    Word address;
+    Byte value;
+    bool write;
+};
+
+struct SingleStepState
+{
+    Registers registers;
+    std::vector<std::pair<Word, Byte>> ram;
+};
+
+struct SingleStepCase
+{
+    std::string name;
+    SingleStepState initial;
+    SingleStepState final;
+    std::vector<BusCycle> cycles;
+};
+
+// Just enough JSON for the suite: objects, arrays, strings without escapes
+// that matter and non-negative integers. Any error leaves `ok` false.
+class JsonCursor
+{
+public:
+    JsonCursor(const Byte *text, size_t size) : next(text), end(text + size) {}
+
+    bool ok = true;
+
+    bool at_end()
+    {
+        skip_space();
+        return next == end;
+    }
+
+    // consumes `c` when it is the next token
+    bool accept(char c)
+    {
+        skip_space();
+        if (next != end && *next == c)
+        {
+            next++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c))
+        {
+            ok = false;
+        }
+    }
+
+    void string(std::string &out)
+    {
+        out.clear();
+        expect('"');
+        while (ok && next != end && *next != '"')
+        {
+            if (*next == '\\' && ++next == end)
+            {
+                break;
+            }
+            out.push_back(*next++);
+        }
+        expect_raw('"');
+    }
+
+    // a string without escapes, as a view into the text
+    std::string_view view()
+    {
+        expect('"');
+        const Byte *start = next;
+        while (next != end && *next != '"')
+        {
+            next++;
+        }
+        std::string_view view(reinterpret_cast<const char *>(start), next - start);
+        expect_raw('"');
+        return view;
+    }
+
+    uint64_t number()
+    {
+        skip_space();
+        if (next == end || *next < '0' || *next > '9')
+        {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        while (next != end && *next >= '0' && *next <= '9')
+        {
+            value = value * 10 + (*next++ - '0');
+        }
+        return value;
+    }
+
+    // skips one value of any type, including floats, literals and nesting
+    void skip_value()
+    {
+        skip_space();
+        if (next == end)
+        {
+            ok = false;
+            return;
+        }
+        if (*next == '"')
+        {
+            std::string ignored;
+            string(ignored);
+        }
+        else if (*next == '{' || *next == '[')
+        {
+            char close = *next++ == '{' ? '}' : ']';
+            if (accept(close))
+            {
+                return;
+            }
+            do
+            {
+                if (close == '}')
+                {
+                    view();
+                    expect(':');
+                }
+                skip_value();
+            } while (ok && accept(','));
+            expect(close);
+        }
+        else
+        {
+            while (next != end && *next != ',' && *next != '}' && *next != ']' && !is_space(*next))
+            {
+                next++;
+            }
+        }
+    }
+
+    // calls `fn()` for every element of an array
+    template <typename Fn>
+    void array(Fn &&fn)
+    {
+        expect('[');
+        if (!ok || accept(']'))
+        {
+            return;
+        }
+        do
+        {
+            fn();
+        } while (ok && accept(','));
+        expect(']');
+    }
+
+    // calls `fn(key)` for every member of an object, positioned on its value
+    template <typename Fn>
+    void object(Fn &&fn)
+    {
+        expect('{');
+        if (!ok || accept('}'))
+        {
+            return;
+        }
+        do
+        {
+            std::string_view name = view();
+            expect(':');
+            if (ok)
+            {
+                fn(name);
+            }
+        } while (ok && accept(','));
+        expect('}');
+    }
+
+private:
+    const Byte *next;
+    const Byte *end;
+
+    static bool is_space(Byte c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    void skip_space()
+    {
+        while (next != end && is_space(*next))
+        {
+            next++;
+        }
+    }
+
+    void expect_raw(char c)
+    {
+        if (next == end || *next != c)
+        {
+            ok = false;
+            return;
+        }
+        next++;
+    }
+};
+
+inline void parse_single_step_state(JsonCursor &json, SingleStepState &state)
+{
+    state.ram.clear();
+    json.object([&](std::string_view key) {
+        if (key == "ram")
+        {
+            json.array([&] {
+                json.expect('[');
+                Word address = json.number();
+                json.expect(',');
+                Byte value = json.number();
+                json.expect(']');
+                state.ram.push_back({address, value});
+            });
+        }
+        else if (key == "pc")
+        {
+            state.registers.PC = json.number();
+        }
+        else if (key == "s" || key == "a" || key == "x" || key == "y" || key == "p")
+        {
+            Byte value = json.number();
+            Byte &r = key == "s" ? state.registers.SP : key == "a" ? state.registers.A : key == "x" ? state.registers.X
+                                                    : key == "y" ? state.registers.Y : state.registers.P;
+            r = value;
+        }
+        else
+        {
+            json.skip_value();
+        }
+    });
+}
+
+// Calls `fn(test)` for every case of a suite file, reusing one SingleStepCase.
+// Returns false if the text is not a well formed suite.
+template <typename Fn>
+bool for_each_single_step_case(const Byte *text, size_t size, Fn &&fn)
+{
+    JsonCursor json(text, size);
+    SingleStepCase test;
+    json.array([&] {
+        test.name.clear();
+        test.cycles.clear();
+        json.object([&](std::string_view key) {
+            if (key == "name")
+            {
+                json.string(test.name);
+            }
+            else if (key == "initial")
+            {
+                parse_single_step_state(json, test.initial);
+            }
+            else if (key == "final")
+            {
+                parse_single_step_state(json, test.final);
+            }
+            else if (key == "cycles")
+            {
+                json.array([&] {
+                    json.expect('[');
+                    Word address = json.number();
+                    json.expect(',');
+                    Byte value = json.number();
+                    json.expect(',');
+                    bool write = json.view() == "write";
+                    json.expect(']');
+                    test.cycles.push_back({address, value, write});
+                });
+            }
+            else
+            {
+                json.skip_value();
+            }
+        });
+        if (json.ok)
+        {
+            fn(static_cast<const SingleStepCase &>(test));
+        }
+    });
+    return json.ok && json.at_end();
+}
+
+// Results for one opcode, whichever files its cases came from
+struct OpcodeReport
+{
+    uint64_t cases = 0;
+    uint64_t passed = 0;
+    uint64_t skipped = 0; // unofficial opcodes, which the CPU does not implement
+    uint64_t register_failures = 0;
+    uint64_t memory_failures = 0;
+    uint64_t cycle_failures = 0;
+    uint64_t bus_failures = 0;
+    std::string first_failure; // case name and what differed
+
+    uint64_t failed() const
+    {
+        return cases - passed - skipped;
+    }
+
+    void merge(const OpcodeReport &other)
+    {
+        cases += other.cases;
+        passed += other.passed;
+        skipped += other.skipped;
+        register_failures += other.register_failures;
+        memory_failures += other.memory_failures;
+        cycle_failures += other.cycle_failures;
+        bus_failures += other.bus_failures;
+        if (first_failure.empty())
+        {
+            first_failure = other.first_failure;
+        }
+    }
+};
+
+struct ConformanceReport
+{
+    OpcodeReport opcodes[256];
+    std::vector<std::string> errors; // files that could not be read or parsed
+
+    uint64_t cases() const
+    {
+        uint64_t total = 0;
+        for (const OpcodeReport &report : opcodes)
+        {
+            total += report.cases;
+        }
+        return total;
+    }
+
+    uint64_t failed() const
+    {
+        uint64_t total = 0;
+        for (const OpcodeReport &report : opcodes)
+        {
+            total += report.failed();
+        }
+        return total;
+    }
+};
+
+// Runs one case on a CPU + Memory pair that may hold state from earlier
+// cases: only the listed bytes are set, and the suite lists every byte an
+// instruction touches. `trace` is only used when `check_bus` is set.
+inline void run_single_step_case(const SingleStepCase &test, CPU &cpu, Memory &memory, TraceBuffer &trace,
+                                 bool check_bus, OpcodeReport (&reports)[256])
+{
+    Byte opcode = 0;
+    for (const auto &byte : test.initial.ram)
+    {
+        memory.load(byte.first, &byte.second, 1);
+        if (byte.first == test.initial.registers.PC)
+        {
+            opcode = byte.second;
+        }
+    }
+    OpcodeReport &report = reports[opcode];
+    report.cases++;
+    if (CPU::decode(opcode).operation == Operation::ILL)
+    {
+        report.skipped++;
+        return;
+    }
+
+    cpu.set_registers(test.initial.registers);
+    cpu.nmi_pending = false;
+    cpu.irq_lines = 0;
+    uint64_t used;
+    if (check_bus)
+    {
+        trace.clear();
+        cpu.trace = &trace;
+        used = cpu.execute<TraceLevel::bus>(1, memory);
+    }
+    else
+    {
+        used = cpu.execute(1, memory);
+    }
+
+    std::string failure;
+    Registers expected = test.final.registers, actual = cpu.registers();
+    // the CPU keeps neither B nor bit 5 of P (see CPU::set_flags)
+    expected.P &= ~(CPU::break_flag | CPU::unused_flag);
+    if (!(actual == expected))
+    {
+        report.register_failures++;
+        failure = "PC " + to_hex(actual.PC) + " SP " + to_hex(actual.SP) + " A " + to_hex(actual.A) + " X " + to_hex(actual.X) +
+                  " Y " + to_hex(actual.Y) + " P " + to_hex(actual.P) + ", expected PC " + to_hex(expected.PC) + " SP " +
+                  to_hex(expected.SP) + " A " + to_hex(expected.A) + " X " + to_hex(expected.X) + " Y " + to_hex(expected.Y) +
+                  " P " + to_hex(expected.P);
+    }
+    for (const auto &byte : test.final.ram)
+    {
+        if (memory[byte.first] != byte.second)
+        {
+            report.memory_failures++;
+            if (failure.empty())
+            {
+                failure = "memory " + to_hex(byte.first) + " is " + to_hex(memory[byte.first]) + ", expected " + to_hex(byte.second);
+            }
+            break;
+        }
+    }
+    if (used != test.cycles.size())
+    {
+        report.cycle_failures++;
+        if (failure.empty())
+        {
+            failure = std::to_string(used) + " cycles, expected " + std::to_string(test.cycles.size());
+        }
+    }
+    if (check_bus)
+    {
+        size_t i = 0;
+        bool same = trace.dropped() == 0;
+        trace.for_each([&](const TraceRecord &r) {
+            same = same && i < test.cycles.size() && r.address == test.cycles[i].address && r.value == test.cycles[i].value &&
+                   (r.event == TraceEvent::write) == test.cycles[i].write;
+            i++;
+        });
+        if (!same || i != test.cycles.size())
+        {
+            report.bus_failures++;
+            if (failure.empty())
+            {
+                failure = "bus log differs";
+            }
+        }
+    }
+
+    if (failure.empty())
+    {
+        report.passed++;
+    }
+    else if (report.first_failure.empty())
+    {
+        report.first_failure = test.name + ": " + failure;
+    }
+}
+
+// Runs every case of every file on `threads` workers, each with its own CPU
+// and Memory, and merges their per-opcode reports.
+inline ConformanceReport run_conformance(const std::vector<std::string> &paths,
+                                         unsigned threads = std::thread::hardware_concurrency(), bool check_bus = false)
+{
+    ConformanceReport result;
+    std::mutex mutex;
+    std::atomic<size_t> next_file{0};
+
+    auto worker = [&] {
+        auto memory = std::make_unique<Memory>();
+        CPU cpu;
+        cpu.reset(*memory);
+        TraceBuffer trace(8);
+        OpcodeReport reports[256];
+        std::vector<std::string> errors;
+        for (size_t i = next_file++; i < paths.size(); i = next_file++)
+        {
+            std::shared_ptr<const MappedFile> file = MappedFile::open(paths[i]);
+            if (!file)
+            {
+                errors.push_back(paths[i] + ": cannot read");
+                continue;
+            }
+            bool ok = for_each_single_step_case(file->data(), file->size(), [&](const SingleStepCase &test) {
+                run_single_step_case(test, cpu, *memory, trace, check_bus, reports);
+            });
+            if (!ok)
+            {
+                errors.push_back(paths[i] + ": malformed test file");
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int opcode = 0; opcode < 256; opcode++)
+        {
+            result.opcodes[opcode].merge(reports[opcode]);
+        }
+        result.errors.insert(result.errors.end(), errors.begin(), errors.end());
+    };
+
+    threads = std::max(1u, std::min<unsigned>(threads, paths.size()));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool)
+    {
+        thread.join();
+    }
+    std::sort(result.errors.begin(), result.errors.end());
+    return result;
+}
@@ -0,0 +1,1563 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "breakpoints.h"
+#include "common.h"
+#include "decimal.h"
+#include "memory.h"
+#include "profiler.h"
+#include "trace.h"
+
+enum class AddressingMode : uint8_t
+{
+    implied,
+    accumulator,
+    immediate,
+    zero_page,
+    zero_page_x,
+    zero_page_y,
+    absolute,
+    absolute_x,
+    absolute_y,
+    indirect,
+    indexed_indirect, // (zp,X)
+    indirect_indexed, // (zp),Y
+    relative
+};
+
+enum class Operation : uint8_t
+{
+    ILL, // not an official opcode, stops execution
+    ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC,
+    CLD, CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP,
+    JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI,
+    RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA
+};
+
+inline const char *operation_name(Operation op)
+{
+    static const char *const names[] = {
+        "ILL",
+        "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRK", "BVC", "BVS", "CLC",
+        "CLD", "CLI", "CLV", "CMP", "CPX", "CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP",
+        "JSR", "LDA", "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL", "ROR", "RTI",
+        "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA"};
+    return names[static_cast<int>(op)];
+}
+
+inline const char *addressing_mode_name(AddressingMode mode)
+{
+    static const char *const names[] = {
+        "implied", "accumulator", "immediate", "zero_page", "zero_page_x", "zero_page_y", "absolute",
+        "absolute_x", "absolute_y", "indirect", "indexed_indirect", "indirect_indexed", "relative"};
+    return names[static_cast<int>(mode)];
+}
+
+struct OpcodeInfo
+{
+    Operation operation;
+    AddressingMode mode;
+};
+
+// operations that only consume an operand byte
+constexpr bool is_read_operation(Operation op)
+{
+    switch (op)
+    {
+    case Operation::ADC: case Operation::AND: case Operation::BIT: case Operation::CMP:
+    case Operation::CPX: case Operation::CPY: case Operation::EOR: case Operation::LDA:
+    case Operation::LDX: case Operation::LDY: case Operation::ORA: case Operation::SBC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+constexpr bool is_store_operation(Operation op)
+{
+    return op == Operation::STA || op == Operation::STX || op == Operation::STY;
+}
+
+// operations that read, modify and write back their operand
+constexpr bool is_rmw_operation(Operation op)
+{
+    switch (op)
+    {
+    case Operation::ASL: case Operation::LSR: case Operation::ROL:
+    case Operation::ROR: case Operation::INC: case Operation::DEC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Operations an idle loop may consist of: they read registers or memory and
+// write only registers and flags, so a round that brings the registers back to
+// where they were leaves the whole machine as it was. CLI is left out since it
+// may unmask an IRQ.
+constexpr bool is_idle_operation(OpcodeInfo info)
+{
+    switch (info.mode)
+    {
+    case AddressingMode::implied: case AddressingMode::immediate: case AddressingMode::zero_page:
+    case AddressingMode::zero_page_x: case AddressingMode::zero_page_y: case AddressingMode::absolute:
+    case AddressingMode::absolute_x: case AddressingMode::absolute_y:
+        break;
+    default:
+        return false;
+    }
+    switch (info.operation)
+    {
+    case Operation::AND: case Operation::BIT: case Operation::CMP: case Operation::CPX:
+    case Operation::CPY: case Operation::LDA: case Operation::LDX: case Operation::LDY:
+    case Operation::ORA: case Operation::TAX: case Operation::TAY: case Operation::TXA:
+    case Operation::TYA: case Operation::TSX: case Operation::TXS: case Operation::CLC:
+    case Operation::SEC: case Operation::CLV: case Operation::CLD: case Operation::SED:
+    case Operation::SEI: case Operation::NOP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// X-macro over every opcode value, used to generate the dispatch labels/cases
+#define FOR_EACH_OPCODE(X) \
+    X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+    X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+    X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+    X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+    X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+    X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+    X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+    X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+    X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+    X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+    X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+    X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+    X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) X(CB) X(CC) X(CD) X(CE) X(CF) \
+    X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+    X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+    X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+// GCC and Clang support labels as values, which lets every handler jump straight
+// to the next one (threaded dispatch). Other compilers use a plain switch.
+#if defined(__GNUC__) && !defined(CPU_NO_THREADED_DISPATCH)
+#define CPU_THREADED_DISPATCH 1
+#else
+#define CPU_THREADED_DISPATCH 0
+#endif
+
+// Architectural register state, the part of a CPU that jobs and tests set up and compare.
+struct Registers
+{
+    Word PC;
+    Byte SP, A, X, Y;
+    Byte P; // status flags packed as pushed by PHP, bit 0 = carry ... bit 7 = negative
+
+    bool operator==(const Registers &other) const
+    {
+        return PC == other.PC && SP == other.SP && A == other.A && X == other.X && Y == other.Y && P == other.P;
+    }
+};
+
+struct CPU
+{
+    Word PC;
+    Byte SP;
+
+    Byte A, X, Y;
+
+    // bits of the status register
+    enum Flag : Byte
+    {
+        carry_flag = 0x01,
+        zero_flag = 0x02,
+        interrupt_disable_flag = 0x04,
+        decimal_flag = 0x08,
+        break_flag = 0x10,
+        unused_flag = 0x20,
+        overflow_flag = 0x40,
+        negative_flag = 0x80
+    };
+
+    // Status register. `status` holds every flag but N and Z, which are only
+    // materialized when read: Z is set when zero_result is 0, N is bit 7 of
+    // negative_result. Most instructions just store their result in both.
+    Byte status;
+    Byte zero_result;
+    Byte negative_result;
+
+    // destination for execute<TraceLevel::opcode/bus>, unused when tracing is off
+    TraceBuffer *trace = nullptr;
+
+    // destination for execute<TraceLevel::profile>
+    Profiler *profiler = nullptr;
+
+    // checked by execute<TraceLevel::debug>
+    Breakpoints *breakpoints = nullptr;
+
+    // Interrupt inputs, sampled between instructions by poll_interrupts(). NMI
+    // is edge triggered and stays pending until taken; IRQ is level triggered,
+    // with one bit per source so devices can assert and release it independently.
+    bool nmi_pending = false;
+    Byte irq_lines = 0;
+
+    // operand bytes of the current instruction, consumed low byte first by
+    // fetch_byte when tracing is off
+    Word predecoded_operand = 0;
+
+    // Untraced execution fast-forwards idle loops (see skip_idle_loop) unless
+    // this is cleared; idle_cycles_skipped counts the cycles it jumped over.
+    bool skip_idle_loops = true;
+    uint64_t idle_cycles_skipped = 0;
+
+    // set by predecode above the offset byte of a backward branch that closes
+    // a short loop of idle operations, left in predecoded_operand by fetch_byte
+    static constexpr Word idle_loop_mark = 0x100;
+
+    // longest loop body, in instructions, that is checked for being idle
+    static constexpr uint32_t max_idle_loop_length = 16;
+
+    static constexpr Byte INS_LDA_IM = 0xA9;
+    static constexpr Byte INS_LDA_ZP = 0xA5;
+    static constexpr Byte INS_LDA_ZPX = 0xB5;
+    static constexpr Byte INS_JSR = 0x20;
+    static constexpr Byte INS_RTS = 0x60;
+    static constexpr Byte INS_LDA_ABS = 0xAD;
+    static constexpr Byte INS_STA_ZERO_PAGE = 0x85;
+    static constexpr Byte INS_STA_ABS = 0x8D;
+    static constexpr Byte INS_JMP_ABS = 0x4C;
+    static constexpr Byte INS_JMP_INDIRECT = 0x6C;
+    static constexpr Byte INS_STACK_TSX = 0xBA;
+    static constexpr Byte INS_STACK_TXS = 0x9A;
+    static constexpr Byte INS_STACK_PHA = 0x48;
+    static constexpr Byte INS_STACK_PHP = 0x08;
+    static constexpr Byte INS_STACK_PLA = 0x68;
+    static constexpr Byte INS_STACK_PLP = 0x28;
+    static constexpr Byte INS_AND_IM = 0x29;
+    static constexpr Byte INS_BIT_ZP = 0x24;
+    static constexpr Byte INS_TXA = 0x8A;
+    static constexpr Byte INS_INC_ZP_X = 0xF6;
+    static constexpr Byte INS_INC_ABS_X = 0xFE;
+    static constexpr Byte INS_NOP = 0xEA;
+    static constexpr Byte INS_RTI = 0x40;
+    static constexpr Byte INS_BRK = 0x00;
+    static constexpr Byte INS_BEQ = 0xF0;
+
+    static constexpr Byte INS_LDA_ABSX = 0xBD;
+    static constexpr Byte INS_LDA_ABSY = 0xB9;
+    static constexpr Byte INS_LDA_INDX = 0xA1;
+    static constexpr Byte INS_LDA_INDY = 0xB1;
+    static constexpr Byte INS_LDX_IM = 0xA2;
+    static constexpr Byte INS_LDX_ZP = 0xA6;
+    static constexpr Byte INS_LDX_ZPY = 0xB6;
+    static constexpr Byte INS_LDX_ABS = 0xAE;
+    static constexpr Byte INS_LDX_ABSY = 0xBE;
+    static constexpr Byte INS_LDY_IM = 0xA0;
+    static constexpr Byte INS_LDY_ZP = 0xA4;
+    static constexpr Byte INS_LDY_ZPX = 0xB4;
+    static constexpr Byte INS_LDY_ABS = 0xAC;
+    static constexpr Byte INS_LDY_ABSX = 0xBC;
+    static constexpr Byte INS_STA_ZPX = 0x95;
+    static constexpr Byte INS_STA_ABSX = 0x9D;
+    static constexpr Byte INS_STA_ABSY = 0x99;
+    static constexpr Byte INS_STA_INDX = 0x81;
+    static constexpr Byte INS_STA_INDY = 0x91;
+    static constexpr Byte INS_STX_ZP = 0x86;
+    static constexpr Byte INS_STX_ZPY = 0x96;
+    static constexpr Byte INS_STX_ABS = 0x8E;
+    static constexpr Byte INS_STY_ZP = 0x84;
+    static constexpr Byte INS_STY_ZPX = 0x94;
+    static constexpr Byte INS_STY_ABS = 0x8C;
+    static constexpr Byte INS_TAX = 0xAA;
+    static constexpr Byte INS_TAY = 0xA8;
+    static constexpr Byte INS_TYA = 0x98;
+    static constexpr Byte INS_AND_ZP = 0x25;
+    static constexpr Byte INS_AND_ZPX = 0x35;
+    static constexpr Byte INS_AND_ABS = 0x2D;
+    static constexpr Byte INS_AND_ABSX = 0x3D;
+    static constexpr Byte INS_AND_ABSY = 0x39;
+    static constexpr Byte INS_AND_INDX = 0x21;
+    static constexpr Byte INS_AND_INDY = 0x31;
+    static constexpr Byte INS_EOR_IM = 0x49;
+    static constexpr Byte INS_EOR_ZP = 0x45;
+    static constexpr Byte INS_EOR_ZPX = 0x55;
+    static constexpr Byte INS_EOR_ABS = 0x4D;
+    static constexpr Byte INS_EOR_ABSX = 0x5D;
+    static constexpr Byte INS_EOR_ABSY = 0x59;
+    static constexpr Byte INS_EOR_INDX = 0x41;
+    static constexpr Byte INS_EOR_INDY = 0x51;
+    static constexpr Byte INS_ORA_IM = 0x09;
+    static constexpr Byte INS_ORA_ZP = 0x05;
+    static constexpr Byte INS_ORA_ZPX = 0x15;
+    static constexpr Byte INS_ORA_ABS = 0x0D;
+    static constexpr Byte INS_ORA_ABSX = 0x1D;
+    static constexpr Byte INS_ORA_ABSY = 0x19;
+    static constexpr Byte INS_ORA_INDX = 0x01;
+    static constexpr Byte INS_ORA_INDY = 0x11;
+    static constexpr Byte INS_BIT_ABS = 0x2C;
+    static constexpr Byte INS_ADC_IM = 0x69;
+    static constexpr Byte INS_ADC_ZP = 0x65;
+    static constexpr Byte INS_ADC_ZPX = 0x75;
+    static constexpr Byte INS_ADC_ABS = 0x6D;
+    static constexpr Byte INS_ADC_ABSX = 0x7D;
+    static constexpr Byte INS_ADC_ABSY = 0x79;
+    static constexpr Byte INS_ADC_INDX = 0x61;
+    static constexpr Byte INS_ADC_INDY = 0x71;
+    static constexpr Byte INS_SBC_IM = 0xE9;
+    static constexpr Byte INS_SBC_ZP = 0xE5;
+    static constexpr Byte INS_SBC_ZPX = 0xF5;
+    static constexpr Byte INS_SBC_ABS = 0xED;
+    static constexpr Byte INS_SBC_ABSX = 0xFD;
+    static constexpr Byte INS_SBC_ABSY = 0xF9;
+    static constexpr Byte INS_SBC_INDX = 0xE1;
+    static constexpr Byte INS_SBC_INDY = 0xF1;
+    static constexpr Byte INS_CMP_IM = 0xC9;
+    static constexpr Byte INS_CMP_ZP = 0xC5;
+    static constexpr Byte INS_CMP_ZPX = 0xD5;
+    static constexpr Byte INS_CMP_ABS = 0xCD;
+    static constexpr Byte INS_CMP_ABSX = 0xDD;
+    static constexpr Byte INS_CMP_ABSY = 0xD9;
+    static constexpr Byte INS_CMP_INDX = 0xC1;
+    static constexpr Byte INS_CMP_INDY = 0xD1;
+    static constexpr Byte INS_CPX_IM = 0xE0;
+    static constexpr Byte INS_CPX_ZP = 0xE4;
+    static constexpr Byte INS_CPX_ABS = 0xEC;
+    static constexpr Byte INS_CPY_IM = 0xC0;
+    static constexpr Byte INS_CPY_ZP = 0xC4;
+    static constexpr Byte INS_CPY_ABS = 0xCC;
+    static constexpr Byte INS_INC_ZP = 0xE6;
+    static constexpr Byte INS_INC_ABS = 0xEE;
+    static constexpr Byte INS_INX = 0xE8;
+    static constexpr Byte INS_INY = 0xC8;
+    static constexpr Byte INS_DEC_ZP = 0xC6;
+    static constexpr Byte INS_DEC_ZPX = 0xD6;
+    static constexpr Byte INS_DEC_ABS = 0xCE;
+    static constexpr Byte INS_DEC_ABSX = 0xDE;
+    static constexpr Byte INS_DEX = 0xCA;
+    static constexpr Byte INS_DEY = 0x88;
+    static constexpr Byte INS_ASL_ACC = 0x0A;
+    static constexpr Byte INS_ASL_ZP = 0x06;
+    static constexpr Byte INS_ASL_ZPX = 0x16;
+    static constexpr Byte INS_ASL_ABS = 0x0E;
+    static constexpr Byte INS_ASL_ABSX = 0x1E;
+    static constexpr Byte INS_LSR_ACC = 0x4A;
+    static constexpr Byte INS_LSR_ZP = 0x46;
+    static constexpr Byte INS_LSR_ZPX = 0x56;
+    static constexpr Byte INS_LSR_ABS = 0x4E;
+    static constexpr Byte INS_LSR_ABSX = 0x5E;
+    static constexpr Byte INS_ROL_ACC = 0x2A;
+    static constexpr Byte INS_ROL_ZP = 0x26;
+    static constexpr Byte INS_ROL_ZPX = 0x36;
+    static constexpr Byte INS_ROL_ABS = 0x2E;
+    static constexpr Byte INS_ROL_ABSX = 0x3E;
+    static constexpr Byte INS_ROR_ACC = 0x6A;
+    static constexpr Byte INS_ROR_ZP = 0x66;
+    static constexpr Byte INS_ROR_ZPX = 0x76;
+    static constexpr Byte INS_ROR_ABS = 0x6E;
+    static constexpr Byte INS_ROR_ABSX = 0x7E;
+    static constexpr Byte INS_BCC = 0x90;
+    static constexpr Byte INS_BCS = 0xB0;
+    static constexpr Byte INS_BMI = 0x30;
+    static constexpr Byte INS_BNE = 0xD0;
+    static constexpr Byte INS_BPL = 0x10;
+    static constexpr Byte INS_BVC = 0x50;
+    static constexpr Byte INS_BVS = 0x70;
+    static constexpr Byte INS_CLC = 0x18;
+    static constexpr Byte INS_CLD = 0xD8;
+    static constexpr Byte INS_CLI = 0x58;
+    static constexpr Byte INS_CLV = 0xB8;
+    static constexpr Byte INS_SEC = 0x38;
+    static constexpr Byte INS_SED = 0xF8;
+    static constexpr Byte INS_SEI = 0x78;
+
+    // Opcode -> (operation, addressing mode). Every opcode not listed here is
+    // one of the 105 unofficial ones and decodes to Operation::ILL.
+    static constexpr OpcodeInfo decode(Byte opcode)
+    {
+        using Op = Operation;
+        using Mode = AddressingMode;
+        switch (opcode)
+        {
+        case INS_ADC_IM: return {Op::ADC, Mode::immediate};
+        case INS_ADC_ZP: return {Op::ADC, Mode::zero_page};
+        case INS_ADC_ZPX: return {Op::ADC, Mode::zero_page_x};
+        case INS_ADC_ABS: return {Op::ADC, Mode::absolute};
+        case INS_ADC_ABSX: return {Op::ADC, Mode::absolute_x};
+        case INS_ADC_ABSY: return {Op::ADC, Mode::absolute_y};
+        case INS_ADC_INDX: return {Op::ADC, Mode::indexed_indirect};
+        case INS_ADC_INDY: return {Op::ADC, Mode::indirect_indexed};
+        case INS_AND_IM: return {Op::AND, Mode::immediate};
+        case INS_AND_ZP: return {Op::AND, Mode::zero_page};
+        case INS_AND_ZPX: return {Op::AND, Mode::zero_page_x};
+        case INS_AND_ABS: return {Op::AND, Mode::absolute};
+        case INS_AND_ABSX: return {Op::AND, Mode::absolute_x};
+        case INS_AND_ABSY: return {Op::AND, Mode::absolute_y};
+        case INS_AND_INDX: return {Op::AND, Mode::indexed_indirect};
+        case INS_AND_INDY: return {Op::AND, Mode::indirect_indexed};
+        case INS_ASL_ACC: return {Op::ASL, Mode::accumulator};
+        case INS_ASL_ZP: return {Op::ASL, Mode::zero_page};
+        case INS_ASL_ZPX: return {Op::ASL, Mode::zero_page_x};
+        case INS_ASL_ABS: return {Op::ASL, Mode::absolute};
+        case INS_ASL_ABSX: return {Op::ASL, Mode::absolute_x};
+        case INS_BCC: return {Op::BCC, Mode::relative};
+        case INS_BCS: return {Op::BCS, Mode::relative};
+        case INS_BEQ: return {Op::BEQ, Mode::relative};
+        case INS_BIT_ZP: return {Op::BIT, Mode::zero_page};
+        case INS_BIT_ABS: return {Op::BIT, Mode::absolute};
+        case INS_BMI: return {Op::BMI, Mode::relative};
+        case INS_BNE: return {Op::BNE, Mode::relative};
+        case INS_BPL: return {Op::BPL, Mode::relative};
+        case INS_BRK: return {Op::BRK, Mode::implied};
+        case INS_BVC: return {Op::BVC, Mode::relative};
+        case INS_BVS: return {Op::BVS, Mode::relative};
+        case INS_CLC: return {Op::CLC, Mode::implied};
+        case INS_CLD: return {Op::CLD, Mode::implied};
+        case INS_CLI: return {Op::CLI, Mode::implied};
+        case INS_CLV: return {Op::CLV, Mode::implied};
+        case INS_CMP_IM: return {Op::CMP, Mode::immediate};
+        case INS_CMP_ZP: return {Op::CMP, Mode::zero_page};
+        case INS_CMP_ZPX: return {Op::CMP, Mode::zero_page_x};
+        case INS_CMP_ABS: return {Op::CMP, Mode::absolute};
+        case INS_CMP_ABSX: return {Op::CMP, Mode::absolute_x};
+        case INS_CMP_ABSY: return {Op::CMP, Mode::absolute_y};
+        case INS_CMP_INDX: return {Op::CMP, Mode::indexed_indirect};
+        case INS_CMP_INDY: return {Op::CMP, Mode::indirect_indexed};
+        case INS_CPX_IM: return {Op::CPX, Mode::immediate};
+        case INS_CPX_ZP: return {Op::CPX, Mode::zero_page};
+        case INS_CPX_ABS: return {Op::CPX, Mode::absolute};
+        case INS_CPY_IM: return {Op::CPY, Mode::immediate};
+        case INS_CPY_ZP: return {Op::CPY, Mode::zero_page};
+        case INS_CPY_ABS: return {Op::CPY, Mode::absolute};
+        case INS_DEC_ZP: return {Op::DEC, Mode::zero_page};
+        case INS_DEC_ZPX: return {Op::DEC, Mode::zero_page_x};
+        case INS_DEC_ABS: return {Op::DEC, Mode::absolute};
+        case INS_DEC_ABSX: return {Op::DEC, Mode::absolute_x};
+        case INS_DEX: return {Op::DEX, Mode::implied};
+        case INS_DEY: return {Op::DEY, Mode::implied};
+        case INS_EOR_IM: return {Op::EOR, Mode::immediate};
+        case INS_EOR_ZP: return {Op::EOR, Mode::zero_page};
+        case INS_EOR_ZPX: return {Op::EOR, Mode::zero_page_x};
+        case INS_EOR_ABS: return {Op::EOR, Mode::absolute};
+        case INS_EOR_ABSX: return {Op::EOR, Mode::absolute_x};
+        case INS_EOR_ABSY: return {Op::EOR, Mode::absolute_y};
+        case INS_EOR_INDX: return {Op::EOR, Mode::indexed_indirect};
+        case INS_EOR_INDY: return {Op::EOR, Mode::indirect_indexed};
+        case INS_INC_ZP: return {Op::INC, Mode::zero_page};
+        case INS_INC_ZP_X: return {Op::INC, Mode::zero_page_x};
+        case INS_INC_ABS: return {Op::INC, Mode::absolute};
+        case INS_INC_ABS_X: return {Op::INC, Mode::absolute_x};
+        case INS_INX: return {Op::INX, Mode::implied};
+        case INS_INY: return {Op::INY, Mode::implied};
+        case INS_JMP_ABS: return {Op::JMP, Mode::absolute};
+        case INS_JMP_INDIRECT: return {Op::JMP, Mode::indirect};
+        case INS_JSR: return {Op::JSR, Mode::absolute};
+        case INS_LDA_IM: return {Op::LDA, Mode::immediate};
+        case INS_LDA_ZP: return {Op::LDA, Mode::zero_page};
+        case INS_LDA_ZPX: return {Op::LDA, Mode::zero_page_x};
+        case INS_LDA_ABS: return {Op::LDA, Mode::absolute};
+        case INS_LDA_ABSX: return {Op::LDA, Mode::absolute_x};
+        case INS_LDA_ABSY: return {Op::LDA, Mode::absolute_y};
+        case INS_LDA_INDX: return {Op::LDA, Mode::indexed_indirect};
+        case INS_LDA_INDY: return {Op::LDA, Mode::indirect_indexed};
+        case INS_LDX_IM: return {Op::LDX, Mode::immediate};
+        case INS_LDX_ZP: return {Op::LDX, Mode::zero_page};
+        case INS_LDX_ZPY: return {Op::LDX, Mode::zero_page_y};
+        case INS_LDX_ABS: return {Op::LDX, Mode::absolute};
+        case INS_LDX_ABSY: return {Op::LDX, Mode::absolute_y};
+        case INS_LDY_IM: return {Op::LDY, Mode::immediate};
+        case INS_LDY_ZP: return {Op::LDY, Mode::zero_page};
+        case INS_LDY_ZPX: return {Op::LDY, Mode::zero_page_x};
+        case INS_LDY_ABS: return {Op::LDY, Mode::absolute};
+        case INS_LDY_ABSX: return {Op::LDY, Mode::absolute_x};
+        case INS_LSR_ACC: return {Op::LSR, Mode::accumulator};
+        case INS_LSR_ZP: return {Op::LSR, Mode::zero_page};
+        case INS_LSR_ZPX: return {Op::LSR, Mode::zero_page_x};
+        case INS_LSR_ABS: return {Op::LSR, Mode::absolute};
+        case INS_LSR_ABSX: return {Op::LSR, Mode::absolute_x};
+        case INS_NOP: return {Op::NOP, Mode::implied};
+        case INS_ORA_IM: return {Op::ORA, Mode::immediate};
+        case INS_ORA_ZP: return {Op::ORA, Mode::zero_page};
+        case INS_ORA_ZPX: return {Op::ORA, Mode::zero_page_x};
+        case INS_ORA_ABS: return {Op::ORA, Mode::absolute};
+        case INS_ORA_ABSX: return {Op::ORA, Mode::absolute_x};
+        case INS_ORA_ABSY: return {Op::ORA, Mode::absolute_y};
+        case INS_ORA_INDX: return {Op::ORA, Mode::indexed_indirect};
+        case INS_ORA_INDY: return {Op::ORA, Mode::indirect_indexed};
+        case INS_STACK_PHA: return {Op::PHA, Mode::implied};
+        case INS_STACK_PHP: return {Op::PHP, Mode::implied};
+        case INS_STACK_PLA: return {Op::PLA, Mode::implied};
+        case INS_STACK_PLP: return {Op::PLP, Mode::implied};
+        case INS_ROL_ACC: return {Op::ROL, Mode::accumulator};
+        case INS_ROL_ZP: return {Op::ROL, Mode::zero_page};
+        case INS_ROL_ZPX: return {Op::ROL, Mode::zero_page_x};
+        case INS_ROL_ABS: return {Op::ROL, Mode::absolute};
+        case INS_ROL_ABSX: return {Op::ROL, Mode::absolute_x};
+        case INS_ROR_ACC: return {Op::ROR, Mode::accumulator};
+        case INS_ROR_ZP: return {Op::ROR, Mode::zero_page};
+        case INS_ROR_ZPX: return {Op::ROR, Mode::zero_page_x};
+        case INS_ROR_ABS: return {Op::ROR, Mode::absolute};
+        case INS_ROR_ABSX: return {Op::ROR, Mode::absolute_x};
+        case INS_RTI: return {Op::RTI, Mode::implied};
+        case INS_RTS: return {Op::RTS, Mode::implied};
+        case INS_SBC_IM: return {Op::SBC, Mode::immediate};
+        case INS_SBC_ZP: return {Op::SBC, Mode::zero_page};
+        case INS_SBC_ZPX: return {Op::SBC, Mode::zero_page_x};
+        case INS_SBC_ABS: return {Op::SBC, Mode::absolute};
+        case INS_SBC_ABSX: return {Op::SBC, Mode::absolute_x};
+        case INS_SBC_ABSY: return {Op::SBC, Mode::absolute_y};
+        case INS_SBC_INDX: return {Op::SBC, Mode::indexed_indirect};
+        case INS_SBC_INDY: return {Op::SBC, Mode::indirect_indexed};
+        case INS_SEC: return {Op::SEC, Mode::implied};
+        case INS_SED: return {Op::SED, Mode::implied};
+        case INS_SEI: return {Op::SEI, Mode::implied};
+        case INS_STA_ZERO_PAGE: return {Op::STA, Mode::zero_page};
+        case INS_STA_ZPX: return {Op::STA, Mode::zero_page_x};
+        case INS_STA_ABS: return {Op::STA, Mode::absolute};
+        case INS_STA_ABSX: return {Op::STA, Mode::absolute_x};
+        case INS_STA_ABSY: return {Op::STA, Mode::absolute_y};
+        case INS_STA_INDX: return {Op::STA, Mode::indexed_indirect};
+        case INS_STA_INDY: return {Op::STA, Mode::indirect_indexed};
+        case INS_STX_ZP: return {Op::STX, Mode::zero_page};
+        case INS_STX_ZPY: return {Op::STX, Mode::zero_page_y};
+        case INS_STX_ABS: return {Op::STX, Mode::absolute};
+        case INS_STY_ZP: return {Op::STY, Mode::zero_page};
+        case INS_STY_ZPX: return {Op::STY, Mode::zero_page_x};
+        case INS_STY_ABS: return {Op::STY, Mode::absolute};
+        case INS_TAX: return {Op::TAX, Mode::implied};
+        case INS_TAY: return {Op::TAY, Mode::implied};
+        case INS_STACK_TSX: return {Op::TSX, Mode::implied};
+        case INS_TXA: return {Op::TXA, Mode::implied};
+        case INS_STACK_TXS: return {Op::TXS, Mode::implied};
+        case INS_TYA: return {Op::TYA, Mode::implied};
+        default: return {Op::ILL, Mode::implied};
+        }
+    }
+
+    // operand bytes read together with the opcode when the instruction is
+    // predecoded. BRK counts its padding byte; JSR only its low byte, since the
+    // high byte is fetched after the return address is pushed and may be overwritten.
+    static constexpr uint32_t predecoded_bytes(Byte opcode)
+    {
+        OpcodeInfo info = decode(opcode);
+        if (info.operation == Operation::BRK || info.operation == Operation::JSR)
+        {
+            return 1;
+        }
+        switch (info.mode)
+        {
+        case AddressingMode::implied:
+        case AddressingMode::accumulator:
+            return 0;
+        case AddressingMode::absolute:
+        case AddressingMode::absolute_x:
+        case AddressingMode::absolute_y:
+        case AddressingMode::indirect:
+            return 2;
+        default:
+            return 1;
+        }
+    }
+
+    // Cycles of every official opcode (NMOS datasheet), 0 for unofficial ones,
+    // charged once when the instruction starts. On top come the penalties:
+    // +1 for a read whose indexed address crosses a page, +1 for a taken
+    // branch and +1 more when it lands in another page.
+    static constexpr Byte cycle_table[256] = {
+        // 0 1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+        7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0, // 0x
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 1x
+        6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0, // 2x
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 3x
+        6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0, // 4x
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 5x
+        6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0, // 6x
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 7x
+        0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0, // 8x
+        2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0, // 9x
+        2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0, // Ax
+        2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0, // Bx
+        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0, // Cx
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // Dx
+        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0, // Ex
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // Fx
+    };
+
+    // IRQ and NMI entry: two dummy reads, three pushes and the vector fetch
+    static constexpr uint32_t interrupt_cycles = 7;
+
+    // every official opcode has cycles, every unofficial one none
+    static constexpr bool cycle_table_matches_decode()
+    {
+        for (int opcode = 0; opcode < 256; opcode++)
+        {
+            if ((cycle_table[opcode] == 0) != (decode(opcode).operation == Operation::ILL))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    FORCE_INLINE bool flag(Flag which) const
+    {
+        if (which == zero_flag)
+        {
+            return zero_result == 0;
+        }
+        if (which == negative_flag)
+        {
+            return negative_result & 0x80;
+        }
+        return status & which;
+    }
+
+    FORCE_INLINE void set_flag(Flag which, bool value)
+    {
+        if (which == zero_flag)
+        {
+            zero_result = !value;
+        }
+        else if (which == negative_flag)
+        {
+            negative_result = value ? 0x80 : 0;
+        }
+        else
+        {
+            status = value ? status | which : status & ~which;
+        }
+    }
+
+    Byte all_flags() const
+    {
+        return status | (zero_result == 0 ? zero_flag : 0) | (negative_result & negative_flag);
+    }
+
+    // B and bit 5 only exist in pushed copies of the status: PLP and RTI drop
+    // them, so a later IRQ or NMI pushes B clear
+    void set_flags(Byte flags)
+    {
+        status = flags & ~(zero_flag | negative_flag | break_flag | unused_flag);
+        zero_result = ~flags & zero_flag;
+        negative_result = flags;
+    }
+
+    Registers registers() const
+    {
+        return {PC, SP, A, X, Y, all_flags()};
+    }
+
+    void set_registers(const Registers &registers)
+    {
+        PC = registers.PC;
+        SP = registers.SP;
+        A = registers.A;
+        X = registers.X;
+        Y = registers.Y;
+        set_flags(registers.P);
+    }
+
+    void reset(Memory &memory)
+    {
+        PC = 0xFFFC;
+        SP = 0xFF;
+        A = X = Y = 0;
+        set_flags(0);
+        memory.init();
+    }
+
+    void raise_nmi()
+    {
+        nmi_pending = true;
+    }
+
+    void set_irq_line(Byte source, bool asserted)
+    {
+        irq_lines = asserted ? irq_lines | source : irq_lines & ~source;
+    }
+
+    bool irq_unmasked() const
+    {
+        return irq_lines != 0 && !(status & interrupt_disable_flag);
+    }
+
+    // vector of the interrupt poll_interrupts() would take now: $FFFA for a
+    // pending NMI, else $FFFE for an unmasked IRQ, 0 for none
+    Word pending_interrupt() const
+    {
+        return nmi_pending ? 0xFFFA : irq_unmasked() ? 0xFFFE : 0;
+    }
+
+    // Takes the pending interrupt, if any. Returns the cycles spent, interrupt_cycles or 0.
+    template <TraceLevel Level = TraceLevel::off>
+    uint32_t poll_interrupts(Memory &memory)
+    {
+        Word vector = pending_interrupt();
+        return vector == 0 ? 0 : take_interrupt<Level>(memory, vector);
+    }
+
+    // The 7 cycle interrupt sequence through `vector`, whatever the inputs say;
+    // replay uses it to take interrupts at their recorded cycles.
+    template <TraceLevel Level = TraceLevel::off>
+    uint32_t take_interrupt(Memory &memory, Word vector)
+    {
+        if (vector == 0xFFFA)
+        {
+            nmi_pending = false;
+        }
+        // the opcode and operand fetches of the sequence are dummy reads
+        dummy_read<Level>(memory, PC);
+        dummy_read<Level>(memory, PC);
+        enter_interrupt<Level>(memory, vector, unused_flag);
+        return interrupt_cycles;
+    }
+
+    Word SP_address() const
+    {
+        return 0x0100 | SP;
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void trace_bus(TraceEvent event, Word address, Byte value)
+    {
+        if constexpr (Level == TraceLevel::bus)
+        {
+            trace->record({event, value, address, 0, 0, 0, 0});
+        }
+    }
+
+    // A cycle in which the 6502 reads a byte it throws away: the byte after an
+    // implied opcode, the stack before a pull, an address before its index
+    // carried. Only the bus trace shows them; they never reach a device.
+    template <TraceLevel Level>
+    FORCE_INLINE void dummy_read(const Memory &memory, Word address)
+    {
+        if constexpr (Level == TraceLevel::bus)
+        {
+            trace->record({TraceEvent::read, memory.peek(address), address, 0, 0, 0, 0});
+        }
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void trace_opcode(Word address, Byte opcode)
+    {
+        if constexpr (records_trace(Level))
+        {
+            trace->record({TraceEvent::opcode, opcode, address, A, X, Y, SP});
+        }
+    }
+
+    template <TraceLevel Level, StopReason Reason>
+    FORCE_INLINE void watch(Word address)
+    {
+        if constexpr (Level == TraceLevel::debug)
+        {
+            const uint64_t *map = Reason == StopReason::read_watch ? breakpoints->read : breakpoints->write;
+            if (__builtin_expect(Breakpoints::test(map, address), 0))
+            {
+                breakpoints->hit(Reason, address);
+            }
+        }
+    }
+
+    // whether execute<TraceLevel::debug> stops before the instruction at PC:
+    // a watchpoint went off in the last one or PC is on a breakpoint
+    template <TraceLevel Level>
+    FORCE_INLINE bool debug_stop()
+    {
+        if constexpr (Level == TraceLevel::debug)
+        {
+            if (breakpoints->reason == StopReason::none && Breakpoints::test(breakpoints->execute, PC))
+            {
+                breakpoints->hit(StopReason::breakpoint, PC);
+            }
+            return breakpoints->reason != StopReason::none;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void profile_call(Word target)
+    {
+        if constexpr (Level == TraceLevel::profile)
+        {
+            profiler->call(target);
+        }
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void profile_return()
+    {
+        if constexpr (Level == TraceLevel::profile)
+        {
+            profiler->return_from_call();
+        }
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void push_word_to_stack(Memory &memory, Word value)
+    {
+        push_byte_to_stack<Level>(memory, value >> 8);
+        push_byte_to_stack<Level>(memory, value & 0xFF);
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void push_byte_to_stack(Memory &memory, Byte value)
+    {
+        trace_bus<Level>(TraceEvent::write, SP_address(), value);
+        watch<Level, StopReason::write_watch>(SP_address());
+        memory.write_byte(value, SP_address());
+        SP--;
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void write_byte_to_memory(Memory &memory, Byte value, Word address)
+    {
+        assert(address < MAX_MEMORY);
+        trace_bus<Level>(TraceEvent::write, address, value);
+        watch<Level, StopReason::write_watch>(address);
+        memory.store(address, value);
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE void write_word_to_memory(Memory &memory, Word value, Word address)
+    {
+        write_byte_to_memory<Level>(memory, value & 0xFF, address);
+        write_byte_to_memory<Level>(memory, (value >> 8) & 0xFF, address + 1);
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Byte fetch_opcode(Memory &memory)
+    {
+        Byte opcode = memory.read(PC);
+        trace_opcode<Level>(PC, opcode);
+        PC++;
+        return opcode;
+    }
+
+    // The opcode and operand of the next instruction. Untraced execution takes
+    // them from the predecode cache, traced execution shows every fetch on the bus.
+    template <TraceLevel Level>
+    FORCE_INLINE Byte next_opcode(Memory &memory)
+    {
+        if constexpr (uses_predecode(Level))
+        {
+            DecodedInstruction instruction = memory.decoded[PC];
+            if (__builtin_expect(!instruction.valid, 0))
+            {
+                instruction = predecode(memory);
+            }
+            predecoded_operand = instruction.operand;
+            PC++;
+            return instruction.opcode;
+        }
+        else
+        {
+            return fetch_opcode<Level>(memory);
+        }
+    }
+
+    // reads the instruction at PC and caches it when its bytes can only change
+    // through tracked writes; code on device pages is fetched again every time
+    NO_INLINE DecodedInstruction predecode(Memory &memory)
+    {
+        DecodedInstruction instruction = {memory.read(PC), 1, 0};
+        uint32_t size = 1 + predecoded_bytes(instruction.opcode);
+        for (uint32_t i = 1; i < size; i++)
+        {
+            instruction.operand |= memory.read(PC + i) << (8 * (i - 1));
+        }
+        if (decode(instruction.opcode).mode == AddressingMode::relative && int8_t(instruction.operand) < 0 &&
+            is_idle_loop_body(memory, PC + 2 + int8_t(instruction.operand), PC))
+        {
+            instruction.operand |= idle_loop_mark;
+        }
+        if (memory.is_decodable(PC, size))
+        {
+            memory.set_decoded(PC, instruction);
+        }
+        return instruction;
+    }
+
+    // whether the bytes from `first` up to the branch at `branch` decode as a
+    // few idle operations whose memory operands are not on device pages
+    static bool is_idle_loop_body(Memory &memory, Word first, Word branch)
+    {
+        Word address = first;
+        for (uint32_t count = 0; address != branch; count++)
+        {
+            if (count == max_idle_loop_length || !memory.is_decodable(address, 1))
+            {
+                return false;
+            }
+            Byte opcode = memory.read(address);
+            uint32_t size = 1 + predecoded_bytes(opcode);
+            OpcodeInfo info = decode(opcode);
+            if (!is_idle_operation(info) || !memory.is_decodable(address, size))
+            {
+                return false;
+            }
+            if (size > 1 && info.mode != AddressingMode::immediate)
+            {
+                // indexed operands may reach into the next page
+                Word base = memory.read(address + 1) | (size == 3 ? memory.read(address + 2) << 8 : 0);
+                Word last = info.mode == AddressingMode::absolute_x || info.mode == AddressingMode::absolute_y
+                                ? base + 0xFF
+                                : base;
+                if (memory.read_pages[base >> 8] == nullptr || memory.read_pages[last >> 8] == nullptr)
+                {
+                    return false;
+                }
+            }
+            address += size;
+        }
+        return true;
+    }
+
+    // Cycles of one round of the loop PC sits at the head of, just after the
+    // branch or JMP at `branch` went back to it, or 0 when the loop is not
+    // idle. A round is run on a copy of the CPU and counts as idle when every
+    // instruction in it is an idle operation on RAM or ROM and it leaves the
+    // registers and flags exactly as they were: then every later round does
+    // the same, and only an interrupt can end the loop. Takes the CPU by value
+    // so callers keep their registers out of memory.
+    static NO_INLINE int64_t idle_loop_round(CPU probe, Memory &memory, Word branch)
+    {
+        const CPU start = probe;
+        int64_t round = 0;
+        for (uint32_t count = 0;; count++)
+        {
+            Word address = probe.PC;
+            if (count > max_idle_loop_length || !memory.is_decodable(address, 1))
+            {
+                return 0;
+            }
+            Byte opcode = memory.read(address);
+            OpcodeInfo info = decode(opcode);
+            if (!memory.is_decodable(address, 1 + predecoded_bytes(opcode)))
+            {
+                return 0;
+            }
+            bool last = address == branch;
+            if (last ? info.mode != AddressingMode::relative &&
+                           !(info.operation == Operation::JMP && info.mode == AddressingMode::absolute)
+                     : !is_idle_operation(info))
+            {
+                return 0;
+            }
+            if (!last && info.mode != AddressingMode::implied && info.mode != AddressingMode::immediate)
+            {
+                Word operand = memory.read(address + 1);
+                Byte index = info.mode == AddressingMode::zero_page_x || info.mode == AddressingMode::absolute_x
+                                 ? probe.X
+                                 : probe.Y;
+                switch (info.mode)
+                {
+                case AddressingMode::zero_page: break;
+                case AddressingMode::zero_page_x:
+                case AddressingMode::zero_page_y: operand = Byte(operand + index); break;
+                case AddressingMode::absolute: operand |= memory.read(address + 2) << 8; break;
+                default: operand = Word((operand | memory.read(address + 2) << 8) + index); break;
+                }
+                if (memory.read_pages[operand >> 8] == nullptr)
+                {
+                    return 0;
+                }
+            }
+            round += probe.execute(1, memory);
+            if (last)
+            {
+                break;
+            }
+        }
+        bool unchanged = probe.PC == start.PC && probe.SP == start.SP && probe.A == start.A && probe.X == start.X &&
+                         probe.Y == start.Y && probe.status == start.status &&
+                         probe.zero_result == start.zero_result && probe.negative_result == start.negative_result;
+        return unchanged ? round : 0;
+    }
+
+    // Called by a taken branch or JMP at `branch` that may close an idle loop.
+    // Nothing outside acts on the machine while execute runs, so once a round
+    // is known to be idle all of them are: skips every round but the one the
+    // budget runs out in, which leaves the machine where running them one by
+    // one would have, with the same cycles left. Under the Scheduler the
+    // budget ends at the next event, so this fast-forwards to it.
+    template <TraceLevel Level>
+    FORCE_INLINE void skip_idle_loop(int64_t &cycles, Memory &memory, Word branch)
+    {
+        if constexpr (Level == TraceLevel::off)
+        {
+            if (cycles > 0 && skip_idle_loops)
+            {
+                int64_t round = idle_loop_round(*this, memory, branch);
+                if (round > 0)
+                {
+                    int64_t skipped = (cycles - 1) / round * round;
+                    cycles -= skipped;
+                    idle_cycles_skipped += skipped;
+                }
+            }
+        }
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Byte fetch_byte(Memory &memory)
+    {
+        if constexpr (uses_predecode(Level))
+        {
+            Byte value = predecoded_operand & 0xFF;
+            predecoded_operand >>= 8;
+            PC++;
+            return value;
+        }
+        else
+        {
+            return fetch_byte_from_bus<Level>(memory);
+        }
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Byte fetch_byte_from_bus(Memory &memory)
+    {
+        Byte value = memory.read(PC);
+        trace_bus<Level>(TraceEvent::read, PC, value);
+        PC++;
+        return value;
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Word fetch_word(Memory &memory)
+    {
+        Byte first_byte = fetch_byte<Level>(memory);
+        Byte second_byte = fetch_byte<Level>(memory);
+
+        // little-endian -> second_byte "+" first_byte
+        return (second_byte << 8) | first_byte;
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Byte read_byte_from_memory(Memory &memory, Word address)
+    {
+        assert(address < MAX_MEMORY);
+        Byte byte_value = memory.read(address);
+        trace_bus<Level>(TraceEvent::read, address, byte_value);
+        watch<Level, StopReason::read_watch>(address);
+        return byte_value;
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Word read_word_from_memory(Memory &memory, Word address)
+    {
+        Byte first_byte = read_byte_from_memory<Level>(memory, address);
+        Byte second_byte = read_byte_from_memory<Level>(memory, address + 1);
+        return (second_byte << 8) | first_byte;
+    }
+
+    // pointer reads in the zero page wrap around inside the page: ($FF) takes its high byte from $00
+    template <TraceLevel Level>
+    FORCE_INLINE Word read_zero_page_word(Memory &memory, Byte address)
+    {
+        Byte first_byte = read_byte_from_memory<Level>(memory, address);
+        Byte second_byte = read_byte_from_memory<Level>(memory, Byte(address + 1));
+        return (second_byte << 8) | first_byte;
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Byte read_byte_from_stack(Memory &memory)
+    {
+        SP++;
+        return read_byte_from_memory<Level>(memory, SP_address());
+    }
+
+    template <TraceLevel Level>
+    FORCE_INLINE Word read_word_from_stack(Memory &memory)
+    {
+        Byte s_byte = read_byte_from_stack<Level>(memory);
+        Byte f_byte = read_byte_from_stack<Level>(memory);
+        return (f_byte << 8) | s_byte;
+    }
+
+    FORCE_INLINE void set_zero_negative(Byte value)
+    {
+        zero_result = value;
+        negative_result = value;
+    }
+
+    // The cycle an indexed address spends when the index carries into the high
+    // byte, reading from the page before the carry
+    template <TraceLevel Level, bool AlwaysFixup>
+    FORCE_INLINE void index_fixup(int64_t &cycles, const Memory &memory, Word base, Word address)
+    {
+        bool crossed = (base >> 8) != (address >> 8);
+        if (AlwaysFixup || crossed)
+        {
+            dummy_read<Level>(memory, (base & 0xFF00) | (address & 0xFF));
+        }
+        if (!AlwaysFixup && crossed)
+        {
+            decrement_cycles(cycles, 1);
+        }
+    }
+
+    // Effective address of a memory operand. For reads, indexing that carries
+    // into the high byte adds a cycle to cycle_table; stores and
+    // read-modify-write instructions always spend it (AlwaysFixup) because the
+    // 6502 cannot know in advance, so for them the table already includes it.
+    template <TraceLevel Level, AddressingMode Mode, bool AlwaysFixup>
+    FORCE_INLINE Word operand_address(int64_t &cycles, Memory &memory)
+    {
+        if constexpr (Mode == AddressingMode::zero_page)
+        {
+            return fetch_byte<Level>(memory);
+        }
+        else if constexpr (Mode == AddressingMode::zero_page_x || Mode == AddressingMode::zero_page_y)
+        {
+            Byte zero_page_address = fetch_byte<Level>(memory);
+            dummy_read<Level>(memory, zero_page_address);
+            return Byte(zero_page_address + (Mode == AddressingMode::zero_page_x ? X : Y));
+        }
+        else if constexpr (Mode == AddressingMode::absolute)
+        {
+            return fetch_word<Level>(memory);
+        }
+        else if constexpr (Mode == AddressingMode::absolute_x || Mode == AddressingMode::absolute_y)
+        {
+            Word base = fetch_word<Level>(memory);
+            Word address = base + (Mode == AddressingMode::absolute_x ? X : Y);
+            index_fixup<Level, AlwaysFixup>(cycles, memory, base, address);
+            return address;
+        }
+        else if constexpr (Mode == AddressingMode::indexed_indirect)
+        {
+            Byte zero_page_address = fetch_byte<Level>(memory);
+            dummy_read<Level>(memory, zero_page_address);
+            return read_zero_page_word<Level>(memory, zero_page_address + X);
+        }
+        else if constexpr (Mode == AddressingMode::indirect_indexed)
+        {
+            Byte zero_page_address = fetch_byte<Level>(memory);
+            Word base = read_zero_page_word<Level>(memory, zero_page_address);
+            Word address = base + Y;
+            index_fixup<Level, AlwaysFixup>(cycles, memory, base, address);
+            return address;
+        }
+        else
+        {
+            static_assert(Mode == AddressingMode::zero_page, "addressing mode has no memory operand");
+        }
+    }
+
+    template <TraceLevel Level, AddressingMode Mode>
+    FORCE_INLINE Byte read_operand(int64_t &cycles, Memory &memory)
+    {
+        if constexpr (Mode == AddressingMode::immediate)
+        {
+            return fetch_byte<Level>(memory);
+        }
+        else
+        {
+            Word address = operand_address<Level, Mode, false>(cycles, memory);
+            return read_byte_from_memory<Level>(memory, address);
+        }
+    }
+
+    void add_with_carry(Byte value)
+    {
+        unsigned carry = status & carry_flag;
+        unsigned sum = A + value + carry;
+        if (status & decimal_flag)
+        {
+            // Z from the binary sum, the rest from the table (decimal.h)
+            Word entry = decimal_tables.adc[carry << 16 | A << 8 | value];
+            zero_result = sum & 0xFF;
+            negative_result = entry >> 8;
+            status = (status & ~(carry_flag | overflow_flag)) | ((entry >> 8) & (carry_flag | overflow_flag));
+            A = entry & 0xFF;
+            return;
+        }
+        set_flag(overflow_flag, ~(A ^ value) & (A ^ sum) & 0x80);
+        set_flag(carry_flag, sum > 0xFF);
+        A = sum & 0xFF;
+        set_zero_negative(A);
+    }
+
+    void subtract_with_carry(Byte value)
+    {
+        unsigned carry = status & carry_flag;
+        unsigned difference = A - value - (1 - carry);
+        Byte binary = difference & 0xFF;
+        // NMOS behaviour: all flags come from the binary subtraction, even in decimal mode
+        set_flag(overflow_flag, (A ^ value) & (A ^ binary) & 0x80);
+        set_flag(carry_flag, difference < 0x100);
+        set_zero_negative(binary);
+        A = status & decimal_flag ? decimal_tables.sbc[carry << 16 | A << 8 | value] : binary;
+    }
+
+    FORCE_INLINE void compare(Byte reg, Byte value)
+    {
+        set_flag(carry_flag, reg >= value);
+        set_zero_negative(reg - value);
+    }
+
+    template <Operation Op>
+    FORCE_INLINE void read_operation(Byte value)
+    {
+        if constexpr (Op == Operation::LDA) { A = value; set_zero_negative(A); }
+        else if constexpr (Op == Operation::LDX) { X = value; set_zero_negative(X); }
+        else if constexpr (Op == Operation::LDY) { Y = value; set_zero_negative(Y); }
+        else if constexpr (Op == Operation::AND) { A &= value; set_zero_negative(A); }
+        else if constexpr (Op == Operation::ORA) { A |= value; set_zero_negative(A); }
+        else if constexpr (Op == Operation::EOR) { A ^= value; set_zero_negative(A); }
+        else if constexpr (Op == Operation::ADC) { add_with_carry(value); }
+        else if constexpr (Op == Operation::SBC) { subtract_with_carry(value); }
+        else if constexpr (Op == Operation::CMP) { compare(A, value); }
+        else if constexpr (Op == Operation::CPX) { compare(X, value); }
+        else if constexpr (Op == Operation::CPY) { compare(Y, value); }
+        else if constexpr (Op == Operation::BIT)
+        {
+            zero_result = A & value;
+            negative_result = value;
+            set_flag(overflow_flag, value & 0b01000000);
+        }
+    }
+
+    template <Operation Op>
+    FORCE_INLINE Byte rmw_operation(Byte value)
+    {
+        Byte result = 0;
+        if constexpr (Op == Operation::ASL) { result = value << 1; set_flag(carry_flag, value >> 7); }
+        else if constexpr (Op == Operation::LSR) { result = value >> 1; set_flag(carry_flag, value & 0x01); }
+        else if constexpr (Op == Operation::ROL) { result = (value << 1) | (status & carry_flag); set_flag(carry_flag, value >> 7); }
+        else if constexpr (Op == Operation::ROR) { result = (value >> 1) | ((status & carry_flag) << 7); set_flag(carry_flag, value & 0x01); }
+        else if constexpr (Op == Operation::INC) { result = value + 1; }
+        else if constexpr (Op == Operation::DEC) { result = value - 1; }
+        set_zero_negative(result);
+        return result;
+    }
+
+    template <Operation Op>
+    FORCE_INLINE Byte store_value() const
+    {
+        if constexpr (Op == Operation::STA) { return A; }
+        else if constexpr (Op == Operation::STX) { return X; }
+        else { return Y; }
+    }
+
+    template <Operation Op>
+    FORCE_INLINE bool branch_taken() const
+    {
+        if constexpr (Op == Operation::BCC) { return !flag(carry_flag); }
+        else if constexpr (Op == Operation::BCS) { return flag(carry_flag); }
+        else if constexpr (Op == Operation::BNE) { return !flag(zero_flag); }
+        else if constexpr (Op == Operation::BEQ) { return flag(zero_flag); }
+        else if constexpr (Op == Operation::BPL) { return !flag(negative_flag); }
+        else if constexpr (Op == Operation::BMI) { return flag(negative_flag); }
+        else if constexpr (Op == Operation::BVC) { return !flag(overflow_flag); }
+        else { return flag(overflow_flag); }
+    }
+
+    // register transfers, flag changes, increments and NOP: one idle cycle after the opcode fetch
+    template <Operation Op>
+    FORCE_INLINE void implied_operation()
+    {
+        if constexpr (Op == Operation::CLC) { set_flag(carry_flag, false); }
+        else if constexpr (Op == Operation::CLD) { set_flag(decimal_flag, false); }
+        else if constexpr (Op == Operation::CLI) { set_flag(interrupt_disable_flag, false); }
+        else if constexpr (Op == Operation::CLV) { set_flag(overflow_flag, false); }
+        else if constexpr (Op == Operation::SEC) { set_flag(carry_flag, true); }
+        else if constexpr (Op == Operation::SED) { set_flag(decimal_flag, true); }
+        else if constexpr (Op == Operation::SEI) { set_flag(interrupt_disable_flag, true); }
+        else if constexpr (Op == Operation::TAX) { X = A; set_zero_negative(X); }
+        else if constexpr (Op == Operation::TAY) { Y = A; set_zero_negative(Y); }
+        else if constexpr (Op == Operation::TXA) { A = X; set_zero_negative(A); }
+        else if constexpr (Op == Operation::TYA) { A = Y; set_zero_negative(A); }
+        else if constexpr (Op == Operation::TSX) { X = SP; set_zero_negative(X); }
+        else if constexpr (Op == Operation::TXS) { SP = X; }
+        else if constexpr (Op == Operation::INX) { X++; set_zero_negative(X); }
+        else if constexpr (Op == Operation::INY) { Y++; set_zero_negative(Y); }
+        else if constexpr (Op == Operation::DEX) { X--; set_zero_negative(X); }
+        else if constexpr (Op == Operation::DEY) { Y--; set_zero_negative(Y); }
+        else { static_assert(Op == Operation::NOP, "not an implied operation"); }
+    }
+
+    // Pushes PC and the status (with B set only for BRK) and jumps through `vector`.
+    template <TraceLevel Level>
+    FORCE_INLINE void enter_interrupt(Memory &memory, Word vector, Byte pushed_bits)
+    {
+        push_word_to_stack<Level>(memory, PC);
+        push_byte_to_stack<Level>(memory, all_flags() | pushed_bits);
+        set_flag(interrupt_disable_flag, true);
+        PC = read_word_from_memory<Level>(memory, vector);
+        profile_call<Level>(PC);
+    }
+
+    // Handler for one opcode, everything but the opcode fetch. The operation and
+    // addressing mode are resolved at compile time from decode(), so each of the
+    // 256 instantiations is straight-line code. Returns false to stop execution.
+    template <TraceLevel Level, Byte Opcode>
+    FORCE_INLINE bool execute_opcode(int64_t &cycles, Memory &memory)
+    {
+        constexpr OpcodeInfo info = decode(Opcode);
+        constexpr Operation op = info.operation;
+        constexpr AddressingMode mode = info.mode;
+
+        if constexpr (op == Operation::ILL)
+        {
+            return false;
+        }
+        else if constexpr (is_read_operation(op))
+        {
+            read_operation<op>(read_operand<Level, mode>(cycles, memory));
+        }
+        else if constexpr (is_store_operation(op))
+        {
+            Word address = operand_address<Level, mode, true>(cycles, memory);
+            write_byte_to_memory<Level>(memory, store_value<op>(), address);
+        }
+        else if constexpr (is_rmw_operation(op) && mode == AddressingMode::accumulator)
+        {
+            dummy_read<Level>(memory, PC);
+            A = rmw_operation<op>(A);
+        }
+        else if constexpr (is_rmw_operation(op))
+        {
+            Word address = operand_address<Level, mode, true>(cycles, memory);
+            Byte value = read_byte_from_memory<Level>(memory, address);
+            // the unmodified value is written back once before the result
+            write_byte_to_memory<Level>(memory, value, address);
+            write_byte_to_memory<Level>(memory, rmw_operation<op>(value), address);
+        }
+        else if constexpr (mode == AddressingMode::relative)
+        {
+            Byte offset = fetch_byte<Level>(memory);
+            if (branch_taken<op>())
+            {
+                Word target = PC + int8_t(offset);
+                dummy_read<Level>(memory, PC);
+                decrement_cycles(cycles, 1);
+                if ((target >> 8) != (PC >> 8))
+                {
+                    dummy_read<Level>(memory, (PC & 0xFF00) | (target & 0xFF));
+                    decrement_cycles(cycles, 1);
+                }
+                Word branch = PC - 2;
+                PC = target;
+                // what fetch_byte left of the operand is idle_loop_mark >> 8
+                if (__builtin_expect(predecoded_operand != 0, 0))
+                {
+                    skip_idle_loop<Level>(cycles, memory, branch);
+                }
+            }
+        }
+        else if constexpr (op == Operation::JMP && mode == AddressingMode::absolute)
+        {
+            Word jump = PC - 1;
+            PC = fetch_word<Level>(memory);
+            // JMP * waits for an interrupt
+            if (__builtin_expect(PC == jump, 0))
+            {
+                skip_idle_loop<Level>(cycles, memory, jump);
+            }
+        }
+        else if constexpr (op == Operation::JMP)
+        {
+            // NMOS bug: a pointer at $xxFF takes its high byte from $xx00
+            Word pointer = fetch_word<Level>(memory);
+            Byte low = read_byte_from_memory<Level>(memory, pointer);
+            Byte high = read_byte_from_memory<Level>(memory, (pointer & 0xFF00) | Byte(pointer + 1));
+            PC = (high << 8) | low;
+        }
+        else if constexpr (op == Operation::JSR)
+        {
+            // the pushed return address is the last byte of the JSR instruction
+            Byte low = fetch_byte<Level>(memory);
+            dummy_read<Level>(memory, SP_address());
+            push_word_to_stack<Level>(memory, PC);
+            Byte high = fetch_byte_from_bus<Level>(memory);
+            PC = (high << 8) | low;
+            profile_call<Level>(PC);
+        }
+        else if constexpr (op == Operation::RTS)
+        {
+            dummy_read<Level>(memory, PC);
+            dummy_read<Level>(memory, SP_address());
+            PC = read_word_from_stack<Level>(memory);
+            dummy_read<Level>(memory, PC);
+            PC++;
+            profile_return<Level>();
+        }
+        else if constexpr (op == Operation::RTI)
+        {
+            dummy_read<Level>(memory, PC);
+            dummy_read<Level>(memory, SP_address());
+            set_flags(read_byte_from_stack<Level>(memory));
+            PC = read_word_from_stack<Level>(memory);
+            profile_return<Level>();
+        }
+        else if constexpr (op == Operation::BRK)
+        {
+            // BRK skips a padding byte, so RTI returns two bytes after the opcode
+            fetch_byte<Level>(memory);
+            enter_interrupt<Level>(memory, 0xFFFE, break_flag | unused_flag);
+        }
+        else if constexpr (op == Operation::PHA || op == Operation::PHP)
+        {
+            dummy_read<Level>(memory, PC);
+            push_byte_to_stack<Level>(memory, op == Operation::PHA ? A : Byte(all_flags() | break_flag | unused_flag));
+        }
+        else if constexpr (op == Operation::PLA)
+        {
+            dummy_read<Level>(memory, PC);
+            dummy_read<Level>(memory, SP_address());
+            A = read_byte_from_stack<Level>(memory);
+            set_zero_negative(A);
+        }
+        else if constexpr (op == Operation::PLP)
+        {
+            dummy_read<Level>(memory, PC);
+            dummy_read<Level>(memory, SP_address());
+            set_flags(read_byte_from_stack<Level>(memory));
+        }
+        else
+        {
+            dummy_read<Level>(memory, PC);
+            implied_operation<op>();
+        }
+        if constexpr (op == Operation::CLI || op == Operation::PLP || op == Operation::RTI)
+        {
+            // a waiting IRQ that just got unmasked is taken by poll_interrupts
+            return !irq_unmasked();
+        }
+        return true;
+    }
+
+    // Charges the instruction's cycle_table entry, a compile time constant, and
+    // runs execute_opcode, which only adds the penalties. When profiling, also
+    // does the bookkeeping for the instruction: cycles go to the call stack it
+    // started in, so a JSR counts for its caller.
+    template <TraceLevel Level, Byte Opcode>
+    FORCE_INLINE bool run_instruction(int64_t &cycles, Memory &memory)
+    {
+        if constexpr (Level == TraceLevel::profile)
+        {
+            Word pc = PC - 1;
+            uint32_t frame = profiler->current;
+            int64_t start = cycles;
+            decrement_cycles(cycles, cycle_table[Opcode]);
+            bool keep_running = execute_opcode<Level, Opcode>(cycles, memory);
+            profiler->record_instruction(pc, Opcode, frame, start - cycles);
+            return keep_running;
+        }
+        else
+        {
+            decrement_cycles(cycles, cycle_table[Opcode]);
+            return execute_opcode<Level, Opcode>(cycles, memory);
+        }
+    }
+
+    // Trace level is a compile time choice: execute<TraceLevel::off> (the default)
+    // carries no tracing code at all, opcode and bus append records to `trace`,
+    // profile feeds `profiler` and debug checks `breakpoints`.
+    //
+    // Runs whole instructions until `budget` cycles are spent and returns the
+    // cycles actually used: more than `budget` when the last instruction overran
+    // it, less when execution stopped early on an unofficial opcode or because
+    // CLI/PLP/RTI unmasked a waiting IRQ. debug also stops before an
+    // instruction on a breakpoint, the first one included, and after one that
+    // hit a watchpoint; breakpoints->reason tells which.
+    template <TraceLevel Level = TraceLevel::off>
+    uint64_t execute(uint64_t budget, Memory &memory)
+    {
+        int64_t cycles = budget;
+        if constexpr (records_trace(Level))
+        {
+            assert(trace != nullptr);
+        }
+        else
+        {
+            assert(Level != TraceLevel::profile || profiler != nullptr);
+            memory.decoded_instructions();
+        }
+        if constexpr (Level == TraceLevel::debug)
+        {
+            assert(breakpoints != nullptr);
+            breakpoints->reason = StopReason::none;
+        }
+
+#if CPU_THREADED_DISPATCH
+#define OPCODE_LABEL(n) &&opcode_##n,
+        static void *const dispatch_table[256] = {FOR_EACH_OPCODE(OPCODE_LABEL)};
+#undef OPCODE_LABEL
+
+#define DISPATCH()                             \
+    if (cycles <= 0 || debug_stop<Level>())    \
+    {                                          \
+        return budget - cycles;                \
+    }                                          \
+    goto *dispatch_table[next_opcode<Level>(memory)]
+
+        DISPATCH();
+
+#define OPCODE_HANDLER(n)                                \
+    opcode_##n:                                          \
+    if (!run_instruction<Level, 0x##n>(cycles, memory))  \
+    {                                                    \
+        return budget - cycles;                          \
+    }                                                    \
+    DISPATCH();
+
+        FOR_EACH_OPCODE(OPCODE_HANDLER)
+#undef OPCODE_HANDLER
+#undef DISPATCH
+#else
+        bool keep_running = true;
+        while (cycles > 0 && keep_running && !debug_stop<Level>())
+        {
+            switch (next_opcode<Level>(memory))
+            {
+#define OPCODE_CASE(n)                                                 \
+    case 0x##n:                                                        \
+        keep_running = run_instruction<Level, 0x##n>(cycles, memory);  \
+        break;
+
+                FOR_EACH_OPCODE(OPCODE_CASE)
+#undef OPCODE_CASE
+            }
+        }
+        return budget - cycles;
+#endif
+    }
+};
+
+static_assert(CPU::cycle_table_matches_decode(), "cycle_table and decode disagree");
+
+// Opcodes of a profile by total cycles, one "0xA9 LDA immediate <count> <cycles> <share>%" line each
+inline void write_opcode_histogram(std::ostream &out, const Profiler &profiler)
+{
+    std::vector<int> opcodes;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        if (profiler.opcode_counts[opcode] > 0)
+        {
+            opcodes.push_back(opcode);
+        }
+    }
+    std::sort(opcodes.begin(), opcodes.end(), [&profiler](int a, int b) {
+        return profiler.opcode_cycles[a] != profiler.opcode_cycles[b] ? profiler.opcode_cycles[a] > profiler.opcode_cycles[b] : a < b;
+    });
+    uint64_t total = profiler.total_cycles();
+    for (int opcode : opcodes)
+    {
+        OpcodeInfo info = CPU::decode(opcode);
+        out << "0x" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << opcode << std::dec << std::setfill(' ')
+            << ' ' << operation_name(info.operation) << ' ' << std::left << std::setw(17) << addressing_mode_name(info.mode) << std::right
+            << std::setw(12) << profiler.opcode_counts[opcode] << std::setw(14) << profiler.opcode_cycles[opcode]
+            << std::fixed << std::setprecision(2) << std::setw(8) << 100.0 * profiler.opcode_cycles[opcode] / total << "%\n";
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "cpu.h"
+
+// result of Debugger::run/step
+struct DebugStop
+{
+    StopReason reason; // none when the budget ran out
+    Word address;      // see Breakpoints::address
+    uint64_t cycles;   // spent, interrupt entries included
+};
+
+// Runs a CPU under breakpoints and watchpoints. While none is set it runs
+// execute<TraceLevel::off>, the same code as a production build, and only
+// switches to the checking execute<TraceLevel::debug> once one is.
+// Pending interrupts are taken between slices, as Scheduler does.
+class Debugger
+{
+public:
+    Breakpoints points;
+
+    Debugger(CPU &cpu, Memory &memory) : cpu(cpu), memory(memory)
+    {
+        cpu.breakpoints = &points;
+    }
+
+    ~Debugger()
+    {
+        if (cpu.breakpoints == &points)
+        {
+            cpu.breakpoints = nullptr;
+        }
+    }
+
+    Debugger(const Debugger &) = delete;
+    Debugger &operator=(const Debugger &) = delete;
+
+    // Continues for about `budget` cycles (the last instruction may overrun
+    // it). Like a debugger's continue, a breakpoint at the starting PC does not
+    // stop it again.
+    DebugStop run(uint64_t budget)
+    {
+        uint64_t used = 0;
+        if (Breakpoints::test(points.execute, cpu.PC))
+        {
+            DebugStop stop = step();
+            if (stop.reason != StopReason::none)
+            {
+                return stop;
+            }
+            used = stop.cycles;
+        }
+        while (used < budget)
+        {
+            Word vector = cpu.pending_interrupt();
+            if (vector != 0)
+            {
+                used += cpu.take_interrupt(memory, vector);
+                continue;
+            }
+            uint64_t slice = budget - used;
+            bool armed = points.armed();
+            uint64_t spent = armed ? cpu.execute<TraceLevel::debug>(slice, memory) : cpu.execute(slice, memory);
+            used += spent;
+            if (armed && points.reason != StopReason::none)
+            {
+                return {points.reason, points.address, used};
+            }
+            if (spent < slice && !cpu.irq_unmasked())
+            {
+                return {StopReason::illegal, cpu.PC, used};
+            }
+        }
+        return {StopReason::none, 0, used};
+    }
+
+    // Runs one instruction, or enters the pending interrupt, ignoring a
+    // breakpoint at PC; watchpoints still report.
+    DebugStop step()
+    {
+        Word vector = cpu.pending_interrupt();
+        if (vector != 0)
+        {
+            return {StopReason::none, 0, cpu.take_interrupt(memory, vector)};
+        }
+        Word pc = cpu.PC;
+        bool on_breakpoint = Breakpoints::test(points.execute, pc);
+        points.set_breakpoint(pc, false);
+        uint64_t spent = cpu.execute<TraceLevel::debug>(1, memory);
+        points.set_breakpoint(pc, on_breakpoint);
+        if (spent == 0)
+        {
+            return {StopReason::illegal, cpu.PC, 0};
+        }
+        return {points.reason, points.address, spent};
+    }
+
+private:
+    CPU &cpu;
+    Memory &memory;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common.h"
+
+// Decimal mode ADC and SBC as lookup tables built at compile time, one entry
+// per (carry in, A, operand), indexed by carry << 16 | A << 8 | operand. BCD
+// arithmetic then costs one load instead of the nibble adjustments and their
+// unpredictable branches.
+//
+// NMOS quirks: ADC takes Z from the binary sum (left to the CPU) and N and V
+// from the intermediate result after the low nibble adjustment; SBC takes
+// every flag from the binary subtraction, so its table holds only the result.
+struct DecimalTables
+{
+    static constexpr uint32_t size = 0x20000;
+
+    // low byte: the result; high byte: C (bit 0), V (bit 6) and N (bit 7), where the status register keeps them
+    Word adc[size];
+    Byte sbc[size];
+};
+
+// Plain arrays rather than std::array: constant evaluation is slow enough
+// per operation that the accessor calls alone add seconds to every build.
+constexpr DecimalTables make_decimal_tables()
+{
+    DecimalTables tables{};
+    for (uint32_t index = 0; index < DecimalTables::size; index++)
+    {
+        int carry = index >> 16, a = (index >> 8) & 0xFF, value = index & 0xFF;
+
+        int low = (a & 0x0F) + (value & 0x0F) + carry;
+        if (low > 0x09)
+        {
+            low += 0x06;
+        }
+        int high = (a >> 4) + (value >> 4) + (low > 0x0F);
+        int flags = ((high << 4) & 0x80) | (~(a ^ value) & (a ^ (high << 4)) & 0x80 ? 0x40 : 0);
+        if (high > 0x09)
+        {
+            high += 0x06;
+        }
+        flags |= high > 0x0F ? 0x01 : 0;
+        tables.adc[index] = Word(flags << 8 | (high & 0x0F) << 4 | (low & 0x0F));
+
+        low = (a & 0x0F) - (value & 0x0F) - (1 - carry);
+        high = (a >> 4) - (value >> 4);
+        if (low < 0)
+        {
+            low -= 0x06;
+            high--;
+        }
+        if (high < 0)
+        {
+            high -= 0x06;
+        }
+        tables.sbc[index] = Byte((high & 0x0F) << 4 | (low & 0x0F));
+    }
+    return tables;
+}
+
+inline constexpr DecimalTables decimal_tables = make_decimal_tables();
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "loader.h"
+
+// Hand-assembled firmware for the recompiler's differential test and
+// benchmark; demo_firmware_recompiled.h is generated from it with
+// `recompile --demo`. It runs from RAM at $C000: the main loop fills, copies
+// and sums a page, counts in BCD, calls a handler through a jump table
+// (JMP indirect) and a routine through an RTS trick, patches an immediate in
+// its own code at $C2xx, takes a BRK and opens an IRQ window with CLI/SEI.
+// A nonzero $35 makes it stop on an unofficial opcode.
+inline Image demo_firmware_image()
+{
+    Image image;
+    image.segments = {
+        {0xC000, {
+            0x78,                // C000 reset:     SEI
+            0xA2, 0xFF,          // C001            LDX #$FF
+            0x9A,                // C003            TXS
+            0xD8,                // C004            CLD
+            0xA9, 0x00,          // C005            LDA #$00
+            0xA2, 0x3F,          // C007            LDX #$3F
+            0x95, 0x00,          // C009 clear:     STA $00,X
+            0xCA,                // C00B            DEX
+            0x10, 0xFB,          // C00C            BPL clear
+            0xA6, 0x10,          // C00E main:      LDX $10
+            0x20, 0x37, 0xC0,    // C010            JSR fill
+            0x20, 0x44, 0xC0,    // C013            JSR copy
+            0x20, 0x5E, 0xC0,    // C016            JSR checksum
+            0x20, 0x70, 0xC0,    // C019            JSR bcd_tick
+            0x20, 0x00, 0xC1,    // C01C            JSR dispatch
+            0x20, 0x00, 0xC2,    // C01F            JSR patch_add
+            0x20, 0x28, 0xC1,    // C022            JSR rts_trick
+            0x00,                // C025            BRK
+            0xEA,                // C026            .byte $EA
+            0x58,                // C027            CLI
+            0x78,                // C028            SEI
+            0xA5, 0x35,          // C029            LDA $35
+            0xF0, 0x01,          // C02B            BEQ next
+            0x02,                // C02D            .byte $02
+            0xE6, 0x10,          // C02E next:      INC $10
+            0xD0, 0xDC,          // C030            BNE main
+            0xE6, 0x11,          // C032            INC $11
+            0x4C, 0x0E, 0xC0,    // C034            JMP main
+            0xA0, 0x00,          // C037 fill:      LDY #$00
+            0x8A,                // C039            TXA
+            0x99, 0x00, 0x03,    // C03A fill_l:    STA $0300,Y
+            0x18,                // C03D            CLC
+            0x69, 0x03,          // C03E            ADC #$03
+            0xC8,                // C040            INY
+            0xD0, 0xF7,          // C041            BNE fill_l
+            0x60,                // C043            RTS
+            0xA9, 0x00,          // C044 copy:      LDA #$00
+            0x85, 0x20,          // C046            STA $20
+            0x85, 0x22,          // C048            STA $22
+            0xA9, 0x03,          // C04A            LDA #$03
+            0x85, 0x21,          // C04C            STA $21
+            0xA9, 0x04,          // C04E            LDA #$04
+            0x85, 0x23,          // C050            STA $23
+            0xA0, 0x00,          // C052            LDY #$00
+            0xB1, 0x20,          // C054 copy_l:    LDA ($20),Y
+            0x49, 0x5A,          // C056            EOR #$5A
+            0x91, 0x22,          // C058            STA ($22),Y
+            0xC8,                // C05A            INY
+            0xD0, 0xF7,          // C05B            BNE copy_l
+            0x60,                // C05D            RTS
+            0xA2, 0x00,          // C05E checksum:  LDX #$00
+            0x86, 0x14,          // C060            STX $14
+            0x18,                // C062            CLC
+            0x7D, 0xC0, 0x03,    // C063 sum_l:     ADC $03C0,X
+            0x90, 0x02,          // C066            BCC sum_n
+            0xE6, 0x14,          // C068            INC $14
+            0xE8,                // C06A sum_n:     INX
+            0xD0, 0xF6,          // C06B            BNE sum_l
+            0x85, 0x13,          // C06D            STA $13
+            0x60,                // C06F            RTS
+            0xF8,                // C070 bcd_tick:  SED
+            0xA5, 0x12,          // C071            LDA $12
+            0x18,                // C073            CLC
+            0x69, 0x01,          // C074            ADC #$01
+            0x85, 0x12,          // C076            STA $12
+            0xA5, 0x13,          // C078            LDA $13
+            0xE9, 0x27,          // C07A            SBC #$27
+            0x85, 0x16,          // C07C            STA $16
+            0xD8,                // C07E            CLD
+            0x60,                // C07F            RTS
+        }},
+        {0xC100, {
+            0xA5, 0x24,          // C100 dispatch:  LDA $24
+            0xE6, 0x24,          // C102            INC $24
+            0x29, 0x03,          // C104            AND #$03
+            0x0A,                // C106            ASL A
+            0xAA,                // C107            TAX
+            0xBD, 0x36, 0xC1,    // C108            LDA table,X
+            0x85, 0x26,          // C10B            STA $26
+            0xBD, 0x37, 0xC1,    // C10D            LDA table+1,X
+            0x85, 0x27,          // C110            STA $27
+            0x6C, 0x26, 0x00,    // C112            JMP ($26)
+            0xA9, 0x11,          // C115 h0:        LDA #$11
+            0x85, 0x30,          // C117            STA $30
+            0x60,                // C119            RTS
+            0x26, 0x31,          // C11A h1:        ROL $31
+            0x60,                // C11C            RTS
+            0xA6, 0x31,          // C11D h2:        LDX $31
+            0xCA,                // C11F            DEX
+            0x86, 0x32,          // C120            STX $32
+            0x60,                // C122            RTS
+            0x46, 0x30,          // C123 h3:        LSR $30
+            0x66, 0x31,          // C125            ROR $31
+            0x60,                // C127            RTS
+            0xA9, 0xC1,          // C128 rts_trick: LDA #>pushed-1
+            0x48,                // C12A            PHA
+            0xA9, 0x2E,          // C12B            LDA #<pushed-1
+            0x48,                // C12D            PHA
+            0x60,                // C12E            RTS
+            0xE6, 0x34,          // C12F pushed:    INC $34
+            0x60,                // C131            RTS
+            0xE6, 0x15,          // C132 irq:       INC $15
+            0x40,                // C134            RTI
+            0x40,                // C135 nmi:       RTI
+            0x15, 0xC1, 0x1A, 0xC1, 0x1D, 0xC1, 0x23, 0xC1, // C136 table:     .word h0,h1,h2,h3
+        }},
+        {0xC200, {
+            0xA5, 0x10,          // C200 patch_add: LDA $10
+            0x8D, 0x06, 0xC2,    // C202            STA patched+1
+            0xA9, 0x00,          // C205 patched:   LDA #$00
+            0x18,                // C207            CLC
+            0x69, 0x01,          // C208            ADC #$01
+            0x85, 0x33,          // C20A            STA $33
+            0x60,                // C20C            RTS
+        }},
+        {0xFFFA, {
+            0x35, 0xC1, 0x00, 0xC0, 0x32, 0xC1, // FFFA vectors:   .word nmi,reset,irq
+        }},
+    };
+    return image;
+}
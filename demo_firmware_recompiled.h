@@ -0,0 +1,531 @@
+// Generated by recompile.cpp (recompiler.h); do not edit.
+#pragma once
+
+#include "recompiler.h"
+
+struct demo_firmware_recompiled
+{
+    static constexpr CompiledPage pages[] = {
+        {0xC0,
+         {0xFFFFFFFFFFFFFFFFull, 0xFFFFFFFFFFFFFFFFull, 0x0000000000000000ull, 0x0000000000000000ull},
+         {0x78, 0xA2, 0xFF, 0x9A, 0xD8, 0xA9, 0x00, 0xA2, 0x3F, 0x95, 0x00, 0xCA, 0x10, 0xFB, 0xA6, 0x10,
+          0x20, 0x37, 0xC0, 0x20, 0x44, 0xC0, 0x20, 0x5E, 0xC0, 0x20, 0x70, 0xC0, 0x20, 0x00, 0xC1, 0x20,
+          0x00, 0xC2, 0x20, 0x28, 0xC1, 0x00, 0xEA, 0x58, 0x78, 0xA5, 0x35, 0xF0, 0x01, 0x02, 0xE6, 0x10,
+          0xD0, 0xDC, 0xE6, 0x11, 0x4C, 0x0E, 0xC0, 0xA0, 0x00, 0x8A, 0x99, 0x00, 0x03, 0x18, 0x69, 0x03,
+          0xC8, 0xD0, 0xF7, 0x60, 0xA9, 0x00, 0x85, 0x20, 0x85, 0x22, 0xA9, 0x03, 0x85, 0x21, 0xA9, 0x04,
+          0x85, 0x23, 0xA0, 0x00, 0xB1, 0x20, 0x49, 0x5A, 0x91, 0x22, 0xC8, 0xD0, 0xF7, 0x60, 0xA2, 0x00,
+          0x86, 0x14, 0x18, 0x7D, 0xC0, 0x03, 0x90, 0x02, 0xE6, 0x14, 0xE8, 0xD0, 0xF6, 0x85, 0x13, 0x60,
+          0xF8, 0xA5, 0x12, 0x18, 0x69, 0x01, 0x85, 0x12, 0xA5, 0x13, 0xE9, 0x27, 0x85, 0x16, 0xD8, 0x60,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}},
+        {0xC1,
+         {0x003C7F00001FFFFFull, 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull},
+         {0xA5, 0x24, 0xE6, 0x24, 0x29, 0x03, 0x0A, 0xAA, 0xBD, 0x36, 0xC1, 0x85, 0x26, 0xBD, 0x37, 0xC1,
+          0x85, 0x27, 0x6C, 0x26, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xA9, 0xC1, 0x48, 0xA9, 0x2E, 0x48, 0x60, 0x00,
+          0x00, 0x00, 0xE6, 0x15, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}},
+        {0xC2,
+         {0x0000000000001FFFull, 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull},
+         {0xA5, 0x10, 0x8D, 0x06, 0xC2, 0xA9, 0x00, 0x18, 0x69, 0x01, 0x85, 0x33, 0x60, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}},
+    };
+
+    // first instructions of the compiled blocks
+    static constexpr Word entries[] = {0xC000, 0xC009, 0xC00E, 0xC013, 0xC016, 0xC019, 0xC01C, 0xC01F, 0xC022, 0xC025, 0xC027, 0xC02D,
+                                       0xC02E, 0xC032, 0xC037, 0xC03A, 0xC043, 0xC044, 0xC054, 0xC05D, 0xC05E, 0xC063, 0xC068, 0xC06A,
+                                       0xC06D, 0xC070, 0xC100, 0xC128, 0xC132, 0xC135, 0xC200};
+
+    // cpu.execute(budget, memory), with the image's code compiled
+    static uint64_t execute(CPU &cpu, uint64_t budget, Memory &memory)
+    {
+        thread_local RecompiledRuntime runtime(pages, std::size(pages), entries, std::size(entries));
+        int64_t cycles = budget;
+        runtime.check_pages(memory);
+        CPU c = cpu;
+        goto dispatch;
+
+    L_C000:
+        RECOMPILED_CHECK(0xC0, 0xC000)
+        // C000  SEI
+        RECOMPILED_STEP(0xC000, 0x78, 0x0000)
+        // C001  LDX #$FF
+        RECOMPILED_STEP(0xC001, 0xA2, 0x00FF)
+        // C003  TXS
+        RECOMPILED_STEP(0xC003, 0x9A, 0x0000)
+        // C004  CLD
+        RECOMPILED_STEP(0xC004, 0xD8, 0x0000)
+        // C005  LDA #$00
+        RECOMPILED_STEP(0xC005, 0xA9, 0x0000)
+        // C007  LDX #$3F
+        RECOMPILED_STEP(0xC007, 0xA2, 0x003F)
+        goto L_C009;
+
+    L_C009:
+        RECOMPILED_CHECK(0xC0, 0xC009)
+        // C009  STA $00,X
+        RECOMPILED_STEP(0xC009, 0x95, 0x0000)
+        // C00B  DEX
+        RECOMPILED_STEP(0xC00B, 0xCA, 0x0000)
+        // C00C  BPL $C009
+        RECOMPILED_STEP(0xC00C, 0x10, 0x00FB)
+        if (c.PC == 0xC009)
+        {
+            goto L_C009;
+        }
+        goto L_C00E;
+
+    L_C00E:
+        RECOMPILED_CHECK(0xC0, 0xC00E)
+        // C00E  LDX $10
+        RECOMPILED_STEP(0xC00E, 0xA6, 0x0010)
+        // C010  JSR $C037
+        RECOMPILED_STEP(0xC010, 0x20, 0x0037)
+        if (c.PC == 0xC037)
+        {
+            goto L_C037;
+        }
+        goto dispatch;
+
+    L_C013:
+        RECOMPILED_CHECK(0xC0, 0xC013)
+        // C013  JSR $C044
+        RECOMPILED_STEP(0xC013, 0x20, 0x0044)
+        if (c.PC == 0xC044)
+        {
+            goto L_C044;
+        }
+        goto dispatch;
+
+    L_C016:
+        RECOMPILED_CHECK(0xC0, 0xC016)
+        // C016  JSR $C05E
+        RECOMPILED_STEP(0xC016, 0x20, 0x005E)
+        if (c.PC == 0xC05E)
+        {
+            goto L_C05E;
+        }
+        goto dispatch;
+
+    L_C019:
+        RECOMPILED_CHECK(0xC0, 0xC019)
+        // C019  JSR $C070
+        RECOMPILED_STEP(0xC019, 0x20, 0x0070)
+        if (c.PC == 0xC070)
+        {
+            goto L_C070;
+        }
+        goto dispatch;
+
+    L_C01C:
+        RECOMPILED_CHECK(0xC0, 0xC01C)
+        // C01C  JSR $C100
+        RECOMPILED_STEP(0xC01C, 0x20, 0x0000)
+        if (c.PC == 0xC100)
+        {
+            goto L_C100;
+        }
+        goto dispatch;
+
+    L_C01F:
+        RECOMPILED_CHECK(0xC0, 0xC01F)
+        // C01F  JSR $C200
+        RECOMPILED_STEP(0xC01F, 0x20, 0x0000)
+        if (c.PC == 0xC200)
+        {
+            goto L_C200;
+        }
+        goto dispatch;
+
+    L_C022:
+        RECOMPILED_CHECK(0xC0, 0xC022)
+        // C022  JSR $C128
+        RECOMPILED_STEP(0xC022, 0x20, 0x0028)
+        if (c.PC == 0xC128)
+        {
+            goto L_C128;
+        }
+        goto dispatch;
+
+    L_C025:
+        RECOMPILED_CHECK(0xC0, 0xC025)
+        // C025  BRK
+        RECOMPILED_STEP(0xC025, 0x00, 0x00EA)
+        goto dispatch;
+
+    L_C027:
+        RECOMPILED_CHECK(0xC0, 0xC027)
+        // C027  CLI
+        RECOMPILED_STEP(0xC027, 0x58, 0x0000)
+        // C028  SEI
+        RECOMPILED_STEP(0xC028, 0x78, 0x0000)
+        // C029  LDA $35
+        RECOMPILED_STEP(0xC029, 0xA5, 0x0035)
+        // C02B  BEQ $C02E
+        RECOMPILED_STEP(0xC02B, 0xF0, 0x0001)
+        if (c.PC == 0xC02E)
+        {
+            goto L_C02E;
+        }
+        goto L_C02D;
+
+    L_C02D:
+        RECOMPILED_CHECK(0xC0, 0xC02D)
+        // C02D  .byte $02
+        RECOMPILED_STEP(0xC02D, 0x02, 0x0000)
+        goto stop;
+
+    L_C02E:
+        RECOMPILED_CHECK(0xC0, 0xC02E)
+        // C02E  INC $10
+        RECOMPILED_STEP(0xC02E, 0xE6, 0x0010)
+        // C030  BNE $C00E
+        RECOMPILED_STEP(0xC030, 0xD0, 0x00DC)
+        if (c.PC == 0xC00E)
+        {
+            goto L_C00E;
+        }
+        goto L_C032;
+
+    L_C032:
+        RECOMPILED_CHECK(0xC0, 0xC032)
+        // C032  INC $11
+        RECOMPILED_STEP(0xC032, 0xE6, 0x0011)
+        // C034  JMP $C00E
+        RECOMPILED_STEP(0xC034, 0x4C, 0xC00E)
+        if (c.PC == 0xC00E)
+        {
+            goto L_C00E;
+        }
+        goto dispatch;
+
+    L_C037:
+        RECOMPILED_CHECK(0xC0, 0xC037)
+        // C037  LDY #$00
+        RECOMPILED_STEP(0xC037, 0xA0, 0x0000)
+        // C039  TXA
+        RECOMPILED_STEP(0xC039, 0x8A, 0x0000)
+        goto L_C03A;
+
+    L_C03A:
+        RECOMPILED_CHECK(0xC0, 0xC03A)
+        // C03A  STA $0300,Y
+        RECOMPILED_STEP(0xC03A, 0x99, 0x0300)
+        // C03D  CLC
+        RECOMPILED_STEP(0xC03D, 0x18, 0x0000)
+        // C03E  ADC #$03
+        RECOMPILED_STEP(0xC03E, 0x69, 0x0003)
+        // C040  INY
+        RECOMPILED_STEP(0xC040, 0xC8, 0x0000)
+        // C041  BNE $C03A
+        RECOMPILED_STEP(0xC041, 0xD0, 0x00F7)
+        if (c.PC == 0xC03A)
+        {
+            goto L_C03A;
+        }
+        goto L_C043;
+
+    L_C043:
+        RECOMPILED_CHECK(0xC0, 0xC043)
+        // C043  RTS
+        RECOMPILED_STEP(0xC043, 0x60, 0x0000)
+        goto dispatch;
+
+    L_C044:
+        RECOMPILED_CHECK(0xC0, 0xC044)
+        // C044  LDA #$00
+        RECOMPILED_STEP(0xC044, 0xA9, 0x0000)
+        // C046  STA $20
+        RECOMPILED_STEP(0xC046, 0x85, 0x0020)
+        // C048  STA $22
+        RECOMPILED_STEP(0xC048, 0x85, 0x0022)
+        // C04A  LDA #$03
+        RECOMPILED_STEP(0xC04A, 0xA9, 0x0003)
+        // C04C  STA $21
+        RECOMPILED_STEP(0xC04C, 0x85, 0x0021)
+        // C04E  LDA #$04
+        RECOMPILED_STEP(0xC04E, 0xA9, 0x0004)
+        // C050  STA $23
+        RECOMPILED_STEP(0xC050, 0x85, 0x0023)
+        // C052  LDY #$00
+        RECOMPILED_STEP(0xC052, 0xA0, 0x0000)
+        goto L_C054;
+
+    L_C054:
+        RECOMPILED_CHECK(0xC0, 0xC054)
+        // C054  LDA ($20),Y
+        RECOMPILED_STEP(0xC054, 0xB1, 0x0020)
+        // C056  EOR #$5A
+        RECOMPILED_STEP(0xC056, 0x49, 0x005A)
+        // C058  STA ($22),Y
+        RECOMPILED_STEP(0xC058, 0x91, 0x0022)
+        RECOMPILED_CHECK(0xC0, 0xC05A)
+        // C05A  INY
+        RECOMPILED_STEP(0xC05A, 0xC8, 0x0000)
+        // C05B  BNE $C054
+        RECOMPILED_STEP(0xC05B, 0xD0, 0x00F7)
+        if (c.PC == 0xC054)
+        {
+            goto L_C054;
+        }
+        goto L_C05D;
+
+    L_C05D:
+        RECOMPILED_CHECK(0xC0, 0xC05D)
+        // C05D  RTS
+        RECOMPILED_STEP(0xC05D, 0x60, 0x0000)
+        goto dispatch;
+
+    L_C05E:
+        RECOMPILED_CHECK(0xC0, 0xC05E)
+        // C05E  LDX #$00
+        RECOMPILED_STEP(0xC05E, 0xA2, 0x0000)
+        // C060  STX $14
+        RECOMPILED_STEP(0xC060, 0x86, 0x0014)
+        // C062  CLC
+        RECOMPILED_STEP(0xC062, 0x18, 0x0000)
+        goto L_C063;
+
+    L_C063:
+        RECOMPILED_CHECK(0xC0, 0xC063)
+        // C063  ADC $03C0,X
+        RECOMPILED_STEP(0xC063, 0x7D, 0x03C0)
+        // C066  BCC $C06A
+        RECOMPILED_STEP(0xC066, 0x90, 0x0002)
+        if (c.PC == 0xC06A)
+        {
+            goto L_C06A;
+        }
+        goto L_C068;
+
+    L_C068:
+        RECOMPILED_CHECK(0xC0, 0xC068)
+        // C068  INC $14
+        RECOMPILED_STEP(0xC068, 0xE6, 0x0014)
+        goto L_C06A;
+
+    L_C06A:
+        RECOMPILED_CHECK(0xC0, 0xC06A)
+        // C06A  INX
+        RECOMPILED_STEP(0xC06A, 0xE8, 0x0000)
+        // C06B  BNE $C063
+        RECOMPILED_STEP(0xC06B, 0xD0, 0x00F6)
+        if (c.PC == 0xC063)
+        {
+            goto L_C063;
+        }
+        goto L_C06D;
+
+    L_C06D:
+        RECOMPILED_CHECK(0xC0, 0xC06D)
+        // C06D  STA $13
+        RECOMPILED_STEP(0xC06D, 0x85, 0x0013)
+        // C06F  RTS
+        RECOMPILED_STEP(0xC06F, 0x60, 0x0000)
+        goto dispatch;
+
+    L_C070:
+        RECOMPILED_CHECK(0xC0, 0xC070)
+        // C070  SED
+        RECOMPILED_STEP(0xC070, 0xF8, 0x0000)
+        // C071  LDA $12
+        RECOMPILED_STEP(0xC071, 0xA5, 0x0012)
+        // C073  CLC
+        RECOMPILED_STEP(0xC073, 0x18, 0x0000)
+        // C074  ADC #$01
+        RECOMPILED_STEP(0xC074, 0x69, 0x0001)
+        // C076  STA $12
+        RECOMPILED_STEP(0xC076, 0x85, 0x0012)
+        // C078  LDA $13
+        RECOMPILED_STEP(0xC078, 0xA5, 0x0013)
+        // C07A  SBC #$27
+        RECOMPILED_STEP(0xC07A, 0xE9, 0x0027)
+        // C07C  STA $16
+        RECOMPILED_STEP(0xC07C, 0x85, 0x0016)
+        // C07E  CLD
+        RECOMPILED_STEP(0xC07E, 0xD8, 0x0000)
+        // C07F  RTS
+        RECOMPILED_STEP(0xC07F, 0x60, 0x0000)
+        goto dispatch;
+
+    L_C100:
+        RECOMPILED_CHECK(0xC1, 0xC100)
+        // C100  LDA $24
+        RECOMPILED_STEP(0xC100, 0xA5, 0x0024)
+        // C102  INC $24
+        RECOMPILED_STEP(0xC102, 0xE6, 0x0024)
+        // C104  AND #$03
+        RECOMPILED_STEP(0xC104, 0x29, 0x0003)
+        // C106  ASL A
+        RECOMPILED_STEP(0xC106, 0x0A, 0x0000)
+        // C107  TAX
+        RECOMPILED_STEP(0xC107, 0xAA, 0x0000)
+        // C108  LDA $C136,X
+        RECOMPILED_STEP(0xC108, 0xBD, 0xC136)
+        // C10B  STA $26
+        RECOMPILED_STEP(0xC10B, 0x85, 0x0026)
+        // C10D  LDA $C137,X
+        RECOMPILED_STEP(0xC10D, 0xBD, 0xC137)
+        // C110  STA $27
+        RECOMPILED_STEP(0xC110, 0x85, 0x0027)
+        // C112  JMP ($0026)
+        RECOMPILED_STEP(0xC112, 0x6C, 0x0026)
+        goto dispatch;
+
+    L_C128:
+        RECOMPILED_CHECK(0xC1, 0xC128)
+        // C128  LDA #$C1
+        RECOMPILED_STEP(0xC128, 0xA9, 0x00C1)
+        // C12A  PHA
+        RECOMPILED_STEP(0xC12A, 0x48, 0x0000)
+        // C12B  LDA #$2E
+        RECOMPILED_STEP(0xC12B, 0xA9, 0x002E)
+        // C12D  PHA
+        RECOMPILED_STEP(0xC12D, 0x48, 0x0000)
+        // C12E  RTS
+        RECOMPILED_STEP(0xC12E, 0x60, 0x0000)
+        goto dispatch;
+
+    L_C132:
+        RECOMPILED_CHECK(0xC1, 0xC132)
+        // C132  INC $15
+        RECOMPILED_STEP(0xC132, 0xE6, 0x0015)
+        // C134  RTI
+        RECOMPILED_STEP(0xC134, 0x40, 0x0000)
+        goto dispatch;
+
+    L_C135:
+        RECOMPILED_CHECK(0xC1, 0xC135)
+        // C135  RTI
+        RECOMPILED_STEP(0xC135, 0x40, 0x0000)
+        goto dispatch;
+
+    L_C200:
+        RECOMPILED_CHECK(0xC2, 0xC200)
+        // C200  LDA $10
+        RECOMPILED_STEP(0xC200, 0xA5, 0x0010)
+        // C202  STA $C206
+        RECOMPILED_STEP(0xC202, 0x8D, 0xC206)
+        RECOMPILED_CHECK(0xC2, 0xC205)
+        // C205  LDA #$00
+        RECOMPILED_STEP(0xC205, 0xA9, 0x0000)
+        // C207  CLC
+        RECOMPILED_STEP(0xC207, 0x18, 0x0000)
+        // C208  ADC #$01
+        RECOMPILED_STEP(0xC208, 0x69, 0x0001)
+        // C20A  STA $33
+        RECOMPILED_STEP(0xC20A, 0x85, 0x0033)
+        // C20C  RTS
+        RECOMPILED_STEP(0xC20C, 0x60, 0x0000)
+        goto dispatch;
+
+    dispatch:
+        switch (c.PC)
+        {
+        case 0xC000:
+            goto L_C000;
+        case 0xC009:
+            goto L_C009;
+        case 0xC00E:
+            goto L_C00E;
+        case 0xC013:
+            goto L_C013;
+        case 0xC016:
+            goto L_C016;
+        case 0xC019:
+            goto L_C019;
+        case 0xC01C:
+            goto L_C01C;
+        case 0xC01F:
+            goto L_C01F;
+        case 0xC022:
+            goto L_C022;
+        case 0xC025:
+            goto L_C025;
+        case 0xC027:
+            goto L_C027;
+        case 0xC02D:
+            goto L_C02D;
+        case 0xC02E:
+            goto L_C02E;
+        case 0xC032:
+            goto L_C032;
+        case 0xC037:
+            goto L_C037;
+        case 0xC03A:
+            goto L_C03A;
+        case 0xC043:
+            goto L_C043;
+        case 0xC044:
+            goto L_C044;
+        case 0xC054:
+            goto L_C054;
+        case 0xC05D:
+            goto L_C05D;
+        case 0xC05E:
+            goto L_C05E;
+        case 0xC063:
+            goto L_C063;
+        case 0xC068:
+            goto L_C068;
+        case 0xC06A:
+            goto L_C06A;
+        case 0xC06D:
+            goto L_C06D;
+        case 0xC070:
+            goto L_C070;
+        case 0xC100:
+            goto L_C100;
+        case 0xC128:
+            goto L_C128;
+        case 0xC132:
+            goto L_C132;
+        case 0xC135:
+            goto L_C135;
+        case 0xC200:
+            goto L_C200;
+        }
+    interpret:
+        cpu = c;
+        if (!runtime.interpret(cpu, memory, cycles))
+        {
+            return budget - cycles;
+        }
+        c = cpu;
+        goto dispatch;
+    stop:
+        cpu = c;
+        return budget - cycles;
+    }
+};
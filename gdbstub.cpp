@@ -0,0 +1,114 @@
+// GDB remote stub (see gdbstub.h) for a program image.
+//
+//   g++ -O2 -pthread gdbstub.cpp -o ./build/gdbstub
+//   ./build/gdbstub [--port N | --unix PATH] [--load ADDRESS] [--pc ADDRESS] [--history KB] IMAGE
+//
+// Loads IMAGE (raw binaries at --load, default 0), waits for one client on
+// 127.0.0.1:N (default 2159) or on the Unix socket PATH and serves it until
+// it detaches. Execution starts at --pc, else at the image's entry address,
+// else at the reset vector. ADDRESS values are hexadecimal. Up to KB
+// kilobytes (default 1024, 0 for none) of execution history are kept for
+// reverse-step and reverse-continue.
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <iostream>
+#include <string>
+
+#include "gdbstub.h"
+
+int main(int argc, char **argv)
+{
+    int port = 2159;
+    std::string unix_path, image_path;
+    Word load_address = 0;
+    int pc = -1;
+    size_t history_kb = 1024;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--port" && has_value)
+            port = std::stoi(argv[++i]);
+        else if (arg == "--unix" && has_value)
+            unix_path = argv[++i];
+        else if (arg == "--load" && has_value)
+            load_address = std::stoul(argv[++i], nullptr, 16);
+        else if (arg == "--pc" && has_value)
+            pc = std::stoul(argv[++i], nullptr, 16);
+        else if (arg == "--history" && has_value)
+            history_kb = std::stoul(argv[++i]);
+        else if (arg.rfind("--", 0) != 0 && image_path.empty())
+            image_path = arg;
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--port N | --unix PATH] [--load ADDRESS] [--pc ADDRESS] [--history KB] IMAGE"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    Image image;
+    if (image_path.empty() || !load_image_file(image_path, image, load_address))
+    {
+        std::cerr << "cannot load " << image_path << std::endl;
+        return 1;
+    }
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    load_image(memory, image);
+    cpu.PC = pc >= 0 ? Word(pc) : image.has_entry ? image.entry : Word(memory[0xFFFC] | memory[0xFFFD] << 8);
+
+    int listener;
+    if (!unix_path.empty())
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        unix_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+        unlink(unix_path.c_str());
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            std::cerr << "cannot bind " << unix_path << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            std::cerr << "cannot bind 127.0.0.1:" << port << std::endl;
+            return 1;
+        }
+    }
+    listen(listener, 1);
+    std::cout << "waiting for a debugger on " << (unix_path.empty() ? "127.0.0.1:" + std::to_string(port) : unix_path)
+              << ", PC " << to_hex(cpu.PC) << std::endl;
+
+    int connection = accept(listener, nullptr, nullptr);
+    close(listener);
+    if (connection < 0)
+    {
+        std::cerr << "accept failed" << std::endl;
+        return 1;
+    }
+    GdbStub stub(cpu, memory);
+    if (history_kb > 0)
+    {
+        stub.record_history(history_kb * 1024);
+    }
+    stub.serve(connection);
+    close(connection);
+    return 0;
+}
@@ -0,0 +1,501 @@
+#pragma once
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "debugger.h"
+#include "loader.h"
+#include "timetravel.h"
+
+// GDB remote serial protocol stub for one CPU and its Memory, so gdb, lldb or
+// any other RSP client can inspect and control a machine. handle() answers
+// one packet payload and knows nothing about transports; serve() speaks the
+// framed protocol over a connected socket (gdbstub.cpp listens for one).
+//
+// Registers, in `g` packet order and numbering: a, x, y, p, sp (8 bit) and
+// pc (16 bit, little endian). They are described by qXfer target.xml for gdb
+// and by qRegisterInfo for lldb. Breakpoints are Z0/Z1, watchpoints Z2 (write),
+// Z3 (read) and Z4 (access). With record_history() it also goes backwards:
+// bs and bc step and continue in reverse through a TimeTravel history.
+class GdbStub
+{
+public:
+    // cycles run between checks for a client interrupt while continuing
+    uint64_t slice_cycles = 100000;
+
+    // polled between slices of a continue; true stops it with SIGINT
+    std::function<bool()> interrupted;
+
+    GdbStub(CPU &cpu, Memory &memory) : cpu(cpu), memory(memory), debugger(cpu, memory) {}
+
+    Debugger &machine_debugger()
+    {
+        return debugger;
+    }
+
+    // Keeps a TimeTravel history of continues and steps from now on, so the
+    // client can reverse-step and reverse-continue (see TimeTravel for the
+    // arguments). Writes from the client to registers or memory start it over.
+    void record_history(size_t history_limit, uint64_t interval = 100000)
+    {
+        history = std::make_unique<TimeTravel>(cpu, memory, debugger, history_limit, interval);
+    }
+
+    // false once the client detached or killed the session
+    bool attached() const
+    {
+        return !done;
+    }
+
+    // the reply payload to one packet payload; "" is the empty reply, i.e. unsupported
+    std::string handle(const std::string &packet)
+    {
+        if (packet.empty())
+        {
+            return "";
+        }
+        const char *args = packet.c_str() + 1;
+        switch (packet[0])
+        {
+        case '?':
+            return last_stop;
+        case 'g':
+            return hex_bytes(register_bytes().data(), register_count + 1);
+        case 'G':
+            return write_registers(args);
+        case 'p':
+            return read_register(args);
+        case 'P':
+            return write_register(args);
+        case 'm':
+            return read_memory(args);
+        case 'M':
+            return write_memory(args);
+        case 'c':
+            return resume(args, false);
+        case 's':
+            return resume(args, true);
+        case 'b':
+            return reverse(args);
+        case 'Z':
+        case 'z':
+            return set_point(args, packet[0] == 'Z');
+        case 'H':
+            return "OK";
+        case 'D':
+            done = true;
+            return "OK";
+        case 'k':
+            done = true;
+            return "";
+        case 'q':
+            return query(packet);
+        default:
+            return "";
+        }
+    }
+
+    // "$payload#checksum", with the characters the protocol reserves escaped
+    static std::string frame(const std::string &payload)
+    {
+        std::string framed = "$";
+        Byte checksum = 0;
+        for (char c : payload)
+        {
+            if (c == '$' || c == '#' || c == '}' || c == '*')
+            {
+                framed += '}';
+                checksum += '}';
+                c ^= 0x20;
+            }
+            framed += c;
+            checksum += Byte(c);
+        }
+        framed += '#';
+        framed += hex_digits[checksum >> 4];
+        framed += hex_digits[checksum & 15];
+        return framed;
+    }
+
+    // Speaks the protocol on `fd` until the client detaches, kills the session
+    // or disconnects. A ^C from the client interrupts a continue.
+    void serve(int fd)
+    {
+        interrupted = [this, fd] {
+            pollfd request = {fd, POLLIN, 0};
+            char buffer[256];
+            ssize_t n;
+            if (poll(&request, 1, 0) > 0 && (n = read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                input.append(buffer, n);
+            }
+            // the ^C may also have come in with the packet that started the continue
+            size_t at = input.find('\x03');
+            if (at == std::string::npos)
+            {
+                return false;
+            }
+            input.erase(at, 1);
+            return true;
+        };
+        while (!done)
+        {
+            std::string packet;
+            int status = next_packet(fd, packet);
+            if (status < 0)
+            {
+                return;
+            }
+            if (status == 0)
+            {
+                send_all(fd, "-");
+                continue;
+            }
+            send_all(fd, "+" + frame(handle(packet)));
+        }
+    }
+
+private:
+    static constexpr const char *hex_digits = "0123456789abcdef";
+    static constexpr int register_count = 6; // pc is 2 of the 7 bytes
+
+    CPU &cpu;
+    Memory &memory;
+    Debugger debugger;
+    std::unique_ptr<TimeTravel> history; // after debugger, which it uses
+    std::string last_stop = "S05";
+    bool done = false;
+    std::string input; // received bytes not yet handled
+
+    static std::string hex_bytes(const Byte *bytes, size_t size)
+    {
+        std::string text;
+        for (size_t i = 0; i < size; i++)
+        {
+            text += hex_digits[bytes[i] >> 4];
+            text += hex_digits[bytes[i] & 15];
+        }
+        return text;
+    }
+
+    // parses hex digits and leaves `text` on the first other character
+    static uint32_t parse_hex(const char *&text)
+    {
+        uint32_t value = 0;
+        for (int digit; (digit = hex_digit(Byte(*text))) >= 0; text++)
+        {
+            value = value << 4 | digit;
+        }
+        return value;
+    }
+
+    std::array<Byte, register_count + 1> register_bytes() const
+    {
+        Registers r = cpu.registers();
+        return {r.A, r.X, r.Y, r.P, r.SP, Byte(r.PC & 0xFF), Byte(r.PC >> 8)};
+    }
+
+    void set_registers(const std::array<Byte, register_count + 1> &bytes)
+    {
+        cpu.set_registers({Word(bytes[5] | bytes[6] << 8), bytes[4], bytes[0], bytes[1], bytes[2], bytes[3]});
+    }
+
+    std::string write_registers(const char *args)
+    {
+        std::vector<Byte> bytes;
+        if (!parse_hex_bytes(reinterpret_cast<const Byte *>(args), std::strlen(args), bytes) ||
+            bytes.size() != register_count + 1)
+        {
+            return "E01";
+        }
+        std::array<Byte, register_count + 1> values;
+        std::copy(bytes.begin(), bytes.end(), values.begin());
+        set_registers(values);
+        forget_history();
+        return "OK";
+    }
+
+    std::string read_register(const char *args)
+    {
+        uint32_t number = parse_hex(args);
+        if (number >= register_count)
+        {
+            return "E01";
+        }
+        return hex_bytes(register_bytes().data() + number, number == 5 ? 2 : 1);
+    }
+
+    std::string write_register(const char *args)
+    {
+        uint32_t number = parse_hex(args);
+        std::vector<Byte> bytes;
+        if (number >= register_count || *args != '=' ||
+            !parse_hex_bytes(reinterpret_cast<const Byte *>(args + 1), std::strlen(args + 1), bytes) ||
+            bytes.size() != (number == 5 ? 2u : 1u))
+        {
+            return "E01";
+        }
+        std::array<Byte, register_count + 1> values = register_bytes();
+        std::copy(bytes.begin(), bytes.end(), values.begin() + number);
+        set_registers(values);
+        forget_history();
+        return "OK";
+    }
+
+    // Reads RAM and ROM as the CPU would see them, without touching devices:
+    // reading a status register could acknowledge it behind the program's
+    // back. A read stops at the first device page, E14 when it starts on one.
+    std::string read_memory(const char *args)
+    {
+        uint32_t address = parse_hex(args);
+        if (*args++ != ',')
+        {
+            return "E01";
+        }
+        uint32_t length = parse_hex(args);
+        std::string text;
+        for (uint32_t i = 0; i < length && address + i < MAX_MEMORY && memory.read_pages[(address + i) >> 8]; i++)
+        {
+            Byte value = memory.peek(address + i);
+            text += hex_bytes(&value, 1);
+        }
+        return text.empty() && length > 0 ? "E14" : text;
+    }
+
+    std::string write_memory(const char *args)
+    {
+        uint32_t address = parse_hex(args);
+        if (*args++ != ',')
+        {
+            return "E01";
+        }
+        uint32_t length = parse_hex(args);
+        std::vector<Byte> bytes;
+        if (*args++ != ':' || !parse_hex_bytes(reinterpret_cast<const Byte *>(args), std::strlen(args), bytes) ||
+            bytes.size() != length || address + length > MAX_MEMORY)
+        {
+            return "E01";
+        }
+        for (uint32_t i = 0; i < length; i++)
+        {
+            memory.write_byte(bytes[i], address + i);
+        }
+        forget_history();
+        return "OK";
+    }
+
+    // the history cannot replay changes made from outside
+    void forget_history()
+    {
+        if (history)
+        {
+            history->reset();
+        }
+    }
+
+    // "c[addr]" / "s[addr]": continues or steps, from `addr` if given
+    std::string resume(const char *args, bool single_step)
+    {
+        if (*args)
+        {
+            cpu.PC = parse_hex(args);
+            forget_history();
+        }
+        auto run = [this, single_step] {
+            if (history)
+            {
+                return single_step ? history->step() : history->run(slice_cycles);
+            }
+            return single_step ? debugger.step() : debugger.run(slice_cycles);
+        };
+        DebugStop stop = run();
+        while (!single_step && stop.reason == StopReason::none)
+        {
+            if (interrupted && interrupted())
+            {
+                return last_stop = "S02";
+            }
+            stop = run();
+        }
+        return last_stop = stop_reply(stop);
+    }
+
+    // "bs" / "bc": steps or continues backwards; reaching the start of the
+    // history stops there with replaylog:begin
+    std::string reverse(const char *args)
+    {
+        if (!history || (std::strcmp(args, "s") != 0 && std::strcmp(args, "c") != 0))
+        {
+            return "";
+        }
+        DebugStop stop{StopReason::none, 0, 0};
+        if (*args == 's' ? !history->reverse_step() : (stop = history->reverse_continue()).reason == StopReason::none)
+        {
+            return last_stop = "T05replaylog:begin;";
+        }
+        return last_stop = stop_reply(stop);
+    }
+
+    static std::string stop_reply(const DebugStop &stop)
+    {
+        switch (stop.reason)
+        {
+        case StopReason::read_watch:
+            return "T05rwatch:" + hex_word(stop.address) + ";";
+        case StopReason::write_watch:
+            return "T05watch:" + hex_word(stop.address) + ";";
+        case StopReason::illegal:
+            return "S04";
+        default:
+            return "S05";
+        }
+    }
+
+    static std::string hex_word(Word value)
+    {
+        Byte bytes[2] = {Byte(value >> 8), Byte(value & 0xFF)};
+        return hex_bytes(bytes, 2);
+    }
+
+    // "type,addr,kind"
+    std::string set_point(const char *args, bool enable)
+    {
+        Byte type = *args++ - '0';
+        if (*args++ != ',')
+        {
+            return "E01";
+        }
+        uint32_t address = parse_hex(args);
+        uint32_t length = 1;
+        if (*args == ',')
+        {
+            args++;
+            length = type >= 2 ? parse_hex(args) : 1; // the kind of a breakpoint is its size, always one opcode
+        }
+        if (type > 4 || length == 0 || address + length > MAX_MEMORY)
+        {
+            return type > 4 ? "" : "E01";
+        }
+        for (uint32_t i = 0; i < length; i++)
+        {
+            Word a = address + i;
+            if (type <= 1)
+            {
+                debugger.points.set_breakpoint(a, enable);
+            }
+            else
+            {
+                debugger.points.set_watchpoint(a, type != 2, type != 3, enable);
+            }
+        }
+        return "OK";
+    }
+
+    std::string query(const std::string &packet)
+    {
+        if (packet.rfind("qSupported", 0) == 0)
+        {
+            return history ? "PacketSize=4000;qXfer:features:read+;ReverseStep+;ReverseContinue+"
+                           : "PacketSize=4000;qXfer:features:read+";
+        }
+        if (packet == "qAttached")
+        {
+            return "1";
+        }
+        if (packet.rfind("qXfer:features:read:target.xml:", 0) == 0)
+        {
+            const char *args = packet.c_str() + std::strlen("qXfer:features:read:target.xml:");
+            uint32_t offset = parse_hex(args);
+            uint32_t length = *args == ',' ? parse_hex(++args) : 0;
+            static const std::string xml =
+                "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\"><target version=\"1.0\">"
+                "<feature name=\"org.cpu-emulator.6502\">"
+                "<reg name=\"a\" bitsize=\"8\" type=\"uint8\" regnum=\"0\"/>"
+                "<reg name=\"x\" bitsize=\"8\" type=\"uint8\"/>"
+                "<reg name=\"y\" bitsize=\"8\" type=\"uint8\"/>"
+                "<reg name=\"p\" bitsize=\"8\" type=\"uint8\"/>"
+                "<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>"
+                "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+                "</feature></target>";
+            if (offset >= xml.size())
+            {
+                return "l";
+            }
+            std::string part = xml.substr(offset, length);
+            return (offset + part.size() < xml.size() ? "m" : "l") + part;
+        }
+        if (packet.rfind("qRegisterInfo", 0) == 0)
+        {
+            const char *args = packet.c_str() + std::strlen("qRegisterInfo");
+            static const char *const info[register_count] = {
+                "name:a;bitsize:8;offset:0;",
+                "name:x;bitsize:8;offset:1;",
+                "name:y;bitsize:8;offset:2;",
+                "name:p;bitsize:8;offset:3;generic:flags;",
+                "name:sp;bitsize:8;offset:4;generic:sp;",
+                "name:pc;bitsize:16;offset:5;generic:pc;"};
+            uint32_t number = parse_hex(args);
+            if (number >= register_count)
+            {
+                return "E45";
+            }
+            return std::string(info[number]) + "encoding:uint;format:hex;set:General Purpose Registers;";
+        }
+        return "";
+    }
+
+    static bool send_all(int fd, const std::string &text)
+    {
+        for (size_t sent = 0; sent < text.size();)
+        {
+            ssize_t n = write(fd, text.data() + sent, text.size() - sent);
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += n;
+        }
+        return true;
+    }
+
+    // Reads up to the next complete packet, skipping acks and stray ^Cs.
+    // Returns 1 with its unescaped payload, 0 on a checksum error, -1 when the connection closed.
+    int next_packet(int fd, std::string &packet)
+    {
+        for (;;)
+        {
+            size_t start = input.find('$');
+            size_t end = start == std::string::npos ? start : input.find('#', start);
+            if (end != std::string::npos && end + 2 < input.size())
+            {
+                Byte checksum = 0; // over the bytes as sent, escapes included
+                packet.clear();
+                for (size_t i = start + 1; i < end; i++)
+                {
+                    checksum += Byte(input[i]);
+                }
+                for (size_t i = start + 1; i < end; i++)
+                {
+                    packet += input[i] == '}' && i + 1 < end ? char(input[++i] ^ 0x20) : input[i];
+                }
+                int expected = hex_digit(Byte(input[end + 1])) << 4 | hex_digit(Byte(input[end + 2]));
+                input.erase(0, end + 3);
+                return checksum == expected ? 1 : 0;
+            }
+            char buffer[4096];
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n <= 0)
+            {
+                return -1;
+            }
+            input.append(buffer, n);
+        }
+    }
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <iterator>
+#include <map>
+
+// Maps every value of K to a V, in intervals. Only the keys where the value
+// changes are stored, each at most once and never with the value before it,
+// so equal maps hold the same entries. K needs to be copyable and ordered by
+// operator<, V copyable, assignable and comparable with operator==; neither
+// needs a default constructor.
+template <typename K, typename V>
+class interval_map
+{
+    V m_valBegin;
+    std::map<K, V> m_map;
+
+public:
+    // constructor associates whole range of K with val
+    interval_map(V const &val) : m_valBegin(val) {}
+
+    // Assign value val to interval [keyBegin, keyEnd).
+    // Overwrite previous values in this interval.
+    // Conforming to the C++ Standard Library conventions, the interval
+    // includes keyBegin, but excludes keyEnd.
+    // If !( keyBegin < keyEnd ), this designates an empty interval,
+    // and assign must do nothing.
+    //
+    // Two lookups and one erase: O(log n) plus the entries it removes, which
+    // were each inserted by an earlier assign, so amortized O(log n).
+    void assign(K const &keyBegin, K const &keyEnd, V const &val)
+    {
+        if (!(keyBegin < keyEnd))
+        {
+            return;
+        }
+        // from keyEnd on the value stays what it was: keep or add an entry there
+        // unless it would repeat val
+        auto end = m_map.lower_bound(keyEnd);
+        if (end == m_map.end() || keyEnd < end->first)
+        {
+            V const &after = end == m_map.begin() ? m_valBegin : std::prev(end)->second;
+            if (!(after == val))
+            {
+                end = m_map.emplace_hint(end, keyEnd, after);
+            }
+        }
+        else if (end->second == val)
+        {
+            ++end;
+        }
+        // an entry at keyBegin unless the interval continues the one before it
+        auto begin = m_map.lower_bound(keyBegin);
+        V const &before = begin == m_map.begin() ? m_valBegin : std::prev(begin)->second;
+        if (!(before == val))
+        {
+            if (begin != end && !(keyBegin < begin->first))
+            {
+                begin->second = val;
+                ++begin;
+            }
+            else
+            {
+                begin = std::next(m_map.emplace_hint(begin, keyBegin, val));
+            }
+        }
+        m_map.erase(begin, end);
+    }
+
+    // look-up of the value associated with key
+    V const &operator[](K const &key) const
+    {
+        auto it = m_map.upper_bound(key);
+        if (it == m_map.begin())
+        {
+            return m_valBegin;
+        }
+        else
+        {
+            return (--it)->second;
+        }
+    }
+
+    // the value of the keys before the first entry of boundaries()
+    V const &first_value() const
+    {
+        return m_valBegin;
+    }
+
+    // each key where the value changes, with the value from there on
+    std::map<K, V> const &boundaries() const
+    {
+        return m_map;
+    }
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <cctype>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+// Read-only mmap of a whole file. Handed out through shared_ptr: every Memory
+// that maps ROM pages from it points into the same pages of the page cache, so
+// a thousand machines booting the same firmware share one copy.
+class MappedFile
+{
+public:
+    // nullptr if the file cannot be opened or mapped
+    static std::shared_ptr<const MappedFile> open(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        struct stat info;
+        void *mapping = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd); // the mapping keeps the file referenced
+        if (mapping == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        return std::shared_ptr<const MappedFile>(new MappedFile(static_cast<const Byte *>(mapping), info.st_size));
+    }
+
+    ~MappedFile()
+    {
+        munmap(const_cast<Byte *>(bytes), length);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const Byte *data() const
+    {
+        return bytes;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+private:
+    MappedFile(const Byte *bytes, size_t length) : bytes(bytes), length(length) {}
+
+    const Byte *bytes;
+    size_t length;
+};
+
+enum class ImageFormat
+{
+    raw,       // the bytes as they are, at a load address given by the caller
+    prg,       // Commodore .prg: 2 byte little endian load address, then the bytes
+    intel_hex, // ":LLAAAATT<data>CC" records
+    srecord    // Motorola "S<type><count><address><data><checksum>" records
+};
+
+// A program decoded from one of the image formats. Raw images are not copied:
+// their bytes stay in `file`.
+struct Image
+{
+    std::shared_ptr<const MappedFile> file;
+    Word raw_address = 0;
+    std::vector<MemorySegment> segments;
+    bool has_entry = false; // the format carried a start address (Intel HEX 03/05, S7/S8/S9)
+    Word entry = 0;
+};
+
+inline int hex_digit(Byte c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c = std::tolower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// the hex bytes of one record line, false on a stray character
+inline bool parse_hex_bytes(const Byte *text, size_t length, std::vector<Byte> &bytes)
+{
+    bytes.clear();
+    if (length % 2 != 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i += 2)
+    {
+        int high = hex_digit(text[i]), low = hex_digit(text[i + 1]);
+        if (high < 0 || low < 0)
+        {
+            return false;
+        }
+        bytes.push_back(high << 4 | low);
+    }
+    return true;
+}
+
+// appends to the last segment when the data continues it, records are usually contiguous
+inline bool add_image_data(Image &image, uint32_t address, const Byte *bytes, size_t size)
+{
+    if (address + size > MAX_MEMORY)
+    {
+        return false;
+    }
+    if (size == 0)
+    {
+        return true;
+    }
+    if (image.segments.empty() || image.segments.back().address + image.segments.back().bytes.size() != address)
+    {
+        image.segments.push_back({Word(address), {}});
+    }
+    std::vector<Byte> &segment = image.segments.back().bytes;
+    segment.insert(segment.end(), bytes, bytes + size);
+    return true;
+}
+
+// calls `fn(line, length)` for every non-empty line, stops at the first false
+template <typename Fn>
+bool for_each_text_line(const Byte *text, size_t size, Fn &&fn)
+{
+    size_t start = 0;
+    while (start < size)
+    {
+        size_t end = start;
+        while (end < size && text[end] != '\n' && text[end] != '\r')
+        {
+            end++;
+        }
+        if (end > start && !fn(text + start, end - start))
+        {
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+inline bool parse_prg(const Byte *bytes, size_t size, Image &image)
+{
+    if (size < 2)
+    {
+        return false;
+    }
+    return add_image_data(image, bytes[0] | bytes[1] << 8, bytes + 2, size - 2);
+}
+
+// Only the first 64 KB are addressable: extended address records must be zero.
+inline bool parse_intel_hex(const Byte *text, size_t size, Image &image)
+{
+    std::vector<Byte> record;
+    bool end_of_file = false;
+    bool ok = for_each_text_line(text, size, [&](const Byte *line, size_t length) {
+        if (end_of_file || line[0] != ':' || !parse_hex_bytes(line + 1, length - 1, record) ||
+            record.size() < 5 || record.size() != 5u + record[0])
+        {
+            return false;
+        }
+        Byte checksum = 0;
+        for (Byte b : record)
+        {
+            checksum += b;
+        }
+        if (checksum != 0)
+        {
+            return false;
+        }
+        Word address = record[1] << 8 | record[2];
+        const Byte *data = record.data() + 4;
+        switch (record[3])
+        {
+        case 0x00:
+            return add_image_data(image, address, data, record[0]);
+        case 0x01:
+            end_of_file = true;
+            return true;
+        case 0x02:
+        case 0x04:
+            return record[0] == 2 && data[0] == 0 && data[1] == 0;
+        case 0x03: // CS:IP
+        {
+            uint32_t entry = ((data[0] << 8 | data[1]) << 4) + (data[2] << 8 | data[3]);
+            image.has_entry = true;
+            image.entry = entry;
+            return record[0] == 4 && entry < MAX_MEMORY;
+        }
+        case 0x05:
+            image.has_entry = true;
+            image.entry = data[2] << 8 | data[3];
+            return record[0] == 4 && data[0] == 0 && data[1] == 0;
+        default:
+            return false;
+        }
+    });
+    return ok && end_of_file;
+}
+
+// S1/S2/S3 data records, S7/S8/S9 start address; S0 headers and S5/S6 counts are skipped.
+inline bool parse_srecord(const Byte *text, size_t size, Image &image)
+{
+    std::vector<Byte> record;
+    return for_each_text_line(text, size, [&](const Byte *line, size_t length) {
+        if (length < 4 || line[0] != 'S' || !parse_hex_bytes(line + 2, length - 2, record) ||
+            record.size() != 1u + record[0])
+        {
+            return false;
+        }
+        Byte checksum = 0;
+        for (Byte b : record)
+        {
+            checksum += b;
+        }
+        if (checksum != 0xFF)
+        {
+            return false;
+        }
+        char type = line[1];
+        size_t address_size = type == '1' || type == '9' ? 2 : type == '2' || type == '8' ? 3 : type == '3' || type == '7' ? 4 : 2;
+        if (record[0] < address_size + 1)
+        {
+            return false;
+        }
+        uint32_t address = 0;
+        for (size_t i = 0; i < address_size; i++)
+        {
+            address = address << 8 | record[1 + i];
+        }
+        const Byte *data = record.data() + 1 + address_size;
+        size_t data_size = record[0] - address_size - 1;
+        switch (type)
+        {
+        case '0':
+        case '5':
+        case '6':
+            return true;
+        case '1':
+        case '2':
+        case '3':
+            return add_image_data(image, address, data, data_size);
+        case '7':
+        case '8':
+        case '9':
+            image.has_entry = true;
+            image.entry = address;
+            return address < MAX_MEMORY;
+        default:
+            return false;
+        }
+    });
+}
+
+// .prg by extension, records by their first character, anything else is raw
+inline ImageFormat detect_format(const std::string &path, const Byte *bytes, size_t size)
+{
+    std::string extension = path.substr(path.find_last_of('.') == std::string::npos ? path.size() : path.find_last_of('.'));
+    for (char &c : extension)
+    {
+        c = std::tolower(c);
+    }
+    if (extension == ".prg")
+    {
+        return ImageFormat::prg;
+    }
+    if (size > 0 && bytes[0] == ':' && (extension == ".hex" || extension == ".ihex" || extension == ".ihx"))
+    {
+        return ImageFormat::intel_hex;
+    }
+    if (size > 1 && bytes[0] == 'S' && std::isdigit(bytes[1]) &&
+        (extension == ".s19" || extension == ".s28" || extension == ".s37" || extension == ".srec" || extension == ".mot"))
+    {
+        return ImageFormat::srecord;
+    }
+    return ImageFormat::raw;
+}
+
+// Maps `path` and decodes it; raw images are placed at `raw_address` and must fit below 64 KB.
+inline bool load_image_file(const std::string &path, Image &image, Word raw_address = 0)
+{
+    image = Image();
+    std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+    if (!file)
+    {
+        return false;
+    }
+    switch (detect_format(path, file->data(), file->size()))
+    {
+    case ImageFormat::prg:
+        return parse_prg(file->data(), file->size(), image);
+    case ImageFormat::intel_hex:
+        return parse_intel_hex(file->data(), file->size(), image);
+    case ImageFormat::srecord:
+        return parse_srecord(file->data(), file->size(), image);
+    case ImageFormat::raw:
+        break;
+    }
+    if (raw_address + file->size() > MAX_MEMORY)
+    {
+        return false;
+    }
+    image.file = std::move(file);
+    image.raw_address = raw_address;
+    return true;
+}
+
+// copies the image into RAM
+inline void load_image(Memory &memory, const Image &image)
+{
+    if (image.file)
+    {
+        memory.load(image.raw_address, image.file->data(), image.file->size());
+    }
+    for (const MemorySegment &segment : image.segments)
+    {
+        memory.load(segment.address, segment.bytes.data(), segment.bytes.size());
+    }
+}
+
+// Maps a raw image as ROM without copying it: the pages point into the file
+// mapping, shared by every Memory it is mapped into. Needs a page aligned
+// load address; a partial last page reads as zero past the end of the file.
+inline bool map_rom_image(Memory &memory, const Image &image)
+{
+    if (!image.file || image.raw_address % MEMORY_PAGE_SIZE != 0)
+    {
+        return false;
+    }
+    uint32_t pages = (image.file->size() + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    memory.map_rom(image.raw_address / MEMORY_PAGE_SIZE, pages, image.file->data(), image.file);
+    return true;
+}
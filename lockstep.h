@@ -0,0 +1,717 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+
+#include "cpu.h"
+
+// Lockstep interpreter for batches of machines that run the same program on
+// different data, e.g. fuzzing or parameter sweeps. The registers of the
+// `Lanes` machines are kept as structure-of-arrays. While every lane is at
+// the same PC and fetches the same instruction, that instruction is decoded
+// once and executed for all lanes. Register arithmetic is written as
+// branch-free loops over the lanes, which the compiler turns into SIMD.
+// Memory operands are gathered and scattered lane by lane from each
+// machine's own Memory.
+//
+// BRK, RTI, CLI, PLP, JMP (indirect) and unofficial opcodes have no
+// lockstep version. For those, each lane's scalar CPU runs one instruction,
+// and lockstep resumes if the PCs still agree. Once they don't, e.g. after
+// a branch that went different ways, each lane finishes through
+// CPU::execute.
+//
+// Each lane ends with the registers, memory and cycle count CPU::execute
+// would have given it. Lanes do not take interrupts, and lockstep needs
+// every lane to start at the same PC: if any lane has a pending NMI or an
+// asserted IRQ line, or the PCs differ, the whole batch runs lane by lane
+// through CPU::execute from the start (diverged is set).
+template <uint32_t Lanes>
+class LockstepBatch
+{
+    static_assert(Lanes == 8 || Lanes == 16 || Lanes == 32, "a batch is 8, 16 or 32 machines");
+
+public:
+    // from the last run: instructions executed once for all lanes, and
+    // instructions handed to the scalar CPUs one at a time while in lockstep
+    uint64_t lockstep_instructions = 0;
+    uint64_t scalar_steps = 0;
+    bool diverged = false;
+
+    LockstepBatch() : agreed(new DecodedInstruction[MAX_MEMORY]())
+    {
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            memories[lane] = std::make_unique<Memory>();
+            memory_of[lane] = memories[lane].get();
+            cpus[lane].reset(*memories[lane]);
+        }
+    }
+
+    LockstepBatch(const LockstepBatch &) = delete;
+    LockstepBatch &operator=(const LockstepBatch &) = delete;
+
+    // a lane's machine, to set up before run() and to read back after it
+    CPU &cpu(uint32_t lane)
+    {
+        return cpus[lane];
+    }
+
+    Memory &memory(uint32_t lane)
+    {
+        return *memories[lane];
+    }
+
+    // cycles lane `lane` used in the last run
+    uint64_t cycles(uint32_t lane) const
+    {
+        return used[lane];
+    }
+
+    // Runs every lane for `budget` cycles, as CPU::execute(budget) would.
+    void run(uint64_t budget)
+    {
+        lockstep_instructions = scalar_steps = 0;
+        clear_agreed();
+        bool uniform = true;
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            used[lane] = 0;
+            halted[lane] = false;
+            from_cpu(lane);
+            uniform &= cpus[lane].PC == cpus[0].PC && cpus[lane].pending_interrupt() == 0 &&
+                       cpus[lane].irq_lines == 0;
+        }
+        PC = cpus[0].PC;
+        diverged = !uniform || !run_lockstep(budget);
+        if (!diverged)
+        {
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                to_cpu(lane);
+            }
+        }
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            if (!halted[lane] && used[lane] < budget)
+            {
+                used[lane] += cpus[lane].execute(budget - used[lane], *memories[lane]);
+            }
+        }
+    }
+
+private:
+    enum class Step
+    {
+        next,     // executed for every lane, still in lockstep
+        fallback, // not executed, run it through the scalar CPUs
+        diverged  // executed, but the lanes no longer agree; their state is in `cpus`
+    };
+
+    static constexpr Byte decimal = CPU::decimal_flag;
+
+    alignas(32) Byte A[Lanes];
+    alignas(32) Byte X[Lanes];
+    alignas(32) Byte Y[Lanes];
+    alignas(32) Byte SP[Lanes];
+    alignas(32) Byte status[Lanes]; // as CPU::status, with N and Z in zero_result/negative_result
+    alignas(32) Byte zero_result[Lanes];
+    alignas(32) Byte negative_result[Lanes];
+    alignas(32) Byte value[Lanes]; // operand of the current instruction
+    alignas(32) Word address[Lanes];
+    alignas(32) uint64_t used[Lanes];
+    Word PC;
+    bool halted[Lanes];
+
+    CPU cpus[Lanes];
+    std::unique_ptr<Memory> memories[Lanes];
+    Memory *memory_of[Lanes];
+
+    // Instructions known to be the same in every lane, so a fetch costs one
+    // load instead of one per lane. Like Memory::decoded, a lockstep write to
+    // a page drops its entries; a scalar step drops them all.
+    std::unique_ptr<DecodedInstruction[]> agreed;
+    uint64_t agreed_pages[MEMORY_PAGE_COUNT / 64] = {};
+
+    void from_cpu(uint32_t lane)
+    {
+        const CPU &cpu = cpus[lane];
+        A[lane] = cpu.A;
+        X[lane] = cpu.X;
+        Y[lane] = cpu.Y;
+        SP[lane] = cpu.SP;
+        status[lane] = cpu.status;
+        zero_result[lane] = cpu.zero_result;
+        negative_result[lane] = cpu.negative_result;
+    }
+
+    void to_cpu(uint32_t lane)
+    {
+        CPU &cpu = cpus[lane];
+        cpu.PC = PC;
+        cpu.A = A[lane];
+        cpu.X = X[lane];
+        cpu.Y = Y[lane];
+        cpu.SP = SP[lane];
+        cpu.status = status[lane];
+        cpu.zero_result = zero_result[lane];
+        cpu.negative_result = negative_result[lane];
+    }
+
+    void clear_agreed()
+    {
+        for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+        {
+            if ((agreed_pages[page >> 6] >> (page & 63)) & 1)
+            {
+                std::memset(&agreed[page * MEMORY_PAGE_SIZE], 0, MEMORY_PAGE_SIZE * sizeof(DecodedInstruction));
+            }
+        }
+        std::memset(agreed_pages, 0, sizeof(agreed_pages));
+    }
+
+    FORCE_INLINE Byte read(uint32_t lane, Word address)
+    {
+        return memory_of[lane]->read(address);
+    }
+
+    FORCE_INLINE void store(uint32_t lane, Word address, Byte byte)
+    {
+        memory_of[lane]->store(address, byte);
+        uint32_t page = address >> 8;
+        if (__builtin_expect((agreed_pages[page >> 6] >> (page & 63)) & 1, 0))
+        {
+            std::memset(&agreed[page * MEMORY_PAGE_SIZE], 0, MEMORY_PAGE_SIZE * sizeof(DecodedInstruction));
+            agreed_pages[page >> 6] &= ~(1ull << (page & 63));
+        }
+    }
+
+    // the instruction at PC, if every lane has the same bytes there
+    NO_INLINE bool agree(DecodedInstruction &instruction)
+    {
+        instruction = {read(0, PC), 1, 0};
+        uint32_t size = 1 + CPU::predecoded_bytes(instruction.opcode);
+        for (uint32_t i = 1; i < size; i++)
+        {
+            instruction.operand |= read(0, PC + i) << (8 * (i - 1));
+        }
+        bool cacheable = memory_of[0]->is_decodable(PC, size);
+        for (uint32_t lane = 1; lane < Lanes; lane++)
+        {
+            for (uint32_t i = 0; i < size; i++)
+            {
+                Byte expected = i == 0 ? instruction.opcode : (instruction.operand >> (8 * (i - 1))) & 0xFF;
+                if (read(lane, PC + i) != expected)
+                {
+                    return false;
+                }
+            }
+            cacheable &= memory_of[lane]->is_decodable(PC, size);
+        }
+        if (cacheable)
+        {
+            agreed[PC] = instruction;
+            agreed_pages[PC >> 14] |= 1ull << ((PC >> 8) & 63);
+        }
+        return true;
+    }
+
+    // Lockstep until the first lane spends its budget or the lanes stop
+    // agreeing. Returns false in the latter case, with the lanes' state in `cpus`.
+    bool run_lockstep(uint64_t budget)
+    {
+        for (;;)
+        {
+            bool running = true;
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                running &= used[lane] < budget;
+            }
+            if (!running)
+            {
+                return true;
+            }
+
+            DecodedInstruction instruction = agreed[PC];
+            if (!instruction.valid && !agree(instruction))
+            {
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    to_cpu(lane);
+                }
+                return false;
+            }
+
+            Step step = Step::fallback;
+            switch (instruction.opcode)
+            {
+#define OPCODE_CASE(n)                                       \
+    case 0x##n:                                              \
+        step = execute_opcode<0x##n>(instruction.operand);   \
+        break;
+
+                FOR_EACH_OPCODE(OPCODE_CASE)
+#undef OPCODE_CASE
+            }
+            if (step == Step::next)
+            {
+                lockstep_instructions++;
+            }
+            else if (step == Step::diverged || !scalar_step())
+            {
+                return false;
+            }
+        }
+    }
+
+    // one instruction on every lane's CPU; false when their PCs differ afterwards or a lane stopped
+    NO_INLINE bool scalar_step()
+    {
+        scalar_steps++;
+        bool uniform = true;
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            to_cpu(lane);
+            uint64_t spent = cpus[lane].execute(1, *memories[lane]);
+            halted[lane] = spent == 0;
+            used[lane] += spent;
+            uniform &= !halted[lane] && cpus[lane].PC == cpus[0].PC;
+        }
+        clear_agreed(); // the instruction may have written anywhere, code included
+        if (!uniform)
+        {
+            return false;
+        }
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            from_cpu(lane);
+        }
+        PC = cpus[0].PC;
+        return true;
+    }
+
+    // Continues at `targets`, one per lane: in lockstep if they are all the
+    // same, else the lanes' state goes to `cpus` and lockstep ends.
+    FORCE_INLINE Step jump(const Word *targets)
+    {
+        bool uniform = true;
+        for (uint32_t lane = 1; lane < Lanes; lane++)
+        {
+            uniform &= targets[lane] == targets[0];
+        }
+        if (uniform)
+        {
+            PC = targets[0];
+            return Step::next;
+        }
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            to_cpu(lane);
+            cpus[lane].PC = targets[lane];
+        }
+        return Step::diverged;
+    }
+
+    FORCE_INLINE void set_zero_negative(Byte *reg)
+    {
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            zero_result[lane] = reg[lane];
+            negative_result[lane] = reg[lane];
+        }
+    }
+
+    template <AddressingMode Mode, bool AlwaysFixup>
+    FORCE_INLINE void operand_addresses(Word operand)
+    {
+        if constexpr (Mode == AddressingMode::zero_page || Mode == AddressingMode::absolute)
+        {
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                address[lane] = operand;
+            }
+        }
+        else if constexpr (Mode == AddressingMode::zero_page_x || Mode == AddressingMode::zero_page_y)
+        {
+            const Byte *index = Mode == AddressingMode::zero_page_x ? X : Y;
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                address[lane] = Byte(operand + index[lane]);
+            }
+        }
+        else if constexpr (Mode == AddressingMode::absolute_x || Mode == AddressingMode::absolute_y)
+        {
+            const Byte *index = Mode == AddressingMode::absolute_x ? X : Y;
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                address[lane] = operand + index[lane];
+                if constexpr (!AlwaysFixup)
+                {
+                    used[lane] += ((operand & 0xFF) + index[lane]) >> 8;
+                }
+            }
+        }
+        else if constexpr (Mode == AddressingMode::indexed_indirect)
+        {
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                Byte pointer = operand + X[lane];
+                address[lane] = read(lane, pointer) | read(lane, Byte(pointer + 1)) << 8;
+            }
+        }
+        else if constexpr (Mode == AddressingMode::indirect_indexed)
+        {
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                Word base = read(lane, operand) | read(lane, Byte(operand + 1)) << 8;
+                address[lane] = base + Y[lane];
+                if constexpr (!AlwaysFixup)
+                {
+                    used[lane] += ((base & 0xFF) + Y[lane]) >> 8;
+                }
+            }
+        }
+        else
+        {
+            static_assert(Mode == AddressingMode::zero_page, "addressing mode has no memory operand");
+        }
+    }
+
+    template <AddressingMode Mode>
+    FORCE_INLINE void read_operands(Word operand)
+    {
+        if constexpr (Mode == AddressingMode::immediate)
+        {
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                value[lane] = operand;
+            }
+        }
+        else
+        {
+            operand_addresses<Mode, false>(operand);
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                value[lane] = read(lane, address[lane]);
+            }
+        }
+    }
+
+    FORCE_INLINE bool any_decimal() const
+    {
+        Byte flags = 0;
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            flags |= status[lane];
+        }
+        return flags & decimal;
+    }
+
+    // decimal mode ADC/SBC lane by lane through the CPU's own implementation
+    template <Operation Op>
+    NO_INLINE void decimal_arithmetic()
+    {
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            CPU &cpu = cpus[lane];
+            cpu.A = A[lane];
+            cpu.status = status[lane];
+            if constexpr (Op == Operation::ADC)
+            {
+                cpu.add_with_carry(value[lane]);
+            }
+            else
+            {
+                cpu.subtract_with_carry(value[lane]);
+            }
+            A[lane] = cpu.A;
+            status[lane] = cpu.status;
+            zero_result[lane] = cpu.zero_result;
+            negative_result[lane] = cpu.negative_result;
+        }
+    }
+
+    template <Operation Op>
+    FORCE_INLINE void read_operation()
+    {
+        if constexpr (Op == Operation::LDA || Op == Operation::LDX || Op == Operation::LDY)
+        {
+            Byte *reg = Op == Operation::LDA ? A : Op == Operation::LDX ? X : Y;
+            std::memcpy(reg, value, Lanes);
+            set_zero_negative(reg);
+        }
+        else if constexpr (Op == Operation::AND || Op == Operation::ORA || Op == Operation::EOR)
+        {
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                A[lane] = Op == Operation::AND ? A[lane] & value[lane]
+                          : Op == Operation::ORA ? A[lane] | value[lane]
+                                                 : A[lane] ^ value[lane];
+            }
+            set_zero_negative(A);
+        }
+        else if constexpr (Op == Operation::ADC || Op == Operation::SBC)
+        {
+            if (__builtin_expect(any_decimal(), 0))
+            {
+                decimal_arithmetic<Op>();
+                return;
+            }
+            // SBC is ADC of the complement: A - value - (1 - C) = A + ~value + C - 256
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                Byte operand = Op == Operation::ADC ? value[lane] : Byte(~value[lane]);
+                Word sum = A[lane] + operand + (status[lane] & CPU::carry_flag);
+                Byte overflow = (~(A[lane] ^ operand) & (A[lane] ^ sum) & 0x80) >> 1;
+                status[lane] = (status[lane] & ~(CPU::carry_flag | CPU::overflow_flag)) | (sum >> 8) | overflow;
+                A[lane] = sum;
+            }
+            set_zero_negative(A);
+        }
+        else if constexpr (Op == Operation::CMP || Op == Operation::CPX || Op == Operation::CPY)
+        {
+            const Byte *reg = Op == Operation::CMP ? A : Op == Operation::CPX ? X : Y;
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                status[lane] = (status[lane] & ~CPU::carry_flag) | (reg[lane] >= value[lane] ? CPU::carry_flag : 0);
+                zero_result[lane] = reg[lane] - value[lane];
+                negative_result[lane] = reg[lane] - value[lane];
+            }
+        }
+        else
+        {
+            static_assert(Op == Operation::BIT, "not a read operation");
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                zero_result[lane] = A[lane] & value[lane];
+                negative_result[lane] = value[lane];
+                status[lane] = (status[lane] & ~CPU::overflow_flag) | (value[lane] & CPU::overflow_flag);
+            }
+        }
+    }
+
+    // ASL/LSR/ROL/ROR/INC/DEC on value[], leaving the result in value[]
+    template <Operation Op>
+    FORCE_INLINE void rmw_operation()
+    {
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            Byte v = value[lane];
+            Byte carry = status[lane] & CPU::carry_flag;
+            Byte result;
+            if constexpr (Op == Operation::ASL) { result = v << 1; carry = v >> 7; }
+            else if constexpr (Op == Operation::LSR) { result = v >> 1; carry = v & 0x01; }
+            else if constexpr (Op == Operation::ROL) { result = (v << 1) | carry; carry = v >> 7; }
+            else if constexpr (Op == Operation::ROR) { result = (v >> 1) | (carry << 7); carry = v & 0x01; }
+            else if constexpr (Op == Operation::INC) { result = v + 1; }
+            else { result = v - 1; }
+            status[lane] = (status[lane] & ~CPU::carry_flag) | carry;
+            value[lane] = result;
+            zero_result[lane] = result;
+            negative_result[lane] = result;
+        }
+    }
+
+    template <Operation Op>
+    FORCE_INLINE void implied_operation()
+    {
+        if constexpr (Op == Operation::CLC || Op == Operation::SEC) { clear_or_set(CPU::carry_flag, Op == Operation::SEC); }
+        else if constexpr (Op == Operation::CLD || Op == Operation::SED) { clear_or_set(CPU::decimal_flag, Op == Operation::SED); }
+        else if constexpr (Op == Operation::SEI) { clear_or_set(CPU::interrupt_disable_flag, true); }
+        else if constexpr (Op == Operation::CLV) { clear_or_set(CPU::overflow_flag, false); }
+        else if constexpr (Op == Operation::TAX) { std::memcpy(X, A, Lanes); set_zero_negative(X); }
+        else if constexpr (Op == Operation::TAY) { std::memcpy(Y, A, Lanes); set_zero_negative(Y); }
+        else if constexpr (Op == Operation::TXA) { std::memcpy(A, X, Lanes); set_zero_negative(A); }
+        else if constexpr (Op == Operation::TYA) { std::memcpy(A, Y, Lanes); set_zero_negative(A); }
+        else if constexpr (Op == Operation::TSX) { std::memcpy(X, SP, Lanes); set_zero_negative(X); }
+        else if constexpr (Op == Operation::TXS) { std::memcpy(SP, X, Lanes); }
+        else if constexpr (Op == Operation::INX || Op == Operation::DEX || Op == Operation::INY || Op == Operation::DEY)
+        {
+            Byte *reg = Op == Operation::INX || Op == Operation::DEX ? X : Y;
+            Byte step = Op == Operation::INX || Op == Operation::INY ? 1 : 0xFF;
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                reg[lane] += step;
+            }
+            set_zero_negative(reg);
+        }
+        else { static_assert(Op == Operation::NOP, "not an implied operation"); }
+    }
+
+    FORCE_INLINE void clear_or_set(Byte flag, bool set)
+    {
+        for (uint32_t lane = 0; lane < Lanes; lane++)
+        {
+            status[lane] = (status[lane] & ~flag) | (set ? flag : 0);
+        }
+    }
+
+    template <Operation Op>
+    FORCE_INLINE Byte branch_taken(uint32_t lane) const
+    {
+        if constexpr (Op == Operation::BCC) { return !(status[lane] & CPU::carry_flag); }
+        else if constexpr (Op == Operation::BCS) { return status[lane] & CPU::carry_flag; }
+        else if constexpr (Op == Operation::BNE) { return zero_result[lane] != 0; }
+        else if constexpr (Op == Operation::BEQ) { return zero_result[lane] == 0; }
+        else if constexpr (Op == Operation::BPL) { return !(negative_result[lane] & 0x80); }
+        else if constexpr (Op == Operation::BMI) { return negative_result[lane] >> 7; }
+        else if constexpr (Op == Operation::BVC) { return !(status[lane] & CPU::overflow_flag); }
+        else { return (status[lane] & CPU::overflow_flag) != 0; }
+    }
+
+    FORCE_INLINE void push(uint32_t lane, Byte byte)
+    {
+        store(lane, 0x0100 | SP[lane], byte);
+        SP[lane]--;
+    }
+
+    FORCE_INLINE Byte pull(uint32_t lane)
+    {
+        SP[lane]++;
+        return read(lane, 0x0100 | SP[lane]);
+    }
+
+    // The counterpart of CPU::execute_opcode for all lanes at once, PC
+    // already at the instruction (not past the opcode as in CPU).
+    template <Byte Opcode>
+    FORCE_INLINE Step execute_opcode(Word operand)
+    {
+        constexpr OpcodeInfo info = CPU::decode(Opcode);
+        constexpr Operation op = info.operation;
+        constexpr AddressingMode mode = info.mode;
+
+        if constexpr (op == Operation::ILL || op == Operation::BRK || op == Operation::RTI || op == Operation::CLI ||
+                      op == Operation::PLP || (op == Operation::JMP && mode == AddressingMode::indirect))
+        {
+            return Step::fallback;
+        }
+        else
+        {
+            Word next = PC + 1 + CPU::predecoded_bytes(Opcode);
+            for (uint32_t lane = 0; lane < Lanes; lane++)
+            {
+                used[lane] += CPU::cycle_table[Opcode];
+            }
+
+            if constexpr (is_read_operation(op))
+            {
+                read_operands<mode>(operand);
+                read_operation<op>();
+            }
+            else if constexpr (is_store_operation(op))
+            {
+                operand_addresses<mode, true>(operand);
+                const Byte *reg = op == Operation::STA ? A : op == Operation::STX ? X : Y;
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    store(lane, address[lane], reg[lane]);
+                }
+            }
+            else if constexpr (is_rmw_operation(op) && mode == AddressingMode::accumulator)
+            {
+                std::memcpy(value, A, Lanes);
+                rmw_operation<op>();
+                std::memcpy(A, value, Lanes);
+            }
+            else if constexpr (is_rmw_operation(op))
+            {
+                operand_addresses<mode, true>(operand);
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    value[lane] = read(lane, address[lane]);
+                    store(lane, address[lane], value[lane]); // the unmodified value goes back first, as in CPU
+                }
+                rmw_operation<op>();
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    store(lane, address[lane], value[lane]);
+                }
+            }
+            else if constexpr (mode == AddressingMode::relative)
+            {
+                Word target = next + int8_t(operand);
+                Byte taken = 0, all_taken = 1;
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    Byte t = branch_taken<op>(lane);
+                    taken |= t;
+                    all_taken &= t;
+                }
+                if (taken != all_taken)
+                {
+                    Word targets[Lanes];
+                    for (uint32_t lane = 0; lane < Lanes; lane++)
+                    {
+                        bool t = branch_taken<op>(lane);
+                        targets[lane] = t ? target : next;
+                        used[lane] += t ? 1 + ((target >> 8) != (next >> 8)) : 0;
+                    }
+                    return jump(targets);
+                }
+                if (taken)
+                {
+                    for (uint32_t lane = 0; lane < Lanes; lane++)
+                    {
+                        used[lane] += 1 + ((target >> 8) != (next >> 8));
+                    }
+                    next = target;
+                }
+            }
+            else if constexpr (op == Operation::JMP)
+            {
+                next = operand;
+            }
+            else if constexpr (op == Operation::JSR)
+            {
+                // the pushed return address is the last byte of the JSR, read only after the push
+                Word targets[Lanes];
+                Word return_address = PC + 2;
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    push(lane, return_address >> 8);
+                    push(lane, return_address & 0xFF);
+                    targets[lane] = read(lane, return_address) << 8 | (operand & 0xFF);
+                }
+                return jump(targets);
+            }
+            else if constexpr (op == Operation::RTS)
+            {
+                Word targets[Lanes];
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    Byte low = pull(lane);
+                    targets[lane] = Word((pull(lane) << 8 | low) + 1);
+                }
+                return jump(targets);
+            }
+            else if constexpr (op == Operation::PHA)
+            {
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    push(lane, A[lane]);
+                }
+            }
+            else if constexpr (op == Operation::PHP)
+            {
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    push(lane, status[lane] | (zero_result[lane] == 0 ? CPU::zero_flag : 0) |
+                                   (negative_result[lane] & CPU::negative_flag) | 0b00110000);
+                }
+            }
+            else if constexpr (op == Operation::PLA)
+            {
+                for (uint32_t lane = 0; lane < Lanes; lane++)
+                {
+                    A[lane] = pull(lane);
+                }
+                set_zero_negative(A);
+            }
+            else
+            {
+                implied_operation<op>();
+            }
+            PC = next;
+            return Step::next;
+        }
+    }
+};
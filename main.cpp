@@ -1,522 +1,39 @@
-#include <stdio.h>
+#include <sys/socket.h>
+
 #include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
-#include <cstdint>
+#include <random>
 #include <sstream>
-#include <iomanip>
-#include <string>
-#include <bitset>
-
-#define MAX_MEMORY 64 * 1024 // 64 Kb
-
-using Byte = uint8_t;
-using Word = uint16_t;
-
-void decrement_cycles(uint32_t &cycles, uint32_t dec_value)
-{
-    assert(cycles >= dec_value);
-    cycles -= dec_value;
-}
-
-std::string to_binary(unsigned short a)
-{
-    std::stringstream stream;
-    stream << "0b" << std::bitset<16>(a);
-    return stream.str();
-}
-
-std::string to_hex(unsigned short a)
-{
-    std::stringstream stream;
-    stream << "0x" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << a;
-    return stream.str();
-}
-
-struct Memory
-{
-    Byte data[MAX_MEMORY];
-
-    void init()
-    {
-        for (uint32_t i = 0; i < MAX_MEMORY; i++)
-        {
-            data[i] = 0;
-        }
-    }
-
-    Byte operator[](uint32_t address) const
-    {
-        return data[address];
-    }
-
-    void write_word(Word value, uint32_t address, uint32_t &cycles)
-    {
-        assert(cycles >= 2);
-        data[address] = value & 0xFF;
-        data[address + 1] = (value >> 8) & 0xFF;
-        decrement_cycles(cycles, 2);
-    }
-
-    void write_byte(Byte value, uint32_t address, uint32_t &cycles)
-    {
-        assert(cycles >= 1);
-        data[address] = value;
-        decrement_cycles(cycles, 1);
-    }
-};
-
-struct CPU
-{
-    Word PC;
-    Byte SP;
-
-    Byte A, X, Y;
-
-    // status flags
-    Byte carry_flag : 1;
-    Byte zero_flag : 1;
-    Byte interrupt_disable_flag : 1;
-    Byte decimal_flag : 1;
-    Byte break_flag : 1;
-    Byte unused_flag : 1;
-    Byte overflow_flag : 1;
-    Byte negative_flag : 1;
-
-    static constexpr Byte INS_LDA_IM = 0xA9;
-    static constexpr Byte INS_LDA_ZP = 0xA5;
-    static constexpr Byte INS_LDA_ZPX = 0xB5;
-    static constexpr Byte INS_JSR = 0x20;
-    static constexpr Byte INS_RTS = 0x60;
-    static constexpr Byte INS_LDA_ABS = 0xAD;
-    static constexpr Byte INS_STA_ZERO_PAGE = 0x85;
-    static constexpr Byte INS_STA_ABS = 0x8D;
-    static constexpr Byte INS_JMP_ABS = 0x4C;
-    static constexpr Byte INS_JMP_INDIRECT = 0x6C;
-    static constexpr Byte INS_STACK_TSX = 0xBA;
-    static constexpr Byte INS_STACK_TXS = 0x9A;
-    static constexpr Byte INS_STACK_PHA = 0x48;
-    static constexpr Byte INS_STACK_PHP = 0x08;
-    static constexpr Byte INS_STACK_PLA = 0x68;
-    static constexpr Byte INS_STACK_PLP = 0x28;
-    static constexpr Byte INS_AND_IM = 0x29;
-    static constexpr Byte INS_BIT_ZP = 0x24;
-    static constexpr Byte INS_TXA = 0x8A;
-    static constexpr Byte INS_INC_ZP_X = 0xF6;
-    static constexpr Byte INS_INC_ABS_X = 0xFE;
-    static constexpr Byte INS_NOP = 0xEA;
-    static constexpr Byte INS_RTI = 0x40;
-    static constexpr Byte INS_BRK = 0x00;
-    static constexpr Byte INS_BEQ = 0xF0;
-
-    Byte all_flags()
-    {
-        Byte flags = 0;
-        flags |= (carry_flag & 0x01) << 0;
-        flags |= (zero_flag & 0x01) << 1;
-        flags |= (interrupt_disable_flag & 0x01) << 2;
-        flags |= (decimal_flag & 0x01) << 3;
-        flags |= (break_flag & 0x01) << 4;
-        flags |= (unused_flag & 0x01) << 5;
-        flags |= (overflow_flag & 0x01) << 6;
-        flags |= (negative_flag & 0x01) << 7;
-        return flags;
-    }
-
-    void set_flags(Byte flags)
-    {
-        carry_flag = (flags >> 0) & 0x01;
-        zero_flag = (flags >> 1) & 0x01;
-        interrupt_disable_flag = (flags >> 2) & 0x01;
-        decimal_flag = (flags >> 3) & 0x01;
-        break_flag = (flags >> 4) & 0x01;
-        unused_flag = (flags >> 5) & 0x01;
-        overflow_flag = (flags >> 6) & 0x01;
-        negative_flag = (flags >> 7) & 0x01;
-    }
-
-    void reset(Memory &memory)
-    {
-        PC = 0xFFFC;
-        SP = 0xFF;
-        decimal_flag = 0;
-        A = X = Y = 0;
-        carry_flag = zero_flag = interrupt_disable_flag = decimal_flag = break_flag = overflow_flag = negative_flag = 0;
-        memory.init();
-    }
-
-    Word SP_address() const
-    {
-        return 0x0100 | SP;
-    }
-
-    void push_word_to_stack(uint32_t &cycles, Memory &memory, Word value)
-    {
-        std::cout << "Saving word value " << to_hex(value) << " on stack at address " << to_hex(SP_address()) << std::endl;
-        memory.write_byte((value) >> 8, SP_address(), cycles);
-        SP--;
-        memory.write_byte((value) & 0xFF, SP_address(), cycles);
-        SP--;
-    }
-
-    void push_byte_to_stack(uint32_t &cycles, Memory &memory, Byte value)
-    {
-        std::cout << "Saving byte value " << to_hex(value) << " on stack at address " << to_hex(SP_address()) << std::endl;
-        memory.write_byte(value, SP_address(), cycles);
-        SP--;
-    }
-
-    void write_byte_to_memory(uint32_t &cycles, Memory &memory, Byte value, Word address)
-    {
-        assert(address < MAX_MEMORY);
-        std::cout << "Writing byte value " << to_hex(value) << " at address " << to_hex(address) << std::endl;
-        memory.data[address] = value;
-        decrement_cycles(cycles, 1);
-    }
-
-    void write_word_to_memory(uint32_t &cycles, Memory &memory, Word value, Word address)
-    {
-        assert(address < MAX_MEMORY);
-        std::cout << "Writing word value " << to_hex(value) << " at address " << to_hex(address) << std::endl;
-        Byte f_byte = (value >> 8) & 0xFF;
-        Byte s_byte = value & 0xFF;
-        memory.data[address] = s_byte;
-        memory.data[address + 1] = f_byte;
-        decrement_cycles(cycles, 2);
-    }
-
-    Byte fetch_byte(uint32_t &cycles, Memory &memory)
-    {
-        decrement_cycles(cycles, 1);
-        return memory[PC++];
-    }
-
-    Word fetch_word(uint32_t &cycles, Memory &memory)
-    {
-        Byte first_byte = fetch_byte(cycles, memory);
-        Byte second_byte = fetch_byte(cycles, memory);
-
-        // little-endian -> second_byte "+" first_byte
-        return (second_byte << 8) | first_byte;
-    }
-
-    Byte read_byte_from_memory(uint32_t &cycles, Memory &memory, Word address)
-    {
-        assert(address < MAX_MEMORY);
-        decrement_cycles(cycles, 1);
-        Byte byte_value = memory.data[address];
-        std::cout << "Read BYTE value " << to_hex(byte_value) << " from memory address: " << to_hex(address) << std::endl;
-        return byte_value;
-    }
-
-    Word read_word_from_memory(uint32_t &cycles, Memory &memory, Word address)
-    {
-        assert(address < MAX_MEMORY);
-        Byte first_byte = read_byte_from_memory(cycles, memory, address);
-        Byte second_byte = read_byte_from_memory(cycles, memory, address + 1);
-        Word word_value = (second_byte << 8) | first_byte;
-        std::cout << "WORD value " << to_hex(word_value) << " from memory address: " << to_hex(address) << std::endl;
-        return word_value;
-    }
-
-    Byte read_byte_from_stack(uint32_t &cycles, Memory &memory)
-    {
-        Byte byte_value = read_byte_from_memory(cycles, memory, SP_address() + 1);
-        std::cout << "Reading 1 byte with value " << to_hex(byte_value) << " from stack starting from address " << to_hex(SP_address() + 1) << std::endl;
-        // TODO should I decrease 1 cycle for SP++?
-        SP++;
-        return byte_value;
-    }
-
-    Word read_word_from_stack(uint32_t &cycles, Memory &memory)
-    {
-        Byte s_byte = read_byte_from_stack(cycles, memory);
-        Byte f_byte = read_byte_from_stack(cycles, memory);
-        std::cout << "First byte from stack is " << to_hex(f_byte) << " second byte from stack is " << to_hex(s_byte) << std::endl;
-        return (f_byte << 8) | s_byte;
-    }
-
-    void A_reg_status()
-    {
-        zero_flag = A == 0;
-        negative_flag = (A & 0b1000000) > 0;
-    }
-
-    void execute(uint32_t cycles, Memory &memory)
-    {
-        bool stop_execution = false;
-        while (cycles > 0 && !stop_execution)
-        {
-            Byte instruction = fetch_byte(cycles, memory);
-            switch (instruction)
-            {
-            case INS_LDA_IM:
-            {
-                std::cout << "LDA IMD" << std::endl;
-                Byte value = fetch_byte(cycles, memory);
-                A = value;
-                A_reg_status();
-                std::cout << "Assigned value " << to_hex(value) << " to reg A" << std::endl;
-            }
-            break;
-
-            case INS_LDA_ZP:
-            {
-                std::cout << "LDA ZERO PAGE" << std::endl;
-                Byte zero_page_address = fetch_byte(cycles, memory);
-                A = read_byte_from_memory(cycles, memory, zero_page_address);
-                A_reg_status();
-                std::cout << "Assigned value " << std::hex << (int)A << " to reg A based on Zero Page instruction" << std::endl;
-            }
-            break;
-
-            case INS_LDA_ZPX:
-            {
-                std::cout << "LDA ZERO PAGE X" << std::endl;
-                Byte zero_page_address = fetch_byte(cycles, memory);
-                Byte new_address = zero_page_address + X;
-                A = read_byte_from_memory(cycles, memory, new_address);
-                A_reg_status();
-                std::cout << "Assigned value " << to_hex(A) << " to reg A based on Zero Page instruction" << std::endl;
-            }
-            break;
-
-            case INS_JSR:
-            {
-                std::cout << "JSR: Load new address into PC" << std::endl;
-                Word subroutine_addr = fetch_word(cycles, memory);
-                push_word_to_stack(cycles, memory, PC - 1);
-                std::cout << "Override PC old value " << to_hex(PC) << " with new value " << to_hex(subroutine_addr) << std::endl;
-                PC = subroutine_addr;
-                decrement_cycles(cycles, 1);
-            }
-            break;
-
-            case INS_RTS:
-            {
-                std::cout << "Returning from a subroutine using RTS instruction" << std::endl;
-                std::cout << "Reading program counter register from stack" << std::endl;
-                // We increment 1 because PC was added with value PC - 1 by JSR instruction
-                Word return_address = read_word_from_stack(cycles, memory) + 1;
-                std::cout << "Override old value " << to_hex(PC) << " of PC register with new value " << to_hex(return_address) << std::endl;
-                PC = return_address;
-            }
-            break;
-
-            case INS_LDA_ABS:
-            {
-                std::cout << "LDA Absolute" << std::endl;
-                Word address = fetch_word(cycles, memory);
-                A = read_byte_from_memory(cycles, memory, address);
-                A_reg_status();
-                std::cout << "Assigned value " << (int)A << " to register A" << std::endl;
-            }
-            break;
-
-            case INS_STA_ZERO_PAGE:
-            {
-                std::cout << "STA Zero Page" << std::endl;
-                Byte address = fetch_byte(cycles, memory);
-                memory.write_byte(A, address, cycles);
-                std::cout << "Value " << (int)A << " was written at memory location: " << std::hex << address << std::endl;
-            }
-            break;
-
-            case INS_STA_ABS:
-            {
-                std::cout << "STA ABSOLUTE" << std::endl;
-                Word address = fetch_word(cycles, memory);
-                memory.write_byte(A, address, cycles);
-                std::cout << "Value " << (int)A << " was written at memory location: " << std::hex << address << std::endl;
-            }
-            break;
-
-            case INS_JMP_ABS:
-            {
-                Word address = fetch_word(cycles, memory);
-                std::cout << "Jumping using JMP Absolute from " << to_hex(PC) << " to address " << to_hex(address) << std::endl;
-                PC = address;
-            }
-            break;
-
-            case INS_JMP_INDIRECT:
-            {
-                Word address = fetch_word(cycles, memory);
-                Word new_PC = read_word_from_memory(cycles, memory, address);
-                std::cout << "In the JMP instruction found address " << to_hex(address) << ", take PC address from that memory location" << std::endl;
-                std::cout << "Jumping using JMP INDIRECT from " << to_hex(PC) << " to address " << to_hex(new_PC) << std::endl;
-                PC = new_PC;
-            }
-            break;
-
-            case INS_STACK_TSX:
-            {
-                // TODO should be 2 cycles. X = SP should consume 1 cycle?
-                std::cout << "Copies the current contents of the stack register " << SP << " into the X register" << std::endl;
-                std::cout << "Setting CPU flags" << std::endl;
-                X = SP;
-                zero_flag = X == 0;
-                negative_flag = (X & 0b1000000) == 1;
-            }
-            break;
-
-            case INS_STACK_TXS:
-            {
-                std::cout << "Copy X with value " << to_hex(X) << " in SP" << std::endl;
-                SP = X;
-                cycles--;
-            }
-            break;
-
-            case INS_STACK_PHA:
-            {
-                std::cout << "Push val reg A " << to_hex(A) << " to stack" << std::endl;
-                // TODO why 3 cycles?
-                push_byte_to_stack(cycles, memory, A);
-            }
-            break;
-
-            case INS_STACK_PHP:
-            {
-                std::cout << "Push val CPU flags  " << to_hex(all_flags()) << " to stack" << std::endl;
-                push_byte_to_stack(cycles, memory, all_flags());
-            }
-            break;
-
-            case INS_STACK_PLA:
-            {
-                // TODO why 4 cycles? and not 2, 1 for fetch instruction and 1 for writting into memory
-                Byte v = read_byte_from_stack(cycles, memory);
-                std::cout << "Pull accumulator from stack from address " << to_hex(SP_address()) << " with value " << to_hex(v) << std::endl;
-                A = v;
-                A_reg_status();
-            }
-            break;
-
-            case INS_AND_IM:
-            {
-                Byte v = fetch_byte(cycles, memory);
-                std::cout << "Performing AND operation with INSTRUCTION AND IMEMEDIATE between " << to_hex(A) << " & " << to_hex(v) << std::endl;
-                A &= v;
-                std::cout << "Result between A reg and imd value: " << to_hex(A) << std::endl;
-                A_reg_status();
-            }
-            break;
-
-            case INS_STACK_PLP:
-            {
-                // TODO why 4 cycles? and not 2, 1 for fetch instruction and 1 for writting into memory
-                Byte v = read_byte_from_stack(cycles, memory);
-                std::cout << "Pull accumulator from stack from address " << to_hex(SP_address()) << " with value " << to_hex(v) << std::endl;
-                set_flags(v);
-            }
-            break;
-
-            case INS_BIT_ZP:
-            {
-                Byte memory_value = fetch_byte(cycles, memory);
-                Byte result = A & memory_value;
-                zero_flag = result == 0;
-                std::cout << "Check what bytes are set based on mask from register A = " << to_binary(A) << " and value " << to_binary(memory_value) << ", result = " << to_binary(result) << std::endl;
-                negative_flag = (memory_value & 0b10000000) > 0;
-                overflow_flag = (memory_value & 0b1000000) > 0;
-                std::cout << "N flag = " << to_binary(negative_flag) << ", V flag = " << to_binary(overflow_flag) << std::endl;
-                decrement_cycles(cycles, 1);
-            }
-            break;
-
-            case INS_TXA:
-            {
-                std::cout << "Transfer value " << to_hex(X) << " from X reg to A reg with previous value " << to_hex(A) << std::endl;
-                A = X;
-                decrement_cycles(cycles, 1);
-                A_reg_status();
-            }
-            break;
-
-            case INS_INC_ZP_X:
-            {
-                Byte zp_address = fetch_byte(cycles, memory);
-                // TODO this can be overflow of byte and we will lose some part. We take into consideration a word instead of byte ?!
-                Byte new_address = zp_address + X;
-                std::cout << "Increment value from address ZeroPage " << to_hex(zp_address) << " + X reg " << to_hex(X) << " = " << to_hex(new_address) << std::endl;
-                Byte value = read_byte_from_memory(cycles, memory, new_address);
-                std::cout << "Value from address " << to_hex(new_address) << " is " << to_hex(value) << std::endl;
-                Byte inc_value = value + 1;
-                std::cout << "Value " << to_hex(value) << " incremented is " << to_hex(inc_value) << std::endl;
-                write_byte_to_memory(cycles, memory, inc_value, new_address);
-            }
-            break;
-
-            case INS_INC_ABS_X:
-            {
-                Word im_address = fetch_word(cycles, memory);
-                Word new_address = im_address + X;
-                std::cout << "IM Address: " << to_hex(im_address) << " + " << " X: " << to_hex(X) << " = " << to_hex(new_address);
-                Word value = read_word_from_memory(cycles, memory, new_address);
-                Word inc_value = value + 1;
-                std::cout << "Value from address " << to_hex(new_address) << " is " << to_hex(value) << " and inc by 1 will be " << to_hex(inc_value) << std::endl;
-                write_word_to_memory(cycles, memory, inc_value, new_address);
-            }
-            break;
-
-            case INS_NOP:
-            {
-                std::cout << "NOP -> No instruction" << std::endl;
-                decrement_cycles(cycles, 1);
-            }
-            break;
-
-            case INS_BEQ:
-            {
-                if (zero_flag == 1)
-                {
-                    Byte relative_addr = fetch_byte(cycles, memory);
-                    Word old_pc = PC;
-                    PC += relative_addr;
-
-                    std::cout << "Zero flag is set -> jump to a new instruction using relative address " << to_hex(relative_addr) << " FROM " << to_hex(old_pc) << " TO " << to_hex(PC) << std::endl;
-                    const bool page_changed = (PC >> 8) != (old_pc >> 8);
-                    if (page_changed)
-                    {
-                        decrement_cycles(cycles, 1);
-                    }
-                }
-                else
-                {
-                    std::cout << "Zero flag is not set -> NO jump" << std::endl;
-                }
-            }
-            break;
-
-            case INS_RTI:
-            {
-                std::cout << "Pulls the processor flags from the stack followed by the program counter" << std::endl;
-                Byte flags = read_byte_from_stack(cycles, memory);
-                PC = read_word_from_memory(cycles, memory) + 1;
-                set_flags(flags);
-            }
-            break;
-
-            case INS_BRK:
-            {
-                std::cout << "The program counter and processor status are pushed on the stack then the IRQ interrupt vector at $FFFE/F is loaded into the PC and the break flag in the status set to one" << std::endl;
-                push_word_to_stack(cycles, memory, PC - 1);
-                push_byte_to_stack(cycles, memory, all_flags());
-                Word interrupt_vect_addr = 0xFFFE;
-                PC = read_word_from_memory(cycles, memory, interrupt_vect_addr);
-                break_flag = 1;
-                interrupt_disable_flag = 1;
-            }
-            break;
-
-            default:
-                std::cout << "Unknown instruction: " << to_hex(instruction) << " -> STOP execution" << std::endl;
-                stop_execution = true;
-                break;
-            }
-        }
-    }
-};
+#include <vector>
+
+#include "batch.h"
+#include "busmap.h"
+#include "conformance.h"
+#include "demo_firmware_recompiled.h"
+#include "demo_firmware.h"
+#include "gdbstub.h"
+#include "interval_map.h"
+#include "cpu.h"
+#include "loader.h"
+#include "lockstep.h"
+#include "pool.h"
+#include "replay.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "telemetry.h"
+#include "timetravel.h"
+
+// where test_recompiler finds the checked-in demo_firmware_recompiled.h: by
+// default next to this file as named on the command line, which for a
+// relative name depends on where the tests run, so set it when running them
+// elsewhere, e.g. -DCPU_SOURCE_DIR=\"$PWD\"
+#ifndef CPU_SOURCE_DIR
+#define CPU_SOURCE_DIR ""
+#endif
 
 void test_BEQ()
 {
@@ -525,10 +42,10 @@ void test_BEQ()
     cpu.reset(memory);
 
     memory.data[0xFFFC] = CPU::INS_BEQ;
-    memory.data[0xFFFD] = 0x2;
-    cpu.zero_flag = 1;
+    memory.data[0xFFFD] = 0x1;
+    cpu.set_flag(CPU::zero_flag, true);
 
-    cpu.execute(2, memory);
+    cpu.execute(3, memory);
 
     assert(cpu.PC == 0xFFFF);
 }
@@ -588,12 +105,13 @@ void test_bit_zp()
 
     memory.data[0xFFFC] = CPU::INS_BIT_ZP;
     cpu.A = 0b11000000;
-    memory.data[0xFFFD] = 0b01000000;
+    memory.data[0xFFFD] = 0x40;
+    memory.data[0x40] = 0b01000000;
 
     cpu.execute(3, memory);
-    assert(cpu.overflow_flag == 0b1);
-    assert(cpu.negative_flag == 0b0);
-    assert(cpu.zero_flag == 0b0);
+    assert(cpu.flag(CPU::overflow_flag));
+    assert(!cpu.flag(CPU::negative_flag));
+    assert(!cpu.flag(CPU::zero_flag));
 }
 
 void test_and_imd()
@@ -699,7 +217,7 @@ void test_ins_rts()
     memory.data[0x4242] = CPU::INS_LDA_IM;
     memory.data[0x4243] = 0x69;
     memory.data[0x4244] = CPU::INS_RTS;
-    cpu.execute(11, memory); // TODO how many cycles we really need (14? do I miss to decrement somewhere?)
+    assert(cpu.execute(6 + 2 + 6, memory) == 14);
 
     assert(cpu.PC == 0xFFFF);
     assert(cpu.A == 0x69);
@@ -751,23 +269,1827 @@ void test_ins_lda_abs()
     assert(cpu.A == 0x69);
 }
 
-int main()
+void test_official_opcodes()
 {
-    std::cout << "======== START EMULATING THE 6502 CPU ========" << std::endl;
-    // test_ins_jsr();
-    // test_ins_lda_abs();
-    // test_sta_zero_page();
-    // test_sta_absolute();
-    // test_ins_rts();
-    // test_jmp_absolute();
-    // test_jmp_indirect();
-    // test_pha();
-    // test_pla();
-    // test_and_imd();
-    // test_bit_zp();
-    // test_TXA();
-    // test_INC_ZP_X();
-    // test_INS_ABS_X();
-    test_BEQ();
-    return 0;
-}
\ No newline at end of file
+    int official = 0;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        if (CPU::decode(opcode).operation != Operation::ILL)
+        {
+            official++;
+        }
+    }
+    assert(official == 151);
+}
+
+void test_adc_sbc()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+
+    memory.data[0xFFFC] = CPU::INS_ADC_IM;
+    memory.data[0xFFFD] = 0x50;
+    cpu.A = 0x50;
+    cpu.execute(2, memory);
+    assert(cpu.A == 0xA0 && cpu.flag(CPU::overflow_flag) && cpu.flag(CPU::negative_flag) && !cpu.flag(CPU::carry_flag));
+
+    cpu.reset(memory);
+    memory.data[0xFFFC] = CPU::INS_SBC_IM;
+    memory.data[0xFFFD] = 0x01;
+    cpu.A = 0x00;
+    cpu.set_flag(CPU::carry_flag, true);
+    cpu.execute(2, memory);
+    assert(cpu.A == 0xFF && !cpu.flag(CPU::carry_flag) && cpu.flag(CPU::negative_flag));
+}
+
+void test_adc_sbc_decimal()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+
+    memory.data[0xFFFC] = CPU::INS_ADC_IM;
+    memory.data[0xFFFD] = 0x48;
+    cpu.set_flag(CPU::decimal_flag, true);
+    cpu.A = 0x25;
+    cpu.set_flag(CPU::carry_flag, true);
+    cpu.execute(2, memory);
+    assert(cpu.A == 0x74 && !cpu.flag(CPU::carry_flag));
+
+    cpu.reset(memory);
+    memory.data[0xFFFC] = CPU::INS_SBC_IM;
+    memory.data[0xFFFD] = 0x01;
+    cpu.set_flag(CPU::decimal_flag, true);
+    cpu.A = 0x10;
+    cpu.set_flag(CPU::carry_flag, true);
+    cpu.execute(2, memory);
+    assert(cpu.A == 0x09 && cpu.flag(CPU::carry_flag));
+}
+
+// the tables against the per-digit algorithm they were built from, for every input
+void test_decimal_tables()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    for (unsigned carry = 0; carry < 2; carry++)
+    {
+        for (unsigned a = 0; a < 256; a++)
+        {
+            for (unsigned value = 0; value < 256; value++)
+            {
+                unsigned low = (a & 0x0F) + (value & 0x0F) + carry;
+                low += low > 0x09 ? 0x06 : 0;
+                unsigned high = (a >> 4) + (value >> 4) + (low > 0x0F);
+                bool negative = high & 0x08, overflow = ~(a ^ value) & (a ^ (high << 4)) & 0x80;
+                high += high > 0x09 ? 0x06 : 0;
+                cpu.set_flags(CPU::decimal_flag | carry);
+                cpu.A = a;
+                cpu.add_with_carry(value);
+                assert(cpu.A == Byte(high << 4 | (low & 0x0F)) && cpu.flag(CPU::carry_flag) == (high > 0x0F));
+                assert(cpu.flag(CPU::negative_flag) == negative && cpu.flag(CPU::overflow_flag) == overflow);
+                assert(cpu.flag(CPU::zero_flag) == (Byte(a + value + carry) == 0));
+
+                int borrow = 1 - carry;
+                int low_difference = (a & 0x0F) - (value & 0x0F) - borrow, high_difference = (a >> 4) - (value >> 4);
+                if (low_difference < 0)
+                {
+                    low_difference -= 0x06;
+                    high_difference--;
+                }
+                high_difference -= high_difference < 0 ? 0x06 : 0;
+                Byte binary = a - value - borrow;
+                cpu.set_flags(CPU::decimal_flag | carry);
+                cpu.A = a;
+                cpu.subtract_with_carry(value);
+                assert(cpu.A == Byte((high_difference & 0x0F) << 4 | (low_difference & 0x0F)));
+                assert(cpu.flag(CPU::carry_flag) == (int(a) - int(value) - borrow >= 0));
+                assert(cpu.flag(CPU::zero_flag) == (binary == 0) && cpu.flag(CPU::negative_flag) == bool(binary & 0x80));
+            }
+        }
+    }
+
+    // NMOS: 99 + 01 = 00 with carry, but N from the intermediate $A0 and Z from the binary $9A
+    cpu.set_flags(CPU::decimal_flag);
+    cpu.A = 0x99;
+    cpu.add_with_carry(0x01);
+    assert(cpu.A == 0x00 && cpu.flag(CPU::carry_flag) && cpu.flag(CPU::negative_flag) && !cpu.flag(CPU::zero_flag));
+}
+
+void test_jmp_indirect_page_wrap()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+
+    memory.data[0xFFFC] = CPU::INS_JMP_INDIRECT;
+    memory.data[0xFFFD] = 0xFF;
+    memory.data[0xFFFE] = 0x02;
+    memory.data[0x02FF] = 0x34;
+    memory.data[0x0200] = 0x12;
+    memory.data[0x0300] = 0x56;
+
+    cpu.execute(5, memory);
+    assert(cpu.PC == 0x1234);
+}
+
+void test_loop_program()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+
+    // sum 3 five times, then stop on an unofficial opcode
+    const Byte program[] = {
+        CPU::INS_LDX_IM, 0x05,
+        CPU::INS_LDA_IM, 0x00,
+        CPU::INS_CLC,
+        CPU::INS_ADC_IM, 0x03,
+        CPU::INS_DEX,
+        CPU::INS_BNE, 0xFA,
+        CPU::INS_STA_ZERO_PAGE, 0x10,
+        0x02};
+    for (uint32_t i = 0; i < sizeof(program); i++)
+    {
+        memory.data[0x0200 + i] = program[i];
+    }
+    memory.data[0xFFFC] = CPU::INS_JMP_ABS;
+    memory.data[0xFFFD] = 0x00;
+    memory.data[0xFFFE] = 0x02;
+
+    cpu.execute(1000, memory);
+    assert(cpu.A == 15 && cpu.X == 0);
+    assert(memory[0x10] == 15);
+    assert(cpu.PC == 0x0200 + sizeof(program));
+}
+
+void test_trace_levels()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    TraceBuffer buffer(4);
+    cpu.trace = &buffer;
+
+    memory.data[0xFFFC] = CPU::INS_LDA_ZP;
+    memory.data[0xFFFD] = 0x10;
+    memory.data[0x10] = 0x42;
+
+    cpu.execute<TraceLevel::opcode>(3, memory);
+    assert(buffer.size() == 1);
+
+    buffer.clear();
+    cpu.reset(memory);
+    memory.data[0xFFFC] = CPU::INS_LDA_ZP;
+    memory.data[0xFFFD] = 0x10;
+    memory.data[0x10] = 0x42;
+
+    cpu.execute<TraceLevel::bus>(3, memory);
+    assert(buffer.size() == 3);
+    std::vector<TraceRecord> records;
+    buffer.for_each([&records](const TraceRecord &r) { records.push_back(r); });
+    assert(records[0].event == TraceEvent::opcode && records[0].address == 0xFFFC);
+    assert(records[2].event == TraceEvent::read && records[2].address == 0x10 && records[2].value == 0x42);
+    assert(format_trace_record(records[2]) == "    read  0x0042 from 0x0010");
+}
+
+void test_batch_runner()
+{
+    // count X down from a per-job start value, accumulating 3 per step into A
+    const std::vector<Byte> program = {
+        CPU::INS_LDA_IM, 0x00,
+        CPU::INS_CLC,
+        CPU::INS_ADC_IM, 0x03,
+        CPU::INS_DEX,
+        CPU::INS_BNE, 0xFA,
+        CPU::INS_STA_ZERO_PAGE, 0x10,
+        0x02};
+
+    std::vector<BatchJob> jobs;
+    for (int i = 0; i < 500; i++)
+    {
+        BatchJob job;
+        job.image.push_back({0x0200, program});
+        job.registers = {0x0200, 0xFF, 0, Byte(i % 40 + 1), 0, 0};
+        job.cycles = 10000;
+        job.capture_memory = i == 7;
+        jobs.push_back(job);
+    }
+
+    BatchRunner runner(4);
+    for (int round = 0; round < 3; round++)
+    {
+        std::vector<BatchResult> results = runner.run(jobs);
+        assert(results.size() == jobs.size());
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            Memory memory;
+            CPU cpu;
+            cpu.reset(memory);
+            memory.load(0x0200, program.data(), program.size());
+            cpu.set_registers(jobs[i].registers);
+            cpu.execute(jobs[i].cycles, memory);
+
+            assert(results[i].registers == cpu.registers());
+            assert(results[i].registers.A == Byte(3 * (i % 40 + 1)));
+            assert(results[i].memory_digest == memory.digest());
+            assert(results[i].memory.size() == (i == 7 ? MAX_MEMORY : 0));
+        }
+    }
+}
+
+void test_dirty_page_reset()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    assert(memory.dirty_page_count() == 0);
+
+    const Byte program[] = {CPU::INS_LDA_IM, 0x69, CPU::INS_STA_ABS, 0x34, 0x12, CPU::INS_STACK_PHA};
+    memory.load(0x0200, program, sizeof(program));
+    cpu.PC = 0x0200;
+    cpu.execute(9, memory);
+    assert(memory[0x1234] == 0x69 && memory[0x01FF] == 0x69);
+    assert(memory.dirty_page_count() == 3);
+    assert(memory.is_dirty_page(0x02) && memory.is_dirty_page(0x12) && memory.is_dirty_page(0x01));
+
+    memory.restore();
+    assert(memory.dirty_page_count() == 0);
+    assert(memory[0x1234] == 0 && memory[0x01FF] == 0 && memory[0x0200] == 0);
+
+    // reset clears writes straight into data too, which restore() cannot see
+    memory.data[0x3000] = 0x42;
+    memory.restore();
+    assert(memory[0x3000] == 0x42);
+    cpu.reset(memory);
+    assert(memory[0x3000] == 0 && memory.dirty_page_count() == 0);
+
+    // restore to a baseline image instead of zero
+    Memory baseline;
+    baseline.init();
+    baseline.load(0x0200, program, sizeof(program));
+    memory.assign(baseline);
+    cpu.PC = 0x0200;
+    cpu.execute(9, memory);
+    assert(memory.dirty_page_count() == 2);
+    memory.restore(baseline);
+    assert(memory.dirty_page_count() == 0);
+    assert(memory[0x1234] == 0 && memory[0x01FF] == 0 && memory[0x0200] == CPU::INS_LDA_IM);
+}
+
+struct CountingDevice : BusDevice
+{
+    Byte status = 0x80;
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+    Byte last_value = 0;
+
+    Byte read(Word) override
+    {
+        reads++;
+        return status;
+    }
+
+    void write(Word, Byte value) override
+    {
+        writes++;
+        last_value = value;
+    }
+};
+
+void test_memory_bus()
+{
+    Memory memory;
+    CPU cpu;
+    CountingDevice device;
+    Byte rom[MEMORY_PAGE_SIZE] = {};
+    rom[0x10] = 0x42;
+    memory.map_device(0xD0, 1, &device);
+    memory.map_rom(0xE0, 1, rom);
+    memory.mirror(0x08, 0x00); // $0800-$08FF shows the zero page
+    cpu.reset(memory);
+
+    const Byte program[] = {
+        CPU::INS_LDA_ABS, 0x00, 0xD0, // status register of the device
+        CPU::INS_STA_ABS, 0x01, 0xD0, // goes to the device
+        CPU::INS_LDX_ABS, 0x10, 0xE0, // ROM
+        CPU::INS_STX_ABS, 0x10, 0xE0, // dropped
+        CPU::INS_STX_ZP, 0x20,        // visible through the mirror
+        CPU::INS_LDY_ABS, 0x20, 0x08,
+    };
+    memory.load(0x0200, program, sizeof(program));
+    cpu.PC = 0x0200;
+    cpu.execute(4 + 4 + 4 + 4 + 3 + 4, memory);
+    assert(cpu.A == 0x80);
+    assert(device.writes == 1 && device.last_value == 0x80);
+    assert(cpu.X == 0x42 && rom[0x10] == 0x42 && memory.read(0xE010) == 0x42);
+    assert(cpu.Y == 0x42 && memory.read(0x0820) == 0x42 && memory[0x0020] == 0x42);
+    assert(!memory.is_dirty_page(0xD0) && !memory.is_dirty_page(0xE0));
+    assert(device.reads == 1);
+
+    // the dummy reads at PC of an interrupt entry do not reach the device
+    cpu.PC = 0xD000;
+    cpu.set_irq_line(0x01, true);
+    assert(cpu.poll_interrupts(memory) == 7 && device.reads == 1);
+    cpu.set_irq_line(0x01, false);
+
+    // pages with no device read as 0 and ignore writes
+    memory.map_device(0xC0, 1, nullptr);
+    memory.store(0xC000, 0x12);
+    assert(memory.read(0xC000) == 0 && memory[0xC000] == 0);
+
+    // back to plain RAM
+    memory.map_ram(0xC0, 1);
+    memory.map_ram(0xD0, 1);
+    memory.store(0xD001, 0x34);
+    assert(memory.read(0xD001) == 0x34 && device.writes == 1);
+}
+
+void test_self_modifying_code()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+
+    // every iteration increments the immediate operand of its own LDX
+    const Byte program[] = {
+        CPU::INS_LDX_IM, 0x11,
+        CPU::INS_STX_ZP, 0x10,
+        CPU::INS_INC_ABS, 0x01, 0x02,
+        CPU::INS_JMP_ABS, 0x00, 0x02,
+    };
+    memory.load(0x0200, program, sizeof(program));
+    cpu.PC = 0x0200;
+    cpu.execute(2 * (2 + 3 + 6 + 3) + 2, memory);
+    assert(cpu.X == 0x13 && memory[0x10] == 0x12 && memory[0x0201] == 0x13);
+
+    // writes straight into data are picked up after mark_dirty
+    memory.data[0x0201] = 0x40;
+    memory.mark_dirty(0x0201);
+    cpu.PC = 0x0200;
+    cpu.execute(2, memory);
+    assert(cpu.X == 0x40);
+}
+
+void test_status_register()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+
+    // every flag survives the trip through the packed representation; B and
+    // bit 5 are not flags and are dropped
+    for (int flags = 0; flags < 256; flags++)
+    {
+        cpu.set_flags(flags);
+        assert(cpu.all_flags() == (flags & ~(CPU::break_flag | CPU::unused_flag)));
+    }
+
+    // BIT sets N and Z independently: N = 1 and Z = 1 at the same time
+    memory.data[0xFFFC] = CPU::INS_BIT_ZP;
+    memory.data[0xFFFD] = 0x40;
+    memory.data[0x40] = 0b10000000;
+    cpu.A = 0b01111111;
+    cpu.execute(3, memory);
+    assert(cpu.flag(CPU::negative_flag) && cpu.flag(CPU::zero_flag) && !cpu.flag(CPU::overflow_flag));
+    assert((cpu.all_flags() & 0b11000010) == 0b10000010);
+
+    // PHP materializes the lazy flags, PLP splits them again
+    cpu.reset(memory);
+    const Byte program[] = {CPU::INS_LDA_IM, 0x80, CPU::INS_STACK_PHP, CPU::INS_LDA_IM, 0x00, CPU::INS_STACK_PLP};
+    memory.load(0x0200, program, sizeof(program));
+    cpu.PC = 0x0200;
+    assert(cpu.execute(2 + 3 + 2 + 4, memory) == 11 && cpu.PC == 0x0206);
+    assert(memory[0x01FF] == 0b10110000);
+    assert(cpu.flag(CPU::negative_flag) && !cpu.flag(CPU::zero_flag) && cpu.A == 0x00);
+
+    // B pulled by PLP or RTI does not leak into the status an IRQ pushes
+    const Byte pull_b[] = {CPU::INS_LDA_IM, 0x30, CPU::INS_STACK_PHA, CPU::INS_STACK_PLP};
+    const Byte rti_frame[] = {0x30, 0x00, 0x04}; // P = $30, return to $0400
+    for (bool rti : {false, true})
+    {
+        cpu.reset(memory);
+        memory.load(0x0200, pull_b, sizeof(pull_b));
+        memory.store(0x0300, CPU::INS_RTI);
+        cpu.PC = 0x0200;
+        if (rti)
+        {
+            memory.load(0x01FD, rti_frame, sizeof(rti_frame));
+            cpu.SP = 0xFC;
+            cpu.PC = 0x0300;
+        }
+        assert(cpu.execute(rti ? 6 : 2 + 3 + 4, memory) > 0 && !cpu.flag(CPU::interrupt_disable_flag));
+        cpu.set_irq_line(0x01, true);
+        assert(cpu.poll_interrupts(memory) == 7);
+        assert(memory[cpu.SP_address() + 1] == 0b00100000);
+    }
+}
+
+// acknowledges the timer interrupt when its status register is read
+struct TimerDevice : BusDevice
+{
+    CPU *cpu;
+
+    explicit TimerDevice(CPU *cpu) : cpu(cpu) {}
+
+    Byte read(Word) override
+    {
+        cpu->set_irq_line(0x01, false);
+        return 0x80;
+    }
+
+    void write(Word, Byte) override {}
+};
+
+void test_scheduler_interrupts()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    TimerDevice timer(&cpu);
+    memory.map_device(0xD0, 1, &timer);
+
+    const Byte program[] = {CPU::INS_CLI, CPU::INS_JMP_ABS, 0x01, 0x02}; // spins on its own JMP
+    const Byte irq_handler[] = {CPU::INS_INC_ZP, 0x10, CPU::INS_LDA_ABS, 0x00, 0xD0, CPU::INS_RTI};
+    const Byte nmi_handler[] = {CPU::INS_INC_ZP, 0x11, CPU::INS_RTI};
+    const Byte vectors[] = {0x00, 0x04, 0x00, 0x00, 0x00, 0x03}; // $FFFA NMI, $FFFC reset, $FFFE IRQ/BRK
+    memory.load(0x0200, program, sizeof(program));
+    memory.load(0x0300, irq_handler, sizeof(irq_handler));
+    memory.load(0x0400, nmi_handler, sizeof(nmi_handler));
+    memory.load(0xFFFA, vectors, sizeof(vectors));
+    cpu.PC = 0x0200;
+
+    // a timer that asserts IRQ every 100 cycles
+    Scheduler scheduler;
+    std::vector<uint64_t> fired;
+    std::function<void()> tick = [&] {
+        fired.push_back(scheduler.now());
+        cpu.set_irq_line(0x01, true);
+        scheduler.schedule_in(100 - scheduler.now() % 100, tick);
+    };
+    scheduler.schedule_at(100, tick);
+    Scheduler::EventId nmi = scheduler.schedule_at(550, [&] { cpu.raise_nmi(); });
+    Scheduler::EventId second_nmi = scheduler.schedule_at(560, [&] { cpu.raise_nmi(); });
+    assert(scheduler.cancel(nmi) && !scheduler.cancel(nmi));
+
+    assert(scheduler.run_until(1000, cpu, memory));
+    assert(scheduler.now() >= 1000 && scheduler.now() < 1000 + 7);
+    assert(fired.size() == 9);
+    for (size_t i = 0; i < fired.size(); i++)
+    {
+        // events fire at the first instruction boundary at or after their cycle
+        assert(fired[i] >= 100 * (i + 1) && fired[i] < 100 * (i + 1) + 7);
+    }
+    assert(memory[0x10] == 9 && memory[0x11] == 1);
+    assert(!scheduler.cancel(second_nmi) && !scheduler.cancel(second_nmi + 100)); // fired, never issued
+    assert(cpu.irq_lines == 0 && !cpu.flag(CPU::interrupt_disable_flag));
+    assert(cpu.PC >= 0x0200 && cpu.PC < 0x0204);
+
+    // the pushed status has B clear, unlike BRK
+    cpu.set_irq_line(0x01, true);
+    assert(cpu.poll_interrupts(memory) == 7);
+    assert(cpu.PC == 0x0300 && cpu.flag(CPU::interrupt_disable_flag));
+    assert((memory[cpu.SP_address() + 1] & 0b00110000) == 0b00100000);
+    assert(cpu.poll_interrupts(memory) == 0);
+}
+
+void test_image_loader()
+{
+    Image image;
+    const Byte prg[] = {0x00, 0xC0, CPU::INS_LDA_IM, 0x42};
+    assert(parse_prg(prg, sizeof(prg), image));
+    assert(image.segments.size() == 1 && image.segments[0].address == 0xC000 && image.segments[0].bytes.size() == 2);
+
+    const char hex[] = ":0300300002337A1E\r\n:02003300A942E0\r\n:0400000500000400F3\r\n:00000001FF\r\n";
+    image = Image();
+    assert(parse_intel_hex(reinterpret_cast<const Byte *>(hex), sizeof(hex) - 1, image));
+    assert(image.segments.size() == 1 && image.segments[0].address == 0x0030);
+    assert((image.segments[0].bytes == std::vector<Byte>{0x02, 0x33, 0x7A, 0xA9, 0x42}));
+    assert(image.has_entry && image.entry == 0x0400);
+    const char bad_checksum[] = ":0300300002337A1F\n:00000001FF\n";
+    assert(!parse_intel_hex(reinterpret_cast<const Byte *>(bad_checksum), sizeof(bad_checksum) - 1, image));
+
+    const char srec[] = "S00600004844521B\nS1130000285F245F2212226A000424290008237C2A\nS9030000FC\n";
+    image = Image();
+    assert(parse_srecord(reinterpret_cast<const Byte *>(srec), sizeof(srec) - 1, image));
+    assert(image.segments.size() == 1 && image.segments[0].address == 0x0000 && image.segments[0].bytes.size() == 16);
+    assert(image.segments[0].bytes[0] == 0x28 && image.segments[0].bytes[15] == 0x7C);
+    assert(image.has_entry && image.entry == 0x0000);
+
+    // a raw ROM file is mapped, not copied: two machines read the same pages
+    std::string path = (std::filesystem::temp_directory_path() / "cpu_emulator_test_rom.bin").string();
+    {
+        std::vector<Byte> rom(0x300);
+        for (size_t i = 0; i < rom.size(); i++)
+        {
+            rom[i] = i * 7;
+        }
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char *>(rom.data()), rom.size());
+    }
+    Image rom;
+    assert(load_image_file(path, rom, 0xE000));
+    std::remove(path.c_str()); // the mapping stays valid
+    auto first = std::make_unique<Memory>();
+    auto second = std::make_unique<Memory>();
+    assert(map_rom_image(*first, rom) && map_rom_image(*second, rom));
+    Image misaligned = rom;
+    misaligned.raw_address = 0xE010;
+    assert(!map_rom_image(*first, misaligned));
+    rom = misaligned = Image(); // the Memory instances keep the mapping alive
+
+    assert(first->read_pages[0xE1] == second->read_pages[0xE1]);
+    assert(first->read(0xE000 + 0x123) == Byte(0x123 * 7) && second->read(0xE2FF) == Byte(0x2FF * 7));
+    first->store(0xE001, 0x00);
+    assert(first->read(0xE001) == 7);
+    assert(!load_image_file("/nonexistent/rom.bin", rom));
+}
+
+void test_profiler()
+{
+    // three calls of $0300, each of which calls $0400
+    const Byte program[] = {CPU::INS_JSR, 0x00, 0x03, CPU::INS_DEX, CPU::INS_BNE, 0xFA, 0x02};
+    const Byte outer[] = {CPU::INS_JSR, 0x00, 0x04, CPU::INS_RTS};
+    const Byte inner[] = {CPU::INS_INY, CPU::INS_RTS};
+
+    Memory memory;
+    CPU cpu;
+    Profiler profiler;
+    cpu.profiler = &profiler;
+    cpu.reset(memory);
+    memory.load(0x0200, program, sizeof(program));
+    memory.load(0x0300, outer, sizeof(outer));
+    memory.load(0x0400, inner, sizeof(inner));
+    cpu.PC = 0x0200;
+    cpu.X = 3;
+    uint64_t used = cpu.execute<TraceLevel::profile>(1000, memory);
+
+    // same machine state as an unprofiled run
+    Memory plain_memory;
+    CPU plain;
+    plain.reset(plain_memory);
+    plain_memory.assign(memory);
+    plain.set_registers({0x0200, 0xFF, 0, 3, 0, cpu.registers().P});
+    assert(plain.execute(1000, plain_memory) == used);
+    assert(plain.registers() == cpu.registers() && cpu.Y == 3);
+
+    assert(profiler.total_cycles() == used);
+    assert(profiler.pc_hits[0x0200] == 3 && profiler.pc_hits[0x0400] == 3 && profiler.pc_hits[0x0206] == 1);
+    assert(profiler.opcode_counts[CPU::INS_JSR] == 6 && profiler.opcode_counts[CPU::INS_RTS] == 6);
+    assert(profiler.current == 0);
+
+    std::vector<Profiler::CallEdge> edges = profiler.call_edges();
+    assert(edges.size() == 2);
+    assert(edges[0].caller == 0x0000 && edges[0].callee == 0x0300 && edges[0].calls == 3);
+    assert(edges[1].caller == 0x0300 && edges[1].callee == 0x0400 && edges[1].calls == 3);
+
+    std::ostringstream stacks;
+    profiler.write_collapsed_stacks(stacks);
+    assert(stacks.str().find("root;$0300;$0400 ") != std::string::npos);
+    std::ostringstream histogram;
+    write_opcode_histogram(histogram, profiler);
+    assert(histogram.str().find("0x20 JSR absolute") == 0);
+
+    // recursion past max_depth stays in the deepest frame until it has returned as often as it called
+    profiler.clear();
+    const uint32_t calls = Profiler::max_depth + 10, kept = Profiler::max_depth - 1;
+    for (uint32_t i = 0; i < calls; i++)
+    {
+        profiler.call(0x0300);
+    }
+    uint32_t deepest = profiler.current;
+    assert(profiler.frames[deepest].depth == kept && profiler.dropped_calls == calls - kept);
+    for (uint32_t i = 0; i < calls - kept; i++)
+    {
+        profiler.return_from_call();
+        assert(profiler.current == deepest);
+    }
+    for (uint32_t i = 0; i < kept; i++)
+    {
+        profiler.return_from_call();
+    }
+    assert(profiler.current == 0 && profiler.frames[profiler.current].depth == 0);
+}
+
+// $D000 reads a random number, reading $D001 acknowledges the timer interrupt
+struct NoiseDevice : BusDevice
+{
+    CPU *cpu;
+    std::mt19937 random{std::random_device{}()};
+
+    explicit NoiseDevice(CPU *cpu) : cpu(cpu) {}
+
+    Byte read(Word address) override
+    {
+        if (address == 0xD001)
+        {
+            cpu->set_irq_line(0x01, false);
+            return 0x80;
+        }
+        return random();
+    }
+
+    void write(Word, Byte) override {}
+};
+
+void test_record_replay()
+{
+    const Byte program[] = {CPU::INS_CLI,
+                            CPU::INS_LDA_ABS, 0x00, 0xD0,
+                            CPU::INS_AND_IM, 0x0F,
+                            CPU::INS_TAX,
+                            CPU::INS_INC_ABS_X, 0x00, 0x03,
+                            CPU::INS_JMP_ABS, 0x01, 0x02};
+    const Byte irq_handler[] = {CPU::INS_INC_ZP, 0x10, CPU::INS_LDA_ABS, 0x01, 0xD0, CPU::INS_RTI};
+    const Byte nmi_handler[] = {CPU::INS_INC_ZP, 0x11, CPU::INS_RTI};
+    const Byte vectors[] = {0x10, 0x04, 0x00, 0x00, 0x00, 0x04};
+
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    NoiseDevice noise(&cpu);
+    memory.load(0x0200, program, sizeof(program));
+    memory.load(0x0400, irq_handler, sizeof(irq_handler));
+    memory.load(0x0410, nmi_handler, sizeof(nmi_handler));
+    memory.load(0xFFFA, vectors, sizeof(vectors));
+    cpu.PC = 0x0200;
+
+    Scheduler scheduler;
+    std::function<void()> tick = [&] {
+        cpu.set_irq_line(0x01, true);
+        scheduler.schedule_in(97, tick);
+    };
+    scheduler.schedule_at(97, tick);
+    scheduler.schedule_at(5003, [&] { cpu.raise_nmi(); });
+
+    // a hook installed before recording keeps being called and is put back afterwards
+    uint32_t hooked_interrupts = 0;
+    scheduler.on_interrupt = [&](uint64_t, Word) { hooked_interrupts++; };
+
+    ReplayLog log;
+    {
+        Recorder recorder(cpu, memory, scheduler, 1000);
+        memory.map_device(0xD0, 1, recorder.wrap(&noise));
+        assert(scheduler.run_until(20000, cpu, memory));
+        log = recorder.finish();
+    }
+    assert(log.keyframes.size() == 21);
+    assert(memory[0x10] > 150 && memory[0x11] == 1);
+    assert(hooked_interrupts >= memory[0x10] + 1u && scheduler.on_interrupt);
+
+    // the log is a small fraction of the state it reproduces
+    std::vector<Byte> bytes = log.serialize();
+    assert(bytes.size() < 8000);
+    ReplayLog loaded;
+    assert(loaded.deserialize(bytes.data(), bytes.size()));
+    assert(loaded.keyframes.size() == log.keyframes.size() && loaded.reads == log.reads);
+    assert(!loaded.deserialize(bytes.data(), bytes.size() - 1));
+    loaded.deserialize(bytes.data(), bytes.size());
+
+    // replays on a machine without the device or the scheduler, from the
+    // start and from a keyframe in the middle
+    for (size_t start : {size_t(0), size_t(7)})
+    {
+        Memory replay_memory;
+        CPU replay_cpu;
+        replay_cpu.reset(replay_memory);
+        Replayer replayer(loaded);
+        replay_memory.map_device(0xD0, 1, replayer.device());
+        replayer.seek(start, replay_cpu, replay_memory);
+        assert(replayer.matches(start, replay_cpu, replay_memory));
+        assert(replayer.run_until(log.keyframes[12].clock, replay_cpu, replay_memory));
+        assert(replayer.matches(12, replay_cpu, replay_memory));
+        assert(replayer.run_to_end(replay_cpu, replay_memory));
+        assert(!replayer.diverged());
+        assert(replayer.now() == scheduler.now());
+        assert(replay_cpu.registers() == cpu.registers());
+        assert(replay_memory.digest() == memory.digest());
+    }
+}
+
+void test_conformance_runner()
+{
+    // LDA #$42, STA $10, an unofficial opcode, LDA #$00 with a wrong expected Z flag, and TAX, PHA and
+    // LDA $10FF,X crossing a page, whose bus logs hold dummy reads
+    const char suite[] = R"([
+ {"name": "a9 42", "initial": {"pc": 4096, "s": 253, "a": 0, "x": 0, "y": 0, "p": 36, "ram": [[4096, 169], [4097, 66]]},
+  "final": {"pc": 4098, "s": 253, "a": 66, "x": 0, "y": 0, "p": 36, "ram": [[4096, 169], [4097, 66]]},
+  "cycles": [[4096, 169, "read"], [4097, 66, "read"]]},
+ {"name": "85 10", "initial": {"pc": 8192, "s": 253, "a": 153, "x": 0, "y": 0, "p": 164, "ram": [[8192, 133], [8193, 16], [16, 0]]},
+  "final": {"pc": 8194, "s": 253, "a": 153, "x": 0, "y": 0, "p": 164, "ram": [[8192, 133], [8193, 16], [16, 153]]},
+  "cycles": [[8192, 133, "read"], [8193, 16, "read"], [16, 153, "write"]]},
+ {"name": "02", "initial": {"pc": 0, "s": 0, "a": 0, "x": 0, "y": 0, "p": 0, "ram": [[0, 2]]},
+  "final": {"pc": 1, "s": 0, "a": 0, "x": 0, "y": 0, "p": 0, "ram": [[0, 2]]}, "cycles": [[0, 2, "read"]]},
+ {"name": "a9 00", "initial": {"pc": 4096, "s": 253, "a": 1, "x": 0, "y": 0, "p": 36, "ram": [[4096, 169], [4097, 0]]},
+  "final": {"pc": 4098, "s": 253, "a": 0, "x": 0, "y": 0, "p": 36, "ram": []},
+  "cycles": [[4096, 169, "read"], [4097, 0, "read"]]},
+ {"name": "aa", "initial": {"pc": 12288, "s": 253, "a": 128, "x": 0, "y": 0, "p": 36, "ram": [[12288, 170], [12289, 7]]},
+  "final": {"pc": 12289, "s": 253, "a": 128, "x": 128, "y": 0, "p": 164, "ram": [[12288, 170], [12289, 7]]},
+  "cycles": [[12288, 170, "read"], [12289, 7, "read"]]},
+ {"name": "48", "initial": {"pc": 16384, "s": 253, "a": 90, "x": 0, "y": 0, "p": 36, "ram": [[16384, 72], [16385, 1], [509, 0]]},
+  "final": {"pc": 16385, "s": 252, "a": 90, "x": 0, "y": 0, "p": 36, "ram": [[16384, 72], [16385, 1], [509, 90]]},
+  "cycles": [[16384, 72, "read"], [16385, 1, "read"], [509, 90, "write"]]},
+ {"name": "bd ff 10", "initial": {"pc": 20480, "s": 253, "a": 0, "x": 1, "y": 0, "p": 38, "ram": [[20480, 189], [20481, 255], [20482, 16], [4096, 3], [4352, 7]]},
+  "final": {"pc": 20483, "s": 253, "a": 7, "x": 1, "y": 0, "p": 36, "ram": [[4096, 3], [4352, 7]]},
+  "cycles": [[20480, 189, "read"], [20481, 255, "read"], [20482, 16, "read"], [4096, 3, "read"], [4352, 7, "read"]]}
+])";
+    size_t count = 0;
+    assert(for_each_single_step_case(reinterpret_cast<const Byte *>(suite), sizeof(suite) - 1, [&](const SingleStepCase &test) {
+        count++;
+        assert(test.cycles.size() == (test.name == "85 10" || test.name == "48" ? 3u
+                                      : test.name == "02"                 ? 1u
+                                      : test.name == "bd ff 10"           ? 5u
+                                                                          : 2u));
+    }));
+    assert(count == 7);
+    assert(!for_each_single_step_case(reinterpret_cast<const Byte *>(suite), sizeof(suite) - 3, [](const SingleStepCase &) {}));
+
+    std::string path = (std::filesystem::temp_directory_path() / "cpu_emulator_test_suite.json").string();
+    {
+        std::ofstream(path, std::ios::binary) << suite;
+    }
+    for (bool check_bus : {false, true})
+    {
+        ConformanceReport report = run_conformance({path, path}, 2, check_bus);
+        assert(report.errors.empty() && report.cases() == 14 && report.failed() == 2);
+        assert(report.opcodes[0x85].passed == 2 && report.opcodes[0x02].skipped == 2);
+        assert(report.opcodes[0xAA].passed == 2 && report.opcodes[0x48].passed == 2 && report.opcodes[0xBD].passed == 2);
+        const OpcodeReport &lda = report.opcodes[0xA9];
+        assert(lda.passed == 2 && lda.register_failures == 2 && lda.cycle_failures == 0 && lda.bus_failures == 0);
+        assert(lda.first_failure.rfind("a9 00: ", 0) == 0);
+    }
+    assert(run_conformance({path + ".missing"}, 1).errors.size() == 1);
+    std::filesystem::remove(path);
+}
+
+void test_memory_snapshot()
+{
+    auto memory = std::make_unique<Memory>();
+    memory->init();
+    MemorySnapshot golden(*memory);
+    uint64_t golden_digest = memory->digest();
+    assert(golden.diff(*memory).empty());
+
+    // a run across the page boundary at $0300, a single byte and a whole page
+    for (Word address = 0x02F0; address < 0x0310; address++)
+    {
+        memory->store(address, 0xAA);
+    }
+    memory->store(0x8001, 0x01);
+    for (Word address = 0xC000; address < 0xC100; address++)
+    {
+        memory->store(address, Byte(address) | 1);
+    }
+    const std::vector<MemoryRange> expected = {{0x02F0, 0x20}, {0x8001, 1}, {0xC000, 0x100}};
+    assert(golden.diff(*memory) == expected && golden.diff_dirty(*memory) == expected);
+
+    // every kernel agrees with a byte by byte comparison on scattered changes
+    std::mt19937 random(1);
+    for (int i = 0; i < 2000; i++)
+    {
+        memory->store(random(), random());
+    }
+    std::vector<MemoryRange> reference;
+    for (uint32_t address = 0; address < MAX_MEMORY; address++)
+    {
+        if (memory->data[address] == golden.data()[address])
+        {
+            continue;
+        }
+        if (!reference.empty() && reference.back().address + reference.back().length == address)
+        {
+            reference.back().length++;
+        }
+        else
+        {
+            reference.push_back({Word(address), 1});
+        }
+    }
+    std::vector<PageDiffKernel> kernels = {page_diff_scalar};
+#if SNAPSHOT_X86
+    kernels.push_back(page_diff_sse2);
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.push_back(page_diff_avx2);
+    }
+#endif
+    for (PageDiffKernel kernel : kernels)
+    {
+        assert(diff_memory(golden.data(), memory->data, kernel) == reference);
+    }
+    assert(golden.diff_dirty(*memory) == reference);
+
+    // restore copies only the pages that differ and drops their predecoded code
+    memory->store(0x0200, CPU::INS_NOP);
+    CPU cpu;
+    cpu.PC = 0x0200;
+    cpu.execute(2, *memory);
+    uint32_t pages = 0;
+    memory->for_each_dirty_page([&](uint32_t page) { pages += std::memcmp(memory->data + page * 256, golden.data() + page * 256, 256) != 0; });
+    assert(golden.restore(*memory) == pages);
+    assert(golden.diff(*memory).empty() && memory->digest() == golden_digest);
+    assert(memory->decoded[0x0200].valid == 0);
+}
+
+void test_cycle_model()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+
+    struct Case
+    {
+        std::vector<Byte> code;
+        Byte X, Y;
+        uint64_t cycles;
+    };
+    const Case cases[] = {
+        {{CPU::INS_LDA_ABSX, 0x10, 0x20}, 0x01, 0, 4},  // same page
+        {{CPU::INS_LDA_ABSX, 0xFF, 0x20}, 0x01, 0, 5},  // page crossed
+        {{CPU::INS_STA_ABSX, 0x10, 0x20}, 0x01, 0, 5},  // stores always take the extra cycle...
+        {{CPU::INS_STA_ABSX, 0xFF, 0x20}, 0x01, 0, 5},  // ...and never more
+        {{CPU::INS_INC_ABS_X, 0xFF, 0x20}, 0x01, 0, 7},
+        {{CPU::INS_LDA_INDY, 0x80}, 0, 0x10, 6},        // ($80) = $20F8, +$10 crosses
+        {{CPU::INS_STACK_PLA}, 0, 0, 4},
+        {{CPU::INS_STACK_PLP}, 0, 0, 4},
+        {{CPU::INS_BNE, 0x10}, 0, 0, 3},                // taken (Z clear), same page
+        {{CPU::INS_BNE, 0x80}, 0, 0, 4},                // taken into the previous page
+        {{CPU::INS_BEQ, 0x80}, 0, 0, 2},                // not taken
+    };
+    for (const Case &c : cases)
+    {
+        cpu.reset(memory);
+        memory.load(0x0200, c.code.data(), c.code.size());
+        memory.data[0x80] = 0xF8;
+        memory.data[0x81] = 0x20;
+        cpu.set_flags(0);
+        cpu.set_zero_negative(1);
+        cpu.PC = 0x0200;
+        cpu.X = c.X;
+        cpu.Y = c.Y;
+        assert(cpu.execute(1, memory) == c.cycles);
+    }
+
+    // the instruction that exhausts the budget runs to its end; an unofficial opcode stops early and costs nothing
+    cpu.reset(memory);
+    const Byte program[] = {CPU::INS_NOP, CPU::INS_JSR, 0x00, 0x03, 0x02};
+    const Byte subroutine[] = {0x02};
+    memory.load(0x0200, program, sizeof(program));
+    memory.load(0x0300, subroutine, sizeof(subroutine));
+    cpu.PC = 0x0200;
+    assert(cpu.execute(3, memory) == 2 + 6 && cpu.PC == 0x0300);
+    assert(cpu.execute(10, memory) == 0);
+}
+
+void test_telemetry()
+{
+    // a full ring drops and counts instead of blocking
+    SpscRing<uint32_t> small(2);
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        assert(small.try_push(i) == (i < 4));
+    }
+    assert(small.dropped() == 2);
+    std::vector<uint32_t> drained;
+    assert(small.drain([&](uint32_t value) { drained.push_back(value); }) == 4);
+    assert((drained == std::vector<uint32_t>{0, 1, 2, 3}));
+    assert(small.try_push(4) && small.drain([](uint32_t) {}) == 1);
+
+    // across threads: records arrive in order and every one is either delivered or counted
+    Telemetry channel(6);
+    uint64_t received = 0, last = 0;
+    bool ordered = true;
+    TelemetryMonitor consumer(channel.ring, [&](const TelemetryRecord &record) {
+        ordered &= received == 0 || record.cycle > last;
+        last = record.cycle;
+        received++;
+    }, std::chrono::microseconds(50));
+    const uint64_t published = 200000;
+    for (uint64_t i = 1; i <= published; i++)
+    {
+        channel.ring.try_push({i, 0, TelemetryKind::sample, 0, 0, {}});
+    }
+    consumer.stop();
+    assert(ordered && received + channel.ring.dropped() == published);
+
+    // a running machine: register samples from the scheduler, writes from a tapped page
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    const Byte program[] = {CPU::INS_INC_ABS, 0x10, 0x02, CPU::INS_JMP_ABS, 0x00, 0x03};
+    memory.load(0x0300, program, sizeof(program));
+    cpu.PC = 0x0300;
+
+    Scheduler scheduler;
+    Telemetry telemetry(15); // room for the whole run, so nothing is dropped however the threads interleave
+    telemetry.sample_every(1000, scheduler, cpu);
+    telemetry.tap_writes(memory, scheduler, 0x02, 1);
+    TelemetrySummary summary;
+    std::ostringstream log;
+    {
+        TelemetryMonitor monitor(telemetry.ring, [&](const TelemetryRecord &record) {
+            summary.add(record);
+            write_telemetry_record(log, record);
+        });
+        assert(scheduler.run_until(20000, cpu, memory));
+        telemetry.stop_sampling();
+        assert(scheduler.run_until(30000, cpu, memory));
+    }
+    assert(telemetry.ring.dropped() == 0);
+    assert(summary.samples >= 19 && summary.samples <= 20);
+    assert(summary.cycle >= 19000 && summary.cycle < 20000 + 9);
+    assert(summary.registers.PC == 0x0300 || summary.registers.PC == 0x0303);
+    assert(summary.writes >= 30000 / 9 && summary.recent_writes.size() == TelemetrySummary::recent_write_count);
+    assert(summary.recent_writes.back().address == 0x0210 && summary.recent_writes.back().value == memory.data[0x0210]);
+    assert(memory[0x0210] == memory.data[0x0210]); // the tapped page still behaves as RAM
+    assert(log.str().find(" sample PC ") != std::string::npos && log.str().find(" write ") != std::string::npos);
+}
+
+void test_breakpoints()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    const Byte program[] = {CPU::INS_LDA_ZP, 0x10, CPU::INS_STA_ZERO_PAGE, 0x11, CPU::INS_INX, CPU::INS_JMP_ABS, 0x04, 0x02};
+    memory.load(0x0200, program, sizeof(program));
+    memory.data[0x0300] = 0x02; // unofficial
+    cpu.PC = 0x0200;
+
+    // nothing armed: runs like execute
+    Debugger debugger(cpu, memory);
+    assert(cpu.breakpoints == &debugger.points && !debugger.points.armed());
+    DebugStop stop = debugger.run(100);
+    assert(stop.reason == StopReason::none && stop.cycles >= 100 && stop.cycles < 100 + 3);
+
+    // a breakpoint stops before its instruction; continuing from it runs it
+    cpu.PC = 0x0200;
+    cpu.X = 0;
+    debugger.points.set_breakpoint(0x0204);
+    assert(debugger.points.armed());
+    stop = debugger.run(1000);
+    assert(stop.reason == StopReason::breakpoint && stop.address == 0x0204 && stop.cycles == 3 + 3);
+    assert(cpu.PC == 0x0204 && cpu.X == 0);
+    stop = debugger.run(1000);
+    assert(stop.reason == StopReason::breakpoint && stop.cycles == 2 + 3 && cpu.X == 1);
+    stop = debugger.step();
+    assert(stop.reason == StopReason::none && stop.cycles == 2 && cpu.PC == 0x0205 && cpu.X == 2);
+    assert(Breakpoints::test(debugger.points.execute, 0x0204));
+    // a breakpoint on the first instruction of a plain execute stops right away
+    cpu.PC = 0x0204;
+    assert(cpu.execute<TraceLevel::debug>(100, memory) == 0 && cpu.breakpoints->reason == StopReason::breakpoint);
+    debugger.points.set_breakpoint(0x0204, false);
+    assert(!debugger.points.armed());
+
+    // watchpoints stop after the instruction that accessed the address
+    debugger.points.set_watchpoint(0x10, true, false);
+    cpu.PC = 0x0200;
+    stop = debugger.run(1000);
+    assert(stop.reason == StopReason::read_watch && stop.address == 0x10 && cpu.PC == 0x0202 && stop.cycles == 3);
+    debugger.points.clear();
+    debugger.points.set_watchpoint(0x11, false, true);
+    debugger.points.set_watchpoint(0x10, false, true); // only written to, never by this program
+    cpu.PC = 0x0200;
+    stop = debugger.run(1000);
+    assert(stop.reason == StopReason::write_watch && stop.address == 0x11 && cpu.PC == 0x0204);
+    assert(debugger.points.count == 2);
+
+    // stack pushes are writes too
+    debugger.points.clear();
+    debugger.points.set_watchpoint(cpu.SP_address(), false, true);
+    memory.data[0x0400] = CPU::INS_STACK_PHA;
+    cpu.PC = 0x0400;
+    stop = debugger.step();
+    assert(stop.reason == StopReason::write_watch && stop.address == 0x01FF);
+
+    debugger.points.clear();
+    cpu.PC = 0x0300;
+    stop = debugger.run(1000);
+    assert(stop.reason == StopReason::illegal && stop.cycles == 0);
+}
+
+void test_gdb_stub()
+{
+    Memory memory;
+    CPU cpu;
+    cpu.reset(memory);
+    const Byte program[] = {CPU::INS_LDA_ZP, 0x10, CPU::INS_STA_ZERO_PAGE, 0x11, CPU::INS_INX, CPU::INS_JMP_ABS, 0x04, 0x02};
+    memory.load(0x0200, program, sizeof(program));
+    cpu.set_registers({0x1234, 0xFD, 0x01, 0x02, 0x03, 0x24});
+
+    GdbStub stub(cpu, memory);
+    assert(stub.handle("g") == "01020304fd3412"); // bit 5 of P is not kept
+    assert(stub.handle("P5=0002") == "OK" && cpu.PC == 0x0200 && stub.handle("p5") == "0002");
+    assert(stub.handle("P1=7f") == "OK" && cpu.X == 0x7F && stub.handle("p1") == "7f");
+    assert(stub.handle("G01020324fd0002") == "OK" && cpu.X == 0x02 && cpu.PC == 0x0200);
+    assert(stub.handle("M10,2:2a00") == "OK" && stub.handle("m10,2") == "2a00" && memory[0x10] == 0x2A);
+    assert(stub.handle("m200,3") == "a510" + std::string("85"));
+    assert(stub.handle("?") == "S05");
+
+    // memory reads stop short of device pages and never reach the device
+    CountingDevice device;
+    memory.map_device(0x30, 1, &device);
+    memory.store(0x2FFF, 0x5A);
+    assert(stub.handle("m2fff,2") == "5a" && stub.handle("m3000,1") == "E14" && device.reads == 0);
+    memory.map_ram(0x30, 1);
+
+    assert(stub.handle("Z0,204,1") == "OK");
+    assert(stub.handle("c") == "S05" && cpu.PC == 0x0204 && cpu.A == 0x2A && memory[0x11] == 0x2A);
+    assert(stub.handle("s") == "S05" && cpu.PC == 0x0205);
+    assert(stub.handle("z0,204,1") == "OK" && !stub.machine_debugger().points.armed());
+    assert(stub.handle("Z2,11,1") == "OK" && stub.handle("c200") == "T05watch:0011;" && cpu.PC == 0x0204);
+    assert(stub.handle("z2,11,1") == "OK" && stub.handle("Z4,10,2") == "OK");
+    assert(stub.handle("c200") == "T05rwatch:0010;" && stub.handle("?") == "T05rwatch:0010;");
+    assert(stub.handle("z4,10,2") == "OK" && !stub.machine_debugger().points.armed());
+
+    // reverse execution once the stub keeps a history
+    assert(stub.handle("bs") == "" && stub.handle("qSupported").find("Reverse") == std::string::npos);
+    stub.record_history(64 * 1024, 100);
+    assert(stub.handle("qSupported").find("ReverseStep+;ReverseContinue+") != std::string::npos);
+    assert(stub.handle("P5=0002") == "OK" && stub.handle("P1=00") == "OK" && stub.handle("Z0,204,1") == "OK");
+    assert(stub.handle("c") == "S05" && stub.handle("c") == "S05" && stub.handle("c") == "S05" && cpu.X == 2);
+    assert(stub.handle("bc") == "S05" && cpu.PC == 0x0204 && cpu.X == 1);
+    assert(stub.handle("bs") == "S05" && cpu.PC == 0x0205 && cpu.X == 1);
+    assert(stub.handle("bc") == "S05" && cpu.PC == 0x0204 && cpu.X == 0);
+    assert(stub.handle("bc") == "T05replaylog:begin;" && cpu.PC == 0x0200 && stub.handle("bs") == "T05replaylog:begin;");
+    assert(stub.handle("c") == "S05" && cpu.PC == 0x0204 && cpu.X == 0);
+    assert(stub.handle("z0,204,1") == "OK" && stub.handle("P5=0202") == "OK");
+
+    assert(stub.handle("qSupported:multiprocess+").find("qXfer:features:read+") != std::string::npos);
+    assert(stub.handle("qXfer:features:read:target.xml:0,fff").rfind("l<?xml", 0) == 0);
+    assert(stub.handle("qXfer:features:read:target.xml:0,10") == "m<?xml version=\"1");
+    assert(stub.handle("qRegisterInfo5").find("generic:pc") != std::string::npos && stub.handle("qRegisterInfo6") == "E45");
+    assert(stub.handle("vMustReplyEmpty") == "" && stub.handle("Z9,0,0") == "");
+    assert(GdbStub::frame("OK") == "$OK#9a" && GdbStub::frame("}") == "$}]#da");
+
+    // the same over a socket: framing, acks, a bad checksum, ^C during a continue, detach
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    stub.slice_cycles = 1000;
+    std::thread server([&] { stub.serve(fds[0]); });
+    auto exchange = [&](const std::string &request) {
+        assert(write(fds[1], request.data(), request.size()) == ssize_t(request.size()));
+        std::string reply;
+        char c;
+        while (read(fds[1], &c, 1) == 1)
+        {
+            reply += c;
+            if (reply == "-" || (reply.size() >= 3 && reply[reply.size() - 3] == '#'))
+            {
+                break;
+            }
+        }
+        return reply;
+    };
+    assert(exchange(GdbStub::frame("p5")) == "+" + GdbStub::frame("0202"));
+    assert(exchange("$p5#00") == "-");
+    assert(exchange(GdbStub::frame("c") + "\x03") == "+" + GdbStub::frame("S02"));
+    assert(exchange("+" + GdbStub::frame("D")) == "+" + GdbStub::frame("OK"));
+    server.join();
+    assert(!stub.attached());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Runs `lanes` machines set up by `setup(lane, cpu, memory)` through a
+// LockstepBatch and one by one through CPU::execute, and checks that every
+// lane ends the same way.
+template <uint32_t Lanes, typename Setup>
+void check_lockstep(LockstepBatch<Lanes> &batch, uint64_t budget, Setup setup)
+{
+    for (uint32_t lane = 0; lane < Lanes; lane++)
+    {
+        batch.cpu(lane).reset(batch.memory(lane));
+        setup(lane, batch.cpu(lane), batch.memory(lane));
+    }
+    batch.run(budget);
+    for (uint32_t lane = 0; lane < Lanes; lane++)
+    {
+        Memory memory;
+        CPU cpu;
+        cpu.reset(memory);
+        setup(lane, cpu, memory);
+        uint64_t used = cpu.execute(budget, memory);
+        assert(batch.cycles(lane) == used);
+        assert(batch.cpu(lane).registers() == cpu.registers());
+        assert(std::memcmp(batch.memory(lane).data, memory.data, MAX_MEMORY) == 0);
+    }
+}
+
+void test_lockstep_batch()
+{
+    // the same loop on different data: lockstep until BNE goes different ways
+    const Byte program[] = {CPU::INS_CLC, CPU::INS_ADC_ZP, 0x10, CPU::INS_STA_ZERO_PAGE, 0x10, CPU::INS_INX,
+                            CPU::INS_CPX_ZP, 0x11, CPU::INS_BNE, 0xF6, CPU::INS_JMP_ABS, 0x00, 0x02};
+    LockstepBatch<16> batch;
+    auto loop = [&](uint32_t lane, CPU &cpu, Memory &memory) {
+        memory.load(0x0200, program, sizeof(program));
+        memory.data[0x10] = lane;
+        memory.data[0x11] = 200;
+        cpu.PC = 0x0200;
+        cpu.A = lane * 3;
+    };
+    check_lockstep(batch, 2000, loop);
+    assert(!batch.diverged && batch.lockstep_instructions > 300 && batch.scalar_steps == 0);
+    check_lockstep(batch, 2000, [&](uint32_t lane, CPU &cpu, Memory &memory) {
+        loop(lane, cpu, memory);
+        memory.data[0x11] = 10 + lane; // leaves the loop after a different number of rounds
+    });
+    assert(batch.diverged && batch.lockstep_instructions > 0);
+
+    // subroutines, the stack, a scalar step (CLI) and decimal mode
+    const Byte calls[] = {CPU::INS_SED, CPU::INS_CLI, CPU::INS_JSR, 0x00, 0x03, CPU::INS_STACK_PHP, CPU::INS_STACK_PLA,
+                          CPU::INS_JMP_ABS, 0x00, 0x02};
+    const Byte subroutine[] = {CPU::INS_STACK_PHA, CPU::INS_ADC_IM, 0x19, CPU::INS_SBC_IM, 0x01, CPU::INS_STACK_PLA, CPU::INS_RTS};
+    check_lockstep(batch, 5000, [&](uint32_t lane, CPU &cpu, Memory &memory) {
+        memory.load(0x0200, calls, sizeof(calls));
+        memory.load(0x0300, subroutine, sizeof(subroutine));
+        cpu.PC = 0x0200;
+        cpu.A = lane * 7;
+    });
+    assert(!batch.diverged && batch.scalar_steps > 0);
+
+    // Random straight-line code over random data in every lane, ending in a
+    // JMP to itself; every official opcode but the ones that transfer control.
+    std::mt19937 random(19);
+    std::vector<Byte> opcodes;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        OpcodeInfo info = CPU::decode(opcode);
+        Operation op = info.operation;
+        if (op != Operation::ILL && op != Operation::BRK && op != Operation::RTI && op != Operation::JMP &&
+            op != Operation::JSR && op != Operation::RTS && info.mode != AddressingMode::relative)
+        {
+            opcodes.push_back(opcode);
+        }
+    }
+    LockstepBatch<8> small;
+    LockstepBatch<32> large;
+    for (int round = 0; round < 40; round++)
+    {
+        std::vector<Byte> code;
+        while (code.size() < 600)
+        {
+            Byte opcode = opcodes[random() % opcodes.size()];
+            code.push_back(opcode);
+            for (uint32_t i = 0; i < CPU::predecoded_bytes(opcode); i++)
+            {
+                // operands mostly in the zero page and $0400-$07FF, away from the code at $C000
+                code.push_back(i == 1 ? 0x04 + random() % 4 : random());
+            }
+        }
+        code.insert(code.end(), {CPU::INS_JMP_ABS, Byte(0xC000 + code.size()), Byte((0xC000 + code.size()) >> 8)});
+        uint32_t seed = random();
+        auto setup = [&](uint32_t lane, CPU &cpu, Memory &memory) {
+            std::mt19937 data(seed + lane % 4); // lanes repeat, so identical lanes get compared as well
+            for (uint32_t address = 0; address < 0x0800; address++)
+            {
+                memory.data[address] = data();
+            }
+            memory.load(0xC000, code.data(), code.size());
+            cpu.set_registers({0xC000, Byte(data()), Byte(data()), Byte(data()), Byte(data()), Byte(data() & ~0x08)});
+        };
+        check_lockstep(small, 3000, setup);
+        check_lockstep(large, 3000, setup);
+    }
+}
+
+// Runs the demo firmware through CPU::execute and demo_firmware_recompiled
+// side by side for `budgets`, taking pending interrupts between the runs as
+// Scheduler does; `poke` changes both machines before run i.
+template <typename Poke>
+void check_recompiled(const std::vector<uint64_t> &budgets, bool as_rom, Poke poke)
+{
+    Image image = demo_firmware_image();
+    auto reference = std::make_unique<Memory>();
+    auto compiled = std::make_unique<Memory>();
+    CPU expected, actual;
+    std::vector<Byte> rom(3 * MEMORY_PAGE_SIZE);
+    for (auto machine : {std::make_pair(&expected, reference.get()), std::make_pair(&actual, compiled.get())})
+    {
+        machine.first->reset(*machine.second);
+        load_image(*machine.second, image);
+        machine.first->PC = 0xC000;
+        if (as_rom)
+        {
+            std::memcpy(rom.data(), machine.second->data + 0xC000, rom.size());
+            machine.second->map_rom(0xC0, 3, rom.data());
+        }
+    }
+    for (size_t i = 0; i < budgets.size(); i++)
+    {
+        poke(i, expected, *reference);
+        poke(i, actual, *compiled);
+        uint64_t used = expected.execute(budgets[i], *reference);
+        assert(demo_firmware_recompiled::execute(actual, budgets[i], *compiled) == used);
+        assert(actual.registers() == expected.registers());
+        assert(std::memcmp(compiled->data, reference->data, MAX_MEMORY) == 0);
+        for (auto machine : {std::make_pair(&expected, reference.get()), std::make_pair(&actual, compiled.get())})
+        {
+            Word vector = machine.first->pending_interrupt();
+            if (vector != 0)
+            {
+                machine.first->take_interrupt(*machine.second, vector);
+                machine.first->set_irq_line(1, false); // the device is acknowledged
+            }
+        }
+    }
+    assert(compiled->page_flags[0xC0] & Memory::page_compiled);
+}
+
+void test_recompiler()
+{
+    // blocks come from the vectors; the jump table targets and the RTS trick are left to the interpreter
+    Image image = demo_firmware_image();
+    RecoveredCode code = recover_code(image, image_entry_points(image));
+    assert(code.leaders.count(0xC000) && code.leaders.count(0xC132) && code.leaders.count(0xC135));
+    assert(code.leaders.count(0xC027) && code.leaders.count(0xC02D)); // after BRK, after BEQ
+    assert(code.instructions.count(0xC112) && !code.instructions.count(0xC115) && !code.instructions.count(0xC12F));
+
+    // an instruction across a page boundary is interpreted, the block after it compiled
+    Image straddling;
+    straddling.segments = {{0x02FD, {CPU::INS_NOP, CPU::INS_LDA_ABS, 0x34, 0x12, CPU::INS_RTS}}};
+    code = recover_code(straddling, {0x02FD});
+    assert(code.instructions.count(0x02FD) && !code.instructions.count(0x02FE) && code.leaders.count(0x0301));
+
+    // the checked-in header is what the recompiler makes of demo_firmware.h today (recompile --demo)
+    std::filesystem::path source_dir = *CPU_SOURCE_DIR ? CPU_SOURCE_DIR : std::filesystem::path(__FILE__).parent_path();
+    std::ifstream file(source_dir / "demo_firmware_recompiled.h");
+    assert(file.is_open() && "demo_firmware_recompiled.h not found: run from the source directory or set CPU_SOURCE_DIR");
+    std::stringstream checked_in;
+    checked_in << file.rdbuf();
+    assert(checked_in.str() == recompile_image(image, "demo_firmware_recompiled"));
+
+    std::mt19937 random(20);
+    std::vector<uint64_t> budgets;
+    for (int i = 0; i < 300; i++)
+    {
+        budgets.push_back(i % 50 == 0 ? 1 : 1 + random() % 3000);
+    }
+    // an IRQ every few runs, an NMI, the stop on an unofficial opcode, data
+    // written next to code and code overwritten and put back
+    check_recompiled(budgets, false, [](size_t i, CPU &cpu, Memory &memory) {
+        if (i % 7 == 3)
+        {
+            cpu.set_irq_line(1, true);
+        }
+        if (i == 30)
+        {
+            cpu.raise_nmi();
+        }
+        if (i == 50 || i == 60)
+        {
+            memory.write_byte(i == 50, 0x35);
+        }
+        if (i == 80)
+        {
+            memory.write_byte(0x99, 0xC0F0);
+        }
+        if (i == 100 || i == 120)
+        {
+            memory.write_byte(i == 100 ? 0x05 : 0x03, 0xC03F); // ADC #$03 in fill
+        }
+    });
+    // from ROM the patch at $C206 is dropped and every page stays compiled
+    check_recompiled(budgets, true, [](size_t, CPU &, Memory &) {});
+}
+
+// returns 0 three reads in four, so a loop polling it must run every round
+struct PollDevice : BusDevice
+{
+    uint32_t reads = 0;
+
+    Byte read(Word) override
+    {
+        return ++reads % 4 == 0;
+    }
+
+    void write(Word, Byte) override {}
+};
+
+struct IdleMachine
+{
+    Memory memory;
+    CPU cpu;
+    TimerDevice timer{&cpu};
+    PollDevice poll;
+    Scheduler scheduler;
+    std::function<void()> tick;
+
+    explicit IdleMachine(bool skip_idle_loops)
+    {
+        cpu.reset(memory);
+        cpu.skip_idle_loops = skip_idle_loops;
+        memory.map_device(0xD0, 1, &timer);
+        memory.map_device(0xD1, 1, &poll);
+        const Byte program[] = {
+            CPU::INS_CLI,
+            CPU::INS_LDA_ZP, 0x10, CPU::INS_BEQ, 0xFC,            // $0201: idle until the IRQ handler sets $10
+            CPU::INS_LDA_IM, 0x00, CPU::INS_STA_ZERO_PAGE, 0x10,
+            CPU::INS_LDX_IM, 0x05, CPU::INS_DEX, CPU::INS_BNE, 0xFD, // $020B: counts down
+            CPU::INS_LDA_ABS, 0x00, 0xD1, CPU::INS_BEQ, 0xFB,     // $020E: polls a device
+            CPU::INS_LDX_ZP, 0x12, CPU::INS_TXA, CPU::INS_CMP_IM, 0x01, CPU::INS_BNE, 0xF9, // $0213: waits for the NMI
+            CPU::INS_LDA_IM, 0x00, CPU::INS_STA_ZERO_PAGE, 0x12,
+            CPU::INS_JMP_ABS, 0x01, 0x02};
+        const Byte irq_handler[] = {CPU::INS_INC_ZP, 0x10, CPU::INS_LDA_ABS, 0x00, 0xD0, CPU::INS_RTI};
+        const Byte nmi_handler[] = {CPU::INS_LDA_IM, 0x01, CPU::INS_STA_ZERO_PAGE, 0x12, CPU::INS_RTI};
+        const Byte vectors[] = {0x00, 0x04, 0x00, 0x00, 0x00, 0x03};
+        memory.load(0x0200, program, sizeof(program));
+        memory.load(0x0300, irq_handler, sizeof(irq_handler));
+        memory.load(0x0400, nmi_handler, sizeof(nmi_handler));
+        memory.load(0xFFFA, vectors, sizeof(vectors));
+        cpu.PC = 0x0200;
+
+        // an IRQ every 5000 cycles, an NMI every 12345
+        tick = [this] {
+            cpu.set_irq_line(0x01, true);
+            scheduler.schedule_in(5000, tick);
+        };
+        scheduler.schedule_at(5000, tick);
+        for (uint64_t cycle = 12345; cycle < 2000000; cycle += 12345)
+        {
+            scheduler.schedule_at(cycle, [this] { cpu.raise_nmi(); });
+        }
+    }
+};
+
+void test_idle_loops()
+{
+    // predecode marks the branches of the loops that wait on RAM
+    IdleMachine machine(true), reference(false);
+    assert(machine.scheduler.run_until(50000, machine.cpu, machine.memory));
+    assert(machine.memory.decoded[0x0203].operand & CPU::idle_loop_mark);
+    assert(!(machine.memory.decoded[0x020C].operand & CPU::idle_loop_mark));
+    assert(!(machine.memory.decoded[0x0211].operand & CPU::idle_loop_mark));
+    assert(machine.memory.decoded[0x0218].operand & CPU::idle_loop_mark);
+
+    // skipping is invisible: same clock, registers, memory and device reads
+    // as running every round, whatever slices the budget comes in
+    std::mt19937 random(21);
+    assert(reference.scheduler.run_until(50000, reference.cpu, reference.memory));
+    while (machine.scheduler.now() < 1500000)
+    {
+        uint64_t until = machine.scheduler.now() + 1 + random() % 40000;
+        assert(machine.scheduler.run_until(until, machine.cpu, machine.memory));
+        assert(reference.scheduler.run_until(until, reference.cpu, reference.memory));
+        assert(machine.scheduler.now() == reference.scheduler.now());
+        Registers a = machine.cpu.registers(), b = reference.cpu.registers();
+        assert(a.PC == b.PC && a.SP == b.SP && a.A == b.A && a.X == b.X && a.Y == b.Y && a.P == b.P);
+        for (Word address : {0x10, 0x12, 0x01FD, 0x01FE, 0x01FF})
+        {
+            assert(machine.memory[address] == reference.memory[address]);
+        }
+        assert(machine.poll.reads == reference.poll.reads);
+    }
+    assert(machine.memory[0x10] + machine.memory[0x12] <= 2 && machine.poll.reads > 100);
+    assert(reference.cpu.idle_cycles_skipped == 0);
+    assert(machine.cpu.idle_cycles_skipped > machine.scheduler.now() / 2);
+
+    // JMP * spins until the budget is spent, overrunning it like the loop would
+    Memory memory;
+    CPU cpu, spinning;
+    cpu.reset(memory);
+    const Byte program[] = {CPU::INS_NOP, CPU::INS_JMP_ABS, 0x01, 0x05};
+    memory.load(0x0500, program, sizeof(program));
+    cpu.PC = 0x0500;
+    spinning = cpu;
+    spinning.skip_idle_loops = false;
+    for (uint64_t budget : {1, 2, 3, 4, 5, 1000, 1001, 1002, 999999})
+    {
+        CPU skipped = cpu;
+        uint64_t used = skipped.execute(budget, memory);
+        assert(used == spinning.execute(budget, memory));
+        assert(used >= budget && used < budget + 3 && skipped.PC == spinning.PC);
+        assert(budget < 1000 || skipped.idle_cycles_skipped >= budget - 6);
+        cpu = skipped;
+    }
+
+    // a loop that stores is never idle
+    const Byte storing[] = {CPU::INS_STA_ZERO_PAGE, 0x20, CPU::INS_BNE, 0xFC};
+    memory.load(0x0600, storing, sizeof(storing));
+    cpu.PC = 0x0600;
+    cpu.A = 1;
+    cpu.set_flags(0);
+    cpu.idle_cycles_skipped = 0;
+    cpu.execute(10000, memory);
+    assert(cpu.idle_cycles_skipped == 0 && memory.decoded[0x0602].valid &&
+           !(memory.decoded[0x0602].operand & CPU::idle_loop_mark));
+}
+
+void test_machine_pool()
+{
+    MachinePool pool(3);
+    Memory &image = pool.image();
+    // copies a byte of the shared page to RAM, then writes the shared page
+    const Byte program[] = {CPU::INS_LDA_ABS, 0x10, 0xE0, CPU::INS_STA_ZERO_PAGE, 0x40, CPU::INS_LDA_IM, 0x99,
+                            CPU::INS_STA_ABS, 0x10, 0xE0, CPU::INS_LDA_ABS, 0x00, 0xF0};
+    image.load(0x0200, program, sizeof(program));
+    std::vector<Byte> rom(0x2000, 0xEA);
+    rom[0x0010] = 0x42;
+    image.load(0xE000, rom.data(), rom.size());
+    pool.share(0xE0, 0x20);
+    // 31 pages of NOPs and the one with $42 in it
+    assert(pool.page_store().page_count() == 2);
+    assert(image.is_shared_page(0xE1) && image.read_pages[0xE1] == image.read_pages[0xFF]);
+
+    PooledMachine *first = pool.acquire();
+    PooledMachine *second = pool.acquire();
+    assert(first != second && pool.machines_out() == 2);
+    assert(first->cpu.PC == 0xFFFC && first->cpu.SP == 0xFF && first->cpu.registers().P == 0);
+    assert(first->memory.read_pages[0xE0] == second->memory.read_pages[0xE0]);
+    assert(first->memory.read(0x0200) == CPU::INS_LDA_ABS && first->memory.read(0xE010) == 0x42);
+
+    // a write gives the machine its own copy of the page, the others keep sharing
+    first->cpu.PC = 0x0200;
+    assert(first->cpu.execute(17, first->memory) == 17);
+    assert(first->memory.read(0x0040) == 0x42 && first->memory.read(0xE010) == 0x99 && first->cpu.A == 0xEA);
+    assert(!first->memory.is_shared_page(0xE0) && first->memory.is_shared_page(0xE1));
+    assert(second->memory.read(0xE010) == 0x42 && image.read(0xE010) == 0x42);
+
+    // a released machine comes back as the image, sharing again, without its devices
+    CountingDevice device;
+    first->memory.map_device(0x30, 1, &device);
+    pool.release(first);
+    PooledMachine *again = pool.acquire();
+    assert(again == first && pool.machines_out() == 2);
+    assert(again->memory.read(0xE010) == 0x42 && again->memory.read_pages[0xE0] == second->memory.read_pages[0xE0]);
+    assert(again->memory.read(0x0040) == 0 && again->memory.read(0x0200) == CPU::INS_LDA_ABS);
+    assert(again->memory.devices[0x30] == nullptr && again->memory.dirty_page_count() == 0);
+    assert(again->cpu.PC == 0xFFFC && again->cpu.A == 0);
+
+    // it runs like a machine that loaded everything into its own RAM
+    auto reference = std::make_unique<Memory>();
+    CPU cpu;
+    cpu.reset(*reference);
+    reference->load(0x0200, program, sizeof(program));
+    reference->load(0xE000, rom.data(), rom.size());
+    cpu.PC = again->cpu.PC = 0x0200;
+    assert(cpu.execute(17, *reference) == again->cpu.execute(17, again->memory));
+    assert(cpu.A == again->cpu.A && cpu.PC == again->cpu.PC && (*reference)[0x0040] == again->memory.read(0x0040));
+
+    assert(pool.acquire() != nullptr && pool.acquire() == nullptr);
+}
+
+void test_save_state()
+{
+    // pages compress and decompress to themselves: zeros, runs, text, noise
+    std::mt19937 random(23);
+    for (int kind = 0; kind < 5; kind++)
+    {
+        Byte page[MEMORY_PAGE_SIZE], back[MEMORY_PAGE_SIZE];
+        for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i++)
+        {
+            Byte values[] = {0, Byte(i / 40), Byte("save state "[i % 11]), Byte(random()), Byte(random() % 3)};
+            page[i] = values[kind];
+        }
+        std::vector<Byte> stored;
+        compress_page(page, stored);
+        assert(decompress_page(stored.data(), stored.size(), back) && std::memcmp(page, back, sizeof(page)) == 0);
+        assert(kind >= 3 || stored.size() < MEMORY_PAGE_SIZE / 4);
+        assert(!decompress_page(stored.data(), stored.size() - 1, back));
+    }
+    // pages pieced together from runs, repeats and noise
+    for (int i = 0; i < 1000; i++)
+    {
+        Byte page[MEMORY_PAGE_SIZE], back[MEMORY_PAGE_SIZE];
+        for (uint32_t at = 0; at < MEMORY_PAGE_SIZE;)
+        {
+            uint32_t length = std::min<uint32_t>(1 + random() % 40, MEMORY_PAGE_SIZE - at);
+            uint32_t kind = random() % 3, from = at ? random() % at : 0;
+            Byte value = random();
+            for (uint32_t j = 0; j < length; j++, at++)
+            {
+                page[at] = kind == 0 ? value : kind == 1 && at > 0 ? page[from + j] : Byte(random());
+            }
+        }
+        std::vector<Byte> stored;
+        compress_page(page, stored);
+        assert(stored.size() <= MEMORY_PAGE_SIZE + 3);
+        assert(decompress_page(stored.data(), stored.size(), back) && std::memcmp(page, back, sizeof(page)) == 0);
+    }
+
+    // a machine saved mid-run and loaded elsewhere continues the same way
+    auto memory = std::make_unique<Memory>();
+    CPU cpu;
+    cpu.reset(*memory);
+    load_image(*memory, demo_firmware_image());
+    cpu.PC = 0xC000;
+    cpu.execute(50000, *memory);
+    cpu.set_irq_line(0x02, true);
+    std::vector<Byte> record;
+    save_state(record, cpu, *memory, 123456789);
+    assert(save_state_size(record.data(), record.size()) == record.size() && record.size() < 4096);
+
+    auto copy = std::make_unique<Memory>();
+    CPU loaded;
+    loaded.reset(*copy);
+    copy->store(0x8000, 0x55); // not in the state: must come back as zero
+    uint64_t clock = 0;
+    assert(load_state(record.data(), record.size(), loaded, *copy, clock) && clock == 123456789);
+    assert(loaded.irq_lines == 0x02 && !loaded.nmi_pending && std::memcmp(copy->data, memory->data, MAX_MEMORY) == 0);
+    cpu.set_irq_line(0x02, false);
+    loaded.set_irq_line(0x02, false);
+    assert(cpu.execute(30000, *memory) == loaded.execute(30000, *copy));
+    Registers a = cpu.registers(), b = loaded.registers();
+    assert(a.PC == b.PC && a.SP == b.SP && a.A == b.A && a.X == b.X && a.Y == b.Y && a.P == b.P);
+    assert(memory->digest() == copy->digest());
+
+    // truncated or corrupted records are refused
+    assert(!load_state(record.data(), record.size() - 1, loaded, *copy, clock));
+    std::vector<Byte> corrupt = record;
+    corrupt[0] = 'X';
+    assert(!load_state(corrupt.data(), corrupt.size(), loaded, *copy, clock));
+
+    // records stream back to back and a file of them loads through the mapping
+    std::stringstream stream;
+    assert(write_state(stream, cpu, *memory, 1) && write_state(stream, loaded, *copy, 2));
+    std::string path = (std::filesystem::temp_directory_path() / "cpu_emulator_test_states.sav").string();
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << stream.str();
+    }
+    assert(read_state(stream, loaded, *copy, clock) && clock == 1);
+    assert(read_state(stream, loaded, *copy, clock) && clock == 2);
+    assert(!read_state(stream, loaded, *copy, clock));
+
+    SaveStateLibrary library;
+    assert(library.open(path) && library.size() == 2);
+    auto from_file = std::make_unique<Memory>();
+    assert(library.load(1, loaded, *from_file, clock) && clock == 2);
+    assert(from_file->digest() == copy->digest() && loaded.PC == cpu.PC);
+    std::remove(path.c_str());
+}
+
+void test_time_travel()
+{
+    auto memory = std::make_unique<Memory>();
+    CPU cpu;
+    cpu.reset(*memory);
+    load_image(*memory, demo_firmware_image());
+    cpu.PC = 0xC000;
+    Debugger debugger(cpu, *memory);
+    TimeTravel history(cpu, *memory, debugger, 1 << 20, 1000);
+
+    // the way forward, one boundary at a time, with the pushes to $01FF: a
+    // pass of the main loop, which also patches its own code
+    struct Point
+    {
+        uint64_t clock;
+        Registers registers;
+        uint64_t digest;
+    };
+    std::vector<Point> points;
+    std::vector<size_t> writes;
+    debugger.points.set_watchpoint(0x01FF, false, true);
+    for (int i = 0; i < 5000; i++)
+    {
+        points.push_back({history.now(), cpu.registers(), memory->digest()});
+        if (history.step().reason == StopReason::write_watch)
+        {
+            writes.push_back(points.size());
+        }
+    }
+    points.push_back({history.now(), cpu.registers(), memory->digest()});
+    debugger.points.clear();
+    assert(writes.size() >= 7 && history.snapshot_count() > 10);
+    auto at = [&](size_t index) {
+        const Point &point = points[index];
+        return history.now() == point.clock && cpu.registers() == point.registers && memory->digest() == point.digest;
+    };
+
+    // reverse steps retrace it exactly
+    for (size_t index = points.size() - 1; index > points.size() - 300; index--)
+    {
+        assert(history.reverse_step() && at(index - 1));
+    }
+    // as do seeks either way
+    std::mt19937 random(24);
+    for (int i = 0; i < 100; i++)
+    {
+        size_t index = random() % points.size();
+        history.seek(points[index].clock);
+        assert(at(index));
+    }
+
+    // reverse continue stops at the last hit before now
+    history.seek(points.back().clock);
+    Word pc = points[1500].registers.PC;
+    debugger.points.set_breakpoint(pc);
+    size_t last = points.size() - 1;
+    while (points[--last].registers.PC != pc)
+    {
+    }
+    DebugStop stop = history.reverse_continue();
+    assert(stop.reason == StopReason::breakpoint && stop.address == pc && at(last));
+    while (points[--last].registers.PC != pc)
+    {
+    }
+    assert(history.reverse_continue().reason == StopReason::breakpoint && at(last));
+    // continuing forward from there hits the next one
+    size_t next = last;
+    while (points[++next].registers.PC != pc)
+    {
+    }
+    assert(history.run(100000).reason == StopReason::breakpoint && at(next));
+    debugger.points.clear();
+
+    // watchpoints report after the access, like going forward
+    history.seek(points.back().clock);
+    debugger.points.set_watchpoint(0x01FF, false, true);
+    stop = history.reverse_continue();
+    assert(stop.reason == StopReason::write_watch && stop.address == 0x01FF && at(writes.back()));
+    assert(history.reverse_continue().reason == StopReason::write_watch && at(writes[writes.size() - 2]));
+    debugger.points.clear();
+
+    // with nothing to stop at, the way back ends at the start of the history
+    stop = history.reverse_continue();
+    assert(stop.reason == StopReason::none && at(0) && !history.reverse_step());
+
+    // the history stays within its budget by dropping the oldest snapshots
+    TimeTravel bounded(cpu, *memory, debugger, 16 * 1024, 1000);
+    assert(bounded.run(500000).reason == StopReason::none);
+    assert(bounded.history_bytes() <= 16 * 1024 && bounded.history_start() > 0);
+    Registers end = cpu.registers();
+    uint64_t end_clock = bounded.now();
+    bounded.seek(bounded.history_start());
+    assert(!bounded.reverse_step());
+    bounded.seek(end_clock);
+    assert(cpu.registers() == end);
+
+    // back from a crash: the firmware stops on an unofficial opcode when $35 is
+    // set, with PC past it
+    memory->data[0x35] = 1;
+    bounded.reset();
+    assert(bounded.run(100000).reason == StopReason::illegal && cpu.PC == 0xC02E);
+    assert(bounded.reverse_step() && cpu.PC == 0xC02B && bounded.reverse_step() && cpu.PC == 0xC029);
+    assert(bounded.run(100000).reason == StopReason::illegal && cpu.PC == 0xC02E && cpu.A == 1);
+}
+
+// keys and values with only what interval_map needs
+struct OrderedKey
+{
+    explicit OrderedKey(int value) : value(value) {}
+    bool operator<(const OrderedKey &other) const
+    {
+        return value < other.value;
+    }
+    int value;
+};
+
+struct ComparableValue
+{
+    explicit ComparableValue(char value) : value(value) {}
+    bool operator==(const ComparableValue &other) const
+    {
+        return value == other.value;
+    }
+    char value;
+};
+
+void test_bus_map()
+{
+    // random assigns against a brute force array, including empty and
+    // reversed intervals and ones reaching past the keys checked
+    std::mt19937 random(25);
+    for (int round = 0; round < 300; round++)
+    {
+        interval_map<OrderedKey, ComparableValue> map(ComparableValue('a'));
+        char reference[64];
+        std::fill(std::begin(reference), std::end(reference), 'a');
+        for (int i = 0; i < 40; i++)
+        {
+            int begin = int(random() % 70) - 3, end = int(random() % 70) - 3;
+            char value = 'a' + random() % 3;
+            map.assign(OrderedKey(begin), OrderedKey(end), ComparableValue(value));
+            for (int key = std::max(begin, 0); key < std::min(end, 64); key++)
+            {
+                reference[key] = value;
+            }
+            for (int key = 0; key < 64; key++)
+            {
+                assert(map[OrderedKey(key)].value == reference[key]);
+            }
+            // canonical: no entry repeats the value before it
+            const ComparableValue *previous = &map.first_value();
+            for (const auto &boundary : map.boundaries())
+            {
+                assert(!(boundary.second == *previous));
+                previous = &boundary.second;
+            }
+        }
+    }
+
+    // the bus map of a board against a page by page reference
+    Byte rom[2][MAX_MEMORY];
+    for (uint32_t i = 0; i < MAX_MEMORY; i++)
+    {
+        rom[0][i] = Byte(i);
+        rom[1][i] = Byte(i >> 8);
+    }
+    CountingDevice devices[2];
+    auto memory = std::make_unique<Memory>();
+    for (int round = 0; round < 20; round++)
+    {
+        BusMap map;
+        BusRegion reference[MEMORY_PAGE_COUNT];
+        for (int i = 0; i < 30; i++)
+        {
+            uint32_t first = random() % MEMORY_PAGE_COUNT;
+            uint32_t count = 1 + random() % std::min<uint32_t>(32, MEMORY_PAGE_COUNT - first);
+            uint32_t begin = first * MEMORY_PAGE_SIZE, end = (first + count) * MEMORY_PAGE_SIZE;
+            uint32_t choice = random() % 5;
+            BusRegion region;
+            if (choice == 0)
+            {
+                map.map_ram(begin, end);
+            }
+            else if (choice <= 2)
+            {
+                map.map_rom(begin, end, rom[choice - 1] + begin);
+                region = {BusRegion::rom, rom[choice - 1] + begin, begin, nullptr};
+            }
+            else
+            {
+                map.map_device(begin, end, &devices[choice - 3]);
+                region = {BusRegion::device, nullptr, 0, &devices[choice - 3]};
+            }
+            std::fill(reference + first, reference + first + count, region);
+        }
+        size_t regions = 1;
+        for (uint32_t page = 1; page < MEMORY_PAGE_COUNT; page++)
+        {
+            regions += !(reference[page] == reference[page - 1]);
+        }
+        assert(map.region_count() == regions);
+
+        map.apply(*memory);
+        for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+        {
+            const BusRegion &region = reference[page];
+            Word address = page * MEMORY_PAGE_SIZE + 0x12;
+            assert(map[address] == region);
+            Byte *own = memory->data + page * MEMORY_PAGE_SIZE;
+            switch (region.kind)
+            {
+            case BusRegion::ram:
+                assert(memory->read_pages[page] == own && memory->write_pages[page] == own && !memory->devices[page]);
+                break;
+            case BusRegion::rom:
+                assert(memory->read(address) == region.storage[address - region.base] && !memory->write_pages[page]);
+                break;
+            case BusRegion::device:
+                assert(memory->devices[page] == region.bus_device && !memory->read_pages[page]);
+                break;
+            }
+        }
+    }
+}
+
+int main()
+{
+    std::cout << "======== START EMULATING THE 6502 CPU ========" << std::endl;
+    test_ins_jsr();
+    test_ins_lda_abs();
+    test_sta_zero_page();
+    test_sta_absolute();
+    test_ins_rts();
+    test_jmp_absolute();
+    test_jmp_indirect();
+    test_pha();
+    test_pla();
+    test_and_imd();
+    test_bit_zp();
+    test_TXA();
+    test_INC_ZP_X();
+    test_INS_ABS_X();
+    test_BEQ();
+    test_official_opcodes();
+    test_adc_sbc();
+    test_adc_sbc_decimal();
+    test_decimal_tables();
+    test_jmp_indirect_page_wrap();
+    test_loop_program();
+    test_trace_levels();
+    test_batch_runner();
+    test_dirty_page_reset();
+    test_memory_bus();
+    test_self_modifying_code();
+    test_status_register();
+    test_scheduler_interrupts();
+    test_image_loader();
+    test_profiler();
+    test_record_replay();
+    test_conformance_runner();
+    test_memory_snapshot();
+    test_cycle_model();
+    test_telemetry();
+    test_breakpoints();
+    test_gdb_stub();
+    test_lockstep_batch();
+    test_recompiler();
+    test_idle_loops();
+    test_machine_pool();
+    test_save_state();
+    test_time_travel();
+    test_bus_map();
+    return 0;
+}
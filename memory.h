@@ -0,0 +1,463 @@
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "common.h"
+
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGE_COUNT (MAX_MEMORY / MEMORY_PAGE_SIZE)
+
+// Memory mapped device. It receives every access to the pages it is mapped on,
+// with the full 16 bit address.
+struct BusDevice
+{
+    virtual ~BusDevice() = default;
+    virtual Byte read(Word address) = 0;
+    virtual void write(Word address, Byte value) = 0;
+};
+
+// A block of bytes destined for `address`, e.g. one record run of a program image
+struct MemorySegment
+{
+    Word address;
+    std::vector<Byte> bytes;
+};
+
+// Zeroed memory straight from the kernel: nothing is backed by physical pages
+// until it is touched, so large sparse tables cost only what is used
+inline void *map_zeroed(size_t size)
+{
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return mapping == MAP_FAILED ? nullptr : mapping;
+}
+
+// deleter for map_zeroed memory
+struct Unmapper
+{
+    size_t size = 0;
+
+    void operator()(void *mapping) const
+    {
+        munmap(mapping, size);
+    }
+};
+
+// An instruction as predecoded by CPU::execute: the opcode and its operand
+// bytes, little endian. Entries with valid == 0 have not been decoded yet.
+struct DecodedInstruction
+{
+    Byte opcode;
+    Byte valid;
+    Word operand;
+};
+
+// The CPU sees memory through a 256 entry page table. A page with a read
+// (write) pointer is plain storage; without one the access goes to the page's
+// BusDevice. A page with a read pointer but no write pointer and no device is
+// ROM: writes to it are dropped, unless the page is shared (map_shared), in
+// which case the first write copies it into `data`. Pages mapped onto their own
+// slice of `data` skip the table and cost one indexed load (store).
+//
+// Memory also holds the predecode cache of the CPU, one entry per address,
+// because every write goes through it: a write to a page that has decoded
+// entries drops them, so self-modifying code is decoded again.
+struct Memory
+{
+    // RAM backing store; by default page N of the bus is page N of this array.
+    // Writes that bypass store/write_byte/write_word/load must call mark_dirty,
+    // otherwise restore() will not undo them and the CPU may keep running the
+    // instructions it predecoded before; init() clears them either way.
+    Byte data[MAX_MEMORY];
+
+    // one bit per 256 byte bus page written since the last init/restore/assign;
+    // a new Memory holds garbage, so every page starts dirty
+    uint64_t dirty_pages[MEMORY_PAGE_COUNT / 64] = {~0ull, ~0ull, ~0ull, ~0ull};
+
+    const Byte *read_pages[MEMORY_PAGE_COUNT];
+    Byte *write_pages[MEMORY_PAGE_COUNT];
+    BusDevice *devices[MEMORY_PAGE_COUNT];
+
+    // keeps storage mapped with map_rom(..., owner) alive, e.g. an mmap'd ROM file
+    std::vector<std::shared_ptr<const void>> storage_owners;
+
+    // page_mapped: not mapped 1:1 onto `data`, page_decoded: has predecode cache
+    // entries, page_compiled: recompiled code (recompiler.h) checked that the
+    // page still holds the instructions it was generated from, page_shared:
+    // read-only storage that is copied on write. Reads take the
+    // fast path without page_mapped, stores without any flag. The check is only
+    // a predicted branch, so the RAM access itself does not wait on the page table.
+    static constexpr Byte page_mapped = 1;
+    static constexpr Byte page_decoded = 2;
+    static constexpr Byte page_compiled = 4;
+    static constexpr Byte page_shared = 8;
+    Byte page_flags[MEMORY_PAGE_COUNT] = {};
+
+    std::unique_ptr<DecodedInstruction[], Unmapper> decoded;
+
+    Memory()
+    {
+        map_ram(0x00, MEMORY_PAGE_COUNT);
+    }
+
+    // the page table points into `data`, a copy would alias the original
+    Memory(const Memory &) = delete;
+    Memory &operator=(const Memory &) = delete;
+
+    // pages [first_page, first_page + count) become RAM, backed by `storage`
+    // (count * 256 bytes) or by the matching pages of `data`
+    void map_ram(Byte first_page, uint32_t count, Byte *storage = nullptr)
+    {
+        assert(first_page + count <= MEMORY_PAGE_COUNT);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            Byte *page = storage ? storage + i * MEMORY_PAGE_SIZE : data + (first_page + i) * MEMORY_PAGE_SIZE;
+            set_page(first_page + i, page, page, nullptr);
+        }
+    }
+
+    // read-only pages backed by `storage` (count * 256 bytes), which may be
+    // shared; `owner`, if any, is kept alive for as long as this Memory exists
+    void map_rom(Byte first_page, uint32_t count, const Byte *storage, std::shared_ptr<const void> owner = nullptr)
+    {
+        assert(first_page + count <= MEMORY_PAGE_COUNT);
+        if (owner)
+        {
+            storage_owners.push_back(std::move(owner));
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            set_page(first_page + i, storage + i * MEMORY_PAGE_SIZE, nullptr, nullptr);
+        }
+    }
+
+    // Like map_rom, but a write to one of the pages gives this Memory its own
+    // copy in `data` first (copy-on-write), e.g. for RAM that starts out the
+    // same in every machine of a MachinePool (pool.h) and is seldom written.
+    void map_shared(Byte first_page, uint32_t count, const Byte *storage, std::shared_ptr<const void> owner = nullptr)
+    {
+        map_rom(first_page, count, storage, std::move(owner));
+        for (uint32_t i = 0; i < count; i++)
+        {
+            page_flags[first_page + i] |= page_shared;
+        }
+    }
+
+    bool is_shared_page(uint32_t page) const
+    {
+        return page_flags[page] & page_shared;
+    }
+
+    void map_device(Byte first_page, uint32_t count, BusDevice *device)
+    {
+        assert(first_page + count <= MEMORY_PAGE_COUNT);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            set_page(first_page + i, nullptr, nullptr, device);
+        }
+    }
+
+    // `page` shows whatever `target_page` is mapped to
+    void mirror(Byte page, Byte target_page)
+    {
+        set_page(page, read_pages[target_page], write_pages[target_page], devices[target_page]);
+    }
+
+    FORCE_INLINE Byte read(Word address)
+    {
+        if (__builtin_expect(!(page_flags[address >> 8] & page_mapped), 1))
+        {
+            return data[address];
+        }
+        return read_mapped(address);
+    }
+
+    FORCE_INLINE void store(Word address, Byte value)
+    {
+        if (__builtin_expect(page_flags[address >> 8] == 0, 1))
+        {
+            data[address] = value;
+            set_dirty(address);
+            return;
+        }
+        store_mapped(address, value);
+    }
+
+    // zeroes all RAM, including pages mapped onto other storage, and drops the
+    // predecode cache: programs are usually poked into `data` right after a reset
+    void init()
+    {
+        std::memset(data, 0, MAX_MEMORY);
+        for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+        {
+            Byte *storage = write_pages[page];
+            if (storage != nullptr && (storage < data || storage >= data + MAX_MEMORY))
+            {
+                std::memset(storage, 0, MEMORY_PAGE_SIZE);
+            }
+        }
+        clear_dirty();
+        invalidate_all_decoded();
+    }
+
+    // init() for a Memory last written through store/write_byte/write_word/load
+    // or mark_dirty: zeroes only the pages written since the last init/restore,
+    // not the whole 64 KB
+    void restore()
+    {
+        for_each_dirty_page([this](uint32_t page) {
+            if (write_pages[page] != nullptr)
+            {
+                std::memset(write_pages[page], 0, MEMORY_PAGE_SIZE);
+            }
+        });
+        clear_dirty();
+        invalidate_all_decoded();
+    }
+
+    // puts back the dirty pages of `baseline`; only valid when everything else
+    // already matches it, i.e. after assign(baseline) or a previous restore(baseline)
+    void restore(const Memory &baseline)
+    {
+        for_each_dirty_page([this, &baseline](uint32_t page) {
+            if (write_pages[page] != nullptr && baseline.read_pages[page] != nullptr)
+            {
+                std::memcpy(write_pages[page], baseline.read_pages[page], MEMORY_PAGE_SIZE);
+                storage_written(write_pages[page]);
+            }
+        });
+        clear_dirty();
+    }
+
+    // full copy of the RAM array of `image`, after which restore(image) only has to undo new writes
+    void assign(const Memory &image)
+    {
+        std::memcpy(data, image.data, MAX_MEMORY);
+        clear_dirty();
+        invalidate_all_decoded();
+    }
+
+    // for writes straight into `data`: the page is reset by init/restore and
+    // its predecoded instructions are dropped
+    void mark_dirty(Word address)
+    {
+        set_dirty(address);
+        storage_written(data + address);
+    }
+
+    bool is_dirty_page(uint32_t page) const
+    {
+        return (dirty_pages[page >> 6] >> (page & 63)) & 1;
+    }
+
+    uint32_t dirty_page_count() const
+    {
+        uint32_t count = 0;
+        for (uint64_t bits : dirty_pages)
+        {
+            count += __builtin_popcountll(bits);
+        }
+        return count;
+    }
+
+    void clear_dirty()
+    {
+        std::memset(dirty_pages, 0, sizeof(dirty_pages));
+    }
+
+    template <typename Fn>
+    void for_each_dirty_page(Fn &&fn) const
+    {
+        for (uint32_t word = 0; word < MEMORY_PAGE_COUNT / 64; word++)
+        {
+            uint64_t bits = dirty_pages[word];
+            while (bits)
+            {
+                fn(word * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+
+    // copies a block, e.g. a program image, into the RAM array at the same address
+    void load(Word address, const Byte *bytes, size_t size)
+    {
+        assert(address + size <= MAX_MEMORY);
+        if (size == 0)
+        {
+            return;
+        }
+        std::memcpy(data + address, bytes, size);
+        for (uint32_t page = address / MEMORY_PAGE_SIZE; page <= (address + size - 1) / MEMORY_PAGE_SIZE; page++)
+        {
+            mark_dirty(page * MEMORY_PAGE_SIZE);
+        }
+    }
+
+    // predecode cache, allocated on first use; only the entries of pages that
+    // ever held code get physical memory
+    DecodedInstruction *decoded_instructions()
+    {
+        if (!decoded)
+        {
+            size_t size = MAX_MEMORY * sizeof(DecodedInstruction);
+            void *mapping = map_zeroed(size);
+            if (mapping == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            decoded = {static_cast<DecodedInstruction *>(mapping), Unmapper{size}};
+        }
+        return decoded.get();
+    }
+
+    // whether the `size` bytes at `address` may be predecoded: they sit in one
+    // page that is plain RAM of `data` or ROM, so only the tracked writes can change them
+    bool is_decodable(Word address, uint32_t size) const
+    {
+        uint32_t page = address >> 8;
+        if ((address + size - 1) >> 8 != page || read_pages[page] == nullptr)
+        {
+            return false;
+        }
+        return write_pages[page] == nullptr || (read_pages[page] == data + page * MEMORY_PAGE_SIZE &&
+                                               write_pages[page] == data + page * MEMORY_PAGE_SIZE);
+    }
+
+    void set_decoded(Word address, DecodedInstruction instruction)
+    {
+        decoded[address] = instruction;
+        page_flags[address >> 8] |= page_decoded;
+    }
+
+    // the page changed or was remapped: drops its predecoded instructions and
+    // makes recompiled code check it again
+    void invalidate_decoded(uint32_t page)
+    {
+        if (page_flags[page] & page_decoded)
+        {
+            std::memset(&decoded[page * MEMORY_PAGE_SIZE], 0, MEMORY_PAGE_SIZE * sizeof(DecodedInstruction));
+        }
+        page_flags[page] &= ~(page_decoded | page_compiled);
+    }
+
+    void invalidate_all_decoded()
+    {
+        for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+        {
+            invalidate_decoded(page);
+        }
+    }
+
+    // 64 bit FNV-1a over 8 byte lanes, cheap enough to fingerprint every batch job
+    uint64_t digest() const
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (uint32_t i = 0; i < MAX_MEMORY; i += 8)
+        {
+            uint64_t lane;
+            std::memcpy(&lane, data + i, sizeof(lane));
+            hash = (hash ^ lane) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // raw view of the RAM array, bypasses the page table and devices
+    Byte operator[](uint32_t address) const
+    {
+        return data[address];
+    }
+
+    // what a read of `address` returns, without the access reaching a device
+    // (those pages read as 0)
+    Byte peek(Word address) const
+    {
+        const Byte *page = read_pages[address >> 8];
+        return page ? page[address & 0xFF] : 0;
+    }
+
+    void write_word(Word value, uint32_t address)
+    {
+        store(address, value & 0xFF);
+        store(address + 1, (value >> 8) & 0xFF);
+    }
+
+    void write_byte(Byte value, uint32_t address)
+    {
+        store(address, value);
+    }
+
+private:
+    void set_page(uint32_t page, const Byte *read, Byte *write, BusDevice *device)
+    {
+        read_pages[page] = read;
+        write_pages[page] = write;
+        devices[page] = device;
+        bool direct = read == data + page * MEMORY_PAGE_SIZE && write == data + page * MEMORY_PAGE_SIZE;
+        page_flags[page] = direct ? page_flags[page] & ~(page_mapped | page_shared)
+                                  : (page_flags[page] | page_mapped) & ~page_shared;
+        invalidate_decoded(page);
+    }
+
+    FORCE_INLINE void set_dirty(Word address)
+    {
+        dirty_pages[address >> 14] |= 1ull << ((address >> 8) & 63);
+    }
+
+    // a page of `data` was written behind the bus: drop what was decoded from it
+    void storage_written(const Byte *storage)
+    {
+        if (storage >= data && storage < data + MAX_MEMORY)
+        {
+            invalidate_decoded((storage - data) / MEMORY_PAGE_SIZE);
+        }
+    }
+
+    // everything but plain RAM, kept out of line so read()/store() stay small
+    NO_INLINE Byte read_mapped(Word address)
+    {
+        const Byte *page = read_pages[address >> 8];
+        if (page != nullptr)
+        {
+            return page[address & 0xFF];
+        }
+        BusDevice *device = devices[address >> 8];
+        return device != nullptr ? device->read(address) : 0;
+    }
+
+    NO_INLINE void store_mapped(Word address, Byte value)
+    {
+        Byte *page = write_pages[address >> 8];
+        if (page != nullptr)
+        {
+            page[address & 0xFF] = value;
+            set_dirty(address);
+            storage_written(page);
+            return;
+        }
+        BusDevice *device = devices[address >> 8];
+        if (device != nullptr)
+        {
+            device->write(address, value);
+        }
+        else if (page_flags[address >> 8] & page_shared)
+        {
+            unshare_page(address >> 8);
+            store(address, value);
+        }
+    }
+
+    // the private copy of a shared page, from then on plain RAM of `data`
+    void unshare_page(uint32_t page)
+    {
+        Byte *own = data + page * MEMORY_PAGE_SIZE;
+        std::memcpy(own, read_pages[page], MEMORY_PAGE_SIZE);
+        set_page(page, own, own, nullptr);
+        set_dirty(page * MEMORY_PAGE_SIZE);
+    }
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu.h"
+
+// Read-only pages stored once by content: interning two pages with the same
+// 256 bytes gives the same pointer, whichever images or pools they came from.
+class SharedPageStore
+{
+public:
+    SharedPageStore() = default;
+    SharedPageStore(const SharedPageStore &) = delete;
+    SharedPageStore &operator=(const SharedPageStore &) = delete;
+
+    // the stored copy of `page`, added if it is new; valid as long as the store
+    const Byte *intern(const Byte *page)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t hash = page_hash(page);
+        auto range = index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (std::memcmp(it->second, page, MEMORY_PAGE_SIZE) == 0)
+            {
+                return it->second;
+            }
+        }
+        if (used % pages_per_chunk == 0)
+        {
+            chunks.emplace_back(new Byte[pages_per_chunk * MEMORY_PAGE_SIZE]);
+        }
+        Byte *copy = chunks.back().get() + (used++ % pages_per_chunk) * MEMORY_PAGE_SIZE;
+        std::memcpy(copy, page, MEMORY_PAGE_SIZE);
+        index.emplace(hash, copy);
+        return copy;
+    }
+
+    // distinct pages stored
+    size_t page_count() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used;
+    }
+
+private:
+    static constexpr size_t pages_per_chunk = 64;
+
+    // FNV-1a over 8 byte lanes, like Memory::digest
+    static uint64_t page_hash(const Byte *page)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i += 8)
+        {
+            uint64_t lane;
+            std::memcpy(&lane, page + i, sizeof(lane));
+            hash = (hash ^ lane) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    mutable std::mutex mutex;
+    std::unordered_multimap<uint64_t, const Byte *> index;
+    std::vector<std::unique_ptr<Byte[]>> chunks;
+    size_t used = 0;
+};
+
+// A machine handed out by MachinePool. Memory comes first so that `data`
+// starts on an OS page of the arena.
+struct PooledMachine
+{
+    Memory memory;
+    CPU cpu;
+};
+
+// Up to `capacity` machines that all start from the same memory, `image()`.
+// The machines live in one anonymous mapping reserved up front; a slot is only
+// backed by physical memory where its machine touched it, which for a machine
+// that never wrote a page of `data` is nothing. Pages made shared with share()
+// are interned in a SharedPageStore and mapped copy-on-write (see
+// Memory::map_shared), so ROM and other pages that are the same everywhere
+// exist once for the whole pool.
+//
+// release() only puts a machine on the free list; acquire() brings a used one
+// back to the image with Memory::restore, which copies the pages it wrote. No
+// path after construction allocates, apart from the predecode cache a machine
+// maps the first time it executes.
+//
+// With huge_pages the arena asks for transparent huge pages: fewer TLB misses
+// when the machines are busy, but every 2 MB the machines touch is backed at
+// once, which gives up most of the density.
+class MachinePool
+{
+public:
+    explicit MachinePool(size_t capacity, bool huge_pages = false,
+                         std::shared_ptr<SharedPageStore> store = std::make_shared<SharedPageStore>())
+        : capacity(capacity), store(std::move(store)), base_image(std::make_unique<Memory>())
+    {
+        arena_size = std::max<size_t>(1, capacity * slot_size);
+        arena = static_cast<Byte *>(map_zeroed(arena_size));
+        if (arena == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        if (huge_pages)
+        {
+            madvise(arena, arena_size, MADV_HUGEPAGE);
+        }
+        free_slots.reserve(capacity);
+        base_image->init();
+    }
+
+    ~MachinePool()
+    {
+        for (size_t i = 0; i < constructed; i++)
+        {
+            slot(i)->~PooledMachine();
+        }
+        munmap(arena, arena_size);
+    }
+
+    MachinePool(const MachinePool &) = delete;
+    MachinePool &operator=(const MachinePool &) = delete;
+
+    // The memory machines start with: load the program into it and map ROM
+    // (map_rom), then share() the pages that are the same for every machine.
+    // Devices belong to the machines and are mapped after acquire().
+    // Changing it while machines are out is not supported.
+    Memory &image()
+    {
+        return *base_image;
+    }
+
+    // pages [first_page, first_page + count) of the image are interned and
+    // become shared, copy-on-write, in every machine
+    void share(Byte first_page, uint32_t count)
+    {
+        assert(first_page + count <= MEMORY_PAGE_COUNT);
+        for (uint32_t page = first_page; page < first_page + count; page++)
+        {
+            assert(base_image->devices[page] == nullptr);
+            const Byte *storage = base_image->read_pages[page];
+            base_image->map_shared(page, 1, store->intern(storage));
+        }
+    }
+
+    // A machine with memory equal to the image and the registers of
+    // CPU::reset (PC $FFFC, SP $FF, everything else 0), or nullptr when all
+    // `capacity` are out
+    PooledMachine *acquire()
+    {
+        PooledMachine *machine;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free_slots.empty())
+            {
+                machine = free_slots.back();
+                free_slots.pop_back();
+            }
+            else if (constructed < capacity)
+            {
+                // default-initialized: `data` is left as the zeroed arena has
+                // it, and only the pages the image wrote need copying
+                machine = new (slot(constructed++)) PooledMachine;
+                Memory &memory = machine->memory;
+                std::memcpy(memory.dirty_pages, base_image->dirty_pages, sizeof(memory.dirty_pages));
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+        match_image(machine->memory);
+        machine->memory.restore(*base_image);
+        machine->cpu = CPU();
+        machine->cpu.set_registers({0xFFFC, 0xFF, 0, 0, 0, 0});
+        return machine;
+    }
+
+    void release(PooledMachine *machine)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_slots.push_back(machine);
+    }
+
+    size_t machines_out() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return constructed - free_slots.size();
+    }
+
+    const SharedPageStore &page_store() const
+    {
+        return *store;
+    }
+
+private:
+    // whole OS pages per machine, so no two machines share one
+    static constexpr size_t slot_size = (sizeof(PooledMachine) + 4095) / 4096 * 4096;
+
+    PooledMachine *slot(size_t index)
+    {
+        return reinterpret_cast<PooledMachine *>(arena + index * slot_size);
+    }
+
+    // Puts back the image's page table: shared pages that were copied on
+    // write or remapped are shared again, ROM is ROM, and pages the machine
+    // mapped elsewhere are its own RAM again, dirty so restore refills them.
+    void match_image(Memory &memory)
+    {
+        const Memory &image = *base_image;
+        for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+        {
+            const Byte *storage = image.read_pages[page];
+            Byte *own = memory.data + page * MEMORY_PAGE_SIZE;
+            if (image.is_shared_page(page))
+            {
+                if (memory.read_pages[page] != storage || !memory.is_shared_page(page))
+                {
+                    memory.map_shared(page, 1, storage);
+                }
+            }
+            else if (image.write_pages[page] == nullptr)
+            {
+                if (memory.read_pages[page] != storage || memory.write_pages[page] != nullptr ||
+                    memory.devices[page] != nullptr)
+                {
+                    memory.map_rom(page, 1, storage);
+                }
+            }
+            else if (memory.read_pages[page] != own || memory.write_pages[page] != own)
+            {
+                memory.map_ram(page, 1);
+                memory.mark_dirty(page * MEMORY_PAGE_SIZE);
+            }
+        }
+    }
+
+    size_t capacity;
+    std::shared_ptr<SharedPageStore> store;
+    std::unique_ptr<Memory> base_image;
+    Byte *arena;
+    size_t arena_size;
+    size_t constructed = 0;
+    std::vector<PooledMachine *> free_slots;
+    mutable std::mutex mutex;
+};
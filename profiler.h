@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+// Execution profile filled by CPU::execute<TraceLevel::profile>: instructions
+// started per PC, instructions and cycles per opcode, and a calling context
+// tree built from JSR/RTS and interrupt entry/RTI. A profiler belongs to one
+// CPU, so it is updated without any locking.
+class Profiler
+{
+public:
+    // deeper call chains (e.g. code that drops return addresses) stay in the
+    // deepest frame until as many returns as calls past it
+    static constexpr uint32_t max_depth = 256;
+
+    // One node of the calling context tree: a subroutine reached through one
+    // particular chain of calls. `cycles` excludes the callees.
+    struct Frame
+    {
+        Word function;
+        uint32_t parent;
+        uint32_t depth;
+        uint64_t calls;
+        uint64_t cycles;
+    };
+
+    struct CallEdge
+    {
+        Word caller; // entry address of the calling subroutine, 0 for the root
+        Word callee;
+        uint64_t calls;
+    };
+
+    std::vector<uint64_t> pc_hits = std::vector<uint64_t>(MAX_MEMORY);
+    uint64_t opcode_counts[256] = {};
+    uint64_t opcode_cycles[256] = {};
+    std::vector<Frame> frames = {{0, 0, 0, 0, 0}}; // frames[0] is the root, whatever ran when profiling started
+    uint32_t current = 0;
+    uint32_t dropped_calls = 0; // made in the deepest frame, not yet returned from
+
+    void clear()
+    {
+        std::fill(pc_hits.begin(), pc_hits.end(), 0);
+        std::fill(std::begin(opcode_counts), std::end(opcode_counts), 0);
+        std::fill(std::begin(opcode_cycles), std::end(opcode_cycles), 0);
+        frames.assign(1, {0, 0, 0, 0, 0});
+        children.clear();
+        current = 0;
+        dropped_calls = 0;
+    }
+
+    FORCE_INLINE void record_instruction(Word pc, Byte opcode, uint32_t frame, int64_t cycles)
+    {
+        pc_hits[pc]++;
+        opcode_counts[opcode]++;
+        opcode_cycles[opcode] += cycles;
+        frames[frame].cycles += cycles;
+    }
+
+    void call(Word target)
+    {
+        if (frames[current].depth + 1 >= max_depth)
+        {
+            dropped_calls++;
+            return;
+        }
+        uint64_t key = uint64_t(current) << 16 | target;
+        auto found = children.find(key);
+        if (found == children.end())
+        {
+            found = children.emplace(key, uint32_t(frames.size())).first;
+            frames.push_back({target, current, frames[current].depth + 1, 0, 0});
+        }
+        current = found->second;
+        frames[current].calls++;
+    }
+
+    // a return without a matching call (e.g. RTS used as a jump) stays at the root
+    void return_from_call()
+    {
+        if (dropped_calls > 0)
+        {
+            dropped_calls--;
+            return;
+        }
+        current = frames[current].parent;
+    }
+
+    uint64_t total_cycles() const
+    {
+        uint64_t total = 0;
+        for (uint64_t cycles : opcode_cycles)
+        {
+            total += cycles;
+        }
+        return total;
+    }
+
+    // calls summed over every context, ordered by caller then callee
+    std::vector<CallEdge> call_edges() const
+    {
+        std::unordered_map<uint32_t, uint64_t> calls;
+        for (size_t i = 1; i < frames.size(); i++)
+        {
+            calls[uint32_t(frames[frames[i].parent].function) << 16 | frames[i].function] += frames[i].calls;
+        }
+        std::vector<CallEdge> edges;
+        for (const auto &edge : calls)
+        {
+            edges.push_back({Word(edge.first >> 16), Word(edge.first), edge.second});
+        }
+        std::sort(edges.begin(), edges.end(), [](const CallEdge &a, const CallEdge &b) {
+            return a.caller != b.caller ? a.caller < b.caller : a.callee < b.callee;
+        });
+        return edges;
+    }
+
+    // One "root;$C000;$C123 <cycles>" line per context with cycles of its own,
+    // the input format of flamegraph.pl and most flame graph viewers.
+    void write_collapsed_stacks(std::ostream &out) const
+    {
+        std::vector<std::string> names(frames.size());
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            names[i] = i == 0 ? "root" : names[frames[i].parent] + ";$" + to_hex(frames[i].function).substr(2);
+            if (frames[i].cycles > 0)
+            {
+                out << names[i] << ' ' << frames[i].cycles << '\n';
+            }
+        }
+    }
+
+private:
+    std::unordered_map<uint64_t, uint32_t> children; // (parent frame << 16 | function) -> frame
+};
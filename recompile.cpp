@@ -0,0 +1,82 @@
+// Ahead-of-time recompiler (see recompiler.h) for a program image.
+//
+//   g++ -O2 recompile.cpp -o ./build/recompile
+//   ./build/recompile [--load ADDRESS] [--entry ADDRESS]... [--name NAME] [-o FILE] IMAGE | --demo
+//
+// Writes a header defining `struct NAME` (default recompiled_program) whose
+// NAME::execute(cpu, budget, memory) runs like cpu.execute(budget, memory) on
+// machines holding IMAGE. Analysis starts at each --entry, else at the image's
+// entry address and vectors. --demo recompiles demo_firmware.h, which is how
+// demo_firmware_recompiled.h is made. ADDRESS values are hexadecimal.
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "demo_firmware.h"
+#include "recompiler.h"
+
+int main(int argc, char **argv)
+{
+    std::string image_path, output_path, name = "recompiled_program";
+    Word load_address = 0;
+    std::vector<Word> entries;
+    bool demo = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--load" && has_value)
+            load_address = std::stoul(argv[++i], nullptr, 16);
+        else if (arg == "--entry" && has_value)
+            entries.push_back(std::stoul(argv[++i], nullptr, 16));
+        else if (arg == "--name" && has_value)
+            name = argv[++i];
+        else if (arg == "-o" && has_value)
+            output_path = argv[++i];
+        else if (arg == "--demo")
+            demo = true;
+        else if (arg.rfind("-", 0) != 0 && image_path.empty())
+            image_path = arg;
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--load ADDRESS] [--entry ADDRESS]... [--name NAME] [-o FILE] IMAGE | --demo"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    Image image;
+    if (demo)
+    {
+        image = demo_firmware_image();
+        name = "demo_firmware_recompiled";
+    }
+    else if (image_path.empty() || !load_image_file(image_path, image, load_address))
+    {
+        std::cerr << "cannot load " << image_path << std::endl;
+        return 1;
+    }
+
+    if (recover_code(image, entries.empty() ? image_entry_points(image) : entries).instructions.empty())
+    {
+        std::cerr << "no code reachable from the entry points, see --entry" << std::endl;
+        return 1;
+    }
+    std::string source = recompile_image(image, name, entries);
+    if (output_path.empty())
+    {
+        std::cout << source;
+        return 0;
+    }
+    std::ofstream out(output_path);
+    out << source;
+    if (!out)
+    {
+        std::cerr << "cannot write " << output_path << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,548 @@
+#pragma once
+
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "loader.h"
+
+// Ahead-of-time recompiler for fixed program images. recompile_image() follows
+// every static path from the image's vectors, splits the code it finds into
+// basic blocks and emits C++ in which every instruction is the interpreter's
+// own handler, CPU::run_instruction, on a local copy of the CPU with address,
+// opcode and operand as constants. The compiler then folds the dispatch, the
+// operand fetch and most PC updates away and jumps between blocks become
+// gotos. What the analysis cannot follow runs in the interpreter: computed
+// jumps (JMP indirect, or RTS/RTI to an address that starts no block), code
+// outside the image and pages whose instructions were overwritten. Registers,
+// memory and cycles come out exactly as from CPU::execute either way.
+
+// A page of the image as the generated code expects to find it in memory
+struct CompiledPage
+{
+    Byte page;
+    uint64_t code[MEMORY_PAGE_SIZE / 64]; // one bit per byte of a compiled instruction
+    Byte bytes[MEMORY_PAGE_SIZE];         // the image; only the `code` bytes are compared
+};
+
+// The part of a recompiled program that is not generated: checks which pages
+// still hold their code and runs the interpreter where compiled code cannot.
+// Block starts on intact pages are breakpoints, so the interpreter
+// (execute<TraceLevel::debug>) stops where compiled code can take over again.
+// Generated code keeps one per thread; it assumes one recompiled program per Memory.
+class RecompiledRuntime
+{
+public:
+    RecompiledRuntime(const CompiledPage *pages, size_t page_count, const Word *entries, size_t entry_count)
+        : pages(pages), page_count(page_count)
+    {
+        std::fill(std::begin(page_index), std::end(page_index), -1);
+        for (size_t i = 0; i < page_count; i++)
+        {
+            page_index[pages[i].page] = int(i);
+        }
+        for (size_t i = 0; i < entry_count; i++)
+        {
+            page_entries[entries[i] >> 8].push_back(entries[i]);
+        }
+    }
+
+    RecompiledRuntime(const RecompiledRuntime &) = delete;
+    RecompiledRuntime &operator=(const RecompiledRuntime &) = delete;
+
+    // before a run: the memory may have been written, or be another Memory, since the last one
+    void check_pages(Memory &memory)
+    {
+        for (size_t i = 0; i < page_count; i++)
+        {
+            check_page(memory, pages[i].page);
+        }
+    }
+
+    // Whether `page` holds the code it was compiled from. The answer is kept in
+    // Memory::page_compiled until the next write to the page; after one the
+    // instruction bytes are compared again, so data next to code costs a
+    // compare, not the compiled code.
+    bool check_page(Memory &memory, uint32_t page)
+    {
+        if (page_index[page] < 0)
+        {
+            return false;
+        }
+        bool intact = memory.page_flags[page] & Memory::page_compiled;
+        if (!intact && memory.is_decodable(page * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE))
+        {
+            intact = matches(pages[page_index[page]], memory.read_pages[page]);
+            if (intact)
+            {
+                memory.page_flags[page] |= Memory::page_compiled;
+            }
+        }
+        if (intact != entries_enabled[page])
+        {
+            for (Word entry : page_entries[page])
+            {
+                points.set_breakpoint(entry, intact);
+            }
+            entries_enabled[page] = intact;
+        }
+        return intact;
+    }
+
+    // Interprets from cpu.PC until it reaches a block start on an intact page
+    // and returns true, or returns false where CPU::execute would have returned:
+    // budget spent, unofficial opcode or an IRQ unmasked by CLI/PLP/RTI.
+    bool interpret(CPU &cpu, Memory &memory, int64_t &cycles)
+    {
+        Breakpoints *saved = cpu.breakpoints;
+        cpu.breakpoints = &points;
+        bool resume = false;
+        while (cycles > 0)
+        {
+            if (Breakpoints::test(points.execute, cpu.PC) && check_page(memory, cpu.PC >> 8))
+            {
+                resume = true;
+                break;
+            }
+            cycles -= cpu.execute<TraceLevel::debug>(cycles, memory);
+            if (points.reason == StopReason::none)
+            {
+                break;
+            }
+        }
+        cpu.breakpoints = saved;
+        return resume;
+    }
+
+private:
+    const CompiledPage *pages;
+    size_t page_count;
+    int page_index[MEMORY_PAGE_COUNT];
+    std::vector<Word> page_entries[MEMORY_PAGE_COUNT];
+    bool entries_enabled[MEMORY_PAGE_COUNT] = {};
+    Breakpoints points;
+
+    static bool matches(const CompiledPage &compiled, const Byte *storage)
+    {
+        for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i++)
+        {
+            if ((compiled.code[i >> 6] >> (i & 63)) & 1 && storage[i] != compiled.bytes[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// One instruction of generated code, where `c` is the CPU and `cycles` the
+// budget of the run: stops before it once the budget is spent, as
+// CPU::execute does, then runs the interpreter's handler as if the opcode had
+// just been fetched.
+#define RECOMPILED_STEP(address, opcode, operand)                    \
+    if (cycles <= 0)                                                 \
+    {                                                                \
+        c.PC = address;                                              \
+        goto stop;                                                   \
+    }                                                                \
+    c.PC = Word(address + 1);                                        \
+    c.predecoded_operand = operand;                                  \
+    if (!c.run_instruction<TraceLevel::off, opcode>(cycles, memory)) \
+    {                                                                \
+        goto stop;                                                   \
+    }
+
+// hands over to the interpreter at `address` once a write dropped `page`'s Memory::page_compiled
+#define RECOMPILED_CHECK(page, address)                                              \
+    if (__builtin_expect(!(memory.page_flags[page] & Memory::page_compiled), 0))     \
+    {                                                                                \
+        c.PC = address;                                                              \
+        goto interpret;                                                              \
+    }
+
+// Instructions reachable from the entry points along static control flow
+struct RecoveredCode
+{
+    struct Instruction
+    {
+        Byte opcode;
+        Word operand; // the operand bytes, little endian
+        uint32_t size;
+    };
+
+    std::map<Word, Instruction> instructions;
+    std::set<Word> leaders; // instructions that start a basic block
+};
+
+// bytes of an instruction in memory; JSR and BRK read more than they predecode
+inline uint32_t instruction_size(Byte opcode)
+{
+    return CPU::decode(opcode).operation == Operation::JSR ? 3 : 1 + CPU::predecoded_bytes(opcode);
+}
+
+// the image as 64K entries, -1 where it has no byte
+inline std::vector<int> image_bytes(const Image &image)
+{
+    std::vector<int> bytes(MAX_MEMORY, -1);
+    if (image.file)
+    {
+        for (size_t i = 0; i < image.file->size(); i++)
+        {
+            bytes[Word(image.raw_address + i)] = image.file->data()[i];
+        }
+    }
+    for (const MemorySegment &segment : image.segments)
+    {
+        for (size_t i = 0; i < segment.bytes.size(); i++)
+        {
+            bytes[Word(segment.address + i)] = segment.bytes[i];
+        }
+    }
+    return bytes;
+}
+
+// the image's start address, if it has one, and the NMI, reset and IRQ vectors it sets
+inline std::vector<Word> image_entry_points(const Image &image)
+{
+    std::vector<int> bytes = image_bytes(image);
+    std::vector<Word> entries;
+    if (image.has_entry)
+    {
+        entries.push_back(image.entry);
+    }
+    for (Word vector : {0xFFFC, 0xFFFE, 0xFFFA})
+    {
+        if (bytes[vector] >= 0 && bytes[vector + 1] >= 0)
+        {
+            entries.push_back(bytes[vector] | bytes[vector + 1] << 8);
+        }
+    }
+    return entries;
+}
+
+// Follows branches, jumps and calls from `entries` through the bytes of
+// `image`. Blocks end at control transfers, before an instruction that is
+// reached in more than one way and at page boundaries; instructions that
+// straddle a page boundary are left to the interpreter, so that every block
+// depends on exactly one page.
+inline RecoveredCode recover_code(const Image &image, const std::vector<Word> &entries)
+{
+    std::vector<int> bytes = image_bytes(image);
+    RecoveredCode code;
+    std::set<Word> targets(entries.begin(), entries.end());
+    std::map<Word, int> fall_throughs;
+    std::vector<Word> pending(entries.begin(), entries.end());
+
+    auto branch_to = [&](Word target) {
+        targets.insert(target);
+        pending.push_back(target);
+    };
+
+    while (!pending.empty())
+    {
+        Word address = pending.back();
+        pending.pop_back();
+        while (code.instructions.count(address) == 0 && bytes[address] >= 0)
+        {
+            Byte opcode = bytes[address];
+            uint32_t size = instruction_size(opcode);
+            Word operand = 0;
+            bool complete = true;
+            for (uint32_t i = 1; i < size; i++)
+            {
+                int byte = bytes[Word(address + i)];
+                complete = complete && byte >= 0;
+                operand |= (byte & 0xFF) << (8 * (i - 1));
+            }
+            Word next = address + size;
+            OpcodeInfo info = CPU::decode(opcode);
+            bool ends_flow = info.operation == Operation::JMP || info.operation == Operation::RTS ||
+                             info.operation == Operation::RTI || info.operation == Operation::ILL;
+            if (!complete)
+            {
+                break;
+            }
+            bool straddles = (address + size - 1) >> 8 != address >> 8;
+            if (!straddles)
+            {
+                code.instructions[address] = {opcode, operand, size};
+            }
+            if (info.mode == AddressingMode::relative)
+            {
+                branch_to(next + int8_t(operand));
+                branch_to(next);
+                break;
+            }
+            if (info.operation == Operation::JMP && info.mode == AddressingMode::absolute)
+            {
+                branch_to(operand);
+                break;
+            }
+            if (info.operation == Operation::JSR)
+            {
+                branch_to(operand);
+                branch_to(next); // where its RTS returns to
+                break;
+            }
+            if (info.operation == Operation::BRK)
+            {
+                branch_to(next); // where the handler's RTI returns to
+                break;
+            }
+            if (ends_flow)
+            {
+                break;
+            }
+            if (straddles)
+            {
+                branch_to(next); // the interpreter hands back here
+                break;
+            }
+            if (++fall_throughs[next] > 1 || next >> 8 != address >> 8)
+            {
+                targets.insert(next);
+            }
+            address = next;
+        }
+    }
+    for (Word target : targets)
+    {
+        if (code.instructions.count(target))
+        {
+            code.leaders.insert(target);
+        }
+    }
+    return code;
+}
+
+// "LDA $03C0,X" and the like, for the comments of generated code
+inline std::string disassemble(Word address, Byte opcode, Word operand)
+{
+    OpcodeInfo info = CPU::decode(opcode);
+    std::stringstream text;
+    text << std::hex << std::uppercase << std::setfill('0');
+    if (info.operation == Operation::ILL)
+    {
+        text << ".byte $" << std::setw(2) << int(opcode);
+        return text.str();
+    }
+    text << operation_name(info.operation);
+    auto byte = [&]() -> std::ostream & { return text << '$' << std::setw(2) << (operand & 0xFF); };
+    auto word = [&]() -> std::ostream & { return text << '$' << std::setw(4) << operand; };
+    switch (info.mode)
+    {
+    case AddressingMode::implied: break;
+    case AddressingMode::accumulator: text << " A"; break;
+    case AddressingMode::immediate: text << " #"; byte(); break;
+    case AddressingMode::zero_page: text << ' '; byte(); break;
+    case AddressingMode::zero_page_x: text << ' '; byte() << ",X"; break;
+    case AddressingMode::zero_page_y: text << ' '; byte() << ",Y"; break;
+    case AddressingMode::absolute: text << ' '; word(); break;
+    case AddressingMode::absolute_x: text << ' '; word() << ",X"; break;
+    case AddressingMode::absolute_y: text << ' '; word() << ",Y"; break;
+    case AddressingMode::indirect: text << " ("; word() << ')'; break;
+    case AddressingMode::indexed_indirect: text << " ("; byte() << ",X)"; break;
+    case AddressingMode::indirect_indexed: text << " ("; byte() << "),Y"; break;
+    case AddressingMode::relative: text << " $" << std::setw(4) << Word(address + 2 + int8_t(operand)); break;
+    }
+    return text.str();
+}
+
+// whether the instruction may write to `page`: only then does the rest of its block check it
+inline bool may_write_page(Byte opcode, Word operand, uint32_t page)
+{
+    OpcodeInfo info = CPU::decode(opcode);
+    if (info.operation == Operation::PHA || info.operation == Operation::PHP)
+    {
+        return page == 0x01;
+    }
+    if (!is_store_operation(info.operation) &&
+        !(is_rmw_operation(info.operation) && info.mode != AddressingMode::accumulator))
+    {
+        return false;
+    }
+    switch (info.mode)
+    {
+    case AddressingMode::zero_page:
+    case AddressingMode::zero_page_x:
+    case AddressingMode::zero_page_y:
+        return page == 0x00;
+    case AddressingMode::absolute:
+        return page == uint32_t(operand >> 8);
+    case AddressingMode::absolute_x:
+    case AddressingMode::absolute_y:
+        return page == uint32_t(operand >> 8) || page == uint32_t((operand >> 8) + 1) % MEMORY_PAGE_COUNT;
+    default:
+        return true;
+    }
+}
+
+// Generates a header that defines `struct <name>` with
+//   static uint64_t execute(CPU &cpu, uint64_t budget, Memory &memory);
+// a drop-in for cpu.execute(budget, memory) on machines running `image`.
+// `entries` are where the analysis starts, image_entry_points() by default;
+// add the targets of jump tables to compile the code behind them too.
+inline std::string recompile_image(const Image &image, const std::string &name, std::vector<Word> entries = {})
+{
+    if (entries.empty())
+    {
+        entries = image_entry_points(image);
+    }
+    RecoveredCode code = recover_code(image, entries);
+    std::vector<int> bytes = image_bytes(image);
+
+    std::stringstream out;
+    auto hex = [](uint32_t value, int digits) {
+        std::stringstream text;
+        text << "0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(digits) << value;
+        return text.str();
+    };
+    auto label = [&](Word address) {
+        return code.leaders.count(address) ? "L_" + hex(address, 4).substr(2) : std::string("dispatch");
+    };
+
+    std::map<uint32_t, std::vector<Word>> pages;
+    for (const auto &entry : code.instructions)
+    {
+        pages[entry.first >> 8].push_back(entry.first);
+    }
+
+    out << "// Generated by recompile.cpp (recompiler.h); do not edit.\n"
+        << "#pragma once\n\n"
+        << "#include \"recompiler.h\"\n\n"
+        << "struct " << name << "\n{\n";
+
+    out << "    static constexpr CompiledPage pages[] = {\n";
+    for (const auto &page : pages)
+    {
+        uint64_t mask[MEMORY_PAGE_SIZE / 64] = {};
+        for (Word address : page.second)
+        {
+            for (uint32_t i = 0; i < code.instructions[address].size; i++)
+            {
+                uint32_t offset = (address + i) & 0xFF;
+                mask[offset >> 6] |= 1ull << (offset & 63);
+            }
+        }
+        out << "        {" << hex(page.first, 2) << ",\n         {";
+        for (int i = 0; i < 4; i++)
+        {
+            out << (i ? ", " : "") << hex(mask[i] >> 32, 8) << hex(mask[i] & 0xFFFFFFFF, 8).substr(2) << "ull";
+        }
+        out << "},\n         {";
+        for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i++)
+        {
+            bool code_byte = (mask[i >> 6] >> (i & 63)) & 1;
+            out << (i == 0 ? "" : i % 16 == 0 ? ",\n          " : ", ") << hex(code_byte ? bytes[page.first << 8 | i] : 0, 2);
+        }
+        out << "}},\n";
+    }
+    out << "    };\n\n";
+
+    out << "    // first instructions of the compiled blocks\n"
+        << "    static constexpr Word entries[] = {";
+    size_t count = 0;
+    for (Word leader : code.leaders)
+    {
+        out << (count == 0 ? "" : count % 12 == 0 ? ",\n                                       " : ", ") << hex(leader, 4);
+        count++;
+    }
+    out << "};\n\n";
+
+    out << "    // cpu.execute(budget, memory), with the image's code compiled\n"
+        << "    static uint64_t execute(CPU &cpu, uint64_t budget, Memory &memory)\n"
+        << "    {\n"
+        << "        thread_local RecompiledRuntime runtime(pages, std::size(pages), entries, std::size(entries));\n"
+        << "        int64_t cycles = budget;\n"
+        << "        runtime.check_pages(memory);\n"
+        << "        CPU c = cpu;\n"
+        << "        goto dispatch;\n";
+
+    for (Word leader : code.leaders)
+    {
+        uint32_t page = leader >> 8;
+        out << "\n    " << label(leader) << ":\n"
+            << "        RECOMPILED_CHECK(" << hex(page, 2) << ", " << hex(leader, 4) << ")\n";
+        Word address = leader;
+        for (;;)
+        {
+            const RecoveredCode::Instruction &instruction = code.instructions[address];
+            OpcodeInfo info = CPU::decode(instruction.opcode);
+            Word next = address + instruction.size;
+            out << "        // " << hex(address, 4).substr(2) << "  " << disassemble(address, instruction.opcode, instruction.operand) << "\n"
+                << "        RECOMPILED_STEP(" << hex(address, 4) << ", " << hex(instruction.opcode, 2) << ", "
+                << hex(instruction.size > 1 ? CPU::predecoded_bytes(instruction.opcode) == 2 ? instruction.operand : instruction.operand & 0xFF : 0, 4)
+                << ")\n";
+            if (info.operation == Operation::ILL)
+            {
+                out << "        goto stop;\n";
+                break;
+            }
+            if (info.mode == AddressingMode::relative)
+            {
+                Word target = next + int8_t(instruction.operand);
+                out << "        if (c.PC == " << hex(target, 4) << ")\n"
+                    << "        {\n"
+                    << "            goto " << label(target) << ";\n"
+                    << "        }\n"
+                    << "        goto " << label(next) << ";\n";
+                break;
+            }
+            if ((info.operation == Operation::JMP && info.mode == AddressingMode::absolute) || info.operation == Operation::JSR)
+            {
+                // JSR reads its high byte after the push, which may have overwritten it
+                Word target = instruction.operand;
+                out << "        if (c.PC == " << hex(target, 4) << ")\n"
+                    << "        {\n"
+                    << "            goto " << label(target) << ";\n"
+                    << "        }\n"
+                    << "        goto dispatch;\n";
+                break;
+            }
+            if (info.operation == Operation::JMP || info.operation == Operation::RTS || info.operation == Operation::RTI ||
+                info.operation == Operation::BRK)
+            {
+                out << "        goto dispatch;\n";
+                break;
+            }
+            if (code.leaders.count(next) || code.instructions.count(next) == 0)
+            {
+                out << "        goto " << label(next) << ";\n";
+                break;
+            }
+            if (may_write_page(instruction.opcode, instruction.operand, page))
+            {
+                out << "        RECOMPILED_CHECK(" << hex(page, 2) << ", " << hex(next, 4) << ")\n";
+            }
+            address = next;
+        }
+    }
+
+    out << "\n    dispatch:\n"
+        << "        switch (c.PC)\n"
+        << "        {\n";
+    for (Word leader : code.leaders)
+    {
+        out << "        case " << hex(leader, 4) << ":\n"
+            << "            goto " << label(leader) << ";\n";
+    }
+    out << "        }\n"
+        << "    interpret:\n"
+        << "        cpu = c;\n"
+        << "        if (!runtime.interpret(cpu, memory, cycles))\n"
+        << "        {\n"
+        << "            return budget - cycles;\n"
+        << "        }\n"
+        << "        c = cpu;\n"
+        << "        goto dispatch;\n"
+        << "    stop:\n"
+        << "        cpu = c;\n"
+        << "        return budget - cycles;\n"
+        << "    }\n"
+        << "};\n";
+    return out.str();
+}
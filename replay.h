@@ -0,0 +1,556 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "cpu.h"
+#include "scheduler.h"
+
+// Deterministic record/replay. Given the same starting state the CPU and RAM
+// evolve identically, so a recording only holds what came from outside: the
+// values returned by device reads and the cycles at which interrupts were
+// taken. Keyframes of the registers and RAM, taken every few cycles, let a
+// replay start mid-recording and check that it has not diverged.
+//
+// Everything is delta encoded into byte streams of LEB128 varints:
+//   reads       (value, run length) pairs, polling loops collapse into one run
+//   interrupts  (cycles since the previous one << 1 | is NMI)
+//   keyframe    pages that changed since the previous keyframe, as
+//               (page, (zero run, literal length, literal bytes)...) of the
+//               page XOR its previous contents
+
+inline void put_varint(std::vector<Byte> &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(Byte(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(Byte(value));
+}
+
+// Bounds checked cursor over an encoded stream; reading past the end yields
+// zeros and clears `ok`.
+struct ByteReader
+{
+    const Byte *next;
+    const Byte *end;
+    bool ok = true;
+
+    ByteReader(const Byte *bytes, size_t size) : next(bytes), end(bytes + size) {}
+
+    bool at_end() const
+    {
+        return next == end;
+    }
+
+    Byte byte()
+    {
+        if (next == end)
+        {
+            ok = false;
+            return 0;
+        }
+        return *next++;
+    }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7)
+        {
+            Byte b = byte();
+            value |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80))
+            {
+                return value;
+            }
+        }
+        ok = false;
+        return value;
+    }
+
+    const Byte *bytes(size_t count)
+    {
+        if (size_t(end - next) < count)
+        {
+            ok = false;
+            next = end;
+            return nullptr;
+        }
+        const Byte *start = next;
+        next += count;
+        return start;
+    }
+};
+
+// State of the machine at one instruction boundary of a recording
+struct Keyframe
+{
+    uint64_t clock;
+    Registers registers;
+    uint64_t reads;          // device reads logged before it
+    uint64_t interrupts;     // interrupts logged before it
+    std::vector<Byte> pages; // RAM delta against the previous keyframe, the first one against all zeros
+};
+
+struct ReplayLog
+{
+    uint64_t start_clock = 0;
+    uint64_t end_clock = 0;
+    std::vector<Byte> reads;
+    std::vector<Byte> interrupts;
+    std::vector<Keyframe> keyframes; // the first at start_clock, the last at end_clock
+
+    std::vector<Byte> serialize() const
+    {
+        std::vector<Byte> out = {'R', 'P', 'L', '1'};
+        put_varint(out, start_clock);
+        put_varint(out, end_clock - start_clock);
+        put_stream(out, reads);
+        put_stream(out, interrupts);
+        put_varint(out, keyframes.size());
+        const Keyframe *previous = nullptr;
+        for (const Keyframe &keyframe : keyframes)
+        {
+            put_varint(out, keyframe.clock - (previous ? previous->clock : start_clock));
+            put_varint(out, keyframe.reads - (previous ? previous->reads : 0));
+            put_varint(out, keyframe.interrupts - (previous ? previous->interrupts : 0));
+            const Registers &r = keyframe.registers;
+            out.insert(out.end(), {Byte(r.PC), Byte(r.PC >> 8), r.SP, r.A, r.X, r.Y, r.P});
+            put_stream(out, keyframe.pages);
+            previous = &keyframe;
+        }
+        return out;
+    }
+
+    // false on a truncated or malformed log
+    bool deserialize(const Byte *bytes, size_t size)
+    {
+        *this = ReplayLog();
+        ByteReader in(bytes, size);
+        const Byte *magic = in.bytes(4);
+        if (!magic || std::memcmp(magic, "RPL1", 4) != 0)
+        {
+            return false;
+        }
+        start_clock = in.varint();
+        end_clock = start_clock + in.varint();
+        get_stream(in, reads);
+        get_stream(in, interrupts);
+        uint64_t count = in.varint();
+        for (uint64_t i = 0; i < count && in.ok; i++)
+        {
+            const Keyframe *previous = keyframes.empty() ? nullptr : &keyframes.back();
+            Keyframe keyframe;
+            keyframe.clock = (previous ? previous->clock : start_clock) + in.varint();
+            keyframe.reads = (previous ? previous->reads : 0) + in.varint();
+            keyframe.interrupts = (previous ? previous->interrupts : 0) + in.varint();
+            const Byte *r = in.bytes(7);
+            if (r)
+            {
+                keyframe.registers = {Word(r[0] | r[1] << 8), r[2], r[3], r[4], r[5], r[6]};
+            }
+            get_stream(in, keyframe.pages);
+            keyframes.push_back(std::move(keyframe));
+        }
+        return in.ok && in.at_end() && !keyframes.empty();
+    }
+
+    // Applies the page deltas of keyframe `index` to `ram`, which must hold
+    // the RAM of the keyframe before it (or zeros for the first one).
+    bool apply_pages(size_t index, Byte *ram) const
+    {
+        const std::vector<Byte> &pages = keyframes[index].pages;
+        ByteReader in(pages.data(), pages.size());
+        while (!in.at_end() && in.ok)
+        {
+            Byte *page = ram + in.byte() * MEMORY_PAGE_SIZE;
+            uint32_t offset = 0;
+            while (offset < MEMORY_PAGE_SIZE && in.ok)
+            {
+                offset += in.varint();
+                uint64_t length = in.varint();
+                const Byte *literal = in.bytes(length);
+                if (!literal || offset + length > MEMORY_PAGE_SIZE)
+                {
+                    return false;
+                }
+                for (uint64_t i = 0; i < length; i++)
+                {
+                    page[offset++] ^= literal[i];
+                }
+            }
+        }
+        return in.ok;
+    }
+
+    // RAM as of keyframe `index`
+    std::vector<Byte> ram_at(size_t index) const
+    {
+        std::vector<Byte> ram(MAX_MEMORY);
+        for (size_t i = 0; i <= index; i++)
+        {
+            apply_pages(i, ram.data());
+        }
+        return ram;
+    }
+
+private:
+    static void put_stream(std::vector<Byte> &out, const std::vector<Byte> &stream)
+    {
+        put_varint(out, stream.size());
+        out.insert(out.end(), stream.begin(), stream.end());
+    }
+
+    static void get_stream(ByteReader &in, std::vector<Byte> &stream)
+    {
+        uint64_t size = in.varint();
+        const Byte *bytes = in.bytes(size);
+        stream.assign(bytes, bytes ? bytes + size : bytes);
+    }
+};
+
+// Records a machine driven by `scheduler`. Route every device through wrap()
+// before running; the recording lasts until finish() or destruction. Only RAM
+// in Memory::data is keyframed: ROM does not change and devices are replayed
+// from their reads.
+class Recorder
+{
+public:
+    Recorder(CPU &cpu, Memory &memory, Scheduler &scheduler, uint64_t keyframe_interval)
+        : cpu(cpu), memory(memory), scheduler(scheduler), keyframe_interval(keyframe_interval),
+          shadow(new Byte[MAX_MEMORY]())
+    {
+        log.start_clock = last_interrupt = scheduler.now();
+        previous_on_interrupt = std::move(scheduler.on_interrupt);
+        scheduler.on_interrupt = [this](uint64_t clock, Word vector) {
+            put_varint(log.interrupts, (clock - last_interrupt) << 1 | (vector == 0xFFFA));
+            last_interrupt = clock;
+            interrupt_count++;
+            if (previous_on_interrupt)
+            {
+                previous_on_interrupt(clock, vector);
+            }
+        };
+        keyframe();
+        schedule_keyframe();
+    }
+
+    ~Recorder()
+    {
+        stop();
+    }
+
+    Recorder(const Recorder &) = delete;
+    Recorder &operator=(const Recorder &) = delete;
+
+    // a device that forwards to `device` and logs what it reads, owned by the recorder
+    BusDevice *wrap(BusDevice *device)
+    {
+        devices.push_back(std::make_unique<RecordingDevice>(*this, device));
+        return devices.back().get();
+    }
+
+    // Stores the registers and the RAM pages that changed since the previous
+    // keyframe. Only pages written since the last init/restore are compared,
+    // except for the first keyframe, which holds all of RAM.
+    void keyframe()
+    {
+        Keyframe keyframe{scheduler.now(), cpu.registers(), read_count, interrupt_count, {}};
+        auto add_page = [&](uint32_t page) {
+            const Byte *now = memory.data + page * MEMORY_PAGE_SIZE;
+            Byte *before = shadow.get() + page * MEMORY_PAGE_SIZE;
+            if (std::memcmp(now, before, MEMORY_PAGE_SIZE) == 0)
+            {
+                return;
+            }
+            keyframe.pages.push_back(Byte(page));
+            uint32_t offset = 0;
+            while (offset < MEMORY_PAGE_SIZE)
+            {
+                uint32_t zeros = 0;
+                while (offset + zeros < MEMORY_PAGE_SIZE && now[offset + zeros] == before[offset + zeros])
+                {
+                    zeros++;
+                }
+                offset += zeros;
+                uint32_t length = 0;
+                while (offset + length < MEMORY_PAGE_SIZE && now[offset + length] != before[offset + length])
+                {
+                    length++;
+                }
+                put_varint(keyframe.pages, zeros);
+                put_varint(keyframe.pages, length);
+                for (uint32_t i = 0; i < length; i++)
+                {
+                    keyframe.pages.push_back(now[offset + i] ^ before[offset + i]);
+                }
+                offset += length;
+            }
+            std::memcpy(before, now, MEMORY_PAGE_SIZE);
+        };
+        if (log.keyframes.empty())
+        {
+            for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+            {
+                add_page(page);
+            }
+        }
+        else
+        {
+            memory.for_each_dirty_page(add_page);
+        }
+        log.keyframes.push_back(std::move(keyframe));
+    }
+
+    // ends the recording with a keyframe of the final state
+    ReplayLog finish()
+    {
+        stop();
+        flush_reads();
+        if (log.keyframes.back().clock != scheduler.now())
+        {
+            keyframe();
+        }
+        log.end_clock = scheduler.now();
+        return std::move(log);
+    }
+
+private:
+    struct RecordingDevice : BusDevice
+    {
+        Recorder &recorder;
+        BusDevice *device;
+
+        RecordingDevice(Recorder &recorder, BusDevice *device) : recorder(recorder), device(device) {}
+
+        Byte read(Word address) override
+        {
+            Byte value = device->read(address);
+            recorder.log_read(value);
+            return value;
+        }
+
+        void write(Word address, Byte value) override
+        {
+            device->write(address, value);
+        }
+    };
+
+    CPU &cpu;
+    Memory &memory;
+    Scheduler &scheduler;
+    uint64_t keyframe_interval;
+    std::unique_ptr<Byte[]> shadow; // RAM as of the last keyframe
+    std::vector<std::unique_ptr<RecordingDevice>> devices;
+    ReplayLog log;
+    Scheduler::EventId keyframe_event = 0;
+    std::function<void(uint64_t, Word)> previous_on_interrupt; // the scheduler's hook before recording, still called
+    bool recording = true;
+    uint64_t last_interrupt;
+    uint64_t interrupt_count = 0;
+    uint64_t read_count = 0;
+    Byte run_value = 0;
+    uint64_t run_length = 0;
+
+    void log_read(Byte value)
+    {
+        if (run_length > 0 && value != run_value)
+        {
+            flush_reads();
+        }
+        run_value = value;
+        run_length++;
+        read_count++;
+    }
+
+    void flush_reads()
+    {
+        if (run_length > 0)
+        {
+            log.reads.push_back(run_value);
+            put_varint(log.reads, run_length);
+            run_length = 0;
+        }
+    }
+
+    void schedule_keyframe()
+    {
+        keyframe_event = scheduler.schedule_in(keyframe_interval, [this] {
+            keyframe();
+            schedule_keyframe();
+        });
+    }
+
+    void stop()
+    {
+        if (recording)
+        {
+            recording = false;
+            scheduler.cancel(keyframe_event);
+            scheduler.on_interrupt = std::move(previous_on_interrupt);
+        }
+    }
+};
+
+// Plays a ReplayLog back on a machine with the same ROM and the same bus
+// layout, except that device() is mapped wherever a recorded device was. No
+// device or scheduler runs: reads come from the log and interrupts are taken
+// at their recorded cycles, so the CPU runs at full speed between them.
+class Replayer
+{
+public:
+    explicit Replayer(const ReplayLog &log) : log(log), device_(*this) {}
+
+    Replayer(const Replayer &) = delete;
+    Replayer &operator=(const Replayer &) = delete;
+
+    BusDevice *device()
+    {
+        return &device_;
+    }
+
+    uint64_t now() const
+    {
+        return clock;
+    }
+
+    // true once a read went past the end of the log: the replay no longer follows the recording
+    bool diverged() const
+    {
+        return diverged_;
+    }
+
+    // restores the registers and RAM of keyframe `index` and positions the log there
+    void seek(size_t index, CPU &cpu, Memory &memory)
+    {
+        const Keyframe &keyframe = log.keyframes[index];
+        std::vector<Byte> ram = log.ram_at(index);
+        memory.load(0, ram.data(), ram.size());
+        cpu.set_registers(keyframe.registers);
+        cpu.nmi_pending = false;
+        cpu.irq_lines = 0;
+        clock = keyframe.clock;
+        diverged_ = false;
+
+        reads = ByteReader(log.reads.data(), log.reads.size());
+        run_length = 0;
+        for (uint64_t skip = keyframe.reads; skip > 0 && !reads.at_end();)
+        {
+            next_run();
+            uint64_t consumed = std::min(skip, run_length);
+            run_length -= consumed;
+            skip -= consumed;
+        }
+
+        interrupts = ByteReader(log.interrupts.data(), log.interrupts.size());
+        interrupt_clock = log.start_clock;
+        next_interrupt();
+        for (uint64_t i = 0; i < keyframe.interrupts; i++)
+        {
+            next_interrupt();
+        }
+    }
+
+    // Replays until the clock reaches `cycle`; false when the CPU stopped on
+    // an unofficial opcode, as the recorded run did.
+    template <TraceLevel Level = TraceLevel::off>
+    bool run_until(uint64_t cycle, CPU &cpu, Memory &memory)
+    {
+        while (clock < cycle)
+        {
+            if (interrupt_clock <= clock)
+            {
+                clock += cpu.take_interrupt<Level>(memory, interrupt_vector);
+                next_interrupt();
+                continue;
+            }
+            uint64_t budget = std::min(cycle, interrupt_clock) - clock;
+            uint64_t used = cpu.execute<Level>(budget, memory);
+            clock += used;
+            if (used < budget)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <TraceLevel Level = TraceLevel::off>
+    bool run_to_end(CPU &cpu, Memory &memory)
+    {
+        return run_until<Level>(log.end_clock, cpu, memory);
+    }
+
+    // whether the machine is in the state recorded by keyframe `index`
+    bool matches(size_t index, const CPU &cpu, const Memory &memory) const
+    {
+        return clock == log.keyframes[index].clock && cpu.registers() == log.keyframes[index].registers &&
+               std::memcmp(log.ram_at(index).data(), memory.data, MAX_MEMORY) == 0;
+    }
+
+private:
+    // returns the logged reads in order; writes are dropped
+    struct ReplayDevice : BusDevice
+    {
+        Replayer &replayer;
+
+        explicit ReplayDevice(Replayer &replayer) : replayer(replayer) {}
+
+        Byte read(Word) override
+        {
+            return replayer.next_read();
+        }
+
+        void write(Word, Byte) override {}
+    };
+
+    const ReplayLog &log;
+    ReplayDevice device_;
+    uint64_t clock = 0;
+    bool diverged_ = false;
+    ByteReader reads{nullptr, 0};
+    Byte run_value = 0;
+    uint64_t run_length = 0;
+    ByteReader interrupts{nullptr, 0};
+    uint64_t interrupt_clock = UINT64_MAX;
+    Word interrupt_vector = 0;
+
+    void next_run()
+    {
+        run_value = reads.byte();
+        run_length = reads.varint();
+    }
+
+    Byte next_read()
+    {
+        if (run_length == 0)
+        {
+            if (reads.at_end())
+            {
+                diverged_ = true;
+                return 0;
+            }
+            next_run();
+        }
+        run_length--;
+        return run_value;
+    }
+
+    // advances interrupt_clock, the cycle of the previous interrupt (or
+    // start_clock), to the next one; UINT64_MAX past the last one
+    void next_interrupt()
+    {
+        if (interrupts.at_end())
+        {
+            interrupt_clock = UINT64_MAX;
+            return;
+        }
+        uint64_t entry = interrupts.varint();
+        interrupt_clock += entry >> 1;
+        interrupt_vector = entry & 1 ? 0xFFFA : 0xFFFE;
+    }
+};
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "loader.h"
+#include "replay.h"
+
+// Save states: a machine at an instruction boundary, small enough to keep
+// thousands of and to send between hosts. A state is one record
+//
+//   "SAV1", body length (4 bytes little endian), body:
+//     clock                     varint, e.g. Scheduler::now()
+//     PC lo, PC hi, SP, A, X, Y, P (packed status), NMI pending, IRQ lines
+//     page count                varint
+//     per page: page number, stored length (varint), the stored bytes
+//
+// Pages are the 256 byte pages of Memory::data that are not all zero. Each is
+// compressed on its own (see compress_page), or kept as it is, length 256,
+// when that is not smaller. ROM, shared pages and devices are not part of a
+// state, like a MemorySnapshot: whoever loads it maps them as before. Records
+// can follow each other in a stream or file; SaveStateLibrary maps such a file
+// and loads states straight out of the mapping.
+
+// LZ4 style block compression of one page: sequences of a token (literal
+// count << 4 | match length - 4, 15 meaning more in 255-saturated bytes),
+// the literals, and the one byte distance back to the match, which a page of
+// 256 bytes never needs more than. The last sequence has literals only.
+inline void compress_page(const Byte *page, std::vector<Byte> &out)
+{
+    // room for the worst case, all literals in one sequence
+    Byte buffer[MEMORY_PAGE_SIZE + 3];
+    Byte *next = buffer;
+    auto put_length = [&next](uint32_t length) {
+        for (; length >= 255; length -= 255)
+        {
+            *next++ = 255;
+        }
+        *next++ = Byte(length);
+    };
+    auto load32 = [page](uint32_t at) {
+        uint32_t value;
+        std::memcpy(&value, page + at, sizeof(value));
+        return value;
+    };
+    auto put_sequence = [&](uint32_t anchor, uint32_t literals, uint32_t distance, uint32_t match) {
+        uint32_t extra = match ? match - 4 : 0;
+        *next++ = Byte(std::min(literals, 15u) << 4 | std::min(extra, 15u));
+        if (literals >= 15)
+        {
+            put_length(literals - 15);
+        }
+        std::memcpy(next, page + anchor, literals);
+        next += literals;
+        if (match)
+        {
+            *next++ = Byte(distance);
+            if (extra >= 15)
+            {
+                put_length(extra - 15);
+            }
+        }
+    };
+
+    // position of the last 4 bytes with this hash; entries not set yet point
+    // at 0, which the comparison sorts out like any other collision
+    Byte last_seen[256] = {};
+    uint32_t anchor = 0;
+    uint32_t at = 0;
+    while (at + 4 <= MEMORY_PAGE_SIZE)
+    {
+        uint32_t value = load32(at);
+        uint32_t hash = (value * 2654435761u) >> 24;
+        uint32_t candidate = last_seen[hash];
+        last_seen[hash] = at;
+        if (candidate >= at || load32(candidate) != value)
+        {
+            at++;
+            continue;
+        }
+        // extends the match 8 bytes at a time, then byte by byte near the end
+        uint32_t match = 4;
+        bool ended = false;
+        while (!ended && at + match + 8 <= MEMORY_PAGE_SIZE)
+        {
+            uint64_t a, b;
+            std::memcpy(&a, page + candidate + match, sizeof(a));
+            std::memcpy(&b, page + at + match, sizeof(b));
+            ended = a != b;
+            match += ended ? __builtin_ctzll(a ^ b) / 8 : 8;
+        }
+        while (!ended && at + match < MEMORY_PAGE_SIZE && page[candidate + match] == page[at + match])
+        {
+            match++;
+        }
+        put_sequence(anchor, at - anchor, at - candidate, match);
+        at += match;
+        anchor = at;
+    }
+    if (anchor < MEMORY_PAGE_SIZE)
+    {
+        put_sequence(anchor, MEMORY_PAGE_SIZE - anchor, 0, 0);
+    }
+    out.insert(out.end(), buffer, next);
+}
+
+// Inverse of compress_page; false unless `in` holds exactly one page
+inline bool decompress_page(const Byte *in, size_t size, Byte *page)
+{
+    ByteReader reader(in, size);
+    auto get_length = [&reader](uint32_t nibble) {
+        uint32_t length = nibble;
+        if (nibble == 15)
+        {
+            Byte more;
+            do
+            {
+                more = reader.byte();
+                length += more;
+            } while (more == 255 && reader.ok);
+        }
+        return length;
+    };
+    uint32_t at = 0;
+    while (reader.ok)
+    {
+        Byte token = reader.byte();
+        uint32_t literals = get_length(token >> 4);
+        const Byte *bytes = reader.bytes(literals);
+        if (!bytes || at + literals > MEMORY_PAGE_SIZE)
+        {
+            return false;
+        }
+        std::memcpy(page + at, bytes, literals);
+        at += literals;
+        if (at == MEMORY_PAGE_SIZE)
+        {
+            return reader.ok && reader.at_end();
+        }
+        uint32_t distance = reader.byte();
+        uint32_t match = get_length(token & 0x0F) + 4;
+        if (distance == 0 || distance > at || at + match > MEMORY_PAGE_SIZE)
+        {
+            return false;
+        }
+        if (distance == 1)
+        {
+            std::memset(page + at, page[at - 1], match);
+        }
+        else if (distance >= match)
+        {
+            std::memcpy(page + at, page + at - distance, match);
+        }
+        else
+        {
+            // overlapping: repeats the last `distance` bytes
+            for (uint32_t i = 0; i < match; i++)
+            {
+                page[at + i] = page[at + i - distance];
+            }
+        }
+        at += match;
+        if (at == MEMORY_PAGE_SIZE)
+        {
+            return reader.ok && reader.at_end();
+        }
+    }
+    return false;
+}
+
+inline bool is_zero_page(const Byte *page)
+{
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i += 8)
+    {
+        uint64_t lane;
+        std::memcpy(&lane, page + i, sizeof(lane));
+        bits |= lane;
+    }
+    return bits == 0;
+}
+
+constexpr size_t save_state_header_size = 8;
+
+// Appends the state of `cpu` and `memory` as one record
+inline void save_state(std::vector<Byte> &out, const CPU &cpu, const Memory &memory, uint64_t clock)
+{
+    size_t start = out.size();
+    out.insert(out.end(), {'S', 'A', 'V', '1', 0, 0, 0, 0});
+    put_varint(out, clock);
+    Registers r = cpu.registers();
+    out.insert(out.end(), {Byte(r.PC), Byte(r.PC >> 8), r.SP, r.A, r.X, r.Y, r.P, Byte(cpu.nmi_pending), cpu.irq_lines});
+
+    std::vector<Byte> stored;
+    std::vector<Byte> pages;
+    uint32_t count = 0;
+    for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+    {
+        const Byte *bytes = memory.data + page * MEMORY_PAGE_SIZE;
+        if (is_zero_page(bytes))
+        {
+            continue;
+        }
+        stored.clear();
+        compress_page(bytes, stored);
+        pages.push_back(Byte(page));
+        if (stored.size() < MEMORY_PAGE_SIZE)
+        {
+            put_varint(pages, stored.size());
+            pages.insert(pages.end(), stored.begin(), stored.end());
+        }
+        else
+        {
+            put_varint(pages, MEMORY_PAGE_SIZE);
+            pages.insert(pages.end(), bytes, bytes + MEMORY_PAGE_SIZE);
+        }
+        count++;
+    }
+    put_varint(out, count);
+    out.insert(out.end(), pages.begin(), pages.end());
+
+    uint32_t length = out.size() - start - save_state_header_size;
+    for (int i = 0; i < 4; i++)
+    {
+        out[start + 4 + i] = Byte(length >> (8 * i));
+    }
+}
+
+// Length of the record at `bytes`, header included, or 0 if there is no
+// complete SAV1 record there
+inline size_t save_state_size(const Byte *bytes, size_t size)
+{
+    if (size < save_state_header_size || std::memcmp(bytes, "SAV1", 4) != 0)
+    {
+        return 0;
+    }
+    size_t length = bytes[4] | bytes[5] << 8 | bytes[6] << 16 | uint32_t(bytes[7]) << 24;
+    return length <= size - save_state_header_size ? save_state_header_size + length : 0;
+}
+
+// Puts `cpu` and the RAM of `memory` in the state of the record at `bytes`;
+// pages the state does not hold become zero. Everything loaded counts as
+// written (dirty for init/restore, predecoded instructions dropped). Returns
+// false, with the machine in an unspecified state, on a malformed record.
+inline bool load_state(const Byte *bytes, size_t size, CPU &cpu, Memory &memory, uint64_t &clock)
+{
+    size_t record = save_state_size(bytes, size);
+    if (record == 0)
+    {
+        return false;
+    }
+    ByteReader in(bytes + save_state_header_size, record - save_state_header_size);
+    clock = in.varint();
+    const Byte *r = in.bytes(9);
+    if (!r)
+    {
+        return false;
+    }
+    cpu.set_registers({Word(r[0] | r[1] << 8), r[2], r[3], r[4], r[5], r[6]});
+    cpu.nmi_pending = r[7] != 0;
+    cpu.irq_lines = r[8];
+
+    uint64_t count = in.varint();
+    bool loaded[MEMORY_PAGE_COUNT] = {};
+    for (uint64_t i = 0; i < count && in.ok; i++)
+    {
+        Byte page = in.byte();
+        uint64_t length = in.varint();
+        const Byte *stored = in.bytes(length);
+        Byte *target = memory.data + page * MEMORY_PAGE_SIZE;
+        if (!stored || loaded[page])
+        {
+            return false;
+        }
+        if (length == MEMORY_PAGE_SIZE)
+        {
+            std::memcpy(target, stored, MEMORY_PAGE_SIZE);
+        }
+        else if (!decompress_page(stored, length, target))
+        {
+            return false;
+        }
+        loaded[page] = true;
+        memory.mark_dirty(page * MEMORY_PAGE_SIZE);
+    }
+    for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+    {
+        Byte *target = memory.data + page * MEMORY_PAGE_SIZE;
+        if (!loaded[page] && !is_zero_page(target))
+        {
+            std::memset(target, 0, MEMORY_PAGE_SIZE);
+            memory.mark_dirty(page * MEMORY_PAGE_SIZE);
+        }
+    }
+    return in.ok && in.at_end();
+}
+
+// Streams: records are written back to back and read one at a time
+inline bool write_state(std::ostream &out, const CPU &cpu, const Memory &memory, uint64_t clock)
+{
+    std::vector<Byte> record;
+    save_state(record, cpu, memory, clock);
+    out.write(reinterpret_cast<const char *>(record.data()), record.size());
+    return bool(out);
+}
+
+// false at the end of the stream or on a malformed record
+inline bool read_state(std::istream &in, CPU &cpu, Memory &memory, uint64_t &clock)
+{
+    std::vector<Byte> record(save_state_header_size);
+    if (!in.read(reinterpret_cast<char *>(record.data()), record.size()) || std::memcmp(record.data(), "SAV1", 4) != 0)
+    {
+        return false;
+    }
+    size_t length = record[4] | record[5] << 8 | record[6] << 16 | uint32_t(record[7]) << 24;
+    record.resize(save_state_header_size + length);
+    if (!in.read(reinterpret_cast<char *>(record.data() + save_state_header_size), length))
+    {
+        return false;
+    }
+    return load_state(record.data(), record.size(), cpu, memory, clock);
+}
+
+// A file of save state records, mapped read-only: opening it only indexes the
+// records, loading one decompresses its pages straight from the page cache.
+class SaveStateLibrary
+{
+public:
+    // false if the file cannot be mapped or holds anything but whole records
+    bool open(const std::string &path)
+    {
+        file = MappedFile::open(path);
+        records.clear();
+        if (!file)
+        {
+            return false;
+        }
+        for (size_t offset = 0; offset < file->size();)
+        {
+            size_t length = save_state_size(file->data() + offset, file->size() - offset);
+            if (length == 0)
+            {
+                records.clear();
+                return false;
+            }
+            records.push_back(offset);
+            offset += length;
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return records.size();
+    }
+
+    bool load(size_t index, CPU &cpu, Memory &memory, uint64_t &clock) const
+    {
+        size_t offset = records[index];
+        return load_state(file->data() + offset, file->size() - offset, cpu, memory, clock);
+    }
+
+private:
+    std::shared_ptr<const MappedFile> file;
+    std::vector<size_t> records;
+};
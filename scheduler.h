@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <unordered_set>
+#include <vector>
+
+#include "cpu.h"
+
+// 64 bit master clock plus a min-heap of timed events (timer expiries, IRQ/NMI
+// assertions, device ticks). run_until() lets the CPU run freely up to the
+// earliest pending event, fires every event that is due and takes interrupts
+// between the slices, so no device is ever polled per cycle.
+//
+// Events fire at the first instruction boundary at or after their cycle.
+// Devices that raise an interrupt from inside a slice (from a BusDevice
+// handler) have it taken at the end of that slice; schedule an event for
+// exact timing.
+class Scheduler
+{
+public:
+    using EventId = uint64_t;
+    using Callback = std::function<void()>;
+
+    // called with the clock and vector of every interrupt, just before it is taken
+    std::function<void(uint64_t, Word)> on_interrupt;
+
+    uint64_t now() const
+    {
+        return clock;
+    }
+
+    EventId schedule_at(uint64_t cycle, Callback callback)
+    {
+        EventId id = next_id++;
+        events.push({cycle, id, std::move(callback)});
+        pending.insert(id);
+        return id;
+    }
+
+    EventId schedule_in(uint64_t delay, Callback callback)
+    {
+        return schedule_at(clock + delay, std::move(callback));
+    }
+
+    // false, doing nothing, for an event that already fired or was cancelled
+    bool cancel(EventId id)
+    {
+        if (pending.erase(id) == 0)
+        {
+            return false;
+        }
+        cancelled.insert(id);
+        return true;
+    }
+
+    // cycle of the earliest pending event, cancelled ones included
+    uint64_t next_event() const
+    {
+        return events.empty() ? UINT64_MAX : events.top().when;
+    }
+
+    // Runs until the clock reaches `cycle`; the last instruction may overrun it.
+    // Returns false when the CPU stopped on an unofficial opcode.
+    template <TraceLevel Level = TraceLevel::off>
+    bool run_until(uint64_t cycle, CPU &cpu, Memory &memory)
+    {
+        while (clock < cycle)
+        {
+            fire_due_events();
+            Word vector = cpu.pending_interrupt();
+            if (vector != 0)
+            {
+                if (on_interrupt)
+                {
+                    on_interrupt(clock, vector);
+                }
+                clock += cpu.take_interrupt<Level>(memory, vector);
+                continue;
+            }
+            uint64_t budget = std::min(cycle, next_event()) - clock;
+            uint64_t used = cpu.execute<Level>(budget, memory);
+            clock += used;
+            if (used < budget && !cpu.irq_unmasked())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <TraceLevel Level = TraceLevel::off>
+    bool run_for(uint64_t cycles, CPU &cpu, Memory &memory)
+    {
+        return run_until<Level>(clock + cycles, cpu, memory);
+    }
+
+private:
+    struct Event
+    {
+        uint64_t when;
+        EventId id; // breaks ties, events due at the same cycle fire in scheduling order
+        Callback callback;
+    };
+
+    struct Later
+    {
+        bool operator()(const Event &a, const Event &b) const
+        {
+            return a.when != b.when ? a.when > b.when : a.id > b.id;
+        }
+    };
+
+    std::priority_queue<Event, std::vector<Event>, Later> events;
+    std::unordered_set<EventId> pending;   // scheduled, neither fired nor cancelled
+    std::unordered_set<EventId> cancelled; // still in `events`, to drop when due
+    uint64_t clock = 0;
+    EventId next_id = 0;
+
+    void fire_due_events()
+    {
+        while (!events.empty() && events.top().when <= clock)
+        {
+            Event event = events.top();
+            events.pop();
+            if (cancelled.erase(event.id) == 0)
+            {
+                pending.erase(event.id);
+                event.callback();
+            }
+        }
+    }
+};
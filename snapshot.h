@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SNAPSHOT_X86 1
+#else
+#define SNAPSHOT_X86 0
+#endif
+
+#include "memory.h"
+
+// Whole-RAM snapshots of Memory::data with vectorized compare: golden state
+// checks, rollback and divergence detection between two runs. Comparison
+// goes page by page through one kernel that yields a bit per differing byte,
+// 32 bytes per step. The kernel is picked once at startup: AVX2 when the host
+// has it, else SSE2, else portable 64 bit code. Copies are memcpy, which
+// already moves the widest vectors the host supports.
+
+// a run of changed bytes
+struct MemoryRange
+{
+    Word address;
+    uint32_t length;
+
+    bool operator==(const MemoryRange &other) const
+    {
+        return address == other.address && length == other.length;
+    }
+};
+
+// Compares one 256 byte page: bit i of masks[block] is set when byte
+// block * 32 + i differs. Returns whether any byte differs.
+using PageDiffKernel = bool (*)(const Byte *a, const Byte *b, uint32_t masks[8]);
+
+inline bool page_diff_scalar(const Byte *a, const Byte *b, uint32_t masks[8])
+{
+    bool any = false;
+    for (uint32_t block = 0; block < 8; block++)
+    {
+        uint32_t mask = 0;
+        for (uint32_t lane = 0; lane < 32; lane += 8)
+        {
+            uint64_t x, y;
+            std::memcpy(&x, a + block * 32 + lane, 8);
+            std::memcpy(&y, b + block * 32 + lane, 8);
+            if (x != y)
+            {
+                for (uint32_t i = 0; i < 8; i++)
+                {
+                    mask |= uint32_t(a[block * 32 + lane + i] != b[block * 32 + lane + i]) << (lane + i);
+                }
+            }
+        }
+        masks[block] = mask;
+        any |= mask != 0;
+    }
+    return any;
+}
+
+#if SNAPSHOT_X86
+__attribute__((target("sse2"))) inline bool page_diff_sse2(const Byte *a, const Byte *b, uint32_t masks[8])
+{
+    uint32_t any = 0;
+    for (uint32_t block = 0; block < 8; block++)
+    {
+        const Byte *x = a + block * 32, *y = b + block * 32;
+        uint32_t low = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)x), _mm_loadu_si128((const __m128i *)y)));
+        uint32_t high = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(x + 16)), _mm_loadu_si128((const __m128i *)(y + 16))));
+        masks[block] = ~(low | high << 16);
+        any |= masks[block];
+    }
+    return any != 0;
+}
+
+__attribute__((target("avx2"))) inline bool page_diff_avx2(const Byte *a, const Byte *b, uint32_t masks[8])
+{
+    uint32_t any = 0;
+    for (uint32_t block = 0; block < 8; block++)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + block * 32));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + block * 32));
+        masks[block] = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+        any |= masks[block];
+    }
+    return any != 0;
+}
+#endif
+
+inline PageDiffKernel select_page_diff_kernel()
+{
+#if SNAPSHOT_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return page_diff_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return page_diff_sse2;
+    }
+#endif
+    return page_diff_scalar;
+}
+
+inline const PageDiffKernel page_diff = select_page_diff_kernel();
+
+inline const char *page_diff_kernel_name()
+{
+#if SNAPSHOT_X86
+    if (page_diff == page_diff_avx2)
+    {
+        return "avx2";
+    }
+    if (page_diff == page_diff_sse2)
+    {
+        return "sse2";
+    }
+#endif
+    return "scalar";
+}
+
+// Appends the changed ranges of the pages passed to page(), which must come in
+// ascending order, to `ranges`; a range that ends a page continues into the
+// next one when that page is adjacent.
+class RangeBuilder
+{
+public:
+    explicit RangeBuilder(std::vector<MemoryRange> &ranges, PageDiffKernel kernel = page_diff)
+        : ranges(ranges), kernel(kernel) {}
+
+    void page(const Byte *a, const Byte *b, uint32_t page)
+    {
+        uint32_t masks[8];
+        if (!kernel(a + page * MEMORY_PAGE_SIZE, b + page * MEMORY_PAGE_SIZE, masks))
+        {
+            return;
+        }
+        for (uint32_t block = 0; block < 8; block++)
+        {
+            uint64_t mask = masks[block]; // 64 bits wide so a run of all 32 bytes needs no special case
+            uint32_t base = page * MEMORY_PAGE_SIZE + block * 32;
+            while (mask)
+            {
+                uint32_t start = __builtin_ctzll(mask);
+                uint32_t run = __builtin_ctzll(~(mask >> start));
+                add(base + start, run);
+                mask &= ~(((1ull << run) - 1) << start);
+            }
+        }
+    }
+
+private:
+    std::vector<MemoryRange> &ranges;
+    PageDiffKernel kernel;
+
+    void add(uint32_t address, uint32_t length)
+    {
+        if (!ranges.empty() && ranges.back().address + ranges.back().length == address)
+        {
+            ranges.back().length += length;
+        }
+        else
+        {
+            ranges.push_back({Word(address), length});
+        }
+    }
+};
+
+// changed ranges between two 64 KB images, e.g. the RAM of two runs that should agree
+inline std::vector<MemoryRange> diff_memory(const Byte *a, const Byte *b, PageDiffKernel kernel = page_diff)
+{
+    std::vector<MemoryRange> ranges;
+    RangeBuilder builder(ranges, kernel);
+    for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+    {
+        builder.page(a, b, page);
+    }
+    return ranges;
+}
+
+// A copy of the RAM array (Memory::data) of a Memory. ROM and devices are
+// not part of it: they do not change or are not memory.
+class MemorySnapshot
+{
+public:
+    MemorySnapshot() : bytes(new Byte[MAX_MEMORY]()) {}
+
+    explicit MemorySnapshot(const Memory &memory) : MemorySnapshot()
+    {
+        capture(memory);
+    }
+
+    const Byte *data() const
+    {
+        return bytes.get();
+    }
+
+    void capture(const Memory &memory)
+    {
+        std::memcpy(bytes.get(), memory.data, MAX_MEMORY);
+    }
+
+    // Copies back only the pages that differ, which count as written: they
+    // are dirty for init/restore and lose their predecoded instructions.
+    // Returns the number of pages copied.
+    uint32_t restore(Memory &memory) const
+    {
+        uint32_t masks[8];
+        uint32_t copied = 0;
+        for (uint32_t page = 0; page < MEMORY_PAGE_COUNT; page++)
+        {
+            uint32_t offset = page * MEMORY_PAGE_SIZE;
+            if (page_diff(memory.data + offset, bytes.get() + offset, masks))
+            {
+                std::memcpy(memory.data + offset, bytes.get() + offset, MEMORY_PAGE_SIZE);
+                memory.mark_dirty(offset);
+                copied++;
+            }
+        }
+        return copied;
+    }
+
+    // ranges where `memory` no longer matches the snapshot
+    std::vector<MemoryRange> diff(const Memory &memory) const
+    {
+        return diff_memory(bytes.get(), memory.data);
+    }
+
+    // Like diff, but only looks at the pages `memory` wrote since its last
+    // init/restore/assign: exact when the snapshot was captured right after
+    // one of those, e.g. of the baseline every job is restored to.
+    std::vector<MemoryRange> diff_dirty(const Memory &memory) const
+    {
+        std::vector<MemoryRange> ranges;
+        RangeBuilder builder(ranges);
+        memory.for_each_dirty_page([&](uint32_t page) { builder.page(bytes.get(), memory.data, page); });
+        return ranges;
+    }
+
+private:
+    std::unique_ptr<Byte[]> bytes;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "cpu.h"
+#include "scheduler.h"
+
+// Live telemetry from the emulation thread to a monitor thread. The emulation
+// side only ever stores into a preallocated single-producer/single-consumer
+// ring: when the monitor falls behind, records are dropped and counted, never
+// waited for. Nothing is published from inside CPU::execute: register samples
+// are Scheduler events, and memory writes come from a tap mapped over the
+// pages being watched.
+
+enum class TelemetryKind : uint8_t
+{
+    sample, // registers at an instruction boundary
+    write   // a write to a tapped page
+};
+
+struct TelemetryRecord
+{
+    uint64_t cycle;   // scheduler clock; for writes, that of the start of the running slice
+    uint64_t host_ns; // steady_clock time of samples, 0 for writes
+    TelemetryKind kind;
+    Byte value; // written byte
+    Word address; // written address
+    Registers registers; // sample only
+};
+
+static_assert(sizeof(TelemetryRecord) == 32, "telemetry records must stay compact");
+
+// Lock-free ring for one producer thread and one consumer thread. Each side
+// owns one index and only reads the other's; both sit on their own cache line.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(uint32_t capacity_log2 = 12)
+        : slots(new T[size_t(1) << capacity_log2]), mask((size_t(1) << capacity_log2) - 1)
+    {
+    }
+
+    // producer side; false (and counted as dropped) when the ring is full
+    bool try_push(const T &value)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache > mask)
+        {
+            tail_cache = tail_.load(std::memory_order_acquire);
+            if (head - tail_cache > mask)
+            {
+                dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        slots[head & mask] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side; calls `fn(value)` for everything published so far and returns how many
+    template <typename Fn>
+    size_t drain(Fn &&fn)
+    {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        for (uint64_t i = tail; i < head; i++)
+        {
+            fn(static_cast<const T &>(slots[i & mask]));
+        }
+        tail_.store(head, std::memory_order_release);
+        return head - tail;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+    // readable from either side
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::unique_ptr<T[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    uint64_t tail_cache = 0; // producer's last view of tail_, saves a shared load per push
+    std::atomic<uint64_t> dropped_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+// Producer side: the ring plus the hooks that fill it. Lives on the emulation
+// thread with the Scheduler, CPU and Memory it watches.
+class Telemetry
+{
+public:
+    explicit Telemetry(uint32_t capacity_log2 = 12) : ring(capacity_log2) {}
+
+    ~Telemetry()
+    {
+        stop_sampling();
+    }
+
+    Telemetry(const Telemetry &) = delete;
+    Telemetry &operator=(const Telemetry &) = delete;
+
+    SpscRing<TelemetryRecord> ring;
+
+    // publishes the registers every `interval` cycles, at the first instruction boundary after
+    void sample_every(uint64_t interval, Scheduler &scheduler, const CPU &cpu)
+    {
+        stop_sampling();
+        this->scheduler = &scheduler;
+        this->cpu = &cpu;
+        this->interval = interval;
+        schedule_sample();
+    }
+
+    void stop_sampling()
+    {
+        if (scheduler)
+        {
+            scheduler->cancel(sample_event);
+            scheduler = nullptr;
+        }
+    }
+
+    // Publishes every write to pages [first_page, first_page + count) of the
+    // RAM array, which keep working as RAM. The pages go through a device
+    // from now on, so reads and writes there take the slow path.
+    void tap_writes(Memory &memory, const Scheduler &scheduler, Byte first_page, uint32_t count)
+    {
+        taps.push_back(std::make_unique<WriteTap>(*this, memory, scheduler));
+        memory.map_device(first_page, count, taps.back().get());
+    }
+
+private:
+    struct WriteTap : BusDevice
+    {
+        Telemetry &telemetry;
+        Memory &memory;
+        const Scheduler &scheduler;
+
+        WriteTap(Telemetry &telemetry, Memory &memory, const Scheduler &scheduler)
+            : telemetry(telemetry), memory(memory), scheduler(scheduler) {}
+
+        Byte read(Word address) override
+        {
+            return memory.data[address];
+        }
+
+        void write(Word address, Byte value) override
+        {
+            memory.data[address] = value;
+            memory.mark_dirty(address);
+            telemetry.ring.try_push({scheduler.now(), 0, TelemetryKind::write, value, address, {}});
+        }
+    };
+
+    Scheduler *scheduler = nullptr;
+    const CPU *cpu = nullptr;
+    uint64_t interval = 0;
+    Scheduler::EventId sample_event = 0;
+    std::vector<std::unique_ptr<WriteTap>> taps;
+
+    void schedule_sample()
+    {
+        sample_event = scheduler->schedule_in(interval, [this] {
+            uint64_t host_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch()).count();
+            ring.try_push({scheduler->now(), host_ns, TelemetryKind::sample, 0, 0, cpu->registers()});
+            schedule_sample();
+        });
+    }
+};
+
+// What a monitor usually wants to show: the latest registers, the emulated
+// clock rate between the last two samples and the most recent writes. The
+// rate is in cycles, not instructions: CPU::execute counts only cycles, and
+// an instruction counter in its loop would cost every run, watched or not.
+struct TelemetrySummary
+{
+    static constexpr size_t recent_write_count = 16;
+
+    uint64_t samples = 0;
+    uint64_t writes = 0;
+    Registers registers = {};
+    uint64_t cycle = 0;
+    double emulated_mhz = 0;
+    std::vector<TelemetryRecord> recent_writes; // oldest first
+
+    void add(const TelemetryRecord &record)
+    {
+        if (record.kind == TelemetryKind::sample)
+        {
+            if (samples > 0 && record.host_ns > host_ns)
+            {
+                emulated_mhz = double(record.cycle - cycle) * 1e3 / double(record.host_ns - host_ns);
+            }
+            samples++;
+            registers = record.registers;
+            cycle = record.cycle;
+            host_ns = record.host_ns;
+            return;
+        }
+        writes++;
+        if (recent_writes.size() == recent_write_count)
+        {
+            recent_writes.erase(recent_writes.begin());
+        }
+        recent_writes.push_back(record);
+    }
+
+private:
+    uint64_t host_ns = 0;
+};
+
+// one text line per record, e.g. for a log file tailed by a monitor
+inline void write_telemetry_record(std::ostream &out, const TelemetryRecord &r)
+{
+    if (r.kind == TelemetryKind::sample)
+    {
+        out << r.cycle << " sample PC " << to_hex(r.registers.PC) << " A " << to_hex(r.registers.A) << " X "
+            << to_hex(r.registers.X) << " Y " << to_hex(r.registers.Y) << " SP " << to_hex(r.registers.SP) << " P "
+            << to_hex(r.registers.P) << '\n';
+    }
+    else
+    {
+        out << r.cycle << " write " << to_hex(r.value) << " at " << to_hex(r.address) << '\n';
+    }
+}
+
+// Consumer side: a thread that drains the ring every `period` and hands each
+// record to `sink`, e.g. TelemetrySummary::add or write_telemetry_record.
+// stop() (or destruction) drains what is left before returning.
+class TelemetryMonitor
+{
+public:
+    TelemetryMonitor(SpscRing<TelemetryRecord> &ring, std::function<void(const TelemetryRecord &)> sink,
+                     std::chrono::microseconds period = std::chrono::milliseconds(1))
+        : ring(ring), sink(std::move(sink)), period(period), thread(&TelemetryMonitor::run, this)
+    {
+    }
+
+    ~TelemetryMonitor()
+    {
+        stop();
+    }
+
+    TelemetryMonitor(const TelemetryMonitor &) = delete;
+    TelemetryMonitor &operator=(const TelemetryMonitor &) = delete;
+
+    void stop()
+    {
+        if (thread.joinable())
+        {
+            stopping = true;
+            thread.join();
+        }
+    }
+
+private:
+    SpscRing<TelemetryRecord> &ring;
+    std::function<void(const TelemetryRecord &)> sink;
+    std::chrono::microseconds period;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void run()
+    {
+        while (!stopping)
+        {
+            if (ring.drain(sink) == 0)
+            {
+                std::this_thread::sleep_for(period);
+            }
+        }
+        ring.drain(sink);
+    }
+};
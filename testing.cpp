@@ -1,41 +1,22 @@
-#include <map>
+#include <cassert>
 #include <iostream>
 
-template<typename K, typename V>
-class interval_map {
-	friend void IntervalMapTest();
-	V m_valBegin;
-	std::map<K,V> m_map;
-public:
-	// constructor associates whole range of K with val
-	interval_map(V const& val)
-	: m_valBegin(val)
-	{}
-
-	// Assign value val to interval [keyBegin, keyEnd).
-	// Overwrite previous values in this interval.
-	// Conforming to the C++ Standard Library conventions, the interval
-	// includes keyBegin, but excludes keyEnd.
-	// If !( keyBegin < keyEnd ), this designates an empty interval,
-	// and assign must do nothing.
-	void assign( K const& keyBegin, K const& keyEnd, V const& val ) {
-// INSERT YOUR SOLUTION HERE
-	}
-
-	// look-up of the value associated with key
-	V const& operator[]( K const& key ) const {
-		auto it=m_map.upper_bound(key);
-		if(it==m_map.begin()) {
-			return m_valBegin;
-		} else {
-			return (--it)->second;
-		}
-	}
-};
+#include "interval_map.h"
 
 int main()
 {
-    std::cout << "" << std::endl;
-    int a = 123;
+    interval_map<int, char> map('A');
+    map.assign(1, 3, 'B');
+    map.assign(2, 5, 'C');
+    map.assign(5, 5, 'D');
+    map.assign(0, 1, 'A');
+    assert(map[0] == 'A' && map[1] == 'B' && map[2] == 'C' && map[4] == 'C' && map[5] == 'A');
+    assert(map.boundaries().size() == 3);
+
+    for (int key = -1; key <= 5; key++)
+    {
+        std::cout << map[key];
+    }
+    std::cout << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "debugger.h"
+
+// Reverse execution for a machine run through a Debugger. Going forward,
+// TimeTravel takes a snapshot every `interval` cycles: the registers and
+// interrupt inputs, plus, once the next snapshot is taken, the contents the
+// RAM pages written in between had at this one (found, as by Recorder, by
+// comparing the dirty pages with a shadow copy of RAM). Going back to any
+// earlier instruction boundary restores the nearest snapshot before it, which
+// puts back at most every page once, and runs forward from there, which is
+// exact because execution only depends on the machine's state.
+//
+// Like replay.h, that holds as long as nothing outside acts on the machine:
+// devices, interrupt inputs set by the host and writes behind the debugger's
+// back are not recorded, so call reset() after any of those. Only RAM in
+// Memory::data is restored, not page mappings (map_*, copy-on-write of shared
+// pages), and init/restore/assign must not run during a timeline since they
+// clear the dirty bits the snapshots rely on.
+//
+// Positions are cycle counts since the start of the timeline; every
+// instruction boundary has its own.
+class TimeTravel
+{
+public:
+    // Keeps at most about `history_limit` bytes of snapshots and saved pages,
+    // dropping the oldest first, with a snapshot every `interval` cycles: a
+    // shorter one makes going back quicker and the history shorter.
+    TimeTravel(CPU &cpu, Memory &memory, Debugger &debugger, size_t history_limit = 1 << 20,
+               uint64_t interval = 100000)
+        : cpu(cpu), memory(memory), debugger(debugger), history_limit(history_limit), interval(interval),
+          shadow(new Byte[MAX_MEMORY])
+    {
+        reset();
+    }
+
+    TimeTravel(const TimeTravel &) = delete;
+    TimeTravel &operator=(const TimeTravel &) = delete;
+
+    // forgets the history: the timeline starts over at the current state
+    void reset()
+    {
+        while (!snapshots.empty())
+        {
+            drop_oldest();
+        }
+        clock = 0;
+        std::memcpy(shadow.get(), memory.data, MAX_MEMORY);
+        take_snapshot();
+    }
+
+    uint64_t now() const
+    {
+        return clock;
+    }
+
+    // the earliest position reverse execution can reach
+    uint64_t history_start() const
+    {
+        return snapshots.front().clock;
+    }
+
+    size_t snapshot_count() const
+    {
+        return snapshots.size();
+    }
+
+    // memory the history holds now, at most history_limit once more than one
+    // snapshot is kept, plus a fixed 64 KB copy of RAM
+    size_t history_bytes() const
+    {
+        return bytes;
+    }
+
+    // Debugger::run and Debugger::step, taking snapshots on the way
+    DebugStop run(uint64_t budget)
+    {
+        uint64_t used = 0;
+        while (used < budget)
+        {
+            // a slice that ended on a breakpoint stops here; the next run() steps over it
+            if (used > 0 && Breakpoints::test(debugger.points.execute, cpu.PC))
+            {
+                return {StopReason::breakpoint, cpu.PC, used};
+            }
+            uint64_t slice = std::min(budget - used, next_snapshot() - clock);
+            DebugStop stop = debugger.run(slice);
+            used += stop.cycles;
+            advance(stop.cycles);
+            if (stop.reason != StopReason::none)
+            {
+                return {stop.reason, stop.address, used};
+            }
+        }
+        return {StopReason::none, 0, used};
+    }
+
+    DebugStop step()
+    {
+        DebugStop stop = debugger.step();
+        advance(stop.cycles);
+        return stop;
+    }
+
+    // Goes back to the instruction boundary before now. False, without
+    // moving, when that lies before history_start().
+    bool reverse_step()
+    {
+        uint64_t target = clock;
+        if (!find_previous_boundary(target))
+        {
+            return false;
+        }
+        seek(target);
+        return true;
+    }
+
+    // Goes back to the last position before now where forward execution
+    // would have stopped on a breakpoint or watchpoint, which it reports with
+    // the cycles gone back. With none in the history, stops at
+    // history_start() with reason none.
+    DebugStop reverse_continue()
+    {
+        uint64_t end = clock;
+        uint64_t start_clock = clock;
+        while (true)
+        {
+            // the latest snapshot before `end` and the stops from it up to `end`
+            size_t index = latest_snapshot_before(end);
+            if (index == snapshots.size())
+            {
+                break;
+            }
+            restore(index);
+            DebugStop last{StopReason::none, 0, 0};
+            uint64_t last_clock = 0;
+            bool found = false;
+            if (Breakpoints::test(debugger.points.execute, cpu.PC))
+            {
+                last = {StopReason::breakpoint, cpu.PC, 0};
+                last_clock = clock;
+                found = true;
+            }
+            while (clock < end)
+            {
+                DebugStop stop = debugger.run(end - clock);
+                clock += stop.cycles;
+                if (stop.reason == StopReason::none || stop.reason == StopReason::illegal || clock >= end)
+                {
+                    break;
+                }
+                last = stop;
+                last_clock = clock;
+                found = true;
+            }
+            if (found)
+            {
+                seek(last_clock);
+                return {last.reason, last.address, start_clock - clock};
+            }
+            end = snapshots[index].clock;
+            if (index == 0)
+            {
+                break;
+            }
+        }
+        seek(history_start());
+        return {StopReason::none, 0, start_clock - clock};
+    }
+
+    // Moves to the instruction boundary at `target`, a position at or after
+    // history_start() that now() returned earlier on this timeline, going
+    // forward by replaying when it lies ahead.
+    void seek(uint64_t target)
+    {
+        size_t index = snapshots.size() - 1;
+        while (index > 0 && snapshots[index].clock > target)
+        {
+            index--;
+        }
+        if (target < clock || snapshots[index].clock > clock)
+        {
+            restore(index);
+        }
+        replay_to(target);
+    }
+
+private:
+    // the longest instruction or interrupt entry, in cycles
+    static constexpr uint64_t longest_step = 7;
+
+    struct Snapshot
+    {
+        uint64_t clock;
+        Registers registers;
+        bool nmi_pending;
+        Byte irq_lines;
+        std::vector<Byte> pages; // written before the next snapshot
+        std::vector<Byte> saved; // their contents at this one, 256 bytes each
+    };
+
+    CPU &cpu;
+    Memory &memory;
+    Debugger &debugger;
+    size_t history_limit;
+    uint64_t interval;
+    std::unique_ptr<Byte[]> shadow; // RAM as of the newest snapshot
+    std::deque<Snapshot> snapshots;
+    uint64_t clock = 0;
+    size_t bytes = 0;
+
+    uint64_t next_snapshot() const
+    {
+        return snapshots.back().clock + interval;
+    }
+
+    void advance(uint64_t cycles)
+    {
+        clock += cycles;
+        if (clock >= next_snapshot())
+        {
+            take_snapshot();
+        }
+    }
+
+    void take_snapshot()
+    {
+        if (!snapshots.empty())
+        {
+            Snapshot &previous = snapshots.back();
+            memory.for_each_dirty_page([&](uint32_t page) {
+                const Byte *now = memory.data + page * MEMORY_PAGE_SIZE;
+                Byte *before = shadow.get() + page * MEMORY_PAGE_SIZE;
+                if (std::memcmp(now, before, MEMORY_PAGE_SIZE) != 0)
+                {
+                    previous.pages.push_back(Byte(page));
+                    previous.saved.insert(previous.saved.end(), before, before + MEMORY_PAGE_SIZE);
+                    std::memcpy(before, now, MEMORY_PAGE_SIZE);
+                    bytes += 1 + MEMORY_PAGE_SIZE;
+                }
+            });
+        }
+        snapshots.push_back({clock, cpu.registers(), cpu.nmi_pending, cpu.irq_lines, {}, {}});
+        bytes += sizeof(Snapshot);
+        while (bytes > history_limit && snapshots.size() > 1)
+        {
+            drop_oldest();
+        }
+    }
+
+    void drop_oldest()
+    {
+        Snapshot &oldest = snapshots.front();
+        bytes -= sizeof(Snapshot) + oldest.pages.size() * (1 + MEMORY_PAGE_SIZE);
+        snapshots.pop_front();
+    }
+
+    // Puts RAM, registers and the clock back to snapshot `index` and drops the
+    // later ones: first the pages written since the newest snapshot, then the
+    // saved pages from the newest down, so the oldest version of a page wins.
+    void restore(size_t index)
+    {
+        memory.for_each_dirty_page([&](uint32_t page) {
+            Byte *now = memory.data + page * MEMORY_PAGE_SIZE;
+            const Byte *before = shadow.get() + page * MEMORY_PAGE_SIZE;
+            if (std::memcmp(now, before, MEMORY_PAGE_SIZE) != 0)
+            {
+                std::memcpy(now, before, MEMORY_PAGE_SIZE);
+                memory.mark_dirty(page * MEMORY_PAGE_SIZE);
+            }
+        });
+        for (size_t i = snapshots.size() - 1; i-- > index;)
+        {
+            const Snapshot &snapshot = snapshots[i];
+            for (size_t p = 0; p < snapshot.pages.size(); p++)
+            {
+                uint32_t offset = snapshot.pages[p] * MEMORY_PAGE_SIZE;
+                const Byte *saved = snapshot.saved.data() + p * MEMORY_PAGE_SIZE;
+                std::memcpy(memory.data + offset, saved, MEMORY_PAGE_SIZE);
+                std::memcpy(shadow.get() + offset, saved, MEMORY_PAGE_SIZE);
+                memory.mark_dirty(offset);
+            }
+        }
+        while (snapshots.size() > index + 1)
+        {
+            Snapshot &newest = snapshots.back();
+            bytes -= sizeof(Snapshot) + newest.pages.size() * (1 + MEMORY_PAGE_SIZE);
+            snapshots.pop_back();
+        }
+        Snapshot &snapshot = snapshots.back();
+        bytes -= snapshot.pages.size() * (1 + MEMORY_PAGE_SIZE);
+        snapshot.pages.clear();
+        snapshot.saved.clear();
+        snapshot.saved.shrink_to_fit();
+        cpu.set_registers(snapshot.registers);
+        cpu.nmi_pending = snapshot.nmi_pending;
+        cpu.irq_lines = snapshot.irq_lines;
+        clock = snapshot.clock;
+    }
+
+    // index of the newest snapshot strictly before `position`, snapshots.size() if none
+    size_t latest_snapshot_before(uint64_t position) const
+    {
+        for (size_t i = snapshots.size(); i-- > 0;)
+        {
+            if (snapshots[i].clock < position)
+            {
+                return i;
+            }
+        }
+        return snapshots.size();
+    }
+
+    // Runs forward without stopping on breakpoints to the boundary at
+    // `target`. Execute stops on the first boundary at or after its budget,
+    // which on the way taken before is `target` itself, and interrupts are
+    // taken between slices like Debugger::run does, so the path is the same.
+    void replay_to(uint64_t target)
+    {
+        while (clock < target)
+        {
+            Word vector = cpu.pending_interrupt();
+            if (vector != 0)
+            {
+                advance(cpu.take_interrupt(memory, vector));
+                continue;
+            }
+            uint64_t slice = std::min(target, next_snapshot()) - clock;
+            uint64_t spent = cpu.execute(slice, memory);
+            advance(spent);
+            if (spent < slice && !cpu.irq_unmasked())
+            {
+                return;
+            }
+        }
+    }
+
+    // Sets `position` to the boundary before it. The last few boundaries are
+    // found by single steps from a snapshot taken just before them, which the
+    // following seek then restores instead of replaying the whole interval.
+    bool find_previous_boundary(uint64_t &position)
+    {
+        size_t index = latest_snapshot_before(position);
+        if (index == snapshots.size())
+        {
+            return false;
+        }
+        uint64_t target = position;
+        restore(index);
+        replay_to(target > longest_step ? std::max(clock, target - longest_step) : clock);
+        if (snapshots.back().clock != clock)
+        {
+            take_snapshot();
+        }
+        uint64_t previous = clock;
+        while (clock < target)
+        {
+            previous = clock;
+            Word vector = cpu.pending_interrupt();
+            uint64_t spent = vector != 0 ? cpu.take_interrupt(memory, vector) : cpu.execute(1, memory);
+            if (spent == 0)
+            {
+                break;
+            }
+            clock += spent;
+        }
+        position = previous;
+        return true;
+    }
+};
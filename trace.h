@@ -0,0 +1,121 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+#include "common.h"
+
+enum class TraceLevel : uint8_t
+{
+    off,     // no tracing, the hooks compile to nothing
+    opcode,  // one record per executed instruction
+    bus,     // instruction records plus every memory read and write
+    profile, // no records, statistics go to CPU::profiler (profiler.h)
+    debug    // no records, stops on the breakpoints and watchpoints in CPU::breakpoints (breakpoints.h)
+};
+
+// levels that append TraceRecords to CPU::trace
+constexpr bool records_trace(TraceLevel level)
+{
+    return level == TraceLevel::opcode || level == TraceLevel::bus;
+}
+
+// levels that fetch through the predecode cache instead of showing every fetch on the bus
+constexpr bool uses_predecode(TraceLevel level)
+{
+    return !records_trace(level);
+}
+
+enum class TraceEvent : uint8_t
+{
+    opcode,
+    read,
+    write
+};
+
+// Fixed size binary record, turned into text only by format_trace_record.
+// For opcode records `address` is the PC and `value` the opcode, for bus
+// records they are the accessed address and the byte that went over the bus.
+struct TraceRecord
+{
+    TraceEvent event;
+    Byte value;
+    Word address;
+    Byte A, X, Y, SP;
+};
+
+static_assert(sizeof(TraceRecord) == 8, "trace records must stay compact");
+
+// Preallocated ring buffer; once full the oldest records are overwritten.
+class TraceBuffer
+{
+public:
+    explicit TraceBuffer(uint32_t capacity_log2 = 16)
+        : records(size_t(1) << capacity_log2), mask((size_t(1) << capacity_log2) - 1)
+    {
+    }
+
+    void record(const TraceRecord &r)
+    {
+        records[head & mask] = r;
+        head++;
+    }
+
+    size_t size() const
+    {
+        return head < records.size() ? head : records.size();
+    }
+
+    uint64_t dropped() const
+    {
+        return head - size();
+    }
+
+    void clear()
+    {
+        head = 0;
+    }
+
+    // visits the retained records from the oldest to the newest
+    template <typename Fn>
+    void for_each(Fn &&fn) const
+    {
+        for (uint64_t i = head - size(); i < head; i++)
+        {
+            fn(records[i & mask]);
+        }
+    }
+
+private:
+    std::vector<TraceRecord> records;
+    size_t mask;
+    uint64_t head = 0;
+};
+
+inline std::string format_trace_record(const TraceRecord &r)
+{
+    std::stringstream stream;
+    switch (r.event)
+    {
+    case TraceEvent::opcode:
+        stream << "PC " << to_hex(r.address) << " OP " << to_hex(r.value)
+               << " A " << to_hex(r.A) << " X " << to_hex(r.X) << " Y " << to_hex(r.Y) << " SP " << to_hex(r.SP);
+        break;
+    case TraceEvent::read:
+        stream << "    read  " << to_hex(r.value) << " from " << to_hex(r.address);
+        break;
+    case TraceEvent::write:
+        stream << "    write " << to_hex(r.value) << " at " << to_hex(r.address);
+        break;
+    }
+    return stream.str();
+}
+
+inline void write_trace(const TraceBuffer &buffer, std::ostream &out)
+{
+    if (buffer.dropped() > 0)
+    {
+        out << "... " << buffer.dropped() << " older records dropped" << std::endl;
+    }
+    buffer.for_each([&out](const TraceRecord &r) { out << format_trace_record(r) << '\n'; });
+}